@@ -32,6 +32,8 @@
 #ifndef HTU21D_h
 #define HTU21D_h
 
+#include "HTU21D_fixed.h"
+
 #if defined(ARDUINO) && ((ARDUINO) >= 100)     //arduino core v1.0 or later
 #include <Arduino.h>
 #include <WProgram.h>
@@ -47,12 +49,14 @@
 
 #if defined(USE_HAL_DRIVER)
 #include "main.h"
+#include "i2c_bus.h"
 
-#define hi2c1 HTU_I2C;
-HAL_StatusTypeDef I2C_MasterRequestWrite(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint32_t Timeout, uint32_t Tickstart);
+#if !defined(HAL_I2C_MODULE_ENABLED)
+#error "HTU21D needs HAL_I2C_MODULE_ENABLED in stm32f4xx_hal_conf.h"
+#endif
 
-#ifndef hi2c1 
-#error "Please define the hi2c structure"
+#ifndef HTU_I2C
+#define HTU_I2C                      hi2c1     //I2C handle the sensor is on
 #endif
 
 extern I2C_HandleTypeDef HTU_I2C;
@@ -95,6 +99,9 @@ extern I2C_HandleTypeDef HTU_I2C;
 #define HTU21D_FORCE_READ_TEMP       0xFE      //force to read temperature, see https://github.com/enjoyneering/HTU21D/pull/3
 #define HTU21D_ERROR                 0xFF      //returns 255, if CRC8 or communication error is occurred
 
+#define HTU21D_I2C_TIMEOUT           100       //in milliseconds, blocking HAL calls
+#define HTU21D_NACK_RETRIES          100       //no hold master reads NACKed while converting, one per millisecond
+
 #if defined(ARDUINO)
 typedef enum : uint8_t
 {
@@ -127,7 +134,7 @@ typedef enum : uint8_t
 }
 HTU21D_HEATER_SWITCH;
 
-#elseif defined(USE_HAL_DRIVER)
+#elif defined(USE_HAL_DRIVER)
 typedef enum 
 {
   HTU21D_RES_RH12_TEMP14 = 0x00,               //resolution, temperature: 14-Bit & humidity: 12-Bit
@@ -161,14 +168,73 @@ HTU21D_HEATER_SWITCH;
 
 #endif
 
-class bus
+#if defined(USE_HAL_DRIVER)
+typedef enum
 {
-	public:
-		
-	private:
-	bool beginTransmission(uint8_t slave_add);
-	
+  HTU21D_IDLE       = 0,                       //nothing started yet
+  HTU21D_TRIGGER    = 1,                       //sending the no hold master command
+  HTU21D_CONVERTING = 2,                       //sensor busy, service() reads once the conversion time is up
+  HTU21D_READING    = 3,                       //reading MSB, LSB & checksum
+  HTU21D_DONE       = 4,                       //value ready
+  HTU21D_FAILED     = 5                        //NACK, bus error or bad checksum
 }
+HTU21D_STATE;
+
+class HTU21D;
+
+typedef void (*HTU21D_CALLBACK)(HTU21D *sensor, HTU21D_STATE state, float value, void *context);
+
+/*
+    Wire compatible I2C master on a HAL handle
+
+    Every transfer is an i2c_bus.h transaction, so the sensor shares the bus
+    with the other drivers. The blocking calls keep the Arduino code paths of
+    HTU21D.cpp unchanged, endTransmission(false) followed by requestFrom()
+    is one write-read with a repeated start. The *_IT calls queue the
+    transfer & call "done" from the I2C interrupt. One transfer at a time
+    per bus object.
+*/
+class bus
+{
+  public:
+   bus(I2C_HandleTypeDef *hi2c = &HTU_I2C);
+
+   void    beginTransmission(uint8_t address);
+   size_t  write(uint8_t data);
+   size_t  send(uint8_t data) { return write(data); }
+   uint8_t endTransmission(bool stop = true);
+   uint8_t requestFrom(uint8_t address, uint8_t quantity, bool stop = true);
+   int     available(void);
+   int     read(void);
+   int     receive(void) { return read(); }
+
+   bool    transmit_IT(uint8_t address, const uint8_t *data, uint8_t len, void (*done)(void *context, bool ok), void *context);
+   bool    receive_IT(uint8_t address, uint8_t *data, uint8_t len, void (*done)(void *context, bool ok), void *context);
+   bool    transfer_IT(uint8_t address, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen,
+                       void (*done)(void *context, bool ok), void *context);
+   uint8_t lastError(void)  { return _error; }             //HAL_I2C_ERROR_* of the last transfer
+   uint32_t latency(void)   { return _xfer.latency_us; }   //queued to done, in microseconds
+
+  private:
+   i2c_bus_t         *_bus;
+   i2c_xfer_t        _xfer;
+   uint8_t           _address;
+   uint8_t           _txBuffer[4];
+   uint8_t           _txLength;
+   bool              _txHeld;                  //endTransmission(false), sent by requestFrom()
+   uint8_t           _rxBuffer[4];
+   uint8_t           _rxLength;
+   uint8_t           _rxIndex;
+   volatile uint8_t  _error;
+   void              (*_done)(void *context, bool ok);
+   void              *_context;
+
+   bool    prepare(uint8_t address, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen);
+   uint8_t run(void);
+   static void completed(i2c_xfer_t *xfer);
+};
+#endif
+
 class HTU21D
 {
   public:
@@ -176,10 +242,7 @@ class HTU21D
 		typedef uint8_t HTU21D_HUMD_OPERATION_MODE;
 		typedef uint8_t HTU21D_TEMP_OPERATION_MODE;
 		typedef uint8_t HTU21D_HEATER_SWITCH;
-		#if defined(USE_HAL_DRIVER)
-		bus wire;			
-		#endif
-		HTU21D(HTU21D_RESOLUTION = HTU21D_RES_RH12_TEMP14);
+		HTU21D(HTU21D_RESOLUTION = HTU21D_RES_RH12_TEMP14, uint8_t address = HTU21D_ADDRESS); //Si7013 can be strapped to 0x41
 
    #if defined(ESP8266)
    bool     begin(uint8_t sda = SDA, uint8_t scl = SCL);
@@ -195,9 +258,45 @@ class HTU21D
    void     setHeater(HTU21D_HEATER_SWITCH heaterSwitch);
    uint16_t readDeviceID(void);
    uint8_t  readFirmwareVersion(void);
+   uint8_t  address(void)    { return _address; }
+   uint8_t  resolution(void) { return _resolution; }
+
+   #if defined(USE_HAL_DRIVER)
+   bool     startHumidity(HTU21D_CALLBACK callback = NULL, void *context = NULL);      //no hold master, returns at once
+   bool     startTemperature(HTU21D_CALLBACK callback = NULL, void *context = NULL);   //no hold master, returns at once
+   void     service(void);                                                              //call from the main loop while a measurement runs
+   uint8_t  conversionTime(uint8_t command);                                            //ms, of a no hold master command at the current resolution
+   static uint8_t conversionTime(uint8_t command, HTU21D_RESOLUTION sensorResolution);  //ms, same at "sensorResolution"
+   HTU21D_STATE state(void) { return (HTU21D_STATE)_state; }
+   bool     ready(void)     { return _state == HTU21D_DONE || _state == HTU21D_FAILED; }
+   float    value(void)     { return _state == HTU21D_DONE ? _centi / 100.0 : HTU21D_ERROR; } //of the last finished measurement
+   int16_t  centi(void)     { return _state == HTU21D_DONE ? _centi : HTU21D_FIXED_ERROR; } //same in 1/100 %RH or 1/100 °C
+   uint16_t raw(void)       { return _raw; }                                           //status bits cleared
+
+   bus      Wire;                                                                       //named so that the Arduino code paths build as they are
+   #endif
 
   private:
    HTU21D_RESOLUTION _resolution;
+   uint8_t           _address;
+
+   #if defined(USE_HAL_DRIVER)
+   volatile uint8_t  _state;
+   uint8_t           _command;
+   uint8_t           _retries;
+   uint8_t           _frame[3];
+   uint16_t          _raw;
+   int16_t           _centi;
+   uint32_t          _start;
+   uint32_t          _wait;
+   HTU21D_CALLBACK   _callback;
+   void              *_context;
+
+   bool    start(uint8_t command, HTU21D_CALLBACK callback, void *context);
+   void    finish(HTU21D_STATE state);
+   static void triggered(void *context, bool ok);
+   static void received(void *context, bool ok);
+   #endif
 
    void    write8(uint8_t reg, uint8_t value);
    uint8_t read8(uint8_t reg);
@@ -0,0 +1,89 @@
+/***************************************************************************************************/
+/*
+  Adaptive resolution & interval for the sensors of an HTU21D_Scheduler
+
+  Every sensor walks through levels, from fast & coarse to slow & precise:
+
+    level  resolution         interval
+    0      RH 8,  T 12 bit    HTU21D_ADAPT_FAST_MS
+    1      RH 10, T 13 bit    4 x HTU21D_ADAPT_FAST_MS
+    2      RH 12, T 14 bit    HTU21D_SELF_HEATING_MS
+    3      RH 12, T 14 bit    HTU21D_ADAPT_QUIET_MS
+
+  A reading that moved more than HTU21D_ADAPT_RH_DELTA or
+  HTU21D_ADAPT_T_DELTA away from the reference sends the sensor straight to
+  level 0 & becomes the new reference. After HTU21D_ADAPT_SETTLE readings
+  within the thresholds the sensor goes one level up. A slow drift adds up
+  against the reference & is caught too.
+
+  Self-heating: the driver notes a reading every 17 sec as the floor at full
+  resolution. What heats the die is the time it converts, so the same duty
+  cycle is the budget at every resolution: a sensor may convert on average
+  (conversion time at RH12 T14) / HTU21D_SELF_HEATING_MS of the time. It can
+  run above that in bursts of HTU21D_ADAPT_HEAT_BURST ms of conversions, then
+  its interval is held at the floor of its resolution until the budget
+  recovers. Transients are caught at once, a long one is followed at the
+  fastest rate the budget allows.
+
+  Bus time, heating & the number of samples (radio summaries closed by
+  count, see sample_ring.h) all drop while the environment is quiet.
+
+  Call service() from the main loop instead of the one of the scheduler,
+  resolution changes are blocking & are applied between cycles.
+*/
+/***************************************************************************************************/
+
+#ifndef HTU21D_adaptive_h
+#define HTU21D_adaptive_h
+
+#include "HTU21D_scheduler.h"
+
+#if defined(USE_HAL_DRIVER)
+
+#define HTU21D_ADAPT_LEVELS          4
+#define HTU21D_ADAPT_FAST_MS         1000      //ms, level 0 interval & scheduler period
+#define HTU21D_SELF_HEATING_MS       17000     //ms, minimum time between readings at RH12 T14, see readHumidity()
+#define HTU21D_ADAPT_QUIET_MS        60000     //ms, interval of a stable sensor
+#define HTU21D_ADAPT_RH_DELTA        100       //1/100 %RH, 2 LSB at 8 bit
+#define HTU21D_ADAPT_T_DELTA         20        //1/100 °C
+#define HTU21D_ADAPT_SETTLE          5         //stable readings before going one level up
+#define HTU21D_ADAPT_HEAT_BURST      200       //ms of conversions above the self-heating budget
+
+typedef struct
+{
+  volatile uint8_t  level;
+  uint8_t           settle;                    //stable readings at this level
+  volatile bool     pending;                   //resolution of the level not applied yet
+  int16_t           humidity;                  //reference, 1/100 %RH
+  int16_t           temperature;               //reference, 1/100 °C
+  uint32_t          heat;                      //µs of conversions above the budget
+  uint32_t          time;                      //HAL_GetTick() of the last reading
+}
+HTU21D_ADAPT_SLOT;
+
+class HTU21D_Adaptive
+{
+  public:
+   HTU21D_Adaptive(HTU21D_Scheduler *scheduler);
+
+   void     start(HTU21D_SCHED_CALLBACK callback = NULL, void *context = NULL); //starts the scheduler at level 0 for all sensors
+   void     service(void);                                                      //call from the main loop
+   uint8_t  level(uint8_t slot) { return slot < HTU21D_SCHED_SLOTS ? _slots[slot].level : 0; }
+
+   uint32_t transients;                                                         //statistics, readings beyond a threshold
+   uint32_t throttled;                                                          //readings held at the self-heating floor
+   uint32_t changes;                                                            //resolution changes
+
+  private:
+   HTU21D_Scheduler      *_scheduler;
+   HTU21D_ADAPT_SLOT     _slots[HTU21D_SCHED_SLOTS];
+   HTU21D_SCHED_CALLBACK _callback;
+   void                  *_context;
+
+   void    update(uint8_t slot, const HTU21D_SAMPLE *reading);
+   static void observe(uint8_t slot, const HTU21D_SAMPLE *reading, void *context);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+/***************************************************************************************************/
+/*
+  Conversion benchmark, float code of HTU21D.cpp & of the Humidex example
+  against HTU21D_fixed.h & HTU21D_psychro.h
+
+  Enabled by defining HTU21D_BENCH. The same code runs on the board, timed
+  with the DWT cycle counter, and on the host (Host/htu21d_bench), timed in
+  nanoseconds, only the tick source differs.
+
+  Every case decodes the same frames, 1 in 16 with a bad CRC, & reports ticks
+  & nanoseconds per sample, the largest error against the exact formula in
+  1/100 %RH or 1/100 °C & the speedup over the float case it replaces. A fixed
+  case fails if it is off by more than HTU21D_BENCH_TOLERANCE, lets a bad CRC
+  through or is not faster than the float one. HTU21D_Bench() returns the
+  number of failed cases.
+
+  The psychrometric cases take temperatures of -40°C..60°C & humidities of
+  0.01%..100%RH instead of frames, humidex the exact dew point of those in
+  1/100 °C, & compare with libm in double. On the board ticks per sample are
+  the cycles per call. They only have to be faster where double is done in
+  software, as on the Cortex-M4F: a host FPU runs log() & exp() about as
+  fast as the integer code.
+*/
+/***************************************************************************************************/
+
+#ifndef HTU21D_bench_h
+#define HTU21D_bench_h
+
+#include <stdint.h>
+
+//#define HTU21D_BENCH                         //build HTU21D_Bench()
+
+#define HTU21D_BENCH_SAMPLES         256       //frames per case & round
+#define HTU21D_BENCH_TOLERANCE       1         //largest error of the fixed cases, 1/100, HTU21D_PSYCHRO_TOLERANCE for those
+
+typedef enum
+{
+  HTU21D_BENCH_CRC_BITWISE = 0,                //checkCRC8() as it was, 16 shifts
+  HTU21D_BENCH_CRC_TABLE,                      //HTU21D_CRC8()
+  HTU21D_BENCH_HUMD_FLOAT,                     //CRC & readHumidity() conversion
+  HTU21D_BENCH_HUMD_FIXED,                     //HTU21D_DecodeHumidity()
+  HTU21D_BENCH_TEMP_FLOAT,                     //CRC & readTemperature() conversion
+  HTU21D_BENCH_TEMP_FIXED,                     //HTU21D_DecodeTemperature()
+  HTU21D_BENCH_COMP_FLOAT,                     //both CRCs & readCompensatedHumidity() conversion
+  HTU21D_BENCH_COMP_FIXED,                     //HTU21D_DecodeCompensated()
+  HTU21D_BENCH_DEW_FLOAT,                      //calculateDewPoint() of the example, log()
+  HTU21D_BENCH_DEW_FIXED,                      //HTU21D_DewPointCenti()
+  HTU21D_BENCH_HUMIDEX_FLOAT,                  //calculateHumidex() of the example, exp()
+  HTU21D_BENCH_HUMIDEX_FIXED,                  //HTU21D_HumidexCenti()
+  HTU21D_BENCH_ABSOLUTE_FLOAT,                 //absolute humidity with exp()
+  HTU21D_BENCH_ABSOLUTE_FIXED,                 //HTU21D_AbsoluteHumidityCenti()
+  HTU21D_BENCH_COUNT
+}
+HTU21D_BENCH_CASE;
+
+typedef struct
+{
+  uint32_t ticks;                              //all rounds
+  uint32_t ticksPerSample;                     //x100
+  uint32_t nsPerSample;
+  uint16_t maxError;                           //1/100 %RH or 1/100 °C, 0 for the CRC cases
+  uint16_t speedup;                            //x100 over the float case, 0 for those
+  uint8_t  failed;
+}
+HTU21D_BENCH_RESULT;
+
+typedef struct
+{
+  uint32_t (*ticks)(void);                     //free running counter
+  uint32_t ticksPerUs;                         //SystemCoreClock / 1000000 for DWT->CYCCNT, 1000 for nanoseconds
+  void     (*sink)(const char *line, uint16_t len); //report lines, NULL for none
+  uint16_t rounds;                             //passes over the samples per case
+}
+HTU21D_BENCH_CONFIG;
+
+const char *HTU21D_BenchName(uint8_t bench);
+uint8_t     HTU21D_Bench(const HTU21D_BENCH_CONFIG *config, HTU21D_BENCH_RESULT *results);
+
+#endif
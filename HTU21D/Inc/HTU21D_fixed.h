@@ -0,0 +1,47 @@
+/***************************************************************************************************/
+/*
+  Integer conversion & CRC8 for SHT21, HTU21D & Si70xx readings
+
+  Same formulas as HTU21D.cpp without float:
+
+    %RH = -6     + 125    * raw / 2^16, returned in 1/100 %RH, clamped to 0..10000
+    °C  = -46.85 + 175.72 * raw / 2^16, returned in 1/100 °C,  -4685..12886
+
+  "raw" is the 16-bit sensor word, the 2 status bits are cleared here.
+  Results are rounded to the nearest 1/100. The float code of HTU21D.cpp
+  truncates both coefficients (0.001907 & 0.002681) and is up to 2/100 lower
+  at the top of the range.
+
+  The batch functions take the 3-byte frames (MSB, LSB, CRC) as read from the
+  sensor, one after the other, check every CRC with a 256 entry table and
+  write HTU21D_FIXED_ERROR where it fails. On a Cortex-M4 the compensation
+  runs as one dual multiply-accumulate (__SMLAD) & the clamps as __USAT.
+*/
+/***************************************************************************************************/
+
+#ifndef HTU21D_fixed_h
+#define HTU21D_fixed_h
+
+#include <stdint.h>
+
+#define HTU21D_FIXED_ERROR           (-32767 - 1) //INT16_MIN, CRC8 failed
+#define HTU21D_CRC8_POLY             0x31         //x^8 + x^5 + x^4 + 1, HTU21D_CRC8_POLYNOMINAL without the x^8 term
+
+extern const uint8_t HTU21D_CRC8_TABLE[256];
+
+/* CRC8 of MSB & LSB, compare with the 3-rd byte of the frame */
+inline uint8_t HTU21D_CRC8(uint8_t msb, uint8_t lsb)
+{
+  return HTU21D_CRC8_TABLE[HTU21D_CRC8_TABLE[msb] ^ lsb];
+}
+
+int16_t  HTU21D_HumidityCenti(uint16_t rawHumidity);                                      //1/100 %RH, 0..10000
+int16_t  HTU21D_TemperatureCenti(uint16_t rawTemperature);                                //1/100 °C
+int16_t  HTU21D_CompensateCenti(int16_t humidity, int16_t temperature);                   //HTU21D & SHT21 only, see readCompensatedHumidity()
+
+uint16_t HTU21D_DecodeHumidity(const uint8_t *frames, int16_t *humidity, uint16_t count);         //returns frames with a good CRC
+uint16_t HTU21D_DecodeTemperature(const uint8_t *frames, int16_t *temperature, uint16_t count);   //returns frames with a good CRC
+uint16_t HTU21D_DecodeCompensated(const uint8_t *humidityFrames, const uint8_t *temperatureFrames,
+                                  int16_t *humidity, uint16_t count);                              //pairs, returns pairs with good CRCs
+
+#endif
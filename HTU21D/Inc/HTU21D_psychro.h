@@ -0,0 +1,38 @@
+/***************************************************************************************************/
+/*
+  Integer dew point, humidex & absolute humidity for SHT21, HTU21D & Si70xx readings
+
+  Same formulas as examples/HTU21D_ESP8266_Humidex_Windchill without log(),
+  exp() or float, inputs & results in 1/100 as HTU21D_fixed.h:
+
+    dew point  γ  = 17.271 * T / (237.7 + T) + ln(RH / 100)
+               Td = 237.7 * γ / (17.271 - γ)
+    humidex    e  = 6.11 * exp(5417.753 * (1 / 273.16 - 1 / (273.16 + Td)))
+               H  = T + 0.5555 * (e - 10), only above 5°C
+    abs. hum.  AH = 216.7 * RH / 100 * 6.112 * exp(17.62 * T / (243.12 + T)) / (273.15 + T)
+
+  ln() & exp() go through log2 & 2^x: the integer part from the leading zero
+  count or a shift, the fraction from a 65 (log2) or 129 (2^x) entry table
+  with linear interpolation, off by less than 5E-5 in log2 & 4E-6 relative
+  in 2^x. Divisions are 32-bit, products 64-bit (one UMULL/SMULL on a
+  Cortex-M4).
+
+  Largest error against libm in double over -40°C..125°C & 0.01%..100%RH,
+  see Host/htu21d_psychro: HTU21D_PSYCHRO_TOLERANCE. Humidex is checked for
+  the dew point as given, an error of the dew point comes out about 6 times
+  larger at a dew point of 60°C, where e is steep.
+*/
+/***************************************************************************************************/
+
+#ifndef HTU21D_psychro_h
+#define HTU21D_psychro_h
+
+#include "HTU21D_fixed.h"
+
+#define HTU21D_PSYCHRO_TOLERANCE     1         //largest error against libm, 1/100 °C or 1/100 g/m³
+
+int16_t HTU21D_DewPointCenti(int16_t temperature, int16_t humidity);                     //1/100 °C, HTU21D_FIXED_ERROR at 0%RH
+int16_t HTU21D_HumidexCenti(int16_t temperature, int16_t dewPoint);                      //1/100 °C, HTU21D_FIXED_ERROR at 5°C & below or over 327°C
+int16_t HTU21D_AbsoluteHumidityCenti(int16_t temperature, int16_t humidity);             //1/100 g/m³, HTU21D_FIXED_ERROR over 327 g/m³
+
+#endif
@@ -0,0 +1,141 @@
+/***************************************************************************************************/
+/*
+  Acquisition scheduler for several SHT21, HTU21D & Si70xx sensors on one I2C bus
+
+  Every sensor converts in no hold master mode, so the bus is free while it
+  converts. The scheduler triggers all sensors one after the other and reads
+  each one as soon as its conversion time is up: the conversions overlap &
+  a cycle takes about one conversion time plus the bus time of all sensors,
+  not the sum of the conversion times.
+
+  Sensors of the same address sit behind a TCA9548A mux, one channel each,
+  or use an alternate address (Si7013 ADDR pin high, 0x41) on the same
+  channel. The mux channel is only written when it changes.
+
+  Per chip ID read with readDeviceID() at add():
+  - Si7013, Si7020 & Si7021 measure temperature along with every humidity
+    conversion, it is read with SI70xx_TEMP_READ_AFTER_RH_MEASURMENT
+    without a second conversion. Their humidity is already compensated.
+  - HTU21D & SHT21 get a temperature conversion only when the cached one
+    is older than HTU21D_SCHED_TEMP_AGE, humidity is compensated with the
+    cached temperature, see readCompensatedHumidity().
+
+  Every slot can have an interval of its own, a multiple of the period
+  passed to start(): it is left out of the cycles until its interval is
+  up. See HTU21D_adaptive.h.
+
+  Call service() from the main loop, the bus transfers chain from the I2C
+  interrupt. Results are integers, see HTU21D_fixed.h.
+*/
+/***************************************************************************************************/
+
+#ifndef HTU21D_scheduler_h
+#define HTU21D_scheduler_h
+
+#include "HTU21D.h"
+
+#if defined(USE_HAL_DRIVER)
+
+#define HTU21D_SCHED_SLOTS           8         //sensors per scheduler
+#define HTU21D_SCHED_NO_MUX          0xFF      //no mux, or sensor not behind it
+#define HTU21D_SCHED_TEMP_AGE        60000     //ms, HTU21D & SHT21 temperature reused for compensation
+#define HTU21D_MUX_ADDRESS           0x70      //TCA9548A, A2..A0 low
+
+typedef enum
+{
+  HTU21D_SCHED_IDLE       = 0,                 //waiting for the next cycle
+  HTU21D_SCHED_TRIGGER_RH = 1,                 //humidity command due
+  HTU21D_SCHED_READ_RH    = 2,                 //humidity converting, read when due
+  HTU21D_SCHED_READ_T_RH  = 3,                 //Si70xx, temperature of the humidity conversion due
+  HTU21D_SCHED_TRIGGER_T  = 4,                 //temperature command due
+  HTU21D_SCHED_READ_T     = 5                  //temperature converting, read when due
+}
+HTU21D_SCHED_STEP;
+
+typedef struct
+{
+  int16_t  humidity;                           //1/100 %RH as measured, HTU21D_FIXED_ERROR if the cycle failed
+  int16_t  compensated;                        //1/100 %RH, HTU21D & SHT21 compensated with the cached temperature
+  int16_t  temperature;                        //1/100 °C, HTU21D_FIXED_ERROR if none yet
+  uint32_t time;                               //HAL_GetTick() of the humidity
+  uint32_t temperatureTime;                    //HAL_GetTick() of the temperature
+}
+HTU21D_SAMPLE;
+
+typedef void (*HTU21D_SCHED_CALLBACK)(uint8_t slot, const HTU21D_SAMPLE *reading, void *context);
+
+typedef struct
+{
+  HTU21D            *sensor;
+  uint8_t           address;
+  uint8_t           channel;                   //mux channel, HTU21D_SCHED_NO_MUX
+  uint16_t          chip;                      //readDeviceID(): 21, 7013, 7020, 7021 or HTU21D_ERROR
+  volatile uint8_t  step;                      //HTU21D_SCHED_STEP
+  uint8_t           retries;
+  uint8_t           frame[3];
+  uint32_t          due;                       //HAL_GetTick() the step may run from
+  volatile uint32_t interval;                  //ms between readings of this slot, 0 every cycle
+  uint32_t          last;                      //HAL_GetTick() of its last cycle
+  int16_t           humidity;
+  int16_t           temperature;               //cache
+  uint32_t          temperatureTime;
+  volatile uint8_t  sequence;                  //odd while reading is written
+  HTU21D_SAMPLE     reading;
+}
+HTU21D_SLOT;
+
+class HTU21D_Scheduler
+{
+  public:
+   HTU21D_Scheduler(I2C_HandleTypeDef *hi2c = &HTU_I2C, uint8_t muxAddress = HTU21D_SCHED_NO_MUX);
+
+   int8_t   add(HTU21D *sensor, uint8_t muxChannel = HTU21D_SCHED_NO_MUX);     //begin() & readDeviceID(), returns the slot or -1
+   void     start(uint32_t period, HTU21D_SCHED_CALLBACK callback = NULL, void *context = NULL); //ms between cycles, 0 back to back
+   void     stop(void);                                                         //after the cycle in progress
+   void     service(void);                                                      //call from the main loop
+   bool     reading(uint8_t slot, HTU21D_SAMPLE *reading);                      //last finished cycle, false if none
+   float    temperature(uint8_t slot);                                          //cached °C for readCompensatedHumidity(), or HTU21D_FORCE_READ_TEMP
+   void     interval(uint8_t slot, uint32_t interval);                          //ms, the slot skips cycles until it is up, any context
+   void     trigger(uint8_t slot);                                              //the next cycle starts at once & reads the slot
+   bool     resolution(uint8_t slot, HTU21D_RESOLUTION sensorResolution);       //blocking, false while a cycle is in progress
+   uint16_t chip(uint8_t slot) { return slot < _count ? _slots[slot].chip : HTU21D_ERROR; }
+   HTU21D   *sensor(uint8_t slot) { return slot < _count ? _slots[slot].sensor : NULL; }
+   uint8_t  count(void)        { return _count; }
+   bool     idle(void);                                                         //no cycle in progress
+
+   uint32_t cycles;                                                             //statistics
+   uint32_t readings;
+   uint32_t failures;
+   uint32_t cycleMs;                                                            //start to last reading of the last cycle
+   uint32_t busUs;                                                              //time on the wire of the last cycle
+
+  private:
+   i2c_bus_t             *_bus;
+   i2c_xfer_t            _xfer;
+   i2c_xfer_t            _muxXfer;
+   uint8_t               _muxAddress;
+   uint8_t               _muxChannel;          //selected now, HTU21D_SCHED_NO_MUX if unknown
+   uint8_t               _muxByte;
+   uint8_t               _command;
+   HTU21D_SLOT           _slots[HTU21D_SCHED_SLOTS];
+   uint8_t               _count;
+   volatile bool         _running;
+   volatile bool         _busy;                //a transfer of the scheduler is queued or running
+   uint8_t               _current;             //slot of that transfer
+   uint32_t              _period;
+   uint32_t              _cycleStart;
+   uint32_t              _cycleBusUs;
+   HTU21D_SCHED_CALLBACK _callback;
+   void                  *_context;
+
+   bool    select(uint8_t channel);
+   void    issue(void);
+   void    command(void);
+   void    finish(HTU21D_SLOT *slot, bool ok);
+   static void selected(i2c_xfer_t *xfer);
+   static void done(i2c_xfer_t *xfer);
+};
+
+#endif
+
+#endif
@@ -31,15 +31,34 @@
 
 #include "HTU21D.h"
 
+#if defined(USE_HAL_DRIVER) && !defined(delay)
+#define delay(ms) HAL_Delay(ms)
+#endif
+
+#if defined(USE_HAL_DRIVER)
+/* conversion times in milliseconds, first read at the Si7021 maximum, then
+   one retry per millisecond while the sensor NACKs, see the delays below */
+static const uint8_t HTU21D_HUMD_WAIT[4] = {12, 4, 5, 7};   //indexed by resolution bits 7 & 0: RH12, RH8, RH10, RH11
+static const uint8_t HTU21D_TEMP_WAIT[4] = {11, 4, 7, 3};   //indexed by resolution bits 7 & 0: T14,  T12, T13,  T11
+#endif
 
 /**************************************************************************/
 /*
     Constructor
 */
 /**************************************************************************/
-HTU21D::HTU21D(HTU21D_RESOLUTION sensorResolution)
+HTU21D::HTU21D(HTU21D_RESOLUTION sensorResolution, uint8_t address)
 {
   _resolution = sensorResolution;
+  _address    = address;
+
+  #if defined(USE_HAL_DRIVER)
+  _state    = HTU21D_IDLE;
+  _raw      = 0;
+  _centi    = HTU21D_FIXED_ERROR;
+  _callback = NULL;
+  _context  = NULL;
+  #endif
 }
 
 /**************************************************************************/
@@ -64,7 +83,7 @@ bool HTU21D::begin(uint8_t sda, uint8_t scl)
   Wire.begin(sda, scl);
   Wire.setClock(100000UL);                           //experimental! ESP8266 i2c bus speed: 100kHz..400kHz/100000UL..400000UL, default 100000UL
   Wire.setClockStretchLimit(230);                    //experimental! default 230usec
-#elseif defined(ARDUINO)
+#elif defined(ARDUINO)
 bool HTU21D::begin(void) 
 {
   Wire.begin();
@@ -72,7 +91,7 @@ bool HTU21D::begin(void)
 #endif
 #if defined(ESP8266) || defined(ARDUINO) 
 
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
   if (Wire.endTransmission(true) != 0) return false; //safety check, make sure the sensor is connected
 
   setResolution(_resolution);
@@ -84,14 +103,8 @@ bool HTU21D::begin(void)
 #if defined(USE_HAL_DRIVER)
 bool HTU21D::begin(void) 
 {
-//  Wire.begin();
-//  Wire.setClock(100000UL);                           //experimental! AVR i2c bus speed: 31kHz..400kHz/31000UL..400000UL, default 100000UL
-
- uint32_t tickstart = HAL_GetTick();
-	
-
-    
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  /* the I2C handle is set up by MX_I2C1_Init(), bus speed is its ClockSpeed */
+  Wire.beginTransmission(_address);
   if (Wire.endTransmission(true) != 0) return false; //safety check, make sure the sensor is connected
 
   setResolution(_resolution);
@@ -133,7 +146,7 @@ void HTU21D::setResolution(HTU21D_RESOLUTION sensorResolution)
 /**************************************************************************/
 void HTU21D::softReset(void)
 {
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
 
   #if ARDUINO >= 100
   Wire.write(HTU21D_SOFT_RESET);
@@ -170,7 +183,8 @@ bool HTU21D::batteryStatus(void)
   userRegisterData &= 0x40;
 
   if (userRegisterData == 0x00) return true;
-                                return false;
+
+  return false;
 }
 
 /**************************************************************************/
@@ -234,7 +248,7 @@ float HTU21D::readHumidity(HTU21D_HUMD_OPERATION_MODE sensorOperationMode)
   float    humidity    = 0;
 
   /* request humidity measurement */
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
   #if ARDUINO >= 100
   Wire.write(sensorOperationMode);
   #else
@@ -264,9 +278,9 @@ float HTU21D::readHumidity(HTU21D_HUMD_OPERATION_MODE sensorOperationMode)
 
   /* read humidity measurement to "wire.h" rxBuffer */
   #if defined(_VARIANT_ARDUINO_STM32_)
-  Wire.requestFrom(HTU21D_ADDRESS, 3);
+  Wire.requestFrom(_address, 3);
   #else
-  Wire.requestFrom(HTU21D_ADDRESS, 3, true);                   //true, stop message after transmission & releas the I2C bus
+  Wire.requestFrom(_address, 3, true);                   //true, stop message after transmission & releas the I2C bus
   #endif
   if (Wire.available() != 3) return HTU21D_ERROR;              //check rxBuffer & error handler, collision on the i2c bus
 
@@ -325,7 +339,7 @@ float HTU21D::readTemperature(HTU21D_TEMP_OPERATION_MODE sensorOperationMode)
   uint8_t  checksum       = 0;
 
   /* request temperature measurement */
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
   #if ARDUINO >= 100
   Wire.write(sensorOperationMode); 
   #else
@@ -359,9 +373,9 @@ float HTU21D::readTemperature(HTU21D_TEMP_OPERATION_MODE sensorOperationMode)
 
   /* read temperature measurement to "wire.h" rxBuffer */
   #if defined(_VARIANT_ARDUINO_STM32_)
-  Wire.requestFrom(HTU21D_ADDRESS, qntRequest);
+  Wire.requestFrom(_address, qntRequest);
   #else
-  Wire.requestFrom(HTU21D_ADDRESS, qntRequest, true);                                         //true, stop message after transmission & releas the I2C bus
+  Wire.requestFrom(_address, qntRequest, true);                                         //true, stop message after transmission & releas the I2C bus
   #endif
   if (Wire.available() != qntRequest) return HTU21D_ERROR;                                    //check rxBuffer & error handler, collision on the i2c bus
 
@@ -433,7 +447,7 @@ uint16_t HTU21D::readDeviceID(void)
   uint8_t  checksum = 0;
 
   /* request serial_2 -> SNB3**, SNB2, SNB1, SNB0 */
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
 
   #if ARDUINO >= 100
   Wire.write(HTU21D_SERIAL2_READ1);
@@ -446,9 +460,9 @@ uint16_t HTU21D::readDeviceID(void)
 
   /* read serial_2 -> SNB3**, SNB2, CRC */
   #if defined(_VARIANT_ARDUINO_STM32_)
-  Wire.requestFrom(HTU21D_ADDRESS, 3);
+  Wire.requestFrom(_address, 3);
   #else
-  Wire.requestFrom(HTU21D_ADDRESS, 3, true);                //true, stop message after transmission & releas the I2C bus
+  Wire.requestFrom(_address, 3, true);                //true, stop message after transmission & releas the I2C bus
   #endif
 
   #if ARDUINO >= 100
@@ -505,7 +519,7 @@ uint8_t HTU21D::readFirmwareVersion(void)
   uint8_t firmwareVersion = 0;
 
   /* request firware version */
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
 
   #if ARDUINO >= 100
   Wire.write(HTU21D_FIRMWARE_READ1);
@@ -518,9 +532,9 @@ uint8_t HTU21D::readFirmwareVersion(void)
 
   /* read firware version */
   #if defined(_VARIANT_ARDUINO_STM32_)
-  Wire.requestFrom(HTU21D_ADDRESS, 1);
+  Wire.requestFrom(_address, 1);
   #else
-  Wire.requestFrom(HTU21D_ADDRESS, 1, true); //true, stop message after transmission & releas the I2C bus
+  Wire.requestFrom(_address, 1, true); //true, stop message after transmission & releas the I2C bus
   #endif
 
   #if ARDUINO >= 100
@@ -555,7 +569,7 @@ uint8_t HTU21D::readFirmwareVersion(void)
 /**************************************************************************/
 void HTU21D::write8(uint8_t reg, uint8_t value)
 {
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
   #if ARDUINO >= 100
   Wire.write(reg);
   Wire.write(value);
@@ -576,7 +590,7 @@ void HTU21D::write8(uint8_t reg, uint8_t value)
 /**************************************************************************/
 uint8_t HTU21D::read8(uint8_t reg)
 {
-  Wire.beginTransmission(HTU21D_ADDRESS);
+  Wire.beginTransmission(_address);
   #if ARDUINO >= 100
   Wire.write(reg);
   #else
@@ -585,9 +599,9 @@ uint8_t HTU21D::read8(uint8_t reg)
   if (Wire.endTransmission(true) != 0) return HTU21D_ERROR; //error handler, collision on the i2c bus;
 
   #if defined(_VARIANT_ARDUINO_STM32_)
-  Wire.requestFrom(HTU21D_ADDRESS, 1);
+  Wire.requestFrom(_address, 1);
   #else
-  Wire.requestFrom(HTU21D_ADDRESS, 1, true);                //true, stop message after transmission & releas the I2C bus
+  Wire.requestFrom(_address, 1, true);                //true, stop message after transmission & releas the I2C bus
   #endif
   if (Wire.available() != 1) return HTU21D_ERROR;           //check rxBuffer & error handler, collision on the i2c bus
 
@@ -608,32 +622,435 @@ uint8_t HTU21D::read8(uint8_t reg)
     NOTE:
     - for more info about Cyclic Redundancy Check (CRC) see
       http://en.wikipedia.org/wiki/Computation_of_cyclic_redundancy_checks
+    - two lookups in HTU21D_CRC8_TABLE, same result as shifting the 16 bits
+      through HTU21D_CRC8_POLYNOMINAL
 */
 /**************************************************************************/
 uint8_t HTU21D::checkCRC8(uint16_t data)
 {
-  for (uint8_t bit = 0; bit < 16; bit++)
+  return HTU21D_CRC8(data >> 8, data & 0xFF);
+}
+
+
+#if defined(USE_HAL_DRIVER)
+/**************************************************************************/
+/*
+    startHumidity()
+
+    Triggers a humidity measurement in no hold master mode & returns at once
+
+    NOTE:
+    - the I2C bus is free while the sensor converts, call service() from
+      the main loop, it reads the result once the conversion time is up
+    - "callback" is called from the I2C interrupt when the measurement
+      is done or failed, otherwise poll ready() & value()
+    - returns false if a measurement is already running or could not be queued
+*/
+/**************************************************************************/
+bool HTU21D::startHumidity(HTU21D_CALLBACK callback, void *context)
+{
+  return start(HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD, callback, context);
+}
+
+/**************************************************************************/
+/*
+    startTemperature()
+
+    Triggers a temperature measurement in no hold master mode & returns
+    at once, see startHumidity()
+*/
+/**************************************************************************/
+bool HTU21D::startTemperature(HTU21D_CALLBACK callback, void *context)
+{
+  return start(HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD, callback, context);
+}
+
+/**************************************************************************/
+/*
+    service()
+
+    Reads the measurement once the conversion time is up
+
+    NOTE:
+    - the sensor NACKs its address until the conversion is done, the read
+      is then retried every millisecond up to HTU21D_NACK_RETRIES times
+*/
+/**************************************************************************/
+void HTU21D::service(void)
+{
+  if (_state != HTU21D_CONVERTING)          return;
+  if (HAL_GetTick() - _start < _wait)       return;
+
+  _state = HTU21D_READING;
+  if (!Wire.receive_IT(_address, _frame, 3, received, this)) _state = HTU21D_CONVERTING; //not queued, try again on the next call
+}
+
+/**************************************************************************/
+/*
+    conversionTime()
+
+    Returns the conversion time of "command" at the current resolution,
+    or at "sensorResolution"
+
+    NOTE:
+    - HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD or HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD
+*/
+/**************************************************************************/
+uint8_t HTU21D::conversionTime(uint8_t command)
+{
+  return conversionTime(command, _resolution);
+}
+
+uint8_t HTU21D::conversionTime(uint8_t command, HTU21D_RESOLUTION sensorResolution)
+{
+  uint8_t index = ((sensorResolution >> 6) & 0x02) | (sensorResolution & 0x01);
+
+  return (command == HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD) ? HTU21D_HUMD_WAIT[index] : HTU21D_TEMP_WAIT[index];
+}
+
+/**************************************************************************/
+/*
+    start()
+
+    Sends the no hold master "command" without waiting
+*/
+/**************************************************************************/
+bool HTU21D::start(uint8_t command, HTU21D_CALLBACK callback, void *context)
+{
+  if (_state != HTU21D_IDLE && !ready()) return false;
+
+  _command  = command;
+  _callback = callback;
+  _context  = context;
+  _retries  = 0;
+  _wait     = conversionTime(command);
+  _state    = HTU21D_TRIGGER;
+
+  if (!Wire.transmit_IT(_address, &_command, 1, triggered, this))
   {
-    if   (data & 0x8000) data = (data << 1) ^ HTU21D_CRC8_POLYNOMINAL;
-    else data <<= 1;
+    _state = HTU21D_IDLE;
+    return false;
   }
-  return data >>= 8;
+  return true;
+}
+
+/**************************************************************************/
+/*
+    finish()
+
+    Ends the measurement & calls the callback, if any
+*/
+/**************************************************************************/
+void HTU21D::finish(HTU21D_STATE state)
+{
+  _state = state;
+
+  if (_callback != NULL) _callback(this, state, value(), _context);
+}
+
+/**************************************************************************/
+/*
+    triggered()
+
+    I2C interrupt, the measurement command is sent
+*/
+/**************************************************************************/
+void HTU21D::triggered(void *context, bool ok)
+{
+  HTU21D *sensor = (HTU21D *)context;
+
+  if (!ok)
+  {
+    sensor->finish(HTU21D_FAILED);                                                       //sensor not connected or collision on the i2c bus
+    return;
+  }
+  sensor->_start = HAL_GetTick();
+  sensor->_state = HTU21D_CONVERTING;
+}
+
+/**************************************************************************/
+/*
+    received()
+
+    I2C interrupt, MSB, LSB & checksum are in or the read failed
+*/
+/**************************************************************************/
+void HTU21D::received(void *context, bool ok)
+{
+  HTU21D   *sensor = (HTU21D *)context;
+  uint16_t rawData;
+
+  if (!ok)
+  {
+    if ((sensor->Wire.lastError() & HAL_I2C_ERROR_AF) && ++sensor->_retries < HTU21D_NACK_RETRIES)
+    {
+      sensor->_start = HAL_GetTick();                                                      //still converting
+      sensor->_wait  = 1;
+      sensor->_state = HTU21D_CONVERTING;
+      return;
+    }
+    sensor->finish(HTU21D_FAILED);
+    return;
+  }
+
+  if (HTU21D_CRC8(sensor->_frame[0], sensor->_frame[1]) != sensor->_frame[2])
+  {
+    sensor->finish(HTU21D_FAILED);                                                         //checksum verification
+    return;
+  }
+
+  rawData      = ((sensor->_frame[0] << 8) | sensor->_frame[1]) & 0xFFFC;                 //clear status bits
+  sensor->_raw = rawData;
+
+  if (sensor->_command == HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD) sensor->_centi = HTU21D_HumidityCenti(rawData);
+  else                                                        sensor->_centi = HTU21D_TemperatureCenti(rawData);
+
+  sensor->finish(HTU21D_DONE);
+}
+
+/**************************************************************************/
+/*
+    bus()
+
+    Wire compatible I2C master on "hi2c", initialized by MX_I2Cx_Init()
+*/
+/**************************************************************************/
+bus::bus(I2C_HandleTypeDef *hi2c)
+{
+  _bus      = i2c_bus_get(hi2c);
+  _address  = 0;
+  _txLength = 0;
+  _txHeld   = false;
+  _rxLength = 0;
+  _rxIndex  = 0;
+  _error    = HAL_I2C_ERROR_NONE;
+  _done     = NULL;
+  _context  = NULL;
+
+  i2c_xfer_init(&_xfer, _bus, 0, NULL, 0, NULL, 0);
 }
 
-#if defined(USE_HAL_DRIVER)
 /**************************************************************************/
 /*
     beginTransmission()
 
-    sends the device's address and HAL status returns
-	NOTE:
-	- timeout is 100ms
+    Starts buffering bytes for "address", sent by endTransmission()
+*/
 /**************************************************************************/
-bool bus::beginTransmission(uint8_t slave_add)
+void bus::beginTransmission(uint8_t address)
 {
-	HAL_StatusTypeDef status;
-	status = I2C_MasterRequestWrite(&HTU_I2C, slave_add, 100, tickstart);
-	return status;	
+  _address  = address;
+  _txLength = 0;
+  _txHeld   = false;
 }
 
-#endif
\ No newline at end of file
+/**************************************************************************/
+/*
+    write()
+
+    Buffers one byte, returns 0 if the buffer is full
+*/
+/**************************************************************************/
+size_t bus::write(uint8_t data)
+{
+  if (_txLength >= sizeof(_txBuffer)) return 0;
+
+  _txBuffer[_txLength++] = data;
+  return 1;
+}
+
+/**************************************************************************/
+/*
+    endTransmission()
+
+    Sends the buffered bytes, blocking
+
+    NOTE:
+    - returned value, as Wire.endTransmission():
+      - 0 success
+      - 2 received NACK, address or data
+      - 4 other error
+    - without bytes only the address is sent, to probe the device
+    - with "stop" false the bytes are kept & sent by the next requestFrom()
+      to the same address, followed by a repeated start
+*/
+/**************************************************************************/
+uint8_t bus::endTransmission(bool stop)
+{
+  HAL_StatusTypeDef status;
+
+  if (_txLength == 0)
+  {
+    if (!i2c_bus_claim(_bus, this, HTU21D_I2C_TIMEOUT)) return 4;                    //the probe is a blocking HAL call
+
+    status = HAL_I2C_IsDeviceReady(_bus->hi2c, _address << 1, 1, HTU21D_I2C_TIMEOUT);
+    _error = HAL_I2C_GetError(_bus->hi2c);
+    i2c_bus_release(_bus, this);
+
+    if (status == HAL_OK)          return 0;
+    if (_error & HAL_I2C_ERROR_AF) return 2;
+    return 4;
+  }
+
+  if (!stop)
+  {
+    _txHeld = true;
+    return 0;
+  }
+
+  if (!prepare(_address, _txBuffer, _txLength, NULL, 0)) return 4;
+  _txLength = 0;
+
+  return run();
+}
+
+/**************************************************************************/
+/*
+    requestFrom()
+
+    Reads "quantity" bytes, blocking, returns the number of bytes read
+*/
+/**************************************************************************/
+uint8_t bus::requestFrom(uint8_t address, uint8_t quantity, bool stop)
+{
+  uint8_t txLength = (_txHeld && address == _address) ? _txLength : 0;
+
+  if (quantity > sizeof(_rxBuffer)) quantity = sizeof(_rxBuffer);
+
+  _rxIndex  = 0;
+  _rxLength = 0;
+  _txHeld   = false;
+  _txLength = 0;
+  if (!prepare(address, _txBuffer, txLength, _rxBuffer, quantity)) return 0;
+
+  if (run() == 0) _rxLength = quantity;
+
+  return _rxLength;
+}
+
+/**************************************************************************/
+/*
+    available()
+
+    Bytes left from the last requestFrom()
+*/
+/**************************************************************************/
+int bus::available(void)
+{
+  return _rxLength - _rxIndex;
+}
+
+/**************************************************************************/
+/*
+    read()
+
+    Next byte from the last requestFrom(), -1 if none is left
+*/
+/**************************************************************************/
+int bus::read(void)
+{
+  if (_rxIndex >= _rxLength) return -1;
+
+  return _rxBuffer[_rxIndex++];
+}
+
+/**************************************************************************/
+/*
+    transmit_IT()
+
+    Queues sending "len" bytes, "done" is called from the I2C interrupt
+
+    NOTE:
+    - "data" must stay valid until "done" is called
+    - returns false if the previous transfer of this object is not done
+*/
+/**************************************************************************/
+bool bus::transmit_IT(uint8_t address, const uint8_t *data, uint8_t len, void (*done)(void *context, bool ok), void *context)
+{
+  return transfer_IT(address, data, len, NULL, 0, done, context);
+}
+
+/**************************************************************************/
+/*
+    receive_IT()
+
+    Queues reading "len" bytes, see transmit_IT()
+*/
+/**************************************************************************/
+bool bus::receive_IT(uint8_t address, uint8_t *data, uint8_t len, void (*done)(void *context, bool ok), void *context)
+{
+  return transfer_IT(address, NULL, 0, data, len, done, context);
+}
+
+/**************************************************************************/
+/*
+    transfer_IT()
+
+    Queues writing "txLen" bytes, then reading "rxLen" bytes after
+    a repeated start, see transmit_IT()
+*/
+/**************************************************************************/
+bool bus::transfer_IT(uint8_t address, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen,
+                      void (*done)(void *context, bool ok), void *context)
+{
+  if (!prepare(address, tx, txLen, rx, rxLen)) return false;
+
+  _done          = done;
+  _context       = context;
+  _xfer.complete = completed;
+  _xfer.context  = this;
+
+  return i2c_bus_submit(&_xfer) == HAL_OK;
+}
+
+/**************************************************************************/
+/*
+    prepare()
+
+    Sets up the transaction, false if the previous one is still queued
+    or running
+*/
+/**************************************************************************/
+bool bus::prepare(uint8_t address, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen)
+{
+  if (_bus == NULL)                                                              return false;
+  if (_xfer.state == I2C_XFER_QUEUED || _xfer.state == I2C_XFER_ACTIVE)          return false;
+
+  i2c_xfer_init(&_xfer, _bus, address, tx, txLen, rx, rxLen);
+  return true;
+}
+
+/**************************************************************************/
+/*
+    run()
+
+    Runs the prepared transaction & waits for it, returns as endTransmission()
+*/
+/**************************************************************************/
+uint8_t bus::run(void)
+{
+  HAL_StatusTypeDef status = i2c_bus_run(&_xfer);
+
+  _error = (status == HAL_OK) ? HAL_I2C_ERROR_NONE : _xfer.error;
+
+  if (status == HAL_OK)          return 0;
+  if (_error & HAL_I2C_ERROR_AF) return 2;
+
+  return 4;
+}
+
+/**************************************************************************/
+/*
+    completed()
+
+    I2C interrupt, hands the end of a queued transfer to its owner
+*/
+/**************************************************************************/
+void bus::completed(i2c_xfer_t *xfer)
+{
+  bus *owner = (bus *)xfer->context;
+
+  owner->_error = xfer->error;
+  if (owner->_done != NULL) owner->_done(owner->_context, xfer->status == HAL_OK);
+}
+#endif
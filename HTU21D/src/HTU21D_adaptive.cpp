@@ -0,0 +1,196 @@
+/***************************************************************************************************/
+/*
+  Adaptive resolution & interval for the sensors of an HTU21D_Scheduler, see HTU21D_adaptive.h
+*/
+/***************************************************************************************************/
+
+#include "HTU21D_adaptive.h"
+
+#if defined(USE_HAL_DRIVER)
+#include <stdlib.h>
+#include <string.h>
+
+static const struct
+{
+  HTU21D_RESOLUTION resolution;
+  uint32_t          interval;                  //ms
+}
+HTU21D_ADAPT_LEVEL[HTU21D_ADAPT_LEVELS] =
+{
+  {HTU21D_RES_RH8_TEMP12,  HTU21D_ADAPT_FAST_MS},
+  {HTU21D_RES_RH10_TEMP13, HTU21D_ADAPT_FAST_MS * 4},
+  {HTU21D_RES_RH12_TEMP14, HTU21D_SELF_HEATING_MS},
+  {HTU21D_RES_RH12_TEMP14, HTU21D_ADAPT_QUIET_MS}
+};
+
+/* ms of conversions per reading at "sensorResolution", temperature counted every time */
+static uint32_t HTU21D_Active(uint8_t sensorResolution)
+{
+  return HTU21D::conversionTime(HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD, sensorResolution) +
+         HTU21D::conversionTime(HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD, sensorResolution);
+}
+
+/**************************************************************************/
+/*
+    Constructor
+*/
+/**************************************************************************/
+HTU21D_Adaptive::HTU21D_Adaptive(HTU21D_Scheduler *scheduler)
+{
+  _scheduler = scheduler;
+  _callback  = NULL;
+  _context   = NULL;
+
+  transients = 0;
+  throttled  = 0;
+  changes    = 0;
+
+  memset(_slots, 0, sizeof(_slots));
+}
+
+/**************************************************************************/
+/*
+    start()
+
+    Puts every sensor of the scheduler at level 0 & starts the scheduler
+
+    NOTE:
+    - add() the sensors to the scheduler before
+    - "callback" is called from the I2C interrupt for every reading, after
+      the level of the sensor was updated
+*/
+/**************************************************************************/
+void HTU21D_Adaptive::start(HTU21D_SCHED_CALLBACK callback, void *context)
+{
+  _callback = callback;
+  _context  = context;
+
+  for (uint8_t i = 0; i < _scheduler->count(); i++)
+  {
+    memset(&_slots[i], 0, sizeof(HTU21D_ADAPT_SLOT));
+    _slots[i].humidity    = HTU21D_FIXED_ERROR;
+    _slots[i].temperature = HTU21D_FIXED_ERROR;
+    _slots[i].pending     = true;
+    _scheduler->interval(i, HTU21D_ADAPT_LEVEL[0].interval);
+  }
+  _scheduler->start(HTU21D_ADAPT_FAST_MS, observe, this);
+}
+
+/**************************************************************************/
+/*
+    service()
+
+    Applies the resolution of the new levels between cycles & services the
+    scheduler, call from the main loop
+
+    NOTE:
+    - no reading arrives while the scheduler is idle, the level can not
+      change under the resolution change
+*/
+/**************************************************************************/
+void HTU21D_Adaptive::service(void)
+{
+  HTU21D_RESOLUTION sensorResolution;
+
+  for (uint8_t i = 0; i < _scheduler->count(); i++)
+  {
+    if (!_slots[i].pending || !_scheduler->idle()) continue;
+
+    _slots[i].pending = false;
+    sensorResolution  = HTU21D_ADAPT_LEVEL[_slots[i].level].resolution;
+
+    if (sensorResolution != _scheduler->sensor(i)->resolution() && _scheduler->resolution(i, sensorResolution)) changes++;
+  }
+  _scheduler->service();
+}
+
+/**************************************************************************/
+/*
+    update()
+
+    Moves "slot" to its next level from "reading" & sets its interval
+
+    NOTE:
+    - runs in the I2C interrupt
+    - failed readings leave the level as it is
+*/
+/**************************************************************************/
+void HTU21D_Adaptive::update(uint8_t slot, const HTU21D_SAMPLE *reading)
+{
+  HTU21D_ADAPT_SLOT *a       = &_slots[slot];
+  uint32_t          budget   = HTU21D_Active(HTU21D_RES_RH12_TEMP14);   //ms per HTU21D_SELF_HEATING_MS
+  uint32_t          elapsed  = reading->time - a->time;
+  uint32_t          leak;
+  uint32_t          interval;
+  uint32_t          floor;
+  int16_t           humidity = reading->compensated != HTU21D_FIXED_ERROR ? reading->compensated : reading->humidity;
+  int16_t           temperature = reading->temperature;
+  bool              moved;
+
+  if (humidity == HTU21D_FIXED_ERROR) return;
+
+  /* self-heating, conversions above the budget pile up & leak at the budget rate */
+  if (a->time == 0 || elapsed > HTU21D_ADAPT_QUIET_MS) elapsed = HTU21D_ADAPT_QUIET_MS;
+  leak     = elapsed * budget * 1000 / HTU21D_SELF_HEATING_MS;
+  a->heat  = a->heat > leak ? a->heat - leak : 0;
+  a->heat += HTU21D_Active(_scheduler->sensor(slot)->resolution()) * 1000;
+  a->time  = reading->time;
+
+  /* change detection against the reference */
+  moved = a->humidity != HTU21D_FIXED_ERROR && abs(humidity - a->humidity) > HTU21D_ADAPT_RH_DELTA;
+  if (temperature != HTU21D_FIXED_ERROR && a->temperature != HTU21D_FIXED_ERROR && abs(temperature - a->temperature) > HTU21D_ADAPT_T_DELTA) moved = true;
+
+  if (a->humidity == HTU21D_FIXED_ERROR || moved)
+  {
+    a->humidity    = humidity;
+    a->temperature = temperature;
+    a->settle      = 0;
+    if (moved)
+    {
+      a->level = 0;
+      transients++;
+    }
+  }
+  else
+  {
+    if (a->temperature == HTU21D_FIXED_ERROR) a->temperature = temperature;
+
+    if (a->level < HTU21D_ADAPT_LEVELS - 1 && ++a->settle >= HTU21D_ADAPT_SETTLE)
+    {
+      a->level++;
+      a->settle = 0;
+    }
+  }
+
+  /* interval of the level, held at the floor of its resolution once the burst is spent */
+  interval = HTU21D_ADAPT_LEVEL[a->level].interval;
+
+  if (a->heat >= HTU21D_ADAPT_HEAT_BURST * 1000UL)
+  {
+    floor = HTU21D_SELF_HEATING_MS * HTU21D_Active(HTU21D_ADAPT_LEVEL[a->level].resolution) / budget;
+    if (interval < floor)
+    {
+      interval = floor;
+      throttled++;
+    }
+  }
+  _scheduler->interval(slot, interval);
+
+  if (HTU21D_ADAPT_LEVEL[a->level].resolution != _scheduler->sensor(slot)->resolution()) a->pending = true;
+}
+
+/**************************************************************************/
+/*
+    observe()
+
+    Scheduler callback, I2C interrupt
+*/
+/**************************************************************************/
+void HTU21D_Adaptive::observe(uint8_t slot, const HTU21D_SAMPLE *reading, void *context)
+{
+  HTU21D_Adaptive *self = (HTU21D_Adaptive *)context;
+
+  self->update(slot, reading);
+  if (self->_callback != NULL) self->_callback(slot, reading, self->_context);
+}
+#endif
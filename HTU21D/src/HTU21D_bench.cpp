@@ -0,0 +1,451 @@
+/***************************************************************************************************/
+/*
+  Conversion benchmark, see HTU21D_bench.h
+*/
+/***************************************************************************************************/
+
+#include "HTU21D_bench.h"
+#include "HTU21D_fixed.h"
+#include "HTU21D_psychro.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(HTU21D_BENCH)
+
+#define HTU21D_TEMP_COEFFICIENT      -0.15     //as HTU21D.h, which needs the HAL or Arduino
+#define HTU21D_CRC8_POLYNOMINAL      0x13100
+
+/* log() & exp() of the example are double, in software on a Cortex-M4F */
+#if defined(__CC_ARM) || (defined(__ARM_FP) && !(__ARM_FP & 0x08)) || (defined(__arm__) && !defined(__ARM_FP))
+#define HTU21D_BENCH_SOFT_DOUBLE     1
+#else
+#define HTU21D_BENCH_SOFT_DOUBLE     0
+#endif
+
+static const char * const benchNames[HTU21D_BENCH_COUNT] =
+{
+  "crcBitwise",
+  "crcTable",
+  "humdFloat",
+  "humdFixed",
+  "tempFloat",
+  "tempFixed",
+  "compFloat",
+  "compFixed",
+  "dewFloat",
+  "dewFixed",
+  "humidexFlt",
+  "humidexFix",
+  "absFloat",
+  "absFixed",
+};
+
+/* float case each fixed case is measured against */
+static const uint8_t benchReference[HTU21D_BENCH_COUNT] =
+{
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_CRC_BITWISE,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_HUMD_FLOAT,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_TEMP_FLOAT,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_COMP_FLOAT,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_DEW_FLOAT,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_HUMIDEX_FLOAT,
+  HTU21D_BENCH_COUNT, HTU21D_BENCH_ABSOLUTE_FLOAT,
+};
+
+static uint8_t  benchHumidity[HTU21D_BENCH_SAMPLES * 3];
+static uint8_t  benchTemperature[HTU21D_BENCH_SAMPLES * 3];
+static int16_t  benchCentiT[HTU21D_BENCH_SAMPLES];                  //psychrometric inputs, 1/100
+static int16_t  benchCentiRH[HTU21D_BENCH_SAMPLES];
+static int16_t  benchCentiDew[HTU21D_BENCH_SAMPLES];
+static int16_t  benchFixed[HTU21D_BENCH_SAMPLES];
+static float    benchFloat[HTU21D_BENCH_SAMPLES];
+static volatile uint32_t benchSink;
+
+/**************************************************************************/
+/*
+    Float code of HTU21D.cpp, copied as it was
+*/
+/**************************************************************************/
+static uint8_t benchCRC8(uint16_t data)
+{
+  uint32_t value = data;
+
+  for (uint8_t bit = 0; bit < 16; bit++)
+  {
+    if   (value & 0x8000) value = (value << 1) ^ HTU21D_CRC8_POLYNOMINAL;
+    else value <<= 1;
+  }
+  return value >>= 8;
+}
+
+static float benchHumidityFloat(const uint8_t *frame)
+{
+  uint16_t rawHumidity = (frame[0] << 8) | frame[1];
+  float    humidity;
+
+  if (benchCRC8(rawHumidity) != frame[2]) return 0xFF;
+
+  rawHumidity ^= 0x02;
+  humidity     = (0.001907 * (float)rawHumidity - 6);
+
+  if      (humidity < 0)   humidity = 0;
+  else if (humidity > 100) humidity = 100;
+
+  return humidity;
+}
+
+static float benchTemperatureFloat(const uint8_t *frame)
+{
+  uint16_t rawTemperature = (frame[0] << 8) | frame[1];
+
+  if (benchCRC8(rawTemperature) != frame[2]) return 0xFF;
+
+  return (0.002681 * (float)rawTemperature - 46.85);
+}
+
+static float benchCompensatedFloat(const uint8_t *humidityFrame, const uint8_t *temperatureFrame)
+{
+  float humidity    = benchHumidityFloat(humidityFrame);
+  float temperature = benchTemperatureFloat(temperatureFrame);
+
+  if (humidity == 0xFF || temperature == 0xFF) return 0xFF;
+
+  if (temperature > 0 && temperature < 80) humidity = humidity + (25.0 - temperature) * HTU21D_TEMP_COEFFICIENT;
+
+  return humidity;
+}
+
+/**************************************************************************/
+/*
+    Float code of examples/HTU21D_ESP8266_Humidex_Windchill, copied as it
+    was, 0xFF instead of ERROR
+*/
+/**************************************************************************/
+static float benchDewPointFloat(float temperature, float humidity)
+{
+  float a = 17.271;
+  float b = 237.7;
+
+  float gamma    = ((a * temperature) / (b + temperature)) + log(humidity / 100);
+  float dewpoint = (b * gamma) / (a - gamma);
+
+  return (dewpoint);
+}
+
+static float benchHumidexFloat(float temperature, float dewpoint)
+{
+  if (temperature > 5)
+  {
+    float e       = 5417.7530 * ((1 / 273.16) - (1 / (273.16 + dewpoint)));
+    float humidex = temperature + 0.5555 * ( 6.11 * exp(e) - 10);
+
+    return (humidex);
+  }
+  return 0xFF;
+}
+
+static float benchAbsoluteFloat(float temperature, float humidity)
+{
+  return 216.7 * (humidity / 100 * 6.112 * exp(17.62 * temperature / (243.12 + temperature))) / (273.15 + temperature);
+}
+
+/**************************************************************************/
+/*
+    Exact values in 1/100, from the datasheet formulas
+*/
+/**************************************************************************/
+static double benchHumidityExact(const uint8_t *frame)
+{
+  double humidity = -600 + 12500.0 * (((frame[0] << 8) | frame[1]) & 0xFFFC) / 65536;
+
+  if      (humidity < 0)     humidity = 0;
+  else if (humidity > 10000) humidity = 10000;
+
+  return humidity;
+}
+
+static double benchTemperatureExact(const uint8_t *frame)
+{
+  return -4685 + 17572.0 * (((frame[0] << 8) | frame[1]) & 0xFFFC) / 65536;
+}
+
+static double benchCompensatedExact(const uint8_t *humidityFrame, const uint8_t *temperatureFrame)
+{
+  double humidity    = benchHumidityExact(humidityFrame);
+  double temperature = benchTemperatureExact(temperatureFrame);
+
+  if (temperature > 0 && temperature < 8000) humidity += (2500 - temperature) * HTU21D_TEMP_COEFFICIENT;
+
+  return humidity;
+}
+
+static double benchDewPointExact(int16_t temperature, int16_t humidity)
+{
+  double gamma = 17.271 * temperature / (23770.0 + temperature) + log(humidity / 10000.0);
+
+  return 23770 * gamma / (17.271 - gamma);
+}
+
+static double benchHumidexExact(int16_t temperature, int16_t dewPoint)
+{
+  return temperature + 55.55 * (6.11 * exp(5417.7530 * (1 / 273.16 - 1 / (273.16 + dewPoint / 100.0))) - 10);
+}
+
+static double benchAbsoluteExact(int16_t temperature, int16_t humidity)
+{
+  double t = temperature / 100.0;
+
+  return 216.7 * (humidity / 10000.0 * 6.112 * exp(17.62 * t / (243.12 + t))) / (273.15 + t) * 100;
+}
+
+/**************************************************************************/
+/*
+    benchFrames()
+
+    Spreads the raw values over the whole range, humidity with the xxxxxx10
+    status bits, temperature with xxxxxx00, every 16-th CRC is broken, &
+    the psychrometric inputs over -40°C..60°C & 0.01%..100%RH
+*/
+/**************************************************************************/
+static void benchFrames(void)
+{
+  uint32_t seed = 1;
+
+  for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++)
+  {
+    seed = seed * 1103515245UL + 12345;
+    uint16_t humidity    = ((seed >> 8) & 0xFFFC) | 0x02;
+    uint16_t temperature = (seed >> 3) & 0xFFFC;
+
+    benchHumidity[3 * i]        = humidity >> 8;
+    benchHumidity[3 * i + 1]    = humidity & 0xFF;
+    benchHumidity[3 * i + 2]    = benchCRC8(humidity) ^ ((i % 16) == 0);
+    benchTemperature[3 * i]     = temperature >> 8;
+    benchTemperature[3 * i + 1] = temperature & 0xFF;
+    benchTemperature[3 * i + 2] = benchCRC8(temperature);
+
+    benchCentiT[i]   = -4000 + (int16_t)((seed >> 4) % 10001);
+    benchCentiRH[i]  = 1 + (int16_t)((seed >> 18) % 10000);
+    benchCentiDew[i] = (int16_t)floor(benchDewPointExact(benchCentiT[i], benchCentiRH[i]) + 0.5);
+  }
+}
+
+/**************************************************************************/
+/*
+    benchRun()
+
+    Runs one case "rounds" times over all samples, returns the ticks
+*/
+/**************************************************************************/
+static uint32_t benchRun(uint8_t bench, const HTU21D_BENCH_CONFIG *config)
+{
+  uint32_t start = config->ticks();
+  uint32_t crc   = 0;
+
+  for (uint16_t round = 0; round < config->rounds; round++)
+  {
+    switch (bench)
+    {
+      case HTU21D_BENCH_CRC_BITWISE:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) crc += benchCRC8((benchHumidity[3 * i] << 8) | benchHumidity[3 * i + 1]);
+        break;
+
+      case HTU21D_BENCH_CRC_TABLE:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) crc += HTU21D_CRC8(benchHumidity[3 * i], benchHumidity[3 * i + 1]);
+        break;
+
+      case HTU21D_BENCH_HUMD_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchHumidityFloat(&benchHumidity[3 * i]);
+        break;
+
+      case HTU21D_BENCH_HUMD_FIXED:
+        HTU21D_DecodeHumidity(benchHumidity, benchFixed, HTU21D_BENCH_SAMPLES);
+        break;
+
+      case HTU21D_BENCH_TEMP_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchTemperatureFloat(&benchTemperature[3 * i]);
+        break;
+
+      case HTU21D_BENCH_TEMP_FIXED:
+        HTU21D_DecodeTemperature(benchTemperature, benchFixed, HTU21D_BENCH_SAMPLES);
+        break;
+
+      case HTU21D_BENCH_COMP_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchCompensatedFloat(&benchHumidity[3 * i], &benchTemperature[3 * i]);
+        break;
+
+      case HTU21D_BENCH_COMP_FIXED:
+        HTU21D_DecodeCompensated(benchHumidity, benchTemperature, benchFixed, HTU21D_BENCH_SAMPLES);
+        break;
+
+      case HTU21D_BENCH_DEW_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchDewPointFloat(benchCentiT[i] / 100.0, benchCentiRH[i] / 100.0);
+        break;
+
+      case HTU21D_BENCH_DEW_FIXED:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFixed[i] = HTU21D_DewPointCenti(benchCentiT[i], benchCentiRH[i]);
+        break;
+
+      case HTU21D_BENCH_HUMIDEX_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchHumidexFloat(benchCentiT[i] / 100.0, benchCentiDew[i] / 100.0);
+        break;
+
+      case HTU21D_BENCH_HUMIDEX_FIXED:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFixed[i] = HTU21D_HumidexCenti(benchCentiT[i], benchCentiDew[i]);
+        break;
+
+      case HTU21D_BENCH_ABSOLUTE_FLOAT:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFloat[i] = benchAbsoluteFloat(benchCentiT[i] / 100.0, benchCentiRH[i] / 100.0);
+        break;
+
+      case HTU21D_BENCH_ABSOLUTE_FIXED:
+        for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++) benchFixed[i] = HTU21D_AbsoluteHumidityCenti(benchCentiT[i], benchCentiRH[i]);
+        break;
+    }
+  }
+  benchSink = crc;
+
+  return config->ticks() - start;
+}
+
+/**************************************************************************/
+/*
+    benchCheck()
+
+    Largest error of the last run in 1/100, 0xFFFF if a bad CRC got through
+    or a good one was refused
+*/
+/**************************************************************************/
+static uint16_t benchCheck(uint8_t bench)
+{
+  double worst = 0;
+
+  if (bench == HTU21D_BENCH_CRC_BITWISE || bench == HTU21D_BENCH_CRC_TABLE) return 0;
+
+  for (uint16_t i = 0; i < HTU21D_BENCH_SAMPLES; i++)
+  {
+    bool   fixed = (benchReference[bench] != HTU21D_BENCH_COUNT);
+    bool   bad   = (i % 16) == 0 && bench != HTU21D_BENCH_TEMP_FLOAT && bench != HTU21D_BENCH_TEMP_FIXED;
+
+    if (bench >= HTU21D_BENCH_DEW_FLOAT) bad = (bench == HTU21D_BENCH_HUMIDEX_FLOAT || bench == HTU21D_BENCH_HUMIDEX_FIXED) && benchCentiT[i] <= 500;
+    double exact, value, error;
+
+    if (fixed) value = benchFixed[i];
+    else       value = benchFloat[i] == 0xFF ? HTU21D_FIXED_ERROR : benchFloat[i] * 100;
+
+    if ((value == HTU21D_FIXED_ERROR) != bad) return 0xFFFF;
+    if (bad) continue;
+
+    switch (bench)
+    {
+      case HTU21D_BENCH_HUMD_FLOAT:
+      case HTU21D_BENCH_HUMD_FIXED:
+        exact = benchHumidityExact(&benchHumidity[3 * i]);
+        break;
+
+      case HTU21D_BENCH_TEMP_FLOAT:
+      case HTU21D_BENCH_TEMP_FIXED:
+        exact = benchTemperatureExact(&benchTemperature[3 * i]);
+        break;
+
+      case HTU21D_BENCH_DEW_FLOAT:
+      case HTU21D_BENCH_DEW_FIXED:
+        exact = benchDewPointExact(benchCentiT[i], benchCentiRH[i]);
+        break;
+
+      case HTU21D_BENCH_HUMIDEX_FLOAT:
+      case HTU21D_BENCH_HUMIDEX_FIXED:
+        exact = benchHumidexExact(benchCentiT[i], benchCentiDew[i]);
+        break;
+
+      case HTU21D_BENCH_ABSOLUTE_FLOAT:
+      case HTU21D_BENCH_ABSOLUTE_FIXED:
+        exact = benchAbsoluteExact(benchCentiT[i], benchCentiRH[i]);
+        break;
+
+      default:
+        exact = benchCompensatedExact(&benchHumidity[3 * i], &benchTemperature[3 * i]);
+        break;
+    }
+    error = value > exact ? value - exact : exact - value;
+    if (error > worst) worst = error;
+  }
+  return (uint16_t)(worst + 0.5);
+}
+
+/**************************************************************************/
+/*
+    HTU21D_BenchName()
+*/
+/**************************************************************************/
+const char *HTU21D_BenchName(uint8_t bench)
+{
+  return bench < HTU21D_BENCH_COUNT ? benchNames[bench] : "?";
+}
+
+/**************************************************************************/
+/*
+    HTU21D_Bench()
+
+    Runs every case & reports through config->sink
+
+    NOTE:
+    - "results" is HTU21D_BENCH_COUNT entries & may be NULL
+    - returns the number of failed cases
+*/
+/**************************************************************************/
+uint8_t HTU21D_Bench(const HTU21D_BENCH_CONFIG *config, HTU21D_BENCH_RESULT *results)
+{
+  HTU21D_BENCH_RESULT local[HTU21D_BENCH_COUNT];
+  uint32_t samples = (uint32_t)HTU21D_BENCH_SAMPLES * config->rounds;
+  uint8_t  failed  = 0;
+  char     line[96];
+
+  if (results == NULL) results = local;
+  memset(results, 0, sizeof(HTU21D_BENCH_RESULT) * HTU21D_BENCH_COUNT);
+
+  benchFrames();
+
+  for (uint8_t bench = 0; bench < HTU21D_BENCH_COUNT; bench++)
+  {
+    HTU21D_BENCH_RESULT *r = &results[bench];
+    uint8_t reference      = benchReference[bench];
+
+    benchRun(bench, config);                                                                //warm up the caches
+    r->ticks          = benchRun(bench, config);
+    r->ticksPerSample = (uint32_t)((uint64_t)r->ticks * 100 / samples);
+    r->nsPerSample    = (uint32_t)((uint64_t)r->ticks * 1000 / config->ticksPerUs / samples);
+    r->maxError       = benchCheck(bench);
+
+    if (reference != HTU21D_BENCH_COUNT)
+    {
+      r->speedup = r->ticks ? (uint16_t)((uint64_t)results[reference].ticks * 100 / r->ticks) : 0xFFFF;
+      if (bench < HTU21D_BENCH_DEW_FLOAT) r->failed = r->maxError > HTU21D_BENCH_TOLERANCE   || r->speedup <= 100;
+      else                                r->failed = r->maxError > HTU21D_PSYCHRO_TOLERANCE || (r->speedup <= 100 && HTU21D_BENCH_SOFT_DOUBLE);
+    }
+    else
+    {
+      r->failed  = r->maxError == 0xFFFF;
+    }
+    failed += r->failed;
+
+    if (config->sink != NULL)
+    {
+      int len = snprintf(line, sizeof(line), "%-11s %8lu.%02lu ticks %7lu ns/sample  err %5u  x%u.%02u  %s\n",
+                         benchNames[bench], (unsigned long)(r->ticksPerSample / 100), (unsigned long)(r->ticksPerSample % 100),
+                         (unsigned long)r->nsPerSample, r->maxError, r->speedup / 100, r->speedup % 100,
+                         r->failed ? "FAIL" : "ok");
+      config->sink(line, len);
+    }
+  }
+
+  if (config->sink != NULL)
+  {
+    int len = snprintf(line, sizeof(line), "-- %u of %u cases failed --\n", failed, HTU21D_BENCH_COUNT);
+    config->sink(line, len);
+  }
+  return failed;
+}
+
+#endif
@@ -0,0 +1,196 @@
+/***************************************************************************************************/
+/*
+  Integer conversion & CRC8 for SHT21, HTU21D & Si70xx readings, see HTU21D_fixed.h
+*/
+/***************************************************************************************************/
+
+#include "HTU21D_fixed.h"
+
+#if defined(__ARM_FEATURE_DSP) || defined(__TARGET_FEATURE_DSPMUL)
+#include "cmsis_compiler.h"
+#define HTU21D_SIMD
+#endif
+
+/**************************************************************************/
+/*
+    HTU21D_CRC8_TABLE
+
+    Built by the compiler, ARMCC 5 compiles C++ as C++03 so there is no
+    constexpr: the CRC is linear, so the CRC of a byte is the XOR of the
+    CRCs of its set bits, & those 8 are enum constants
+*/
+/**************************************************************************/
+#define HTU21D_CRC8_STEP(c) (((c) & 0x80) ? (((c) << 1) ^ HTU21D_CRC8_POLY) & 0xFF : ((c) << 1) & 0xFF)
+#define HTU21D_CRC8_BIT(c)  HTU21D_CRC8_STEP(HTU21D_CRC8_STEP(HTU21D_CRC8_STEP(HTU21D_CRC8_STEP( \
+                            HTU21D_CRC8_STEP(HTU21D_CRC8_STEP(HTU21D_CRC8_STEP(HTU21D_CRC8_STEP(c))))))))
+
+enum
+{
+  HTU21D_CRC8_B0 = HTU21D_CRC8_BIT(0x01),
+  HTU21D_CRC8_B1 = HTU21D_CRC8_BIT(0x02),
+  HTU21D_CRC8_B2 = HTU21D_CRC8_BIT(0x04),
+  HTU21D_CRC8_B3 = HTU21D_CRC8_BIT(0x08),
+  HTU21D_CRC8_B4 = HTU21D_CRC8_BIT(0x10),
+  HTU21D_CRC8_B5 = HTU21D_CRC8_BIT(0x20),
+  HTU21D_CRC8_B6 = HTU21D_CRC8_BIT(0x40),
+  HTU21D_CRC8_B7 = HTU21D_CRC8_BIT(0x80)
+};
+
+#define HTU21D_CRC8_E(b)    (uint8_t)((((b) & 0x01) ? HTU21D_CRC8_B0 : 0) ^ (((b) & 0x02) ? HTU21D_CRC8_B1 : 0) ^ \
+                                      (((b) & 0x04) ? HTU21D_CRC8_B2 : 0) ^ (((b) & 0x08) ? HTU21D_CRC8_B3 : 0) ^ \
+                                      (((b) & 0x10) ? HTU21D_CRC8_B4 : 0) ^ (((b) & 0x20) ? HTU21D_CRC8_B5 : 0) ^ \
+                                      (((b) & 0x40) ? HTU21D_CRC8_B6 : 0) ^ (((b) & 0x80) ? HTU21D_CRC8_B7 : 0))
+#define HTU21D_CRC8_E4(b)   HTU21D_CRC8_E(b),       HTU21D_CRC8_E((b) + 1),   HTU21D_CRC8_E((b) + 2),   HTU21D_CRC8_E((b) + 3)
+#define HTU21D_CRC8_E16(b)  HTU21D_CRC8_E4(b),      HTU21D_CRC8_E4((b) + 4),  HTU21D_CRC8_E4((b) + 8),  HTU21D_CRC8_E4((b) + 12)
+#define HTU21D_CRC8_E64(b)  HTU21D_CRC8_E16(b),     HTU21D_CRC8_E16((b) + 16), HTU21D_CRC8_E16((b) + 32), HTU21D_CRC8_E16((b) + 48)
+
+const uint8_t HTU21D_CRC8_TABLE[256] =
+{
+  HTU21D_CRC8_E64(0), HTU21D_CRC8_E64(64), HTU21D_CRC8_E64(128), HTU21D_CRC8_E64(192)
+};
+
+/**************************************************************************/
+/*
+    HTU21D_HumidityCenti()
+
+    Converts the raw humidity word to 1/100 %RH
+
+    NOTE:
+    - clamped to 0..100%, due to RH accuracy the value might be slightly
+      less than 0 or more 100
+*/
+/**************************************************************************/
+int16_t HTU21D_HumidityCenti(uint16_t rawHumidity)
+{
+  int32_t humidity = (int32_t)((12500UL * (rawHumidity & 0xFFFC) + 0x8000) >> 16) - 600;
+
+  if      (humidity < 0)     humidity = 0;
+  else if (humidity > 10000) humidity = 10000;
+
+  return humidity;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_TemperatureCenti()
+
+    Converts the raw temperature word to 1/100 °C
+*/
+/**************************************************************************/
+int16_t HTU21D_TemperatureCenti(uint16_t rawTemperature)
+{
+  return (int32_t)((17572UL * (rawTemperature & 0xFFFC) + 0x8000) >> 16) - 4685;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_CompensateCenti()
+
+    Applies HTU21D_TEMP_COEFFICIENT, -0.15 %RH/°C around 25°C, in 0°C..80°C
+
+    NOTE:
+    - rh + (25 - t) * -0.15 = (100 * rh + 15 * t - 37500) / 100, in 1/100
+*/
+/**************************************************************************/
+int16_t HTU21D_CompensateCenti(int16_t humidity, int16_t temperature)
+{
+  if (temperature <= 0 || temperature >= 8000) return humidity;
+
+  return (100L * humidity + 15L * temperature - 37500) / 100;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_DecodeHumidity()
+
+    Checks & converts "count" humidity frames
+*/
+/**************************************************************************/
+uint16_t HTU21D_DecodeHumidity(const uint8_t *frames, int16_t *humidity, uint16_t count)
+{
+  uint16_t good = 0;
+
+  for (uint16_t i = 0; i < count; i++, frames += 3)
+  {
+    if (HTU21D_CRC8(frames[0], frames[1]) != frames[2])
+    {
+      humidity[i] = HTU21D_FIXED_ERROR;
+      continue;
+    }
+    uint32_t raw = ((frames[0] << 8) | frames[1]) & 0xFFFC;
+    #if defined(HTU21D_SIMD)
+    int32_t  rh  = (int32_t)__USAT((int32_t)((12500UL * raw + 0x8000) >> 16) - 600, 14); //0..16383, no branch for the lower bound
+    humidity[i]  = rh > 10000 ? 10000 : rh;
+    #else
+    humidity[i]  = HTU21D_HumidityCenti(raw);
+    #endif
+    good++;
+  }
+  return good;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_DecodeTemperature()
+
+    Checks & converts "count" temperature frames
+*/
+/**************************************************************************/
+uint16_t HTU21D_DecodeTemperature(const uint8_t *frames, int16_t *temperature, uint16_t count)
+{
+  uint16_t good = 0;
+
+  for (uint16_t i = 0; i < count; i++, frames += 3)
+  {
+    if (HTU21D_CRC8(frames[0], frames[1]) != frames[2])
+    {
+      temperature[i] = HTU21D_FIXED_ERROR;
+      continue;
+    }
+    temperature[i] = HTU21D_TemperatureCenti((frames[0] << 8) | frames[1]);
+    good++;
+  }
+  return good;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_DecodeCompensated()
+
+    Checks & converts "count" pairs of humidity & temperature frames into
+    compensated humidity, see HTU21D_CompensateCenti()
+
+    NOTE:
+    - on a Cortex-M4 "100 * rh + 15 * t" is one __SMLAD of the packed
+      halfwords (rh, t) & (100, 15)
+*/
+/**************************************************************************/
+uint16_t HTU21D_DecodeCompensated(const uint8_t *humidityFrames, const uint8_t *temperatureFrames,
+                                  int16_t *humidity, uint16_t count)
+{
+  uint16_t good = 0;
+
+  for (uint16_t i = 0; i < count; i++, humidityFrames += 3, temperatureFrames += 3)
+  {
+    if (HTU21D_CRC8(humidityFrames[0],    humidityFrames[1])    != humidityFrames[2] ||
+        HTU21D_CRC8(temperatureFrames[0], temperatureFrames[1]) != temperatureFrames[2])
+    {
+      humidity[i] = HTU21D_FIXED_ERROR;
+      continue;
+    }
+    int16_t rh = HTU21D_HumidityCenti((humidityFrames[0] << 8) | humidityFrames[1]);
+    int16_t t  = HTU21D_TemperatureCenti((temperatureFrames[0] << 8) | temperatureFrames[1]);
+
+    if (t > 0 && t < 8000)
+    {
+      #if defined(HTU21D_SIMD)
+      rh = (int32_t)__SMLAD(((uint32_t)(uint16_t)t << 16) | (uint16_t)rh, (15UL << 16) | 100, (uint32_t)-37500) / 100;
+      #else
+      rh = (100L * rh + 15L * t - 37500) / 100;
+      #endif
+    }
+    humidity[i] = rh;
+    good++;
+  }
+  return good;
+}
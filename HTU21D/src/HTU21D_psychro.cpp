@@ -0,0 +1,220 @@
+/***************************************************************************************************/
+/*
+  Integer dew point, humidex & absolute humidity, see HTU21D_psychro.h
+*/
+/***************************************************************************************************/
+
+#include "HTU21D_psychro.h"
+
+#if defined(__CC_ARM)
+#define HTU21D_CLZ(x)                __clz(x)
+#elif defined(__GNUC__) || defined(__clang__)
+#define HTU21D_CLZ(x)                __builtin_clz(x)
+#endif
+
+#define HTU21D_MAGNUS_A_Q16          1131872      //17.271
+#define HTU21D_MAGNUS_A_Q17          2263745      //17.271
+#define HTU21D_MAGNUS_B              23770        //237.7 °C, 1/100
+#define HTU21D_MAGNUS_AB_Q13         3363075441UL //17.271 * 237.7 °C, 1/100
+#define HTU21D_LOG2_10000_Q24        222930821    //log2(10000), 100%RH in 1/100
+#define HTU21D_LN2_Q30               744261118    //ln(2)
+#define HTU21D_HUMIDEX_K_Q15         937619       //5417.753 / 273.16 * log2(e)
+#define HTU21D_HUMIDEX_C_Q20         355897704UL  //0.5555 * 6.11, 1/100
+#define HTU21D_HUMIDEX_OFFSET        1111         //0.5555 * 10, 1/100, doubled
+#define HTU21D_ABSOLUTE_K_Q15        832972       //17.62 * log2(e)
+#define HTU21D_ABSOLUTE_C_Q16        86800492UL   //216.7 * 6.112
+
+/* log2(1 + i / 64), Q30 */
+static const uint32_t HTU21D_LOG2_TABLE[65] =
+{
+  0x00000000, 0x016E7968, 0x02D75A6F, 0x043ACE28, 0x0598FDBF, 0x06F21090, 0x08462C46, 0x099574F1,
+  0x0AE00D1D, 0x0C2615E8, 0x0D67AF17, 0x0EA4F726, 0x0FDE0B5D, 0x111307DB, 0x124407AB, 0x137124CF,
+  0x149A784C, 0x15C01A3A, 0x16E221CE, 0x1800A563, 0x191BBA89, 0x1A33760A, 0x1B47EBF7, 0x1C592FAD,
+  0x1D6753E0, 0x1E726AA2, 0x1F7A8569, 0x207FB517, 0x21820A02, 0x228193F5, 0x237E623D, 0x247883A8,
+  0x2570068E, 0x2664F8D5, 0x275767F5, 0x284760FD, 0x2934F098, 0x2A20230E, 0x2B09044D, 0x2BEF9FE8,
+  0x2CD4011D, 0x2DB632D5, 0x2E963FAD, 0x2F7431F2, 0x305013AB, 0x3129EE96, 0x3201CC2C, 0x32D7B5A5,
+  0x33ABB3FB, 0x347DCFE7, 0x354E11EB, 0x361C824D, 0x36E9291F, 0x37B40E3A, 0x387D3946, 0x3944B1B9,
+  0x3A0A7EDA, 0x3ACEA7C0, 0x3B913356, 0x3C52285C, 0x3D118D67, 0x3DCF68E3, 0x3E8BC118, 0x3F469C23,
+  0x40000000
+};
+
+/* 2^(i / 128), Q30 */
+static const uint32_t HTU21D_EXP2_TABLE[129] =
+{
+  0x40000000, 0x4058F6A8, 0x40B268FA, 0x410C57A2, 0x4166C34C, 0x41C1ACA7, 0x421D1462, 0x4278FB2B,
+  0x42D561B4, 0x433248AE, 0x438FB0CB, 0x43ED9AC0, 0x444C0740, 0x44AAF702, 0x450A6ABB, 0x456A6323,
+  0x45CAE0F2, 0x462BE4E2, 0x468D6FAE, 0x46EF8210, 0x47521CC6, 0x47B5408C, 0x4818EE22, 0x487D2646,
+  0x48E1E9BA, 0x4947393F, 0x49AD1598, 0x4A137F88, 0x4A7A77D4, 0x4AE1FF43, 0x4B4A169C, 0x4BB2BEA5,
+  0x4C1BF829, 0x4C85C3F1, 0x4CF022CA, 0x4D5B157E, 0x4DC69CDD, 0x4E32B9B4, 0x4E9F6CD4, 0x4F0CB70C,
+  0x4F7A9930, 0x4FE91413, 0x50582888, 0x50C7D765, 0x51382182, 0x51A907B4, 0x521A8AD7, 0x528CABC3,
+  0x52FF6B55, 0x5372CA68, 0x53E6C9DA, 0x545B6A8B, 0x54D0AD5A, 0x55469329, 0x55BD1CDB, 0x56344B52,
+  0x56AC1F75, 0x57249A29, 0x579DBC57, 0x581786E6, 0x5891FAC1, 0x590D18D3, 0x5988E209, 0x5A055751,
+  0x5A82799A, 0x5B0049D4, 0x5B7EC8F2, 0x5BFDF7E5, 0x5C7DD7A4, 0x5CFE6923, 0x5D7FAD59, 0x5E01A53F,
+  0x5E8451D0, 0x5F07B405, 0x5F8BCCDB, 0x60109D51, 0x60962665, 0x611C6919, 0x61A3666D, 0x622B1F66,
+  0x62B39509, 0x633CC85B, 0x63C6BA64, 0x64516C2E, 0x64DCDEC3, 0x6569132F, 0x65F60A7F, 0x6683C5C3,
+  0x6712460B, 0x67A18C68, 0x683199ED, 0x68C26FB1, 0x69540EC9, 0x69E6784D, 0x6A79AD56, 0x6B0DAEFF,
+  0x6BA27E65, 0x6C381CA6, 0x6CCE8AE1, 0x6D65CA38, 0x6DFDDBCC, 0x6E96C0C3, 0x6F307A41, 0x6FCB096F,
+  0x70666F76, 0x7102AD80, 0x719FC4B9, 0x723DB650, 0x72DC8374, 0x737C2D55, 0x741CB528, 0x74BE1C20,
+  0x75606374, 0x76038C5B, 0x76A7980F, 0x774C87CC, 0x77F25CCE, 0x78991854, 0x7940BB9E, 0x79E947EF,
+  0x7A92BE8B, 0x7B3D20B6, 0x7BE86FBA, 0x7C94ACDE, 0x7D41D96E, 0x7DEFF6B6, 0x7E9F0606, 0x7F4F08AE,
+  0x80000000
+};
+
+/**************************************************************************/
+/*
+    HTU21D_Log2()
+
+    log2("x") in Q24, "x" > 0
+
+    NOTE:
+    - the leading one gives the integer part, the 31 bits below it index
+      the table (6 bits) & interpolate (25 bits)
+*/
+/**************************************************************************/
+static int32_t HTU21D_Log2(uint32_t x)
+{
+  #if defined(HTU21D_CLZ)
+  uint8_t  zeros = HTU21D_CLZ(x);
+  #else
+  uint8_t  zeros = 0;
+  while (!(x & (0x80000000UL >> zeros))) zeros++;
+  #endif
+  uint32_t fraction = (x << zeros) & 0x7FFFFFFF;
+  uint8_t  index    = fraction >> 25;
+  uint32_t step     = HTU21D_LOG2_TABLE[index + 1] - HTU21D_LOG2_TABLE[index];
+  uint32_t value    = HTU21D_LOG2_TABLE[index] + (uint32_t)(((uint64_t)step * (fraction & 0x1FFFFFF)) >> 25);
+
+  return ((int32_t)(31 - zeros) << 24) + (int32_t)((value + 32) >> 6);
+}
+
+/**************************************************************************/
+/*
+    HTU21D_Exp2()
+
+    2^("x" / 2^16) as a Q30 mantissa in 1..2, times 2^"exponent"
+
+    NOTE:
+    - 128 steps, with 64 the chords of 2^x alone were 0.5/100 too high at
+      327 g/m³
+*/
+/**************************************************************************/
+static uint32_t HTU21D_Exp2(int32_t x, int8_t *exponent)
+{
+  uint32_t fraction = x & 0xFFFF;
+  uint8_t  index    = fraction >> 9;
+  uint32_t step     = HTU21D_EXP2_TABLE[index + 1] - HTU21D_EXP2_TABLE[index];
+
+  *exponent = (int8_t)((x - (int32_t)fraction) / 65536);                                   //floor, also below 0
+  return HTU21D_EXP2_TABLE[index] + (uint32_t)(((uint64_t)step * (fraction & 0x1FF)) >> 9);
+}
+
+/**************************************************************************/
+/*
+    HTU21D_Ratio()
+
+    "x" / "divisor" in Q30, |"x"| <= 16383, 0 < "divisor" < 2^18
+
+    NOTE:
+    - two 32-bit divisions, Q17 then 13 more bits from the remainder
+*/
+/**************************************************************************/
+static int32_t HTU21D_Ratio(int32_t x, int32_t divisor)
+{
+  int32_t quotient  = x * 131072 / divisor;
+  int32_t remainder = x * 131072 - quotient * divisor;                                    //same sign as "x"
+
+  return quotient * 8192 + remainder * 8192 / divisor;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_DewPointCenti()
+
+    Dew point in 1/100 °C of "temperature" in 1/100 °C & "humidity" in
+    1/100 %RH, Magnus formula as calculateDewPoint() of the example
+
+    NOTE:
+    - γ in Q17, 17.271 * T / (237.7 + T) from HTU21D_Ratio(), ln(RH / 100)
+      from log2
+    - Td = 237.7 * 17.271 / (17.271 - γ) - 237.7, one 32-bit division
+*/
+/**************************************************************************/
+int16_t HTU21D_DewPointCenti(int16_t temperature, int16_t humidity)
+{
+  if (temperature == HTU21D_FIXED_ERROR || humidity == HTU21D_FIXED_ERROR) return HTU21D_FIXED_ERROR;
+  if (humidity <= 0 || temperature < -16383 || temperature > 16383)         return HTU21D_FIXED_ERROR; //T * 2^17 fits 32 bits
+  if (humidity > 10000) humidity = 10000;
+
+  int32_t  ratio  = HTU21D_Ratio(temperature, HTU21D_MAGNUS_B + temperature);              //T / (237.7 + T), Q30
+  int32_t  ln     = (int32_t)(((int64_t)(HTU21D_Log2(humidity) - HTU21D_LOG2_10000_Q24) * HTU21D_LN2_Q30) >> 30); //Q24, 0 or less
+  int32_t  gamma  = (int32_t)(((int64_t)ratio * HTU21D_MAGNUS_A_Q16) >> 29) + (ln >> 7);   //Q17, -13.4..6.0
+  uint32_t a      = (uint32_t)(HTU21D_MAGNUS_A_Q17 - gamma + 8) >> 4;                       //17.271 - γ, Q13, 11.2..30.7
+
+  return (int32_t)((HTU21D_MAGNUS_AB_Q13 + (a >> 1)) / a) - HTU21D_MAGNUS_B;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_HumidexCenti()
+
+    Humidex in 1/100 °C of "temperature" & "dewPoint" in 1/100 °C, as
+    calculateHumidex() of the example
+
+    NOTE:
+    - 5417.753 * (1 / 273.16 - 1 / (273.16 + Td)) = 5417.753 / 273.16 *
+      Td / (273.16 + Td), taken to base 2 for HTU21D_Exp2()
+*/
+/**************************************************************************/
+int16_t HTU21D_HumidexCenti(int16_t temperature, int16_t dewPoint)
+{
+  if (temperature == HTU21D_FIXED_ERROR || dewPoint == HTU21D_FIXED_ERROR) return HTU21D_FIXED_ERROR;
+  if (temperature <= 500 || dewPoint < -16383 || dewPoint > 16383)          return HTU21D_FIXED_ERROR;
+
+  int32_t  ratio    = HTU21D_Ratio(dewPoint, 27316 + dewPoint);                            //Td / (273.16 + Td), Q30
+  int32_t  power    = (int32_t)(((int64_t)ratio * HTU21D_HUMIDEX_K_Q15 + (1L << 28)) >> 29); //Q16
+  int8_t   exponent;
+  uint32_t mantissa = HTU21D_Exp2(power, &exponent);
+  int32_t  e        = exponent < -14 ? 0 : (int32_t)(((uint64_t)HTU21D_HUMIDEX_C_Q20 * mantissa) >> (49 - exponent)); //0.5555 * 6.11 * 2^y, 1/200
+  int32_t  humidex  = (2L * temperature + e - HTU21D_HUMIDEX_OFFSET + 1) >> 1;
+
+  return humidex > 32767 ? HTU21D_FIXED_ERROR : humidex;
+}
+
+/**************************************************************************/
+/*
+    HTU21D_AbsoluteHumidityCenti()
+
+    Water vapour in 1/100 g/m³ of "temperature" in 1/100 °C & "humidity" in
+    1/100 %RH, with the Magnus saturation pressure over water
+
+    NOTE:
+    - 1324.47 * RH * 2^y / (273.15 + T) in 1/100, the division is a 32-bit
+      reciprocal in Q36, RH * mantissa fits 32 bits
+*/
+/**************************************************************************/
+int16_t HTU21D_AbsoluteHumidityCenti(int16_t temperature, int16_t humidity)
+{
+  if (temperature == HTU21D_FIXED_ERROR || humidity == HTU21D_FIXED_ERROR) return HTU21D_FIXED_ERROR;
+  if (temperature < -16383 || temperature > 16383)                          return HTU21D_FIXED_ERROR;
+  if (humidity <= 0)    return 0;
+  if (humidity > 10000) humidity = 10000;
+
+  int32_t  ratio    = HTU21D_Ratio(temperature, 24312 + temperature);                      //T / (243.12 + T), Q30
+  int32_t  power    = (int32_t)(((int64_t)ratio * HTU21D_ABSOLUTE_K_Q15 + (1L << 28)) >> 29); //Q16
+  int8_t   exponent;
+  uint32_t mantissa = HTU21D_Exp2(power, &exponent);
+  uint32_t kelvin   = 27315 + temperature;                                                 //1/100 K
+  uint32_t scaled   = (uint32_t)humidity * ((mantissa + 8192) >> 14);                      //RH * 2^frac, Q16
+  uint32_t inverse  = 0xFFFFFFFFUL / kelvin;                                               //1 / K, Q32
+  uint32_t ratioed;
+
+  inverse = (inverse << 4) + (((0xFFFFFFFFUL - inverse * kelvin) << 4) + 15) / kelvin;     //Q36 from the remainder
+  ratioed = (uint32_t)(((uint64_t)scaled * inverse) >> 20);                                //Q32
+  uint64_t absolute;
+
+  if (exponent < -16) return 0;                                                            //below 1/200 g/m³
+  absolute = ((uint64_t)ratioed * HTU21D_ABSOLUTE_C_Q16) >> (47 - exponent);               //1/200
+
+  absolute = (absolute + 1) >> 1;
+  return absolute > 32767 ? HTU21D_FIXED_ERROR : (int16_t)absolute;
+}
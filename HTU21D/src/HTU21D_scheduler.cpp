@@ -0,0 +1,569 @@
+/***************************************************************************************************/
+/*
+  Acquisition scheduler for several SHT21, HTU21D & Si70xx sensors, see HTU21D_scheduler.h
+*/
+/***************************************************************************************************/
+
+#include "HTU21D_scheduler.h"
+
+#if defined(USE_HAL_DRIVER)
+#include <string.h>
+
+#define HTU21D_SCHED_SI70XX(chip)    ((chip) == 7013 || (chip) == 7020 || (chip) == 7021)
+
+/**************************************************************************/
+/*
+    Constructor
+
+    NOTE:
+    - "muxAddress" is the TCA9548A address, HTU21D_MUX_ADDRESS, or
+      HTU21D_SCHED_NO_MUX when all sensors have their own address
+*/
+/**************************************************************************/
+HTU21D_Scheduler::HTU21D_Scheduler(I2C_HandleTypeDef *hi2c, uint8_t muxAddress)
+{
+  _bus        = i2c_bus_get(hi2c);
+  _muxAddress = muxAddress;
+  _muxChannel = HTU21D_SCHED_NO_MUX;
+  _muxByte    = 0;
+  _command    = 0;
+  _count      = 0;
+  _running    = false;
+  _busy       = false;
+  _current    = 0;
+  _period     = 0;
+  _cycleStart = 0;
+  _cycleBusUs = 0;
+  _callback   = NULL;
+  _context    = NULL;
+
+  cycles      = 0;
+  readings    = 0;
+  failures    = 0;
+  cycleMs     = 0;
+  busUs       = 0;
+
+  memset(_slots, 0, sizeof(_slots));
+  i2c_xfer_init(&_xfer,    _bus, 0, NULL, 0, NULL, 0);
+  i2c_xfer_init(&_muxXfer, _bus, 0, NULL, 0, NULL, 0);
+}
+
+/**************************************************************************/
+/*
+    add()
+
+    Selects "muxChannel", initializes the sensor with begin() & reads its
+    chip ID, returns the slot of the sensor or -1
+
+    NOTE:
+    - blocking, call before start()
+    - the sensor object keeps its own address, see HTU21D()
+*/
+/**************************************************************************/
+int8_t HTU21D_Scheduler::add(HTU21D *sensor, uint8_t muxChannel)
+{
+  HTU21D_SLOT *slot;
+
+  if (_count >= HTU21D_SCHED_SLOTS || _running || _bus == NULL) return -1;
+  if (!select(muxChannel))                                      return -1; //mux not connected
+  if (!sensor->begin())                                         return -1; //sensor not connected
+
+  slot = &_slots[_count];
+  memset(slot, 0, sizeof(HTU21D_SLOT));
+
+  slot->sensor              = sensor;
+  slot->address             = sensor->address();
+  slot->channel             = muxChannel;
+  slot->chip                = sensor->readDeviceID();
+  slot->step                = HTU21D_SCHED_IDLE;
+  slot->humidity            = HTU21D_FIXED_ERROR;
+  slot->temperature         = HTU21D_FIXED_ERROR;
+  slot->reading.humidity    = HTU21D_FIXED_ERROR;
+  slot->reading.compensated = HTU21D_FIXED_ERROR;
+  slot->reading.temperature = HTU21D_FIXED_ERROR;
+
+  return _count++;
+}
+
+/**************************************************************************/
+/*
+    start()
+
+    Measures all sensors every "period" ms, the first cycle starts on
+    the next service()
+
+    NOTE:
+    - "callback" is called from the I2C interrupt for every sensor, once
+      per cycle, with the reading of that sensor
+    - with "period" 0 cycles run back to back, the sensor throughput is
+      then bounded by the bus time
+    - a slot with an interval() joins the cycles only when it is up
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::start(uint32_t period, HTU21D_SCHED_CALLBACK callback, void *context)
+{
+  _period     = period;
+  _callback   = callback;
+  _context    = context;
+  _cycleStart = HAL_GetTick() - period;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    _slots[i].last = _cycleStart - _slots[i].interval;                         //all due in the first cycle
+  }
+  _running    = true;
+}
+
+/**************************************************************************/
+/*
+    stop()
+
+    No new cycle is started, the one in progress completes
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::stop(void)
+{
+  _running = false;
+}
+
+/**************************************************************************/
+/*
+    service()
+
+    Starts a new cycle when the period is up & issues the transfers that
+    are due, call from the main loop
+
+    NOTE:
+    - once started, transfers chain from the I2C interrupt, service()
+      only picks up the conversions that were not due yet
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::service(void)
+{
+  uint32_t now = HAL_GetTick();
+
+  if (_busy || _count == 0) return;
+
+  if (_running && idle() && now - _cycleStart >= _period)
+  {
+    _cycleStart = now;
+    _cycleBusUs = 0;
+
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      if (now - _slots[i].last < _slots[i].interval) continue;                 //not this cycle
+
+      _slots[i].step    = HTU21D_SCHED_TRIGGER_RH;
+      _slots[i].due     = now;
+      _slots[i].retries = 0;
+      _slots[i].last    = now;
+    }
+  }
+  issue();
+}
+
+/**************************************************************************/
+/*
+    interval()
+
+    Sets the time between readings of "slot", rounded up to the next cycle
+
+    NOTE:
+    - safe from the scheduler callback, a shorter interval takes effect
+      on the next cycle
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::interval(uint8_t slot, uint32_t interval)
+{
+  if (slot < _count) _slots[slot].interval = interval;
+}
+
+/**************************************************************************/
+/*
+    trigger()
+
+    Reads "slot" now instead of when its interval is up, the reading
+    comes through the callback & reading() as usual
+
+    NOTE:
+    - call from the main loop, the cycle starts on the next service() or
+      after the one in progress
+    - the cycles after it keep the period from this one
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::trigger(uint8_t slot)
+{
+  uint32_t now = HAL_GetTick();
+
+  if (slot >= _count) return;
+
+  _slots[slot].last = now - _slots[slot].interval;
+  _cycleStart       = now - _period;
+}
+
+/**************************************************************************/
+/*
+    resolution()
+
+    Sets the resolution of the sensor in "slot", its conversion times follow
+
+    NOTE:
+    - blocking, call from the main loop
+    - false while a cycle is in progress, try again later
+*/
+/**************************************************************************/
+bool HTU21D_Scheduler::resolution(uint8_t slot, HTU21D_RESOLUTION sensorResolution)
+{
+  if (slot >= _count || !idle()) return false;
+  if (!select(_slots[slot].channel)) return false;                             //mux not connected
+
+  _slots[slot].sensor->setResolution(sensorResolution);
+  return true;
+}
+
+/**************************************************************************/
+/*
+    reading()
+
+    Copies the reading of the last finished cycle of "slot", false if
+    there is none yet
+*/
+/**************************************************************************/
+bool HTU21D_Scheduler::reading(uint8_t slot, HTU21D_SAMPLE *reading)
+{
+  HTU21D_SLOT *s = &_slots[slot];
+  uint8_t     sequence;
+
+  if (slot >= _count) return false;
+
+  do
+  {
+    sequence = s->sequence;
+    *reading = s->reading;
+  }
+  while ((sequence & 0x01) || sequence != s->sequence);                         //written from the I2C interrupt meanwhile
+
+  return sequence != 0;
+}
+
+/**************************************************************************/
+/*
+    temperature()
+
+    Cached temperature of "slot" in °C
+
+    NOTE:
+    - pass it to readCompensatedHumidity() instead of forcing a fresh
+      temperature conversion
+    - HTU21D_FORCE_READ_TEMP if there is none or it is older than
+      HTU21D_SCHED_TEMP_AGE
+*/
+/**************************************************************************/
+float HTU21D_Scheduler::temperature(uint8_t slot)
+{
+  HTU21D_SAMPLE reading;
+
+  if (!this->reading(slot, &reading))                                 return HTU21D_FORCE_READ_TEMP;
+  if (reading.temperature == HTU21D_FIXED_ERROR)                      return HTU21D_FORCE_READ_TEMP;
+  if (HAL_GetTick() - reading.temperatureTime >= HTU21D_SCHED_TEMP_AGE) return HTU21D_FORCE_READ_TEMP;
+
+  return reading.temperature / 100.0;
+}
+
+/**************************************************************************/
+/*
+    idle()
+
+    True when no cycle is in progress
+*/
+/**************************************************************************/
+bool HTU21D_Scheduler::idle(void)
+{
+  if (_busy) return false;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_slots[i].step != HTU21D_SCHED_IDLE) return false;
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*
+    select()
+
+    Opens mux "channel", blocking
+*/
+/**************************************************************************/
+bool HTU21D_Scheduler::select(uint8_t channel)
+{
+  if (_muxAddress == HTU21D_SCHED_NO_MUX || channel == HTU21D_SCHED_NO_MUX || channel == _muxChannel) return true;
+
+  _muxByte = 1 << channel;
+  i2c_xfer_init(&_muxXfer, _bus, _muxAddress, &_muxByte, 1, NULL, 0);
+
+  if (i2c_bus_run(&_muxXfer) != HAL_OK)
+  {
+    _muxChannel = HTU21D_SCHED_NO_MUX;
+    return false;
+  }
+  _muxChannel = channel;
+  return true;
+}
+
+/**************************************************************************/
+/*
+    issue()
+
+    Starts the transfer of the slot that is due first, switching the mux
+    before if needed
+
+    NOTE:
+    - called with no transfer of the scheduler in flight, from service()
+      or from the I2C interrupt that ended the previous one
+    - nothing is touched after the submit, the transfer may end before
+      it returns
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::issue(void)
+{
+  uint32_t    now  = HAL_GetTick();
+  int8_t      next = -1;
+  HTU21D_SLOT *slot;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_slots[i].step == HTU21D_SCHED_IDLE)                               continue;
+    if ((int32_t)(now - _slots[i].due) < 0)                                continue; //still converting
+    if (next < 0 || (int32_t)(_slots[i].due - _slots[next].due) < 0)       next = i; //due first, triggers of a new cycle go before
+  }
+  if (next < 0) return;
+
+  slot     = &_slots[next];
+  _current = next;
+  _busy    = true;
+
+  if (_muxAddress != HTU21D_SCHED_NO_MUX && slot->channel != HTU21D_SCHED_NO_MUX && slot->channel != _muxChannel)
+  {
+    _muxByte = 1 << slot->channel;
+    i2c_xfer_init(&_muxXfer, _bus, _muxAddress, &_muxByte, 1, NULL, 0);
+    _muxXfer.complete = selected;
+    _muxXfer.context  = this;
+
+    if (i2c_bus_submit(&_muxXfer) != HAL_OK) _busy = false;
+    return;
+  }
+  command();
+}
+
+/**************************************************************************/
+/*
+    command()
+
+    Starts the transfer of the current step of the current slot
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::command(void)
+{
+  HTU21D_SLOT   *slot  = &_slots[_current];
+  const uint8_t *tx    = &_command;
+  uint8_t       txLen  = 1;
+  uint8_t       rxLen  = 0;
+
+  switch (slot->step)
+  {
+    case HTU21D_SCHED_TRIGGER_RH:
+      _command = HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD;
+      break;
+
+    case HTU21D_SCHED_TRIGGER_T:
+      _command = HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD;
+      break;
+
+    case HTU21D_SCHED_READ_T_RH:
+      _command = SI70xx_TEMP_READ_AFTER_RH_MEASURMENT;                           //MSB & LSB, no checksum
+      rxLen    = 2;
+      break;
+
+    default:
+      tx       = NULL;                                                             //MSB, LSB & checksum of the conversion
+      txLen    = 0;
+      rxLen    = 3;
+      break;
+  }
+
+  i2c_xfer_init(&_xfer, _bus, slot->address, tx, txLen, slot->frame, rxLen);
+  _xfer.complete = done;
+  _xfer.context  = this;
+
+  if (i2c_bus_submit(&_xfer) != HAL_OK) _busy = false;
+}
+
+/**************************************************************************/
+/*
+    finish()
+
+    Publishes the reading of "slot" & calls the callback, the cycle is over
+    once all slots are done
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::finish(HTU21D_SLOT *slot, bool ok)
+{
+  uint32_t now         = HAL_GetTick();
+  int16_t  compensated = HTU21D_FIXED_ERROR;
+
+  if (ok)
+  {
+    compensated = slot->humidity;
+    if (!HTU21D_SCHED_SI70XX(slot->chip) && slot->temperature != HTU21D_FIXED_ERROR)
+    {
+      compensated = HTU21D_CompensateCenti(slot->humidity, slot->temperature);  //Si70xx compensates by itself
+    }
+    readings++;
+  }
+  else
+  {
+    slot->humidity = HTU21D_FIXED_ERROR;
+    failures++;
+  }
+
+  slot->sequence++;
+  slot->reading.humidity        = slot->humidity;
+  slot->reading.compensated     = compensated;
+  slot->reading.temperature     = slot->temperature;
+  slot->reading.time            = now;
+  slot->reading.temperatureTime = slot->temperatureTime;
+  slot->sequence++;
+  slot->step = HTU21D_SCHED_IDLE;
+
+  if (_callback != NULL) _callback(slot - _slots, &slot->reading, _context);
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_slots[i].step != HTU21D_SCHED_IDLE) return;
+  }
+  cycles++;
+  cycleMs = now - _cycleStart;
+  busUs   = _cycleBusUs;
+}
+
+/**************************************************************************/
+/*
+    selected()
+
+    I2C interrupt, the mux channel of the current slot is open or failed
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::selected(i2c_xfer_t *xfer)
+{
+  HTU21D_Scheduler *self = (HTU21D_Scheduler *)xfer->context;
+  HTU21D_SLOT      *slot = &self->_slots[self->_current];
+
+  self->_cycleBusUs += xfer->latency_us - xfer->wait_us;
+
+  if (xfer->status != HAL_OK)
+  {
+    self->_muxChannel = HTU21D_SCHED_NO_MUX;
+    self->finish(slot, false);
+    self->_busy = false;
+    self->issue();
+    return;
+  }
+  self->_muxChannel = slot->channel;
+  self->command();
+}
+
+/**************************************************************************/
+/*
+    done()
+
+    I2C interrupt, the transfer of the current step ended, moves the slot
+    to its next step & issues the next transfer that is due
+
+    NOTE:
+    - the sensor NACKs reads until the conversion is done, the read is
+      then retried every millisecond up to HTU21D_NACK_RETRIES times
+*/
+/**************************************************************************/
+void HTU21D_Scheduler::done(i2c_xfer_t *xfer)
+{
+  HTU21D_Scheduler *self  = (HTU21D_Scheduler *)xfer->context;
+  HTU21D_SLOT      *slot  = &self->_slots[self->_current];
+  uint8_t          *frame = slot->frame;
+  uint32_t         now    = HAL_GetTick();
+
+  self->_cycleBusUs += xfer->latency_us - xfer->wait_us;
+
+  if (xfer->status != HAL_OK)
+  {
+    if ((xfer->error & HAL_I2C_ERROR_AF) && ++slot->retries < HTU21D_NACK_RETRIES &&
+        (slot->step == HTU21D_SCHED_READ_RH || slot->step == HTU21D_SCHED_READ_T))
+    {
+      slot->due = now + 1;                                                     //still converting
+    }
+    else
+    {
+      self->finish(slot, false);                                               //sensor not connected or collision on the i2c bus
+    }
+  }
+  else switch (slot->step)
+  {
+    case HTU21D_SCHED_TRIGGER_RH:
+      slot->step    = HTU21D_SCHED_READ_RH;
+      slot->retries = 0;
+      slot->due     = now + slot->sensor->conversionTime(HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD);
+      if (HTU21D_SCHED_SI70XX(slot->chip)) slot->due += slot->sensor->conversionTime(HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD); //converts temperature too
+      break;
+
+    case HTU21D_SCHED_READ_RH:
+      if (HTU21D_CRC8(frame[0], frame[1]) != frame[2])
+      {
+        self->finish(slot, false);                                             //checksum verification
+        break;
+      }
+      slot->humidity = HTU21D_HumidityCenti((frame[0] << 8) | frame[1]);
+
+      if (HTU21D_SCHED_SI70XX(slot->chip))
+      {
+        slot->step = HTU21D_SCHED_READ_T_RH;                                   //no second conversion
+        slot->due  = now;
+      }
+      else if (slot->temperature == HTU21D_FIXED_ERROR || now - slot->temperatureTime >= HTU21D_SCHED_TEMP_AGE)
+      {
+        slot->step = HTU21D_SCHED_TRIGGER_T;                                   //cached temperature too old
+        slot->due  = now;
+      }
+      else
+      {
+        self->finish(slot, true);
+      }
+      break;
+
+    case HTU21D_SCHED_READ_T_RH:
+      slot->temperature     = HTU21D_TemperatureCenti((frame[0] << 8) | frame[1]);
+      slot->temperatureTime = now;
+      self->finish(slot, true);
+      break;
+
+    case HTU21D_SCHED_TRIGGER_T:
+      slot->step    = HTU21D_SCHED_READ_T;
+      slot->retries = 0;
+      slot->due     = now + slot->sensor->conversionTime(HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD);
+      break;
+
+    case HTU21D_SCHED_READ_T:
+      if (HTU21D_CRC8(frame[0], frame[1]) != frame[2])
+      {
+        self->finish(slot, false);
+        break;
+      }
+      slot->temperature     = HTU21D_TemperatureCenti((frame[0] << 8) | frame[1]);
+      slot->temperatureTime = now;
+      self->finish(slot, true);
+      break;
+  }
+
+  self->_busy = false;
+  self->issue();
+}
+#endif
@@ -0,0 +1,260 @@
+/*
+ Sustained CDC throughput on the host: usbd_cdc_if.c and the ST CDC class
+ over the USB model of Host/emu/usbd_emu.h.
+
+ Build and run from the repository root, the ST USB library is C:
+
+   gcc -c -O2 -DUSE_HAL_DRIVER -DSTM32F407xx -I Host/emu -I MDK-ARM/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Core/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Inc \
+       MDK-ARM/Src/usbd_cdc_if.c \
+       Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Src/usbd_cdc.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_core.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_ctlreq.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_ioreq.c
+   g++ -std=gnu++11 -O2 -DUSE_HAL_DRIVER -DSTM32F407xx -I Host/emu -I MDK-ARM/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Core/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Inc \
+       Host/cdc_bench/cdc_bench_host.cpp Host/emu/hal_emu.cpp Host/emu/usbd_emu.cpp \
+       usbd_cdc_if.o usbd_cdc.o usbd_core.o usbd_ctlreq.o usbd_ioreq.o -o cdc_bench
+   ./cdc_bench [-t ms]
+
+ IN: the main loop writes records with CDC_Transmit_FS() until the ring
+ refuses one, for record sizes from 8 bytes to 256, then with the radio
+ rate of TELEMETRY_RADIO records and with 8 byte records well under the
+ bus rate, where packing shows in the bytes per packet. OUT: the host
+ writes without pause and the main loop takes everything CDC_RxData_FS()
+ offers. Then both at once, and both at the 21 MHz of
+ CLOCK_PROFILE_LOW_POWER where the interrupts take eight times longer.
+ Each run is measured up to its end, then drained: every byte is checked,
+ in order, once.
+
+ Full speed bulk carries 19 packets of 64 bytes a frame, 1.216 MB/s. The
+ checks want 95 % of it each way alone, records of 8 bytes included, and
+ together at both clocks; data the host leaves at a 64 byte boundary seen
+ within a frame. Times are virtual. The exit status is the number of
+ failed checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "hal_emu.h"
+#include "usbd_emu.h"
+#include "usbd_cdc_if.h"
+
+#define LOOP_CYCLES     400            // the rest of the main loop
+#define BUS_MAX_MBS     1.216          // 19 x 64 bytes per ms
+#define RADIO_RECORD    44             // TELEMETRY_RADIO of 32 bytes, COBS framed
+#define RADIO_PER_S     1870           // back to back at 1 Mbps, rf24_bridge
+#define SMALL_PER_S     20000          // log lines and stats, well under the bus
+
+static int failed;
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler\n");
+    exit(100);
+}
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+/****************************************************************************/
+
+/* Byte i of a stream is (uint8_t)(i * 7 + i / 251): no period the ring or
+ * the packets could line up with */
+static uint8_t pattern(uint64_t i)
+{
+    return (uint8_t)(i * 7 + i / 251);
+}
+
+struct Result {
+    double   in_mbs, out_mbs;
+    uint64_t in_bytes, out_bytes;
+    bool     in_intact, out_intact;
+    uint32_t refused;                  // CDC_Transmit_FS() calls the ring refused
+    uint32_t in_packets, in_transfers, in_naks;
+    uint32_t out_transfers, out_naks;
+    uint64_t busy_ns;
+};
+
+static void report(const char* name, const Result& r, double ms)
+{
+    printf("%-22s", name);
+    if (r.in_bytes) {
+        printf(" IN %5.3f MB/s, %5.1f B/packet, %4u transfers/s, %5u NAKs", r.in_mbs,
+               r.in_packets ? (double)r.in_bytes / r.in_packets : 0.0, (unsigned)(r.in_transfers * 1000 / ms),
+               r.in_naks);
+    }
+    if (r.out_bytes) {
+        printf(" OUT %5.3f MB/s, %4u transfers/s, %5u NAKs", r.out_mbs,
+               (unsigned)(r.out_transfers * 1000 / ms), r.out_naks);
+    }
+    printf(" | bus busy %2.0f %%\n", 100.0 * r.busy_ns / (ms * 1e6));
+}
+
+/* record: 0 for no IN, else the record size; per_s: 0 as fast as the ring
+ * takes them, else records per second; out: the host writes OUT */
+static Result run(const char* name, uint32_t record, uint32_t per_s, bool out, double ms)
+{
+    UsbCdcEmu usb;
+    Result r;
+    uint8_t buf[256];
+    uint64_t in_sent = 0, out_checked = 0, out_written = 0;
+    uint64_t start = emu_now_ns(), end = start + (uint64_t)(ms * 1e6);
+    uint64_t next_record = start;
+
+    memset(&r, 0, sizeof(r));
+    r.in_intact = r.out_intact = true;
+    // Measured up to "end", then drained so that every byte can be checked
+    bool load = true;
+    while (load || ((CDC_TxPending_FS() || usb.received.size() < in_sent || out_checked < out_written) &&
+                    emu_now_ns() < end + 50000000ULL)) {
+        if (load && emu_now_ns() >= end) {
+            load = false;
+            r.in_bytes = usb.received.size();
+            r.out_bytes = out_checked;
+            r.in_packets = usb.in_packets;
+            r.in_transfers = usb.in_transfers;
+            r.in_naks = usb.in_naks;
+            r.out_transfers = usb.out_transfers;
+            r.out_naks = usb.out_naks;
+            r.busy_ns = usb.busy_ns;
+        }
+
+        // The host keeps 4 KB of OUT queued, like a writer with big buffers
+        while (load && out && usb.pending() < 4096) {
+            for (uint32_t i = 0; i < sizeof(buf); i++) {
+                buf[i] = pattern(out_written + i);
+            }
+            usb.write(buf, sizeof(buf));
+            out_written += sizeof(buf);
+        }
+
+        while (load && record && (per_s == 0 || emu_now_ns() >= next_record)) {
+            for (uint32_t i = 0; i < record; i++) {
+                buf[i] = pattern(in_sent + i);
+            }
+            if (CDC_Transmit_FS(buf, (uint16_t)record) != USBD_OK) {
+                r.refused++;
+                break;
+            }
+            in_sent += record;
+            next_record += per_s ? 1000000000ULL / per_s : 0;
+        }
+
+        uint8_t* data;
+        uint16_t n = CDC_RxData_FS(&data);
+        for (uint16_t i = 0; i < n; i++) {
+            r.out_intact = r.out_intact && data[i] == pattern(out_checked + i);
+        }
+        out_checked += n;
+        CDC_RxRelease_FS(n);
+
+        emu_advance_cycles(LOOP_CYCLES);
+    }
+
+    for (size_t i = 0; i < usb.received.size(); i++) {
+        r.in_intact = r.in_intact && usb.received[i] == pattern(i);
+    }
+    r.in_intact = r.in_intact && usb.received.size() == in_sent;
+    r.out_intact = r.out_intact && out_checked == out_written;
+    r.in_mbs = r.in_bytes / (ms * 1e3);
+    r.out_mbs = r.out_bytes / (ms * 1e3);
+    report(name, r, ms);
+    return r;
+}
+
+/* The host writes n bytes, a multiple of 64, and nothing more: µs until
+ * the main loop sees all of them */
+static double out_tail_us(uint32_t n)
+{
+    UsbCdcEmu usb;
+    uint8_t buf[64];
+    uint32_t seen = 0;
+    uint64_t start = emu_now_ns();
+
+    for (uint32_t i = 0; i < n; i += sizeof(buf)) {
+        memset(buf, (int)i, sizeof(buf));
+        usb.write(buf, sizeof(buf));
+    }
+    while (seen < n && emu_now_ns() - start < 100000000ULL) {
+        uint8_t* data;
+        uint16_t got = CDC_RxData_FS(&data);
+        seen += got;
+        CDC_RxRelease_FS(got);
+        emu_advance_cycles(LOOP_CYCLES);
+    }
+    return seen < n ? -1.0 : (emu_now_ns() - start) / 1e3;
+}
+
+/****************************************************************************/
+
+int main(int argc, char** argv)
+{
+    double ms = 200;
+    char what[128];
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            ms = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-t ms]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    SystemCoreClock = 168000000;
+    printf("-- CLOCK_PROFILE_MAX, %.0f ms each --\n", ms);
+
+    static const uint32_t sizes[] = { 8, 20, 44, 64, 256 };
+    double in_small = 0, in_worst = BUS_MAX_MBS;
+    bool intact = true;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "IN %u B records", sizes[i]);
+        Result r = run(name, sizes[i], 0, false, ms);
+        intact = intact && r.in_intact;
+        in_worst = r.in_mbs < in_worst ? r.in_mbs : in_worst;
+        in_small = i == 0 ? r.in_mbs : in_small;
+    }
+    check(intact, "IN: every byte in order, once");
+    snprintf(what, sizeof(what), "IN at 95 %% of the bus or more, every record size (worst %.3f MB/s)", in_worst);
+    check(in_worst >= 0.95 * BUS_MAX_MBS, what);
+
+    Result radio = run("IN radio records", RADIO_RECORD, RADIO_PER_S, false, ms);
+    check(radio.in_intact && radio.refused == 0, "IN: radio records at the radio rate, none refused");
+
+    Result small = run("IN 8 B records, 20k/s", 8, SMALL_PER_S, false, ms);
+    double per_packet = small.in_packets ? (double)small.in_bytes / small.in_packets : 0.0;
+    snprintf(what, sizeof(what), "IN: 8 B records at 20k/s share packets (%.1f B/packet)", per_packet);
+    check(small.in_intact && small.refused == 0 && per_packet >= 48, what);
+
+    Result out = run("OUT", 0, 0, true, ms);
+    check(out.out_intact, "OUT: every byte in order, once");
+    snprintf(what, sizeof(what), "OUT at 95 %% of the bus or more (%.3f MB/s)", out.out_mbs);
+    check(out.out_mbs >= 0.95 * BUS_MAX_MBS, what);
+
+    double tail = out_tail_us(1024);
+    snprintf(what, sizeof(what), "OUT: 1024 bytes without a short packet seen within a frame (%.0f us)", tail);
+    check(tail >= 0 && tail < 1000 + 1024 * 1000.0 / (BUS_MAX_MBS * 1e3), what);
+
+    Result both = run("IN 64 B + OUT", 64, 0, true, ms);
+    snprintf(what, sizeof(what), "both ways share the bus, %.3f MB/s together", both.in_mbs + both.out_mbs);
+    check(both.in_intact && both.out_intact && both.in_mbs + both.out_mbs >= 0.95 * BUS_MAX_MBS, what);
+
+    SystemCoreClock = 21000000;
+    printf("-- CLOCK_PROFILE_LOW_POWER --\n");
+    Result slow = run("IN 64 B + OUT", 64, 0, true, ms);
+    snprintf(what, sizeof(what), "at 21 MHz, %.3f MB/s together", slow.in_mbs + slow.out_mbs);
+    check(slow.in_intact && slow.out_intact && slow.in_mbs + slow.out_mbs >= 0.95 * BUS_MAX_MBS, what);
+
+    printf("-- %d failed --\n", failed);
+    return failed;
+}
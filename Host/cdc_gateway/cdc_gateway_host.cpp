@@ -0,0 +1,1101 @@
+/*
+ Gateway daemon: owns the CDC port of the board and fans the telemetry
+ records of telemetry.h out to any number of local consumers, a logger, a
+ dashboard and an alerting job at once, and takes their commands of
+ cdc_command.h back down to the board.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -pthread -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc -I HTU21D/Inc \
+       Host/cdc_gateway/cdc_gateway_host.cpp \
+       -x c++ MDK-ARM/Src/telemetry.c -x none \
+       -o cdc_gateway
+   ./cdc_gateway [-r slots] [-s socket] /dev/ttyACM0
+   ./cdc_gateway -c [-s socket] [-p]
+   ./cdc_gateway -t
+
+ Records go to a ring in shared memory, a memfd the daemon hands to every
+ consumer that connects to its UNIX socket (/tmp/cdc_gateway.sock unless
+ -s). The consumer maps it read only and keeps its own cursor: it cannot
+ slow the daemon or the other consumers down, nor corrupt the ring. Each
+ record is copied once, COBS decoded from the bytes read() returned into
+ its slot, and read where it is.
+
+ The ring overwrites the oldest record. Every slot carries the index of
+ the record in it, written after the record: a consumer the daemon lapped
+ finds another index and counts the records it missed, and one reading a
+ slot while it is rewritten sees that with valid() afterwards, the
+ seqlock pattern. Consumers sleep on a futex the daemon wakes once per
+ read() of the port, they start at the newest record. The header of the
+ ring carries the counts of the stream: records, lost from sequence gaps,
+ bad frames, bytes.
+
+ Commands: consumers write cdc_command.h frames to the socket. The daemon
+ passes whole frames with a good check byte to the board, one client's
+ after another's, never interleaved, and drops the rest. A response
+ goes to the ring like any record, and to the socket of the client that
+ sent the oldest pending command of that id, as a length byte and the
+ record. CDC_CMD_RADIO_SEND is only answered on failure: its responses go
+ to the ring only. If the port goes away the daemon opens it again every
+ second.
+
+ -c runs a consumer that prints one line per record, and the records it
+ dropped; -p sends a CDC_CMD_PING first and prints the answer.
+
+ -t runs the daemon, a board on a pty and several consumers in this
+ process: fan-out, drops of a slow consumer, commands from two clients
+ and their responses, a bad frame, a consumer leaving, the futex wake.
+ The exit status is the number of failed checks.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "telemetry.h"
+#include "cdc_command.h"
+#include <termios.h>                   // after the HAL structs, it defines CR1
+
+#define GATEWAY_MAGIC    0x43444347U   // "GCDC"
+#define GATEWAY_SOCKET   "/tmp/cdc_gateway.sock"
+#define RING_SLOTS       65536U        // power of two, 8 MB
+#define SLOT_DATA        110U          // a record without its CRC, TELEMETRY_MAX_PAYLOAD makes 71 at most
+#define RECORD_HEADER    7             // type, sequence, time
+#define READ_RING        65536U        // bytes of the port, power of two
+#define FRAME_MAX        (SLOT_DATA + 2U)
+#define PENDING_US       2000000U      // a command not answered by then is forgotten
+#define SLOT_WRITING     UINT64_MAX
+
+static int failed;
+static volatile sig_atomic_t stop;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000U;
+}
+
+static uint16_t crc16(const uint8_t* p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc ^= (uint16_t)(*p++ << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/****************************************************************************/
+
+/* The shared ring: one page of header, then the slots */
+struct RingHeader {
+    uint32_t magic;
+    uint32_t slots;
+    std::atomic<uint64_t> head;        // records published, the next index
+    std::atomic<uint32_t> wake;        // futex, bumped after each batch
+    std::atomic<uint64_t> records;
+    std::atomic<uint64_t> lost;        // sequence gaps
+    std::atomic<uint64_t> bad;         // frames that are not a record
+    std::atomic<uint64_t> bytes;       // read from the port
+};
+
+struct Slot {
+    std::atomic<uint64_t> index;       // record in the slot, SLOT_WRITING meanwhile
+    uint64_t arrival_us;               // CLOCK_MONOTONIC of the read() that completed it
+    uint16_t len;
+    uint8_t  data[SLOT_DATA];          // type, sequence, time, payload
+};
+
+#define RING_HEADER_SIZE 4096U
+
+static size_t ring_bytes(uint32_t slots)
+{
+    return RING_HEADER_SIZE + (size_t)slots * sizeof(Slot);
+}
+
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+/* Passes fd with one byte of data over a UNIX socket */
+static bool send_fd(int sock, int fd)
+{
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static int receive_fd(int sock)
+{
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, 0) != 1) {
+        return -1;
+    }
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    if (c != NULL && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    }
+    return fd;
+}
+
+/* Raw, 8 bits, no echo, non-blocking */
+static int open_port(const char* path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    struct termios tio;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIOFLUSH);
+    }
+    return fd;
+}
+
+/****************************************************************************/
+
+class Gateway
+{
+public:
+    Gateway(uint32_t slots) : slots_(slots), ring_fd_(-1), ring_(NULL), listen_(-1), port_(-1), opened_at_(0),
+                              head_(0), tail_(0), scan_(0), skipping_(false), first_(true), expected_(0),
+                              read_(READ_RING)
+    {
+    }
+
+    ~Gateway()
+    {
+        for (size_t i = 0; i < clients_.size(); i++) {
+            close(clients_[i].fd);
+        }
+        if (listen_ >= 0) {
+            close(listen_);
+            unlink(socket_path_.c_str());
+        }
+        if (port_ >= 0) {
+            close(port_);
+        }
+        if (ring_ != NULL) {
+            munmap(ring_, ring_bytes(slots_));
+            close(ring_fd_);
+        }
+    }
+
+    bool start(const char* port, const char* socket_path)
+    {
+        struct sockaddr_un addr;
+
+        ring_fd_ = memfd_create("cdc_gateway", MFD_CLOEXEC);
+        if (ring_fd_ < 0 || ftruncate(ring_fd_, (off_t)ring_bytes(slots_)) != 0) {
+            perror("memfd");
+            return false;
+        }
+        ring_ = (uint8_t*)mmap(NULL, ring_bytes(slots_), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd_, 0);
+        if (ring_ == MAP_FAILED) {
+            ring_ = NULL;
+            perror("mmap");
+            return false;
+        }
+        RingHeader* h = new (ring_) RingHeader();
+        h->magic = GATEWAY_MAGIC;
+        h->slots = slots_;
+        for (uint32_t i = 0; i < slots_; i++) {
+            new (slot(i)) Slot();
+            slot(i)->index.store(SLOT_WRITING, std::memory_order_relaxed);
+        }
+
+        listen_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        unlink(socket_path);
+        if (listen_ < 0 || bind(listen_, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_, 16) != 0) {
+            perror(socket_path);
+            return false;
+        }
+        socket_path_ = socket_path;
+        port_path_ = port;
+        port_ = open_port(port);
+        if (port_ < 0) {
+            fprintf(stderr, "%s: %s, trying again every second\n", port, strerror(errno));
+        }
+        opened_at_ = now_us();
+        return true;
+    }
+
+    /* One round of the event loop, waiting timeout_ms at most */
+    void step(int timeout_ms)
+    {
+        std::vector<struct pollfd> fds;
+        struct pollfd p;
+
+        p.fd = listen_;
+        p.events = POLLIN;
+        fds.push_back(p);
+        p.fd = port_;
+        p.events = (short)(POLLIN | (out_.empty() ? 0 : POLLOUT));
+        fds.push_back(p);
+        for (size_t i = 0; i < clients_.size(); i++) {
+            p.fd = clients_[i].fd;
+            p.events = POLLIN;
+            fds.push_back(p);
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            fds[i].revents = 0;
+        }
+        if (poll(&fds[0], fds.size(), timeout_ms) < 0) {
+            return;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            accept_client();
+        }
+        if (port_ >= 0 && (fds[1].revents & POLLOUT)) {
+            write_port();
+        }
+        if (port_ >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            read_port();
+        }
+        for (size_t i = fds.size() - 1; i >= 2; i--) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_client(i - 2);
+            }
+        }
+        if (port_ < 0 && now_us() - opened_at_ >= 1000000U) {
+            opened_at_ = now_us();
+            port_ = open_port(port_path_.c_str());
+        }
+    }
+
+    const RingHeader* header(void) const { return (const RingHeader*)ring_; }
+    size_t clients(void) const { return clients_.size(); }
+
+private:
+    struct Client {
+        int fd;
+        std::string in;                // command bytes not forming a frame yet
+    };
+
+    struct Pending {
+        int fd;
+        uint64_t until;
+    };
+
+    Slot* slot(uint64_t index)
+    {
+        return (Slot*)(ring_ + RING_HEADER_SIZE) + (index & (slots_ - 1));
+    }
+
+    void accept_client(void)
+    {
+        int fd = accept4(listen_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        Client c;
+
+        if (fd < 0) {
+            return;
+        }
+        if (!send_fd(fd, ring_fd_)) {
+            close(fd);
+            return;
+        }
+        c.fd = fd;
+        clients_.push_back(c);
+    }
+
+    void drop_client(size_t i)
+    {
+        int fd = clients_[i].fd;
+
+        for (std::map<uint8_t, std::deque<Pending> >::iterator it = pending_.begin(); it != pending_.end(); ++it) {
+            for (size_t j = 0; j < it->second.size(); j++) {
+                it->second[j].fd = it->second[j].fd == fd ? -1 : it->second[j].fd;
+            }
+        }
+        close(fd);
+        clients_.erase(clients_.begin() + (long)i);
+    }
+
+    /* Whole frames with a good check go to the board, the rest is skipped
+     * like the board would */
+    void read_client(size_t i)
+    {
+        Client& c = clients_[i];
+        char buf[512];
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            drop_client(i);
+            return;
+        }
+        if (n < 0) {
+            return;
+        }
+        c.in.append(buf, (size_t)n);
+
+        size_t pos = 0;
+        while (pos < c.in.size()) {
+            if ((uint8_t)c.in[pos] != CDC_CMD_SYNC) {
+                pos++;
+                continue;
+            }
+            if (c.in.size() - pos < 3) {
+                break;
+            }
+            unsigned len = (uint8_t)c.in[pos + 2];
+            if (len > CDC_CMD_MAX_PAYLOAD) {
+                pos++;
+                continue;
+            }
+            if (c.in.size() - pos < 4 + len) {
+                break;
+            }
+            uint8_t x = 0;
+            for (unsigned k = 1; k < 4 + len; k++) {
+                x ^= (uint8_t)c.in[pos + k];
+            }
+            if (x != 0) {
+                pos++;
+                continue;
+            }
+            uint8_t id = (uint8_t)c.in[pos + 1];
+            out_.append(c.in, pos, 4 + len);
+            if (id != CDC_CMD_RADIO_SEND) {
+                Pending p = { c.fd, now_us() + PENDING_US };
+                pending_[id].push_back(p);
+            }
+            pos += 4 + len;
+        }
+        c.in.erase(0, pos);
+        if (port_ >= 0) {
+            write_port();
+        }
+    }
+
+    void write_port(void)
+    {
+        ssize_t n = out_.empty() ? 0 : write(port_, out_.data(), out_.size());
+
+        if (n > 0) {
+            out_.erase(0, (size_t)n);
+        }
+    }
+
+    void read_port(void)
+    {
+        size_t at = (size_t)(head_ & (READ_RING - 1));
+        size_t room = READ_RING - (size_t)(head_ - tail_);
+        ssize_t n = read(port_, &read_[at], std::min(room, (size_t)READ_RING - at));
+        RingHeader* h = (RingHeader*)ring_;
+
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (n <= 0) {
+            // Unplugged: what was in the read ring is lost with the frame it started
+            close(port_);
+            port_ = -1;
+            opened_at_ = now_us();
+            tail_ = scan_ = head_;
+            return;
+        }
+        head_ += (uint64_t)n;
+        h->bytes.fetch_add((uint64_t)n, std::memory_order_relaxed);
+
+        uint64_t arrival = now_us();
+        uint64_t published = h->head.load(std::memory_order_relaxed);
+        while (scan_ != head_) {
+            size_t s = (size_t)(scan_ & (READ_RING - 1));
+            size_t run = (size_t)std::min<uint64_t>(head_ - scan_, READ_RING - s);
+            const uint8_t* zero = (const uint8_t*)memchr(&read_[s], 0, run);
+
+            if (zero == NULL) {
+                scan_ += run;
+                continue;
+            }
+            scan_ += (uint64_t)(zero - &read_[s]) + 1;
+            if (!skipping_) {
+                publish(tail_, (size_t)(scan_ - 1 - tail_), arrival);
+            }
+            skipping_ = false;
+            tail_ = scan_;
+        }
+        if (scan_ - tail_ > FRAME_MAX) {
+            if (!skipping_) {
+                h->bad.fetch_add(1, std::memory_order_relaxed);
+            }
+            skipping_ = true;
+            tail_ = scan_;
+        }
+        if (h->head.load(std::memory_order_relaxed) != published) {
+            h->wake.fetch_add(1, std::memory_order_release);
+            futex(&h->wake, FUTEX_WAKE, INT32_MAX, NULL);
+        }
+    }
+
+    /* COBS decodes the frame at start straight into the next slot: the one
+     * copy. Published if the CRC holds */
+    void publish(uint64_t start, size_t len, uint64_t arrival)
+    {
+        RingHeader* h = (RingHeader*)ring_;
+        uint64_t index = h->head.load(std::memory_order_relaxed);
+        Slot* s = slot(index);
+        size_t in = 0, out = 0;
+        bool ok = len <= FRAME_MAX;
+
+        s->index.store(SLOT_WRITING, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        while (ok && in < len) {
+            unsigned code = read_[(start + in++) & (READ_RING - 1)];
+            ok = code != 0 && in + code - 1 <= len && out + code - 1 <= SLOT_DATA;
+            for (unsigned j = 1; ok && j < code; j++) {
+                s->data[out++] = read_[(start + in++) & (READ_RING - 1)];
+            }
+            if (ok && code < 0xFF && in < len) {
+                ok = out < SLOT_DATA;
+                if (ok) {
+                    s->data[out++] = 0;
+                }
+            }
+        }
+        if (!ok || out < RECORD_HEADER + 2U || out > SLOT_DATA ||
+            crc16(s->data, out - 2) != (uint16_t)(s->data[out - 2] | (s->data[out - 1] << 8))) {
+            h->bad.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        uint16_t seq = (uint16_t)(s->data[1] | (s->data[2] << 8));
+        if (!first_) {
+            h->lost.fetch_add((uint16_t)(seq - expected_), std::memory_order_relaxed);
+        }
+        first_ = false;
+        expected_ = (uint16_t)(seq + 1);
+        s->len = (uint16_t)(out - 2);
+        s->arrival_us = arrival;
+        s->index.store(index, std::memory_order_release);
+        h->head.store(index + 1, std::memory_order_release);
+        h->records.fetch_add(1, std::memory_order_relaxed);
+
+        if (s->data[0] == TELEMETRY_RESPONSE && s->len > RECORD_HEADER) {
+            respond(s->data[RECORD_HEADER], s->data, s->len);
+        }
+    }
+
+    /* To the client of the oldest command of that id still waiting */
+    void respond(uint8_t id, const uint8_t* record, uint16_t len)
+    {
+        std::deque<Pending>& q = pending_[id];
+        uint64_t now = now_us();
+        uint8_t msg[1 + SLOT_DATA];
+
+        while (!q.empty() && q.front().until < now) {
+            q.pop_front();
+        }
+        if (q.empty()) {
+            return;
+        }
+        // The command of a client gone still takes its response
+        if (q.front().fd >= 0) {
+            msg[0] = (uint8_t)len;
+            memcpy(msg + 1, record, len);
+            send(q.front().fd, msg, 1U + len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        q.pop_front();
+    }
+
+    uint32_t slots_;
+    int ring_fd_;
+    uint8_t* ring_;
+    int listen_;
+    int port_;
+    std::string socket_path_, port_path_;
+    uint64_t opened_at_;
+
+    // Bytes of the port: read() fills from head_, the frame being received
+    // starts at tail_, 0x00 was looked for up to scan_
+    uint64_t head_, tail_, scan_;
+    bool skipping_;
+    bool first_;
+    uint16_t expected_;
+    std::vector<uint8_t> read_;
+
+    std::vector<Client> clients_;
+    std::string out_;                  // command frames for the board
+    std::map<uint8_t, std::deque<Pending> > pending_;
+};
+
+/****************************************************************************/
+
+/* A consumer: the ring mapped read only and a cursor of its own */
+class GatewayClient
+{
+public:
+    GatewayClient() : sock_(-1), ring_fd_(-1), ring_(NULL), slots_(0), cursor_(0), current_(0), dropped_(0) {}
+
+    ~GatewayClient()
+    {
+        disconnect();
+    }
+
+    bool connect(const char* socket_path)
+    {
+        struct sockaddr_un addr;
+        struct stat st;
+
+        sock_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        if (sock_ < 0 || ::connect(sock_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            (ring_fd_ = receive_fd(sock_)) < 0 || fstat(ring_fd_, &st) != 0) {
+            disconnect();
+            return false;
+        }
+        ring_ = (const uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, ring_fd_, 0);
+        if (ring_ == MAP_FAILED || header()->magic != GATEWAY_MAGIC ||
+            ring_bytes(header()->slots) != (size_t)st.st_size) {
+            ring_ = ring_ == MAP_FAILED ? NULL : ring_;
+            disconnect();
+            return false;
+        }
+        slots_ = header()->slots;
+        cursor_ = header()->head.load(std::memory_order_acquire);
+        return true;
+    }
+
+    void disconnect(void)
+    {
+        if (ring_ != NULL) {
+            munmap((void*)ring_, ring_bytes(slots_));
+            ring_ = NULL;
+        }
+        if (ring_fd_ >= 0) {
+            close(ring_fd_);
+            ring_fd_ = -1;
+        }
+        if (sock_ >= 0) {
+            close(sock_);
+            sock_ = -1;
+        }
+    }
+
+    /* The next record, in place in the ring, waiting timeout_ms at most for
+     * one: NULL if none came. Check valid() once done with it */
+    const Slot* next(int timeout_ms)
+    {
+        const RingHeader* h = header();
+        uint64_t until = now_us() + (uint64_t)timeout_ms * 1000U;
+
+        for (;;) {
+            uint32_t wake = h->wake.load(std::memory_order_acquire);
+            uint64_t head = h->head.load(std::memory_order_acquire);
+
+            if (cursor_ == head) {
+                uint64_t now = now_us();
+                if (now >= until) {
+                    return NULL;
+                }
+                struct timespec ts = { (time_t)((until - now) / 1000000U), (long)((until - now) % 1000000U * 1000U) };
+                futex((std::atomic<uint32_t>*)&h->wake, FUTEX_WAIT, wake, &ts);
+                continue;
+            }
+            if (head - cursor_ > slots_) {
+                // Lapped: the daemon does not wait for anyone
+                dropped_ += head - slots_ - cursor_;
+                cursor_ = head - slots_;
+            }
+            const Slot* s = slot(cursor_);
+            if (s->index.load(std::memory_order_acquire) != cursor_) {
+                dropped_++;                // rewritten since head was read
+                cursor_++;
+                continue;
+            }
+            current_ = cursor_++;
+            return s;
+        }
+    }
+
+    /* The record of the last next() was not rewritten while it was read */
+    bool valid(void) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot(current_)->index.load(std::memory_order_relaxed) == current_;
+    }
+
+    /* Records lost so far: lapped, or rewritten while read and counted by
+     * the caller through valid() */
+    uint64_t dropped(void) const { return dropped_; }
+
+    void countDropped(void) { dropped_++; }
+
+    bool command(uint8_t id, const void* payload, uint8_t len)
+    {
+        uint8_t frame[4 + CDC_CMD_MAX_PAYLOAD];
+        uint8_t x = (uint8_t)(id ^ len);
+
+        if (len > CDC_CMD_MAX_PAYLOAD) {
+            return false;
+        }
+        frame[0] = CDC_CMD_SYNC;
+        frame[1] = id;
+        frame[2] = len;
+        memcpy(frame + 3, payload, len);
+        for (unsigned i = 0; i < len; i++) {
+            x ^= frame[3 + i];
+        }
+        frame[3 + len] = x;
+        return write(sock_, frame, 4U + len) == 4 + len;
+    }
+
+    /* A response to one of this client's commands: the record, type to
+     * payload, in buf. Its length, 0 after timeout_ms */
+    unsigned response(uint8_t* buf, int timeout_ms)
+    {
+        struct pollfd p = { sock_, POLLIN, 0 };
+        uint8_t len;
+
+        if (poll(&p, 1, timeout_ms) <= 0 || read(sock_, &len, 1) != 1) {
+            return 0;
+        }
+        for (unsigned got = 0; got < len;) {
+            ssize_t n = read(sock_, buf + got, len - got);
+            if (n <= 0) {
+                return 0;
+            }
+            got += (unsigned)n;
+        }
+        return len;
+    }
+
+    const RingHeader* header(void) const { return (const RingHeader*)ring_; }
+    int socket(void) const { return sock_; }
+
+private:
+    const Slot* slot(uint64_t index) const
+    {
+        return (const Slot*)(ring_ + RING_HEADER_SIZE) + (index & (slots_ - 1));
+    }
+
+    int sock_;
+    int ring_fd_;
+    const uint8_t* ring_;
+    uint32_t slots_;
+    uint64_t cursor_;                  // next record to read
+    uint64_t current_;                 // returned by the last next()
+    uint64_t dropped_;
+};
+
+/****************************************************************************/
+
+/* The board side of the self test: telemetry.c writing to the pty master,
+ * command frames read back from it */
+static int test_master;
+
+static uint8_t test_write(uint8_t* buf, uint16_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(test_master, buf, len);
+        if (n <= 0) {
+            return 1;
+        }
+        buf += n;
+        len = (uint16_t)(len - n);
+    }
+    return 0;
+}
+
+static uint32_t test_micros(void)
+{
+    return (uint32_t)now_us();
+}
+
+/* Radio records with their number in the payload */
+static void test_records(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++) {
+        telemetry_radio((uint8_t)(i % 6), &i, sizeof(i));
+    }
+}
+
+/* Command frames the board got, waiting timeout_ms at most for "count" of
+ * them. Every byte read is in "bytes" */
+static std::vector<std::string> test_commands(size_t count, int timeout_ms, size_t* bytes)
+{
+    std::vector<std::string> frames;
+    std::string in;
+    uint64_t until = now_us() + (uint64_t)timeout_ms * 1000U;
+
+    while (frames.size() < count && now_us() < until) {
+        struct pollfd p = { test_master, POLLIN, 0 };
+        char buf[256];
+        if (poll(&p, 1, 10) <= 0) {
+            continue;
+        }
+        ssize_t n = read(test_master, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        *bytes += (size_t)n;
+        in.append(buf, (size_t)n);
+        while (in.size() >= 4 && in.size() >= 4U + (uint8_t)in[2]) {
+            frames.push_back(in.substr(0, 4U + (uint8_t)in[2]));
+            in.erase(0, 4U + (uint8_t)in[2]);
+        }
+    }
+    return frames;
+}
+
+/* Answers a frame as the board would, echoing the request payload */
+static void test_answer(const std::string& frame)
+{
+    uint8_t head[2] = { (uint8_t)frame[1], CDC_CMD_OK };
+
+    telemetry_send(TELEMETRY_RESPONSE, head, 2, frame.data() + 3, (uint16_t)(frame.size() - 4));
+}
+
+/* Waits for the daemon to publish up to "head" */
+static bool test_published(const GatewayClient& c, uint64_t head)
+{
+    for (int i = 0; i < 500 && c.header()->head.load(std::memory_order_acquire) < head; i++) {
+        usleep(2000);
+    }
+    return c.header()->head.load(std::memory_order_acquire) == head;
+}
+
+/* Reads up to count records: how many were radio records numbered from
+ * "first" on, in order */
+static uint32_t test_read(GatewayClient* c, uint32_t first, uint32_t count)
+{
+    uint32_t good = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const Slot* s = c->next(1000);
+        uint32_t n;
+        if (s == NULL) {
+            break;
+        }
+        memcpy(&n, s->data + RECORD_HEADER + 1, sizeof(n));
+        good += c->valid() && s->data[0] == TELEMETRY_RADIO && n == first + i ? 1 : 0;
+    }
+    return good;
+}
+
+/* Sends a frame in pieces, with a pause between them */
+static void test_send_split(GatewayClient* c, const uint8_t* frame, size_t len, size_t at)
+{
+    write(c->socket(), frame, at);
+    usleep(20000);
+    write(c->socket(), frame + at, len - at);
+}
+
+#define TEST_SLOTS     1024
+#define TEST_FANOUT    500             // records every consumer reads
+#define TEST_LAP       3000            // records more, the slow consumer reads none
+
+static void self_test(void)
+{
+    static const telemetry_config_t config = { test_write, test_micros };
+    char path[64], what[128];
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    printf("-- daemon on a pty --\n");
+    if (master < 0 || grantpt(master) || unlockpt(master)) {
+        check(false, "pty");
+        return;
+    }
+    test_master = master;
+    telemetry_init(&config);
+    snprintf(path, sizeof(path), "/tmp/cdc_gateway_test.%d.sock", (int)getpid());
+
+    Gateway g(TEST_SLOTS);
+    if (!g.start(ptsname(master), path)) {
+        check(false, "daemon");
+        return;
+    }
+    std::atomic<bool> done(false);
+    std::thread daemon([&] {
+        while (!done) {
+            g.step(10);
+        }
+    });
+
+    GatewayClient a, b, slow;
+    check(a.connect(path) && b.connect(path) && slow.connect(path), "three consumers map the ring");
+
+    test_records(0, TEST_FANOUT);
+    check(test_published(a, TEST_FANOUT), "every record published");
+    snprintf(what, sizeof(what), "two consumers read all %u records, in order, in place", TEST_FANOUT);
+    check(test_read(&a, 0, TEST_FANOUT) == TEST_FANOUT && test_read(&b, 0, TEST_FANOUT) == TEST_FANOUT &&
+          a.dropped() == 0 && b.dropped() == 0, what);
+
+    // a reads along in a thread of its own, the slow one reads nothing
+    uint32_t along = 0;
+    std::thread reader([&] {
+        along = test_read(&a, TEST_FANOUT, TEST_LAP);
+    });
+    for (uint32_t i = 0; i < TEST_LAP; i += 100) {
+        test_records(TEST_FANOUT + i, 100);
+        usleep(1000);
+    }
+    reader.join();
+    check(along == TEST_LAP && a.dropped() == 0, "a consumer reading along loses nothing");
+    check(test_published(a, TEST_FANOUT + TEST_LAP), "the daemon does not wait for the slow consumer");
+    uint32_t got = test_read(&slow, TEST_FANOUT + TEST_LAP - TEST_SLOTS, TEST_SLOTS);
+    snprintf(what, sizeof(what), "the slow consumer is told it lost %llu records, reads the last %u",
+             (unsigned long long)slow.dropped(), got);
+    check(slow.dropped() == TEST_FANOUT + TEST_LAP - TEST_SLOTS && got == TEST_SLOTS && slow.next(0) == NULL, what);
+
+    // A consumer asleep on the futex
+    std::atomic<uint64_t> woken(0);
+    while (b.next(0) != NULL) {
+    }
+    std::thread sleeper([&] {
+        if (b.next(2000) != NULL) {
+            woken = now_us();
+        }
+    });
+    usleep(50000);
+    uint64_t sent = now_us();
+    test_records(TEST_FANOUT + TEST_LAP, 1);
+    sleeper.join();
+    snprintf(what, sizeof(what), "a sleeping consumer wakes %.1f ms after the record",
+             woken ? (woken - sent) / 1e3 : -1.0);
+    check(woken != 0 && woken - sent < 100000, what);
+
+    // Commands: a's frame cut in two around b's, a bad one, one from a client gone
+    uint8_t ping_a[] = { CDC_CMD_SYNC, CDC_CMD_PING, 1, 'a', CDC_CMD_PING ^ 1 ^ 'a' };
+    uint8_t bad[] = { CDC_CMD_SYNC, CDC_CMD_STATS, 0, 0x00 };
+    GatewayClient gone;
+    check(gone.connect(path) && gone.command(CDC_CMD_PING, "g", 1), "a consumer sends a command");
+    usleep(20000);
+    gone.disconnect();
+    write(a.socket(), ping_a, 2);
+    usleep(20000);
+    b.command(CDC_CMD_PING, "b", 1);
+    usleep(20000);
+    write(a.socket(), ping_a + 2, sizeof(ping_a) - 2);
+    test_send_split(&b, bad, sizeof(bad), 1);
+    a.command(CDC_CMD_STATS, NULL, 0);
+
+    size_t bytes = 0;
+    std::vector<std::string> frames = test_commands(4, 2000, &bytes);
+    test_commands(1, 100, &bytes);     // anything after them
+    std::string expect[4] = { "g", "b", "a", "" };
+    bool intact = frames.size() == 4;
+    for (size_t i = 0; intact && i < 4; i++) {
+        intact = frames[i].substr(3, frames[i].size() - 4) == expect[i] && frames[i][1] == (i < 3 ? CDC_CMD_PING : CDC_CMD_STATS);
+    }
+    check(intact, "commands reach the board whole, one after another");
+    check(bytes == 5 + 5 + 5 + 4, "the bad frame is not passed on");
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        test_answer(frames[i]);
+    }
+    uint8_t r1[SLOT_DATA], r2[SLOT_DATA], r3[SLOT_DATA];
+    unsigned n1 = a.response(r1, 1000), n2 = a.response(r2, 1000), n3 = b.response(r3, 1000);
+    check(n1 == RECORD_HEADER + 3 && r1[0] == TELEMETRY_RESPONSE && r1[RECORD_HEADER] == CDC_CMD_PING &&
+          r1[RECORD_HEADER + 2] == 'a' && n2 == RECORD_HEADER + 2 && r2[RECORD_HEADER] == CDC_CMD_STATS,
+          "a gets its two responses");
+    check(n3 == RECORD_HEADER + 3 && r3[RECORD_HEADER + 2] == 'b' && b.response(r3, 50) == 0,
+          "b gets its own, not the one of the client gone");
+
+    uint32_t responses = 0;
+    for (const Slot* s = a.next(1000); s != NULL; s = a.next(100)) {
+        responses += s->data[0] == TELEMETRY_RESPONSE ? 1 : 0;
+    }
+    check(responses == 4, "responses are in the ring for everyone");
+
+    const RingHeader* h = a.header();
+    snprintf(what, sizeof(what), "%llu records, %llu lost, %llu bad, %llu bytes", (unsigned long long)h->records.load(),
+             (unsigned long long)h->lost.load(), (unsigned long long)h->bad.load(),
+             (unsigned long long)h->bytes.load());
+    check(h->records == TEST_FANOUT + TEST_LAP + 1 + 4 && h->lost == 0 && h->bad == 0, what);
+
+    done = true;
+    daemon.join();
+    close(master);
+}
+
+/****************************************************************************/
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* -c: one line per record, arrival in seconds, sequence, device time, type
+ * and payload in hex, and a comment line for every run of records lost */
+static int consume(const char* path, bool ping)
+{
+    GatewayClient c;
+    uint8_t r[SLOT_DATA];
+    char line[32 + 3 * SLOT_DATA];
+    uint64_t reported = 0;
+
+    if (!c.connect(path)) {
+        fprintf(stderr, "%s: no gateway\n", path);
+        return 2;
+    }
+    if (ping) {
+        unsigned n = c.command(CDC_CMD_PING, NULL, 0) ? c.response(r, 1000) : 0;
+        if (n < RECORD_HEADER + 2U) {
+            fprintf(stderr, "no answer to CDC_CMD_PING\n");
+            return 1;
+        }
+        printf("# ping status %u", r[RECORD_HEADER + 1]);
+        for (unsigned i = RECORD_HEADER + 2U; i < n; i++) {
+            printf(" %02x", r[i]);
+        }
+        printf("\n");
+    }
+
+    while (!stop) {
+        const Slot* s = c.next(200);
+        if (s == NULL) {
+            struct pollfd p = { c.socket(), POLLIN, 0 };
+            if (poll(&p, 1, 0) > 0 && c.response(r, 0) == 0) {
+                break;                     // the daemon is gone
+            }
+            continue;
+        }
+        int at = snprintf(line, sizeof(line), "%.6f %u %u %u", s->arrival_us / 1e6,
+                          (unsigned)(s->data[1] | (s->data[2] << 8)),
+                          (unsigned)(s->data[3] | (s->data[4] << 8) | (s->data[5] << 16) | ((uint32_t)s->data[6] << 24)),
+                          s->data[0]);
+        for (unsigned i = RECORD_HEADER; i < s->len && i < SLOT_DATA; i++) {
+            at += snprintf(line + at, sizeof(line) - (size_t)at, i == RECORD_HEADER ? " %02x" : "%02x", s->data[i]);
+        }
+        if (!c.valid()) {
+            c.countDropped();
+            continue;
+        }
+        if (c.dropped() != reported) {
+            printf("# dropped %llu\n", (unsigned long long)(c.dropped() - reported));
+            reported = c.dropped();
+        }
+        puts(line);
+    }
+
+    const RingHeader* h = c.header();
+    fprintf(stderr, "%llu dropped here; stream: %llu records, %llu lost, %llu bad, %llu bytes\n",
+            (unsigned long long)c.dropped(), (unsigned long long)h->records.load(),
+            (unsigned long long)h->lost.load(), (unsigned long long)h->bad.load(),
+            (unsigned long long)h->bytes.load());
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* socket_path = GATEWAY_SOCKET;
+    const char* port = NULL;
+    uint32_t slots = RING_SLOTS;
+    bool client = false, ping = false;
+
+    if (argc == 2 && !strcmp(argv[1], "-t")) {
+        self_test();
+        printf("-- %d failed --\n", failed);
+        return failed;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            slots = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (!strcmp(argv[i], "-c")) {
+            client = true;
+        } else if (!strcmp(argv[i], "-p")) {
+            ping = true;
+        } else if (argv[i][0] != '-' && port == NULL) {
+            port = argv[i];
+        } else {
+            slots = 0;
+            break;
+        }
+    }
+    if (slots < 2 || (slots & (slots - 1)) != 0 || client == (port != NULL) || (ping && !client)) {
+        fprintf(stderr, "usage: %s [-r slots] [-s socket] /dev/ttyACMn\n"
+                        "       %s -c [-s socket] [-p]\n"
+                        "       %s -t\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    if (client) {
+        return consume(socket_path, ping);
+    }
+
+    Gateway g(slots);
+    if (!g.start(port, socket_path)) {
+        return 2;
+    }
+    while (!stop) {
+        g.step(200);
+    }
+    const RingHeader* h = g.header();
+    fprintf(stderr, "%llu records, %llu lost, %llu bad, %llu bytes\n", (unsigned long long)h->records.load(),
+            (unsigned long long)h->lost.load(), (unsigned long long)h->bad.load(),
+            (unsigned long long)h->bytes.load());
+    return 0;
+}
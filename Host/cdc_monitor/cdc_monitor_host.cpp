@@ -0,0 +1,838 @@
+/*
+ Companion of the CDC port on Linux: reads the telemetry stream of
+ telemetry.h from the board, prints every record as a CSV or JSON line and
+ reports, every interval, the throughput, the records lost from sequence
+ gaps, the bad frames and a histogram of the arrival latency.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc \
+       Host/cdc_monitor/cdc_monitor_host.cpp \
+       -x c++ MDK-ARM/Src/telemetry.c -x none \
+       -o cdc_monitor
+   ./cdc_monitor [-f csv|json|none] [-i s] [-n s] /dev/ttyACM0
+   ./cdc_monitor -t
+
+ The port is set raw, opening it asserts DTR and the board starts sending.
+ read() lands straight in a 64 KB ring and frames are decoded where they
+ are, only one cut by the end of the ring is copied. Records go to stdout,
+ reports to stderr; -f none leaves only the reports, for benchmarks. -i is
+ the report interval, 1 s by default, -n stops after that many seconds.
+
+ CSV columns are arrival (s, host monotonic clock), sequence, time (s,
+ device clock), type, then by type:
+
+   radio     pipe, payload in hex
+   sample    source, time (ms), SAMPLE_RING_VALUES values
+   summary   source, start, end (ms), count, min, max, mean, last of each value
+   stats     source, counters
+   text      the line, quoted
+   response  command id, status, payload in hex
+   log       payload in hex, tlog_decode formats it
+
+ Missing values (SAMPLE_RING_NONE) are empty, null in JSON.
+
+ Latency is the arrival time of the read() that completed a record minus
+ its device time. The two clocks have no common origin and drift apart by
+ the tolerance of the crystals, so each interval is measured from its
+ fastest record: the histogram shows how much later than the best case
+ records arrive, the queueing in the TX ring, the USB frames and the host.
+
+ -t runs the monitor on a pty: a child process makes records with
+ telemetry.c, drops some, delays some and ends with a burst as fast as the
+ pty takes it. It checks the counts, the loss, the bad frame, the latency
+ of the delayed records and the formatting. The exit status is the number
+ of failed checks.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "telemetry.h"
+#include <termios.h>                   // after the HAL structs, it defines CR1
+
+#define RING_SIZE        65536U        // power of two
+#define RECORD_HEADER    7             // type, sequence, time
+#define FRAME_MAX        255U          // longer is not a record, TELEMETRY_MAX_PAYLOAD makes 75 at most
+#define LATENCY_BUCKETS  10            // under 125 us, then doubling, the last 32 ms and over
+
+enum Format { FORMAT_NONE, FORMAT_CSV, FORMAT_JSON };
+
+static int failed;
+static volatile sig_atomic_t stop;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000U;
+}
+
+/****************************************************************************/
+
+static uint16_t crc16(const uint8_t* p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc ^= (uint16_t)(*p++ << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* In place, the output never overtakes the input. Returns the record
+ * length, or -1 when a code runs past the frame */
+static int cobs_decode(uint8_t* p, size_t len)
+{
+    size_t in = 0, out = 0;
+
+    while (in < len) {
+        unsigned code = p[in++];
+        if (code == 0 || in + code - 1 > len) {
+            return -1;
+        }
+        for (unsigned j = 1; j < code; j++) {
+            p[out++] = p[in++];
+        }
+        if (code < 0xFF && in < len) {
+            p[out++] = 0;
+        }
+    }
+    return (int)out;
+}
+
+static uint16_t u16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/****************************************************************************/
+
+/* One output line, the fields of a record in CSV or JSON */
+class Line
+{
+public:
+    Line(Format format) : format_(format), count_(0), inner_(0), list_(false) {}
+
+    void number(const char* name, long long value)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%lld", value);
+        field(name, text);
+    }
+
+    void seconds(const char* name, double value)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.6f", value);
+        field(name, text);
+    }
+
+    /* A value that may be SAMPLE_RING_NONE */
+    void value(const char* name, int16_t v)
+    {
+        if (v == SAMPLE_RING_NONE) {
+            field(name, format_ == FORMAT_JSON ? "null" : "");
+        } else {
+            number(name, v);
+        }
+    }
+
+    /* A name that never needs quotes in CSV */
+    void word(const char* name, const char* value)
+    {
+        field(name, format_ == FORMAT_JSON ? (std::string("\"") + value + "\"").c_str() : value);
+    }
+
+    void hex(const char* name, const uint8_t* p, unsigned len)
+    {
+        std::string text;
+        for (unsigned i = 0; i < len; i++) {
+            char byte[3];
+            snprintf(byte, sizeof(byte), "%02x", p[i]);
+            text += byte;
+        }
+        word(name, text.c_str());
+    }
+
+    void string(const char* name, const char* p, unsigned len)
+    {
+        std::string text("\"");
+        for (unsigned i = 0; i < len; i++) {
+            unsigned char c = (unsigned char)p[i];
+            if (format_ == FORMAT_CSV) {
+                text += c == '"' ? std::string("\"\"") : std::string(1, (char)c);
+            } else if (c == '"' || c == '\\') {
+                text += '\\';
+                text += (char)c;
+            } else if (c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                text += esc;
+            } else {
+                text += (char)c;
+            }
+        }
+        field(name, (text + "\"").c_str());
+    }
+
+    /* The values up to close() are one array in JSON, columns in CSV */
+    void open(const char* name)
+    {
+        if (format_ == FORMAT_JSON) {
+            text_ += count_++ ? ", \"" : "{\"";
+            text_ += name;
+            text_ += "\": [";
+        }
+        inner_ = 0;
+        list_ = true;
+    }
+
+    void close(void)
+    {
+        if (format_ == FORMAT_JSON) {
+            text_ += "]";
+        }
+        list_ = false;
+    }
+
+    std::string end(void)
+    {
+        return text_ + (format_ == FORMAT_JSON ? "}\n" : "\n");
+    }
+
+private:
+    void field(const char* name, const char* value)
+    {
+        if (format_ == FORMAT_CSV) {
+            text_ += count_++ ? "," : "";
+        } else if (list_) {
+            text_ += inner_++ ? ", " : "";
+        } else {
+            text_ += count_++ ? ", \"" : "{\"";
+            text_ += name;
+            text_ += "\": ";
+        }
+        text_ += value;
+    }
+
+    Format format_;
+    std::string text_;
+    unsigned count_, inner_;
+    bool list_;
+};
+
+/* The line of one checked record, payload of len bytes */
+static std::string format_record(Format format, double arrival, uint16_t seq, uint32_t time, uint8_t type,
+                                 const uint8_t* p, unsigned len)
+{
+    static const char* const names[] = { "0x00", "radio", "sample", "summary", "stats", "text", "response", "log" };
+    Line l(format);
+    char unknown[8];
+
+    snprintf(unknown, sizeof(unknown), "0x%02x", type);
+    l.seconds("arrival", arrival);
+    l.number("seq", seq);
+    l.seconds("time", time / 1e6);
+    l.word("type", type < sizeof(names) / sizeof(names[0]) ? names[type] : unknown);
+
+    if (type == TELEMETRY_RADIO && len >= 1) {
+        l.number("pipe", p[0]);
+        l.hex("payload", p + 1, len - 1);
+    } else if (type == TELEMETRY_SAMPLE && len == 5 + 2 * SAMPLE_RING_VALUES) {
+        l.number("source", p[0]);
+        l.number("ms", u32(p + 1));
+        l.open("values");
+        for (unsigned i = 0; i < SAMPLE_RING_VALUES; i++) {
+            l.value("value", (int16_t)u16(p + 5 + 2 * i));
+        }
+        l.close();
+    } else if (type == TELEMETRY_SUMMARY && len == sizeof(sample_summary_t)) {
+        // sample_summary_t: start, end, count, source, reserved, then min,
+        // max, mean, last of each value
+        static const char* const parts[] = { "min", "max", "mean", "last" };
+        l.number("source", p[10]);
+        l.number("start", u32(p));
+        l.number("end", u32(p + 4));
+        l.number("count", u16(p + 8));
+        for (unsigned k = 0; k < 4; k++) {
+            l.open(parts[k]);
+            for (unsigned i = 0; i < SAMPLE_RING_VALUES; i++) {
+                l.value(parts[k], (int16_t)u16(p + 12 + 8 * i + 2 * k));
+            }
+            l.close();
+        }
+    } else if (type == TELEMETRY_STATS && len >= 1 && (len - 1) % 4 == 0) {
+        l.number("source", p[0]);
+        l.open("counters");
+        for (unsigned i = 1; i < len; i += 4) {
+            l.number("counter", u32(p + i));
+        }
+        l.close();
+    } else if (type == TELEMETRY_TEXT) {
+        while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r')) {
+            len--;
+        }
+        l.string("text", (const char*)p, len);
+    } else if (type == TELEMETRY_RESPONSE && len >= 2) {
+        l.number("command", p[0]);
+        l.number("status", p[1]);
+        l.hex("payload", p + 2, len - 2);
+    } else {
+        l.hex("payload", p, len);
+    }
+    return l.end();
+}
+
+/****************************************************************************/
+
+/* Counts of a run, or of an interval of it */
+struct Counts {
+    uint64_t bytes;                    // read from the port
+    uint64_t records;                  // good ones
+    uint64_t lost;                     // from sequence gaps
+    uint64_t bad;                      // frames that are not a record
+};
+
+class Monitor
+{
+public:
+    Monitor(Format format, FILE* out)
+        : format_(format), out_(out), ring_(RING_SIZE), head_(0), tail_(0), scan_(0), skipping_(false),
+          first_(true), expected_(0), last_time_(0), device_us_(0)
+    {
+        memset(&total_, 0, sizeof(total_));
+        memset(&interval_, 0, sizeof(interval_));
+    }
+
+    /* One read() into the free space of the ring up to its end, then the
+     * frames it completed. False at the end of the stream */
+    bool readFrom(int fd)
+    {
+        size_t at = (size_t)(head_ & (RING_SIZE - 1));
+        size_t room = RING_SIZE - (size_t)(head_ - tail_);
+        ssize_t n = read(fd, &ring_[at], std::min(room, (size_t)RING_SIZE - at));
+
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            return true;
+        }
+        if (n <= 0) {
+            return false;              // EIO once the board or the pty writer is gone
+        }
+        head_ += (uint64_t)n;
+        total_.bytes += (uint64_t)n;
+        interval_.bytes += (uint64_t)n;
+        parse(now_us());
+        return true;
+    }
+
+    /* Throughput, loss and latency since the last report */
+    void report(FILE* f, double seconds)
+    {
+        std::vector<int64_t>& d = delays_;
+        unsigned buckets[LATENCY_BUCKETS] = { 0 };
+
+        fprintf(f, "%7.3f MB/s %8.0f records/s  lost %llu  bad %llu", interval_.bytes / seconds / 1e6,
+                interval_.records / seconds, (unsigned long long)interval_.lost, (unsigned long long)interval_.bad);
+        if (!d.empty()) {
+            std::sort(d.begin(), d.end());
+            int64_t best = d[0];
+            for (size_t i = 0; i < d.size(); i++) {
+                int64_t us = d[i] - best;
+                unsigned b = 0;
+                while (b < LATENCY_BUCKETS - 1 && us >= (125LL << b)) {
+                    b++;
+                }
+                buckets[b]++;
+            }
+            fprintf(f, " | latency p50 %.2f p99 %.2f max %.2f ms\n ", (d[d.size() / 2] - best) / 1e3,
+                    (d[d.size() * 99 / 100] - best) / 1e3, (d.back() - best) / 1e3);
+            for (unsigned b = 0; b < LATENCY_BUCKETS; b++) {
+                if (b < LATENCY_BUCKETS - 1) {
+                    fprintf(f, " <%g ms %u", (125 << b) / 1e3, buckets[b]);
+                } else {
+                    fprintf(f, " more %u", buckets[b]);
+                }
+            }
+        }
+        fprintf(f, "\n");
+        memcpy(last_buckets_, buckets, sizeof(buckets));
+        memset(&interval_, 0, sizeof(interval_));
+        d.clear();
+    }
+
+    const Counts& total(void) const { return total_; }
+    const unsigned* lastBuckets(void) const { return last_buckets_; }
+
+private:
+    /* Frames end on 0x00: find them in what the last read() added */
+    void parse(uint64_t arrival)
+    {
+        while (scan_ != head_) {
+            size_t at = (size_t)(scan_ & (RING_SIZE - 1));
+            size_t run = (size_t)std::min<uint64_t>(head_ - scan_, RING_SIZE - at);
+            const uint8_t* zero = (const uint8_t*)memchr(&ring_[at], 0, run);
+
+            if (zero == NULL) {
+                scan_ += run;
+                continue;
+            }
+            scan_ += (uint64_t)(zero - &ring_[at]) + 1;
+            if (!skipping_) {
+                frame(tail_, (size_t)(scan_ - 1 - tail_), arrival);
+            }
+            skipping_ = false;
+            tail_ = scan_;
+        }
+        if (scan_ - tail_ > FRAME_MAX) {
+            // Not a record, text of a bench build or garbage: one bad frame
+            // up to the next delimiter, and the ring stays free for it
+            if (!skipping_) {
+                total_.bad++;
+                interval_.bad++;
+            }
+            skipping_ = true;
+            tail_ = scan_;
+        }
+    }
+
+    void frame(uint64_t start, size_t len, uint64_t arrival)
+    {
+        size_t at = (size_t)(start & (RING_SIZE - 1));
+        uint8_t* p = &ring_[at];
+
+        if (len > FRAME_MAX) {
+            bad();
+            return;
+        }
+        if (at + len > RING_SIZE) {
+            // Cut by the end of the ring, the only copy
+            memcpy(scratch_, p, RING_SIZE - at);
+            memcpy(scratch_ + RING_SIZE - at, &ring_[0], len - (RING_SIZE - at));
+            p = scratch_;
+        }
+
+        int n = cobs_decode(p, len);
+        if (n < RECORD_HEADER + 2 || crc16(p, (size_t)n - 2) != u16(p + n - 2)) {
+            bad();
+            return;
+        }
+
+        uint8_t type = p[0];
+        uint16_t seq = u16(p + 1);
+        uint32_t time = u32(p + 3);
+        if (!first_) {
+            uint16_t gap = (uint16_t)(seq - expected_);
+            total_.lost += gap;
+            interval_.lost += gap;
+            device_us_ += (int32_t)(time - last_time_);
+        } else {
+            device_us_ = time;
+        }
+        first_ = false;
+        expected_ = (uint16_t)(seq + 1);
+        last_time_ = time;
+        total_.records++;
+        interval_.records++;
+        delays_.push_back((int64_t)arrival - (int64_t)device_us_);
+
+        if (format_ != FORMAT_NONE) {
+            std::string line = format_record(format_, arrival / 1e6, seq, time, type, p + RECORD_HEADER,
+                                             (unsigned)n - RECORD_HEADER - 2);
+            fwrite(line.data(), 1, line.size(), out_);
+        }
+    }
+
+    void bad(void)
+    {
+        total_.bad++;
+        interval_.bad++;
+    }
+
+    Format format_;
+    FILE* out_;
+    std::vector<uint8_t> ring_;
+    uint64_t head_;                    // read() has filled up to here
+    uint64_t tail_;                    // start of the frame being received
+    uint64_t scan_;                    // searched for 0x00 up to here
+    bool skipping_;                    // dropping an overlong frame
+    uint8_t scratch_[FRAME_MAX];
+
+    bool first_;
+    uint16_t expected_;
+    uint32_t last_time_;
+    int64_t device_us_;                // device time, unwrapped
+    std::vector<int64_t> delays_;      // arrival - device time, this interval
+
+    Counts total_, interval_;
+    unsigned last_buckets_[LATENCY_BUCKETS];
+};
+
+/****************************************************************************/
+
+/* Raw, 8 bits, no echo, read() returns what is there */
+static int open_port(const char* path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+    }
+    return fd;
+}
+
+/* Reads fd until its end, a signal or "seconds", reporting every "interval" */
+static void run(Monitor* m, int fd, double interval, double seconds, FILE* reports)
+{
+    uint64_t start = now_us(), last = start;
+    uint64_t end = seconds > 0 ? start + (uint64_t)(seconds * 1e6) : UINT64_MAX;
+
+    while (!stop) {
+        uint64_t now = now_us();
+        uint64_t next = std::min<uint64_t>(last + (uint64_t)(interval * 1e6), end);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if (now >= next) {
+            m->report(reports, (now - last) / 1e6);
+            last = now;
+            if (now >= end) {
+                break;
+            }
+            continue;
+        }
+        if (poll(&pfd, 1, (int)((next - now + 999) / 1000)) > 0 && !m->readFrom(fd)) {
+            break;
+        }
+    }
+    if (now_us() - last >= 1000) {
+        m->report(reports, (now_us() - last) / 1e6);  // what came since the last report
+    }
+}
+
+/****************************************************************************/
+
+/* The board side of the self test: telemetry.c writing to the pty master */
+static int test_master;
+static uint32_t test_refuse;           // refuse every n-th record, 0 never
+static uint32_t test_delay_us;         // wait before writing each record
+static uint32_t test_count;
+static std::vector<uint8_t> test_burst; // records batched up, written by burst_flush()
+
+static uint8_t test_write(uint8_t* buf, uint16_t len)
+{
+    if (test_refuse && ++test_count % test_refuse == 0) {
+        return 1;
+    }
+    if (test_delay_us) {
+        usleep(test_delay_us);
+    }
+    if (test_burst.capacity()) {
+        test_burst.insert(test_burst.end(), buf, buf + len);
+        return 0;
+    }
+    while (len > 0) {
+        ssize_t n = write(test_master, buf, len);
+        if (n <= 0) {
+            return 1;
+        }
+        buf += n;
+        len = (uint16_t)(len - n);
+    }
+    return 0;
+}
+
+static uint32_t test_micros(void)
+{
+    return (uint32_t)now_us();
+}
+
+#define TEST_MIXED     3000            // records of every type, every TEST_REFUSE-th refused
+#define TEST_REFUSE    97
+#define TEST_DELAYED   20              // written TEST_DELAY_US after their time
+#define TEST_DELAY_US  6000
+#define TEST_BURST     100000          // radio records as fast as the pty takes them
+
+/* Records of every type, some refused, some late */
+static void test_mixed(void)
+{
+    static const char bench[] = "RF24 bench, 7 cases\r\n";
+    uint8_t payload[32];
+    uint32_t counters[5] = { 1, 2, 3, 4, 0xFFFFFFFF };
+    sample_t sample;
+    sample_summary_t summary;
+
+    write(test_master, bench, sizeof(bench) - 1);
+    write(test_master, "", 1);
+
+    test_refuse = TEST_REFUSE;
+    for (uint32_t i = 0; i < TEST_MIXED; i++) {
+        memset(payload, (int)i, sizeof(payload));
+        switch (i % 6) {
+        case 0:
+            telemetry_radio((uint8_t)(i % 6), payload, (uint8_t)(1 + i % 32));
+            break;
+        case 1:
+            sample.source = 3;
+            sample.time = 123456;
+            sample.value[0] = 2150;
+            sample.value[1] = SAMPLE_RING_NONE;
+            telemetry_sample(&sample);
+            break;
+        case 2:
+            memset(&summary, 0, sizeof(summary));
+            summary.start = 60000;
+            summary.end = 119500;
+            summary.count = 12;
+            summary.source = 1;
+            summary.value[0].min = -5;
+            summary.value[0].max = 7;
+            summary.value[0].mean = 1;
+            summary.value[0].last = 2;
+            summary.value[1].min = summary.value[1].max = SAMPLE_RING_NONE;
+            summary.value[1].mean = summary.value[1].last = SAMPLE_RING_NONE;
+            telemetry_summary(&summary);
+            break;
+        case 3:
+            telemetry_stats(TELEMETRY_STATS_LINK, counters, 5);
+            break;
+        case 4:
+            telemetry_text("say \"hi\", ok\n", 13);
+            break;
+        default:
+            telemetry_send(TELEMETRY_LOG, NULL, 0, payload, 8);
+            break;
+        }
+        if (i % 64 == 63) {
+            usleep(1000);              // the reader keeps up, latency stays low
+        }
+    }
+    test_refuse = 0;
+
+    for (uint32_t i = 0; i < TEST_DELAYED; i++) {
+        test_delay_us = TEST_DELAY_US;
+        telemetry_radio(0, payload, 32);
+        test_delay_us = 0;
+        usleep(500);
+    }
+}
+
+/* Radio records batched, written as fast as the pty takes them */
+static void test_burst_write(void)
+{
+    uint8_t payload[32];
+
+    memset(payload, 0x5A, sizeof(payload));
+    test_burst.reserve(TEST_BURST * 44);
+    for (uint32_t i = 0; i < TEST_BURST; i++) {
+        telemetry_radio(1, payload, 32);
+    }
+
+    const uint8_t* p = test_burst.data();
+    size_t left = test_burst.size();
+    while (left > 0) {
+        ssize_t n = write(test_master, p, left);
+        if (n <= 0) {
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+}
+
+/* Runs "board" in a child writing to a pty and the monitor on the other
+ * side until the child is gone. False if there is no pty */
+static bool pty_session(void (*board)(void), Monitor* m)
+{
+    static const telemetry_config_t config = { test_write, test_micros };
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    int fd;
+
+    if (master < 0 || grantpt(master) || unlockpt(master) || (fd = open_port(ptsname(master))) < 0) {
+        return false;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        test_master = master;
+        telemetry_init(&config);
+        board();
+        // A hangup flushes what the monitor has not read yet: wait for it
+        int queued = 1, idle = 0;
+        while (idle < 3) {
+            usleep(10000);
+            idle = ioctl(fd, FIONREAD, &queued) == 0 && queued == 0 ? idle + 1 : 0;
+        }
+        _exit(0);
+    }
+    close(master);
+    run(m, fd, 60, 60, stdout);
+    close(fd);
+    waitpid(child, NULL, 0);
+    return true;
+}
+
+static bool contains(const std::string& text, const std::string& what)
+{
+    return text.find(what) != std::string::npos;
+}
+
+static void self_test(void)
+{
+    char what[128];
+    uint8_t rec[16] = { 5, 'a', 0, 'b' };
+
+    printf("-- formatting --\n");
+    std::string csv = format_record(FORMAT_CSV, 1.5, 7, 2000000, TELEMETRY_TEXT, (const uint8_t*)"say \"hi\", ok\n", 13);
+    check(csv == "1.500000,7,2.000000,text,\"say \"\"hi\"\", ok\"\n", "CSV text quoted, quotes doubled, newline cut");
+    std::string json = format_record(FORMAT_JSON, 1.5, 7, 2000000, TELEMETRY_TEXT, (const uint8_t*)"a\"\\\t", 4);
+    check(json == "{\"arrival\": 1.500000, \"seq\": 7, \"time\": 2.000000, \"type\": \"text\", \"text\": \"a\\\"\\\\\\u0009\"}\n",
+          "JSON text escaped");
+    json = format_record(FORMAT_JSON, 0, 1, 0, 0x42, rec, 4);
+    check(contains(json, "\"type\": \"0x42\", \"payload\": \"05610062\"}"), "unknown type in hex");
+
+    printf("-- pty, every type --\n");
+    char* text = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&text, &size);
+    Monitor mixed(FORMAT_CSV, out);
+    if (!pty_session(test_mixed, &mixed)) {
+        check(false, "pty");
+        return;
+    }
+    fclose(out);
+    std::string lines(text, size);
+    free(text);
+
+    const Counts& t = mixed.total();
+    uint32_t refused = TEST_MIXED / TEST_REFUSE;
+    uint32_t records = TEST_MIXED - refused + TEST_DELAYED;
+    snprintf(what, sizeof(what), "%u records decoded (%llu)", records, (unsigned long long)t.records);
+    check(t.records == records, what);
+    snprintf(what, sizeof(what), "%u refused counted lost from the sequence (%llu)", refused,
+             (unsigned long long)t.lost);
+    check(t.lost == refused, what);
+    check(t.bad == 1, "bench text before the records one bad frame");
+    check(contains(lines, ",sample,3,123456,2150,\n"), "sample in CSV, a missing value empty");
+    check(contains(lines, ",summary,1,60000,119500,12,-5,,7,,1,,2,\n"), "summary in CSV");
+    check(contains(lines, ",stats,0,1,2,3,4,4294967295\n"), "stats in CSV");
+    check(contains(lines, ",radio,0,00\n") && contains(lines, ",log,") && contains(lines, ",text,\"say \"\"hi\"\", ok\"\n"),
+          "radio, log and text in CSV");
+
+    const unsigned* b = mixed.lastBuckets();
+    unsigned late = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+        late += (125U << i) > TEST_DELAY_US / 2 ? b[i] : 0;
+    }
+    // The fastest record sets the origin, so the late ones are at least
+    // TEST_DELAY_US behind it whatever the scheduling; most others are not
+    snprintf(what, sizeof(what), "%u records written %u ms late in the slow buckets, most others not (%u)",
+             TEST_DELAYED, TEST_DELAY_US / 1000, late);
+    check(late >= TEST_DELAYED && late < records / 2, what);
+
+    printf("-- pty, burst --\n");
+    Monitor burst(FORMAT_NONE, NULL);
+    uint64_t start = now_us();
+    pty_session(test_burst_write, &burst);
+    double seconds = (now_us() - start) / 1e6;
+    const Counts& u = burst.total();
+    printf("%llu bytes in %.2f s, %.1f MB/s through the pty\n", (unsigned long long)u.bytes, seconds,
+           u.bytes / seconds / 1e6);
+    snprintf(what, sizeof(what), "%u records back to back, none lost or bad", TEST_BURST);
+    check(u.records == TEST_BURST && u.lost == 0 && u.bad == 0, what);
+}
+
+/****************************************************************************/
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+int main(int argc, char** argv)
+{
+    Format format = FORMAT_CSV;
+    double interval = 1, seconds = 0;
+    const char* path = NULL;
+
+    if (argc == 2 && !strcmp(argv[1], "-t")) {
+        self_test();
+        printf("-- %d failed --\n", failed);
+        return failed;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            i++;
+            format = !strcmp(argv[i], "json") ? FORMAT_JSON : !strcmp(argv[i], "none") ? FORMAT_NONE : FORMAT_CSV;
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interval = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || interval <= 0) {
+        fprintf(stderr, "usage: %s [-f csv|json|none] [-i s] [-n s] /dev/ttyACMn\n       %s -t\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    int fd = open_port(path);
+    if (fd < 0) {
+        return 2;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    Monitor m(format, stdout);
+    uint64_t start = now_us();
+    run(&m, fd, interval, seconds, stderr);
+    close(fd);
+
+    const Counts& t = m.total();
+    double s = (now_us() - start) / 1e6;
+    fprintf(stderr, "%llu records, %llu lost, %llu bad, %.3f MB/s over %.1f s\n", (unsigned long long)t.records,
+            (unsigned long long)t.lost, (unsigned long long)t.bad, t.bytes / s / 1e6, s);
+    return t.bad || t.lost ? 1 : 0;
+}
@@ -0,0 +1,378 @@
+/*
+ Host emulation of the board: virtual clock, GPIO, SPI and I2C buses.
+ */
+
+#include "hal_emu.h"
+#include "clock_profile.h"
+
+/* Rough costs of the HAL calls on the F407 at -O1, in core cycles */
+#define EMU_GPIO_WRITE_CYCLES   12
+#define EMU_SPI_CALL_CYCLES     150
+#define EMU_I2C_CALL_CYCLES     200
+
+GPIO_TypeDef emu_gpio[9] = { {0,0,0}, {0,0,1}, {0,0,2}, {0,0,3}, {0,0,4}, {0,0,5}, {0,0,6}, {0,0,7}, {0,0,8} };
+SPI_TypeDef  emu_spi[3]  = { {0,0,0,0}, {0,0,0,1}, {0,0,0,2} };
+I2C_TypeDef  emu_i2c[3]  = { {0,0,0}, {0,0,1}, {0,0,2} };
+uint32_t     SystemCoreClock = 16000000;
+CoreDebug_Type emu_coredebug;
+
+static EmuDevice* devices;
+static uint64_t   now_ns;
+static uint64_t   spi_bytes;
+static uint64_t   i2c_bytes;
+
+/****************************************************************************/
+
+EmuDevice::EmuDevice()
+  : next(devices)
+{
+    devices = this;
+}
+
+EmuDevice::~EmuDevice()
+{
+    EmuDevice** p = &devices;
+    while (*p) {
+        if (*p == this) {
+            *p = next;
+            break;
+        }
+        p = &(*p)->next;
+    }
+}
+
+/****************************************************************************/
+
+uint64_t emu_now_ns(void)
+{
+    return now_ns;
+}
+
+uint32_t emu_micros(void)
+{
+    return (uint32_t)(now_ns / 1000);
+}
+
+void emu_advance_ns(uint64_t ns)
+{
+    now_ns += ns;
+    for (EmuDevice* d = devices; d; d = d->next) {
+        d->step(now_ns);
+    }
+}
+
+void emu_advance_cycles(uint32_t cycles)
+{
+    emu_advance_ns((uint64_t)cycles * 1000000000ULL / SystemCoreClock);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    emu_advance_ns((uint64_t)us * 1000ULL);
+}
+
+/* Time keeping of the firmware, clock_profile.c is not built on the host */
+uint32_t clock_micros(void)
+{
+    emu_advance_cycles(4);
+    return emu_micros();
+}
+
+void clock_delay_us(uint32_t us)
+{
+    delayMicroseconds(us);
+}
+
+void emu_reset_clock(void)
+{
+    now_ns = 0;
+}
+
+uint64_t emu_spi_bytes(void)
+{
+    return spi_bytes;
+}
+
+uint64_t emu_i2c_bytes(void)
+{
+    return i2c_bytes;
+}
+
+DWT_Type* emu_dwt(void)
+{
+    static DWT_Type dwt;
+    dwt.CYCCNT = (uint32_t)(now_ns * (SystemCoreClock / 1000000) / 1000);
+    return &dwt;
+}
+
+/****************************************************************************/
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+    return SystemCoreClock;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    emu_advance_cycles(4);
+    return (uint32_t)(now_ns / 1000000);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    // HAL_Delay adds one tick to guarantee the minimum wait
+    emu_advance_ns((uint64_t)(Delay + 1) * 1000000ULL);
+}
+
+/****************************************************************************/
+
+void HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init)
+{
+    (void)GPIOx;
+    (void)GPIO_Init;
+    emu_advance_cycles(EMU_GPIO_WRITE_CYCLES);
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    emu_advance_cycles(EMU_GPIO_WRITE_CYCLES);
+    if (PinState == GPIO_PIN_SET) {
+        GPIOx->ODR |= GPIO_Pin;
+    } else {
+        GPIOx->ODR &= ~GPIO_Pin;
+    }
+    for (EmuDevice* d = devices; d; d = d->next) {
+        d->pinChanged(GPIOx, GPIO_Pin, PinState == GPIO_PIN_SET);
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    emu_advance_cycles(EMU_GPIO_WRITE_CYCLES);
+    for (EmuDevice* d = devices; d; d = d->next) {
+        int level = d->pinLevel(GPIOx, GPIO_Pin);
+        if (level >= 0) {
+            return level ? GPIO_PIN_SET : GPIO_PIN_RESET;
+        }
+    }
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    HAL_GPIO_WritePin(GPIOx, GPIO_Pin, (GPIOx->ODR & GPIO_Pin) ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+/****************************************************************************/
+
+uint32_t emu_spi_hz(SPI_TypeDef* spi)
+{
+    uint32_t br = (spi->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos;
+    return (spi == SPI1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq()) / (2U << br);
+}
+
+uint32_t emu_spi_hz(SPI_HandleTypeDef* hspi)
+{
+    return emu_spi_hz(hspi->Instance);
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+    hspi->Instance->CR1 = hspi->Init.BaudRatePrescaler | hspi->Init.CLKPolarity | hspi->Init.CLKPhase | SPI_CR1_SPE;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout)
+{
+    uint64_t byte_ns = 8ULL * 1000000000ULL / emu_spi_hz(hspi);
+
+    emu_advance_cycles(EMU_SPI_CALL_CYCLES);
+    hspi->Instance->CR1 |= SPI_CR1_SPE;
+    while (Size--) {
+        emu_advance_ns(byte_ns);
+        uint8_t miso = 0xff;
+        for (EmuDevice* d = devices; d; d = d->next) {
+            if (d->selected(hspi->Instance)) {
+                miso = d->transfer(*pTxData);
+                break;
+            }
+        }
+        *pRxData++ = miso;
+        pTxData++;
+        spi_bytes++;
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+    HAL_StatusTypeDef status = HAL_SPI_TransmitReceive(hspi, pTxData, pRxData, Size, 0xFFFFFFFFU);
+    if (status == HAL_OK) {
+        HAL_SPI_TxRxCpltCallback(hspi);
+    }
+    return status;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+    return HAL_SPI_TransmitReceive_IT(hspi, pTxData, pRxData, Size);
+}
+
+__attribute__((weak)) void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    return HAL_OK;
+}
+
+/****************************************************************************/
+
+uint32_t emu_i2c_hz(I2C_HandleTypeDef* hi2c)
+{
+    return hi2c->Init.ClockSpeed ? hi2c->Init.ClockSpeed : 100000U;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+    hi2c->Instance->CR1 = I2C_CR1_PE;
+    hi2c->Instance->SR2 = 0;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->Lock = HAL_UNLOCKED;
+    return HAL_OK;
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+/*
+ START or repeated start, address, then the bytes of one phase, each 9 SCL
+ periods. The first device that ACKs the address owns the phase; a NACK
+ on the address or on a written byte ends it with HAL_I2C_ERROR_AF and a
+ STOP, as the peripheral does. The STOP also follows the last frame.
+ */
+static EmuDevice* emu_i2c_phase(I2C_HandleTypeDef* hi2c, uint16_t DevAddress, uint8_t* pData, uint16_t Size,
+                                bool read, bool stop)
+{
+    uint64_t bit_ns = 1000000000ULL / emu_i2c_hz(hi2c);
+    EmuDevice* target = NULL;
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->Instance->SR2 |= I2C_SR2_BUSY;
+    emu_advance_ns(10 * bit_ns);
+    i2c_bytes++;
+    for (EmuDevice* d = devices; d; d = d->next) {
+        if (d->i2cAddress(hi2c->Instance, (uint8_t)(DevAddress >> 1), read)) {
+            target = d;
+            break;
+        }
+    }
+    if (target == NULL) {
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+    }
+    while (target && Size--) {
+        emu_advance_ns(target->i2cStretch() + 9 * bit_ns);
+        i2c_bytes++;
+        if (read) {
+            *pData++ = target->i2cRead(Size == 0);
+        } else if (!target->i2cWrite(*pData++)) {
+            hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+            break;
+        }
+    }
+    if (stop || hi2c->ErrorCode != HAL_I2C_ERROR_NONE) {
+        emu_advance_ns(bit_ns);
+        if (target) {
+            target->i2cStop();
+        }
+        hi2c->Instance->SR2 &= ~I2C_SR2_BUSY;
+    }
+    return target;
+}
+
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint32_t Trials, uint32_t Timeout)
+{
+    (void)Timeout;
+    emu_advance_cycles(EMU_I2C_CALL_CYCLES);
+    while (Trials--) {
+        if (emu_i2c_phase(hi2c, DevAddress, NULL, 0, false, true)) {
+            hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+            return HAL_OK;
+        }
+    }
+    return HAL_ERROR;
+}
+
+static HAL_StatusTypeDef emu_i2c_seq(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size,
+                                     uint32_t XferOptions, bool read)
+{
+    bool stop = XferOptions == I2C_FIRST_AND_LAST_FRAME || XferOptions == I2C_LAST_FRAME;
+
+    emu_advance_cycles(EMU_I2C_CALL_CYCLES);
+    emu_i2c_phase(hi2c, DevAddress, pData, Size, read, stop);
+    hi2c->State = HAL_I2C_STATE_READY;
+    if (hi2c->ErrorCode != HAL_I2C_ERROR_NONE) {
+        HAL_I2C_ErrorCallback(hi2c);
+    } else if (read) {
+        HAL_I2C_MasterRxCpltCallback(hi2c);
+    } else {
+        HAL_I2C_MasterTxCpltCallback(hi2c);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                 uint16_t Size, uint32_t XferOptions)
+{
+    return emu_i2c_seq(hi2c, DevAddress, pData, Size, XferOptions, false);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                uint16_t Size, uint32_t XferOptions)
+{
+    return emu_i2c_seq(hi2c, DevAddress, pData, Size, XferOptions, true);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                  uint16_t Size, uint32_t XferOptions)
+{
+    return HAL_I2C_Master_Seq_Transmit_IT(hi2c, DevAddress, pData, Size, XferOptions);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                 uint16_t Size, uint32_t XferOptions)
+{
+    return HAL_I2C_Master_Seq_Receive_IT(hi2c, DevAddress, pData, Size, XferOptions);
+}
+
+__attribute__((weak)) void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
+
+__attribute__((weak)) void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    (void)hi2c;
+}
@@ -0,0 +1,89 @@
+/*
+ Host emulation of the board: virtual clock, GPIO, SPI and I2C buses.
+
+ Device models (the nRF24 in rf24_emu.h, the HTU21D in htu21d_emu.h) derive
+ from EmuDevice
+ and attach themselves. Every HAL call made by the firmware advances the
+ virtual clock by the time it would take on the board, then steps every
+ attached device up to the new time.
+ */
+
+#ifndef __HAL_EMU_H__
+#define __HAL_EMU_H__
+
+#include "stm32f4xx_hal.h"
+
+/**
+ * Base class of every emulated peripheral.
+ */
+class EmuDevice
+{
+public:
+  EmuDevice();
+  virtual ~EmuDevice();
+
+  /** A GPIO output changed level. */
+  virtual void pinChanged(GPIO_TypeDef* port, uint16_t pin, bool level) {}
+
+  /** Level this device drives on an input pin, -1 if it does not drive it. */
+  virtual int pinLevel(GPIO_TypeDef* port, uint16_t pin) { return -1; }
+
+  /** True while this device is selected on @p spi. */
+  virtual bool selected(SPI_TypeDef* spi) { return false; }
+
+  /** One full-duplex SPI byte while selected. */
+  virtual uint8_t transfer(uint8_t mosi) { return 0xff; }
+
+  /** Address byte after a START or repeated start on @p i2c, true to ACK. */
+  virtual bool i2cAddress(I2C_TypeDef* i2c, uint8_t address, bool read) { return false; }
+
+  /** One byte written after an ACKed address, true to ACK. */
+  virtual bool i2cWrite(uint8_t data) { return false; }
+
+  /** One byte read after an ACKed address, @p last when the master NACKs it. */
+  virtual uint8_t i2cRead(bool last) { return 0xff; }
+
+  /** Nanoseconds SCL is held low before the next byte (clock stretching). */
+  virtual uint64_t i2cStretch(void) { return 0; }
+
+  /** STOP after a transfer this device ACKed. */
+  virtual void i2cStop(void) {}
+
+  /** Advance internal state up to @p now_ns. */
+  virtual void step(uint64_t now_ns) {}
+
+  EmuDevice* next;
+};
+
+/** Current virtual time in nanoseconds. */
+uint64_t emu_now_ns(void);
+
+/** Current virtual time in microseconds. */
+uint32_t emu_micros(void);
+
+/** Advance virtual time and step every device. */
+void emu_advance_ns(uint64_t ns);
+
+/** Advance by @p cycles of the emulated core clock. */
+void emu_advance_cycles(uint32_t cycles);
+
+/** Busy wait of the RF24 driver, advances the clock instead of spinning. */
+void delayMicroseconds(uint32_t us);
+
+/** Reset the clock to zero, devices stay attached. */
+void emu_reset_clock(void);
+
+/** SPI clock currently configured on @p hspi, Hz. */
+uint32_t emu_spi_hz(SPI_HandleTypeDef* hspi);
+uint32_t emu_spi_hz(SPI_TypeDef* spi);
+
+/** Total bytes clocked on all SPI buses since start. */
+uint64_t emu_spi_bytes(void);
+
+/** SCL clock of @p hi2c, Hz, 100 kHz when none is set. */
+uint32_t emu_i2c_hz(I2C_HandleTypeDef* hi2c);
+
+/** Total address and data bytes on all I2C buses since start. */
+uint64_t emu_i2c_bytes(void);
+
+#endif // __HAL_EMU_H__
@@ -0,0 +1,333 @@
+/*
+ Behavioural model of an HTU21D / SHT21 / Si70xx for host builds of the
+ HTU21D driver.
+ */
+
+#include "htu21d_emu.h"
+#include "HTU21D.h"
+
+#define EMU_HTU_RESET_NS    15000000ULL        // soft reset, HTU21D maximum
+#define EMU_HTU_USER_RW     0x87               // resolution, heater & OTP bits, the rest is reserved or read only
+#define EMU_HTU_USER_VDD    0x40
+#define EMU_HTU_USER_HEATER 0x04
+
+/* Conversion times in microseconds, typical then maximum, by resolution
+   index RH12/T14, RH8/T12, RH10/T13, RH11/T11 as HTU21D::conversionTime() */
+static const uint32_t HTU21D_RH_US[4][2] = { {14000, 16000}, {2000, 3000}, {4000, 5000}, {7000, 8000} };
+static const uint32_t HTU21D_T_US[4][2]  = { {44000, 50000}, {11000, 13000}, {22000, 25000}, {6000, 7000} };
+static const uint32_t SI70XX_RH_US[4][2] = { {10000, 12000}, {2600, 3100}, {3700, 4500}, {5800, 7000} };
+static const uint32_t SI70XX_T_US[4][2]  = { {7000, 10800}, {2400, 3800}, {4000, 6200}, {1500, 2400} };
+
+/* Bits of the result at each resolution index */
+static const uint8_t RH_BITS[4] = { 12, 8, 10, 11 };
+static const uint8_t T_BITS[4]  = { 14, 12, 13, 11 };
+
+/****************************************************************************/
+
+Htu21dEmu::Htu21dEmu(I2C_TypeDef* _i2c, EmuHtuChip _chip, uint8_t _address)
+  : temperature(25.0), humidity(50.0), heater_rise(0.5), vdd_low(false), present(true), slow(false), nack(0),
+    bad_crc(0), stall_us(0), firmware(_chip == EMU_HTU21D ? HTU21D_FIRMWARE_V1 : HTU21D_FIRMWARE_V2), conversions(0), results(0),
+    nacked_busy(0), nacked_fault(0), stretched_ns(0), i2c(_i2c), chip(_chip), address(_address), now(0),
+    heater(0), addressed(false), cmd_len(0), converting(false), hold(false), conv_end(0),
+    conv_raw(0), rh_temperature(0), reset_end(0), out_len(0), out_pos(0), out_result(false)
+{
+    static const uint8_t ids[4] = { HTU21D_CHIPID, SI7013_CHIPID, SI7020_CHIPID, SI7021_CHIPID };
+    static const uint8_t sn[8] = { 0x48, 0x54, 0x55, 0x21, 0x00, 0x00, 0xB1, 0x7E };
+
+    memcpy(serial, sn, sizeof(serial));
+    serial[4] = ids[chip];
+    user = 0;
+    reset();
+}
+
+/****************************************************************************/
+
+uint8_t Htu21dEmu::crc8(const uint8_t* data, uint8_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t quantize(double value, double offset, double span, uint8_t bits, uint16_t status)
+{
+    double raw = (value + offset) * 65536.0 / span + 0.5;
+
+    if (raw < 0) {
+        raw = 0;
+    } else if (raw > 65535) {
+        raw = 65535;
+    }
+    return (uint16_t)(((uint16_t)raw & (uint16_t)(0xFFFF << (16 - bits)) & 0xFFFC) | status);
+}
+
+static uint8_t resolutionIndex(uint8_t user)
+{
+    return ((user >> 6) & 0x02) | (user & 0x01);
+}
+
+uint16_t Htu21dEmu::rawTemperature(void) const
+{
+    double t = temperature;
+
+    if (user & EMU_HTU_USER_HEATER) {
+        t += heater_rise * ((heater & 0x0F) + 1);
+    }
+    return quantize(t, 46.85, 175.72, T_BITS[resolutionIndex(user)], 0x0000);
+}
+
+uint16_t Htu21dEmu::rawHumidity(void) const
+{
+    return quantize(humidity, 6.0, 125.0, RH_BITS[resolutionIndex(user)], 0x0002);
+}
+
+uint32_t Htu21dEmu::conversionUs(bool humidity_) const
+{
+    uint8_t index = resolutionIndex(user);
+
+    if (!si70xx()) {
+        return humidity_ ? HTU21D_RH_US[index][slow] : HTU21D_T_US[index][slow];
+    }
+    /* Si70xx measure temperature along with humidity */
+    return humidity_ ? SI70XX_RH_US[index][slow] + SI70XX_T_US[index][slow] : SI70XX_T_US[index][slow];
+}
+
+/****************************************************************************/
+
+void Htu21dEmu::reset(void)
+{
+    /* Everything but the heater bit goes back to its default */
+    user = (uint8_t)((si70xx() ? 0x3A : 0x02) | (user & EMU_HTU_USER_HEATER));
+    converting = false;
+    out_len = out_pos = 0;
+}
+
+void Htu21dEmu::answer(const uint8_t* data, uint8_t len)
+{
+    memcpy(out, data, len);
+    out_len = len;
+    out_pos = 0;
+    out_result = false;
+}
+
+void Htu21dEmu::answerResult(uint16_t raw, bool checksum)
+{
+    uint8_t frame[3] = { (uint8_t)(raw >> 8), (uint8_t)raw, 0 };
+
+    frame[2] = crc8(frame, 2);
+    if (checksum && bad_crc) {
+        bad_crc--;
+        frame[2] ^= 0x5A;
+    }
+    answer(frame, checksum ? 3 : 2);
+    out_result = true;
+}
+
+void Htu21dEmu::convert(bool humidity_, bool _hold)
+{
+    conversions++;
+    converting = true;
+    hold = _hold;
+    conv_end = now + (conversionUs(humidity_) + stall_us) * 1000ULL;
+    conv_raw = humidity_ ? rawHumidity() : rawTemperature();
+    if (humidity_ && si70xx()) {
+        rh_temperature = rawTemperature();
+    }
+    out_len = out_pos = 0;
+}
+
+/* Runs the command in cmd[] once all its bytes are in */
+void Htu21dEmu::command(void)
+{
+    uint8_t frame[12];
+
+    switch (cmd[0]) {
+    case HTU21D_TRIGGER_HUMD_MEASURE_HOLD:
+    case HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD:
+        convert(true, cmd[0] == HTU21D_TRIGGER_HUMD_MEASURE_HOLD);
+        break;
+
+    case HTU21D_TRIGGER_TEMP_MEASURE_HOLD:
+    case HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD:
+        convert(false, cmd[0] == HTU21D_TRIGGER_TEMP_MEASURE_HOLD);
+        break;
+
+    case SI70xx_TEMP_READ_AFTER_RH_MEASURMENT:
+        answerResult(rh_temperature, false);
+        break;
+
+    case HTU21D_USER_REGISTER_READ:
+        frame[0] = (uint8_t)(user | (vdd_low ? EMU_HTU_USER_VDD : 0));
+        answer(frame, 1);
+        break;
+
+    case HTU21D_USER_REGISTER_WRITE:
+        user = (uint8_t)((user & ~EMU_HTU_USER_RW) | (cmd[1] & EMU_HTU_USER_RW));
+        break;
+
+    case HTU21D_HEATER_REGISTER_READ:
+        answer(&heater, 1);
+        break;
+
+    case HTU21D_HEATER_REGISTER_WRITE:
+        heater = cmd[1] & 0x0F;
+        break;
+
+    case HTU21D_SOFT_RESET:
+        reset();
+        reset_end = now + EMU_HTU_RESET_NS;
+        break;
+
+    case HTU21D_SERIAL1_READ1:
+        /* SNA3..SNA0, each followed by its checksum */
+        for (uint8_t i = 0; i < 4; i++) {
+            frame[2 * i] = serial[i];
+            frame[2 * i + 1] = crc8(&serial[i], 1);
+        }
+        answer(frame, 8);
+        break;
+
+    case HTU21D_SERIAL2_READ1:
+        /* SNB3 SNB2 CRC SNB1 SNB0 CRC, SNB3 is the chip ID */
+        for (uint8_t i = 0; i < 2; i++) {
+            frame[3 * i] = serial[4 + 2 * i];
+            frame[3 * i + 1] = serial[5 + 2 * i];
+            frame[3 * i + 2] = crc8(&serial[4 + 2 * i], 2);
+        }
+        answer(frame, 6);
+        break;
+
+    case HTU21D_FIRMWARE_READ1:
+        answer(&firmware, 1);
+        break;
+    }
+}
+
+/****************************************************************************/
+
+bool Htu21dEmu::i2cAddress(I2C_TypeDef* _i2c, uint8_t _address, bool read)
+{
+    if (_i2c != i2c || _address != address) {
+        return false;
+    }
+    if (!present || nack) {
+        nack -= nack ? 1 : 0;
+        nacked_fault++;
+        return false;
+    }
+    if (now < reset_end || (converting && !(read && hold))) {
+        nacked_busy++;
+        return false;
+    }
+    addressed = true;
+    cmd_len = 0;
+    return true;
+}
+
+bool Htu21dEmu::i2cWrite(uint8_t data)
+{
+    if (!addressed || cmd_len >= sizeof(cmd)) {
+        return false;
+    }
+    cmd[cmd_len++] = data;
+
+    if (cmd_len == 1) {
+        switch (data) {
+        case HTU21D_TRIGGER_HUMD_MEASURE_HOLD:
+        case HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD:
+        case HTU21D_TRIGGER_TEMP_MEASURE_HOLD:
+        case HTU21D_TRIGGER_TEMP_MEASURE_NOHOLD:
+        case HTU21D_USER_REGISTER_READ:
+        case HTU21D_SOFT_RESET:
+            command();
+            return true;
+
+        case SI70xx_TEMP_READ_AFTER_RH_MEASURMENT:
+        case HTU21D_HEATER_REGISTER_READ:
+            if (!si70xx()) {
+                return false;
+            }
+            command();
+            return true;
+
+        case HTU21D_HEATER_REGISTER_WRITE:
+            return si70xx();
+
+        case HTU21D_USER_REGISTER_WRITE:
+        case HTU21D_SERIAL1_READ1:
+        case HTU21D_SERIAL2_READ1:
+        case HTU21D_FIRMWARE_READ1:
+            return true;                       // second byte to come
+
+        default:
+            return false;                      // not a command, NACKed
+        }
+    }
+
+    /* Second byte: register value, or second half of a two byte command */
+    switch (cmd[0]) {
+    case HTU21D_USER_REGISTER_WRITE:
+    case HTU21D_HEATER_REGISTER_WRITE:
+        break;
+    case HTU21D_SERIAL1_READ1:
+        if (data != HTU21D_SERIAL1_READ2) {
+            return false;
+        }
+        break;
+    case HTU21D_SERIAL2_READ1:
+        if (data != HTU21D_SERIAL2_READ2) {
+            return false;
+        }
+        break;
+    case HTU21D_FIRMWARE_READ1:
+        if (data != HTU21D_FIRMWARE_READ2) {
+            return false;
+        }
+        break;
+    default:
+        return false;                          // single byte command, nothing more expected
+    }
+    command();
+    return true;
+}
+
+uint8_t Htu21dEmu::i2cRead(bool last)
+{
+    (void)last;
+    if (!addressed || out_pos >= out_len) {
+        return 0xff;
+    }
+    if (out_pos == 0 && out_result) {
+        results++;
+    }
+    return out[out_pos++];
+}
+
+uint64_t Htu21dEmu::i2cStretch(void)
+{
+    if (!addressed || !converting || now >= conv_end) {
+        return 0;
+    }
+    stretched_ns += conv_end - now;
+    return conv_end - now;
+}
+
+void Htu21dEmu::i2cStop(void)
+{
+    addressed = false;
+}
+
+void Htu21dEmu::step(uint64_t now_ns)
+{
+    now = now_ns;
+    if (converting && now >= conv_end) {
+        converting = false;
+        answerResult(conv_raw, true);
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ Behavioural model of an HTU21D / SHT21 / Si70xx for host builds of the
+ HTU21D driver.
+
+ The model answers the I2C command set in HTU21D.h: hold and no hold master
+ triggers, the user and heater registers, the serial number and firmware
+ reads, SI70xx_TEMP_READ_AFTER_RH_MEASURMENT and the soft reset. Results
+ carry the status bits and the CRC8 of the datasheet, computed bit by bit
+ here and not with the table of the driver.
+
+ Timing: a conversion takes the typical time of the datasheet at the
+ resolution of the user register, or the maximum with "slow". Meanwhile a
+ no hold master read is NACKed on the address and a hold master read
+ stretches SCL until the result is ready. A Si70xx humidity conversion
+ includes a temperature conversion. A soft reset NACKs everything for 15 ms.
+
+ Faults are armed with counters that the model counts down: "bad_crc"
+ corrupts the checksum of the next results, "nack" NACKs the next
+ addresses. "stall_us" lengthens every conversion, "present" false
+ unplugs the sensor.
+ */
+
+#ifndef __HTU21D_EMU_H__
+#define __HTU21D_EMU_H__
+
+#include "hal_emu.h"
+
+/**
+ * Chips of the family, they differ in ID, timing and the Si70xx commands.
+ */
+enum EmuHtuChip
+{
+  EMU_HTU21D,                  /**< Also SHT21 */
+  EMU_SI7013,
+  EMU_SI7020,
+  EMU_SI7021
+};
+
+class Htu21dEmu : public EmuDevice
+{
+public:
+  Htu21dEmu(I2C_TypeDef* i2c, EmuHtuChip chip = EMU_HTU21D, uint8_t address = 0x40);
+
+  /* EmuDevice */
+  bool     i2cAddress(I2C_TypeDef* i2c, uint8_t address, bool read);
+  bool     i2cWrite(uint8_t data);
+  uint8_t  i2cRead(bool last);
+  uint64_t i2cStretch(void);
+  void     i2cStop(void);
+  void     step(uint64_t now_ns);
+
+  /** CRC8 of the datasheet, x^8 + x^5 + x^4 + 1 from 0, over @p len bytes */
+  static uint8_t crc8(const uint8_t* data, uint8_t len);
+
+  /** Raw results for the environment now, at the resolution of the user register */
+  uint16_t rawTemperature(void) const;
+  uint16_t rawHumidity(void) const;
+
+  /* Environment, read when a conversion starts */
+  double   temperature;        /**< °C */
+  double   humidity;           /**< %RH */
+  double   heater_rise;        /**< °C the heater adds per step of the heater register */
+  bool     vdd_low;            /**< End of battery bit of the user register */
+
+  /* Behaviour and faults */
+  bool     present;            /**< False, the sensor NACKs every address */
+  bool     slow;               /**< Maximum conversion times instead of the typical ones */
+  uint32_t nack;               /**< NACK the next n addresses */
+  uint32_t bad_crc;            /**< Corrupt the checksum of the next n results */
+  uint32_t stall_us;           /**< Added to every conversion, a sensor that hangs */
+  uint8_t  firmware;           /**< Answer to HTU21D_FIRMWARE_READ1/2 */
+  uint8_t  serial[8];          /**< SNA3..SNA0, SNB3..SNB0, SNB3 is the chip ID */
+
+  /* Statistics */
+  uint32_t conversions;
+  uint32_t results;            /**< Results read, with or without checksum */
+  uint32_t nacked_busy;        /**< Addresses NACKed while converting or resetting */
+  uint32_t nacked_fault;       /**< Addresses NACKed by "nack" or "present" */
+  uint64_t stretched_ns;       /**< SCL held low in hold master mode */
+
+  uint8_t  userRegister(void) const { return user; }
+  uint8_t  heaterRegister(void) const { return heater; }
+
+private:
+  void     command(void);
+  void     convert(bool humidity_, bool hold);
+  void     answer(const uint8_t* data, uint8_t len);
+  void     answerResult(uint16_t raw, bool checksum);
+  void     reset(void);
+  uint32_t conversionUs(bool humidity_) const;
+  bool     si70xx(void) const { return chip != EMU_HTU21D; }
+
+  I2C_TypeDef* i2c;
+  EmuHtuChip   chip;
+  uint8_t      address;
+  uint64_t     now;
+
+  uint8_t  user;
+  uint8_t  heater;
+
+  bool     addressed;          /**< This transfer is ours */
+  uint8_t  cmd[2];
+  uint8_t  cmd_len;
+
+  bool     converting;
+  bool     hold;
+  uint64_t conv_end;
+  uint16_t conv_raw;
+  uint16_t rh_temperature;     /**< Si70xx, temperature of the last humidity conversion */
+  uint64_t reset_end;
+
+  uint8_t  out[12];            /**< Next read returns these */
+  uint8_t  out_len;
+  uint8_t  out_pos;
+  bool     out_result;         /**< out holds a measurement */
+};
+
+#endif // __HTU21D_EMU_H__
@@ -0,0 +1,510 @@
+/*
+ Behavioural model of an nRF24L01+ for host builds of the RF24 driver.
+ */
+
+#include "rf24_emu.h"
+#include "a_nRF24L01.h"
+
+#define EMU_SETTLE_NS   130000ULL          // Tstby2a, standby-I to TX/RX
+#define EMU_BIT(x)      (1U << (x))
+
+static EmuAirNode* air_nodes;
+uint32_t EmuAir::frames;
+
+/****************************************************************************/
+
+EmuAirNode::EmuAirNode()
+  : next(air_nodes)
+{
+    air_nodes = this;
+}
+
+EmuAirNode::~EmuAirNode()
+{
+    EmuAirNode** p = &air_nodes;
+    while (*p) {
+        if (*p == this) {
+            *p = next;
+            break;
+        }
+        p = &(*p)->next;
+    }
+}
+
+/****************************************************************************/
+
+bool EmuAir::transmit(EmuAirNode* from, const EmuFrame& f, EmuFrame* ack)
+{
+    bool acked = false;
+    EmuFrame reply;
+
+    frames++;
+    ack->len = 0;
+    for (EmuAirNode* n = air_nodes; n; n = n->next) {
+        if (n == from) {
+            continue;
+        }
+        reply.len = 0;
+        if (n->deliver(f, &reply) && !acked) {
+            acked = true;
+            *ack = reply;
+        }
+    }
+    return acked;
+}
+
+/****************************************************************************/
+
+EmuPeer::EmuPeer(const uint8_t* _address, uint8_t _addr_width, uint8_t _channel)
+  : addr_width(_addr_width), channel(_channel), rate(0), link_ok(true), received(0)
+{
+    memcpy(address, _address, 5);
+}
+
+bool EmuPeer::deliver(const EmuFrame& f, EmuFrame* ack)
+{
+    if (!link_ok || f.channel != channel || f.rate != rate || f.addr_width != addr_width
+        || memcmp(f.addr, address, addr_width) != 0) {
+        return false;
+    }
+    received++;
+    ack->len = 0;
+    return !f.noack;
+}
+
+bool EmuPeer::send(const uint8_t* _address, const void* data, uint8_t len, bool noack)
+{
+    EmuFrame f, ack;
+
+    if (!link_ok) {
+        return false;
+    }
+    f.channel = channel;
+    f.rate = rate;
+    f.addr_width = addr_width;
+    memcpy(f.addr, _address, 5);
+    f.len = len > 32 ? 32 : len;
+    memcpy(f.data, data, f.len);
+    f.noack = noack;
+    return EmuAir::transmit(this, f, &ack);
+}
+
+/****************************************************************************/
+
+Nrf24Emu::Nrf24Emu(SPI_TypeDef* _spi, GPIO_TypeDef* _csn_port, uint16_t _csn_pin, GPIO_TypeDef* _ce_port,
+                   uint16_t _ce_pin, GPIO_TypeDef* _irq_port, uint16_t _irq_pin)
+  : tx_ok(0), tx_failed(0), tx_retries(0), rx_ok(0), rx_dropped(0), max_spi_hz(0),
+    spi(_spi), csn_port(_csn_port), csn_pin(_csn_pin), ce_port(_ce_port), ce_pin(_ce_pin),
+    irq_port(_irq_port), irq_pin(_irq_pin), csn_low(false), ce_high(false), cmd(RF24_NOP), idx(0),
+    reuse(false), tx_busy(false), tx_end(0), tx_acked(false), tx_attempts(0), now(0)
+{
+    memset(regs, 0, sizeof(regs));
+    regs[NRF_CONFIG] = 0x08;
+    regs[EN_AA] = 0x3F;
+    regs[EN_RXADDR] = 0x03;
+    regs[SETUP_AW] = 0x03;
+    regs[SETUP_RETR] = 0x03;
+    regs[RF_CH] = 0x02;
+    regs[RF_SETUP] = 0x0E;
+    memset(rx_addr_p0, 0xE7, 5);
+    memset(rx_addr_p1, 0xC2, 5);
+    memset(tx_addr, 0xE7, 5);
+    regs[RX_ADDR_P2] = 0xC3;
+    regs[RX_ADDR_P3] = 0xC4;
+    regs[RX_ADDR_P4] = 0xC5;
+    regs[RX_ADDR_P5] = 0xC6;
+    txq.count = rxq.count = ackq.count = 0;
+}
+
+/****************************************************************************/
+
+void Nrf24Emu::push(Fifo& q, uint8_t pipe, const uint8_t* data, uint8_t len, bool noack)
+{
+    if (q.count >= 3) {
+        return;
+    }
+    q.pipe[q.count] = pipe;
+    q.len[q.count] = len;
+    q.noack[q.count] = noack;
+    memcpy(q.data[q.count], data, len);
+    q.count++;
+}
+
+void Nrf24Emu::pop(Fifo& q)
+{
+    if (!q.count) {
+        return;
+    }
+    for (uint8_t i = 1; i < q.count; i++) {
+        q.pipe[i - 1] = q.pipe[i];
+        q.len[i - 1] = q.len[i];
+        q.noack[i - 1] = q.noack[i];
+        memcpy(q.data[i - 1], q.data[i], 32);
+    }
+    q.count--;
+}
+
+/****************************************************************************/
+
+uint8_t Nrf24Emu::status(void) const
+{
+    uint8_t s = regs[NRF_STATUS] & (EMU_BIT(RX_DR) | EMU_BIT(TX_DS) | EMU_BIT(MAX_RT));
+    s |= (rxq.count ? rxq.pipe[0] : 7) << RX_P_NO;
+    if (txq.count >= 3) {
+        s |= EMU_BIT(TX_FULL);
+    }
+    return s;
+}
+
+uint8_t Nrf24Emu::fifoStatus(void) const
+{
+    uint8_t s = 0;
+    if (reuse) {
+        s |= EMU_BIT(TX_REUSE);
+    }
+    if (txq.count >= 3) {
+        s |= EMU_BIT(FIFO_FULL);
+    }
+    if (!txq.count) {
+        s |= EMU_BIT(TX_EMPTY);
+    }
+    if (rxq.count >= 3) {
+        s |= EMU_BIT(RX_FULL);
+    }
+    if (!rxq.count) {
+        s |= EMU_BIT(RX_EMPTY);
+    }
+    return s;
+}
+
+uint8_t Nrf24Emu::addrWidth(void) const
+{
+    // SETUP_AW 0 is illegal on the chip, it behaves as a 2 byte address
+    return (regs[SETUP_AW] & 0x03) + 2;
+}
+
+/****************************************************************************/
+
+uint8_t Nrf24Emu::readRegister(uint8_t reg, uint8_t i) const
+{
+    switch (reg) {
+    case NRF_STATUS:
+        return status();
+    case FIFO_STATUS:
+        return fifoStatus();
+    case RX_ADDR_P0:
+        return i < 5 ? rx_addr_p0[i] : 0;
+    case RX_ADDR_P1:
+        return i < 5 ? rx_addr_p1[i] : 0;
+    case TX_ADDR:
+        return i < 5 ? tx_addr[i] : 0;
+    default:
+        return regs[reg & REGISTER_MASK];
+    }
+}
+
+void Nrf24Emu::writeRegister(uint8_t reg, uint8_t i, uint8_t value)
+{
+    switch (reg) {
+    case NRF_STATUS:
+        regs[NRF_STATUS] &= ~(value & (EMU_BIT(RX_DR) | EMU_BIT(TX_DS) | EMU_BIT(MAX_RT)));
+        // Clearing MAX_RT with CE still high resumes with the same payload
+        if ((value & EMU_BIT(MAX_RT)) && ce_high && !tx_busy && txq.count
+            && (regs[NRF_CONFIG] & EMU_BIT(PWR_UP)) && !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX))) {
+            startTx(false);
+        }
+        break;
+    case FIFO_STATUS:
+    case OBSERVE_TX:
+    case CD:
+        break;
+    case RX_ADDR_P0:
+        if (i < 5) {
+            rx_addr_p0[i] = value;
+        }
+        break;
+    case RX_ADDR_P1:
+        if (i < 5) {
+            rx_addr_p1[i] = value;
+        }
+        break;
+    case TX_ADDR:
+        if (i < 5) {
+            tx_addr[i] = value;
+        }
+        break;
+    default:
+        if (i == 0) {
+            regs[reg & REGISTER_MASK] = value;
+        }
+        break;
+    }
+}
+
+/****************************************************************************/
+
+bool Nrf24Emu::selected(SPI_TypeDef* _spi)
+{
+    return _spi == spi && csn_low;
+}
+
+uint8_t Nrf24Emu::transfer(uint8_t mosi)
+{
+    uint8_t miso = exchange(mosi);
+
+    // The host samples before the bit has settled, everything shifts by one
+    if (max_spi_hz && emu_spi_hz(spi) > max_spi_hz) {
+        miso = (miso >> 1) | 0x80;
+    }
+    return miso;
+}
+
+uint8_t Nrf24Emu::exchange(uint8_t mosi)
+{
+    uint8_t miso = 0;
+
+    if (idx == 0) {
+        cmd = mosi;
+        idx++;
+        return status();
+    }
+
+    uint8_t i = idx - 1;
+    if (cmd <= (R_REGISTER | REGISTER_MASK)) {
+        miso = readRegister(cmd & REGISTER_MASK, i);
+    } else if ((cmd & 0xE0) == W_REGISTER) {
+        writeRegister(cmd & REGISTER_MASK, i, mosi);
+    } else if (cmd == R_RX_PAYLOAD) {
+        miso = (rxq.count && i < rxq.len[0]) ? rxq.data[0][i] : 0;
+    } else if (cmd == R_RX_PL_WID) {
+        miso = rxq.count ? rxq.len[0] : 0;
+    } else if (i < sizeof(buf)) {
+        buf[i] = mosi;
+    }
+    idx++;
+    return miso;
+}
+
+void Nrf24Emu::endCommand(void)
+{
+    uint8_t n = idx ? idx - 1 : 0;
+
+    if (idx == 0) {
+        return;
+    }
+    if (cmd == R_RX_PAYLOAD) {
+        pop(rxq);
+    } else if (cmd == W_TX_PAYLOAD || cmd == W_TX_PAYLOAD_NO_ACK) {
+        if (txq.count < 3) {
+            push(txq, 0, buf, n > 32 ? 32 : n, cmd == W_TX_PAYLOAD_NO_ACK);
+            reuse = false;
+            if (ce_high && !tx_busy && (regs[NRF_CONFIG] & EMU_BIT(PWR_UP)) && !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX))
+                && !(regs[NRF_STATUS] & EMU_BIT(MAX_RT))) {
+                startTx(false);            // standby-II, no settling
+            }
+        }
+    } else if ((cmd & 0xF8) == W_ACK_PAYLOAD) {
+        push(ackq, cmd & 0x07, buf, n > 32 ? 32 : n, false);
+    } else if (cmd == FLUSH_TX) {
+        txq.count = 0;
+        reuse = false;
+    } else if (cmd == FLUSH_RX) {
+        rxq.count = 0;
+    } else if (cmd == REUSE_TX_PL) {
+        reuse = true;
+    }
+    idx = 0;
+}
+
+/****************************************************************************/
+
+void Nrf24Emu::pinChanged(GPIO_TypeDef* port, uint16_t pin, bool level)
+{
+    if (port == csn_port && pin == csn_pin) {
+        if (!level && !csn_low) {
+            idx = 0;
+        } else if (level && csn_low) {
+            endCommand();
+        }
+        csn_low = !level;
+    } else if (port == ce_port && pin == ce_pin) {
+        bool rising = level && !ce_high;
+        ce_high = level;
+        if (rising && !tx_busy && txq.count && (regs[NRF_CONFIG] & EMU_BIT(PWR_UP))
+            && !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX)) && !(regs[NRF_STATUS] & EMU_BIT(MAX_RT))) {
+            startTx(true);
+        }
+    }
+}
+
+int Nrf24Emu::pinLevel(GPIO_TypeDef* port, uint16_t pin)
+{
+    if (!irq_port || port != irq_port || pin != irq_pin) {
+        return -1;
+    }
+    uint8_t pending = regs[NRF_STATUS] & ~regs[NRF_CONFIG] & (EMU_BIT(RX_DR) | EMU_BIT(TX_DS) | EMU_BIT(MAX_RT));
+    return pending ? 0 : 1;
+}
+
+/****************************************************************************/
+
+uint64_t Nrf24Emu::airTime(uint8_t len) const
+{
+    uint32_t bits_per_us;
+    uint8_t crc = (regs[NRF_CONFIG] & EMU_BIT(EN_CRC)) ? ((regs[NRF_CONFIG] & EMU_BIT(CRCO)) ? 2 : 1) : 0;
+    uint32_t bits = 8U * (1U + addrWidth() + len + crc) + 9U;
+
+    if (regs[RF_SETUP] & EMU_BIT(RF_DR_LOW)) {
+        return (uint64_t)bits * 4000ULL;           // 250kbps
+    }
+    bits_per_us = (regs[RF_SETUP] & EMU_BIT(RF_DR_HIGH)) ? 2 : 1;
+    return (uint64_t)bits * 1000ULL / bits_per_us;
+}
+
+void Nrf24Emu::startTx(bool settle)
+{
+    EmuFrame f, ack;
+    uint8_t arc = regs[SETUP_RETR] & 0x0F;
+    uint64_t ard = (((regs[SETUP_RETR] >> 4) & 0x0F) + 1) * 250000ULL;
+    bool want_ack = !txq.noack[0] && (regs[EN_AA] & EMU_BIT(ENAA_P0));
+
+    f.channel = regs[RF_CH];
+    f.rate = (regs[RF_SETUP] & EMU_BIT(RF_DR_LOW)) ? 2 : ((regs[RF_SETUP] & EMU_BIT(RF_DR_HIGH)) ? 1 : 0);
+    f.addr_width = addrWidth();
+    memcpy(f.addr, tx_addr, 5);
+    f.len = txq.len[0];
+    memcpy(f.data, txq.data[0], f.len);
+    f.noack = !want_ack;
+
+    uint64_t t = now + (settle ? EMU_SETTLE_NS : 0);
+    tx_attempts = 0;
+    for (;;) {
+        bool acked = EmuAir::transmit(this, f, &ack);
+        t += airTime(f.len);
+        if (!want_ack) {
+            tx_acked = true;
+            break;
+        }
+        if (acked) {
+            t += EMU_SETTLE_NS + airTime(ack.len);
+            tx_acked = true;
+            if (ack.len) {
+                push(rxq, 0, ack.data, ack.len, false);
+            }
+            break;
+        }
+        if (tx_attempts >= arc) {
+            t += EMU_SETTLE_NS;
+            tx_acked = false;
+            break;
+        }
+        tx_attempts++;
+        t += ard;
+    }
+    tx_busy = true;
+    tx_end = t;
+}
+
+void Nrf24Emu::finishTx(void)
+{
+    tx_busy = false;
+    regs[OBSERVE_TX] = (regs[OBSERVE_TX] & 0xF0) | tx_attempts;
+    tx_retries += tx_attempts;
+    if (tx_acked) {
+        tx_ok++;
+        regs[NRF_STATUS] |= EMU_BIT(TX_DS);
+        if (rxq.count && rxq.pipe[0] == 0 && !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX))) {
+            regs[NRF_STATUS] |= EMU_BIT(RX_DR);
+        }
+        if (!reuse) {
+            pop(txq);
+        }
+    } else {
+        tx_failed++;
+        regs[NRF_STATUS] |= EMU_BIT(MAX_RT);
+        if ((regs[OBSERVE_TX] >> 4) < 15) {
+            regs[OBSERVE_TX] += 0x10;
+        }
+    }
+    if (ce_high && txq.count && !(regs[NRF_STATUS] & EMU_BIT(MAX_RT)) && !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX))) {
+        startTx(false);
+    }
+}
+
+void Nrf24Emu::step(uint64_t now_ns)
+{
+    now = now_ns;
+    while (tx_busy && now >= tx_end) {
+        finishTx();
+    }
+}
+
+/****************************************************************************/
+
+bool Nrf24Emu::pipeMatch(const EmuFrame& f, uint8_t* pipe) const
+{
+    uint8_t aw = addrWidth();
+
+    if (f.addr_width != aw) {
+        return false;
+    }
+    for (uint8_t p = 0; p < 6; p++) {
+        if (!(regs[EN_RXADDR] & EMU_BIT(p))) {
+            continue;
+        }
+        if (p == 0) {
+            if (memcmp(f.addr, rx_addr_p0, aw) != 0) {
+                continue;
+            }
+        } else if (f.addr[0] != (p == 1 ? rx_addr_p1[0] : regs[RX_ADDR_P0 + p])
+                   || memcmp(f.addr + 1, rx_addr_p1 + 1, aw - 1) != 0) {
+            continue;
+        }
+        *pipe = p;
+        return true;
+    }
+    return false;
+}
+
+bool Nrf24Emu::deliver(const EmuFrame& f, EmuFrame* ack)
+{
+    uint8_t pipe, len;
+    uint8_t rate = (regs[RF_SETUP] & EMU_BIT(RF_DR_LOW)) ? 2 : ((regs[RF_SETUP] & EMU_BIT(RF_DR_HIGH)) ? 1 : 0);
+
+    if (!(regs[NRF_CONFIG] & EMU_BIT(PWR_UP)) || !(regs[NRF_CONFIG] & EMU_BIT(PRIM_RX)) || !ce_high
+        || f.channel != regs[RF_CH] || f.rate != rate || !pipeMatch(f, &pipe)) {
+        return false;
+    }
+
+    if ((regs[FEATURE] & EMU_BIT(EN_DPL)) && (regs[DYNPD] & EMU_BIT(pipe))) {
+        len = f.len;
+    } else {
+        len = regs[RX_PW_P0 + pipe];
+        if (!len) {
+            return false;
+        }
+    }
+
+    if (rxq.count >= 3) {
+        rx_dropped++;
+        return false;
+    }
+
+    uint8_t data[32];
+    memset(data, 0, sizeof(data));
+    memcpy(data, f.data, f.len < len ? f.len : len);
+    push(rxq, pipe, data, len, false);
+    regs[NRF_STATUS] |= EMU_BIT(RX_DR);
+    rx_ok++;
+
+    if (f.noack || !(regs[EN_AA] & EMU_BIT(pipe))) {
+        return false;
+    }
+    ack->len = 0;
+    if ((regs[FEATURE] & EMU_BIT(EN_ACK_PAY)) && ackq.count && ackq.pipe[0] == pipe) {
+        ack->len = ackq.len[0];
+        memcpy(ack->data, ackq.data[0], ack->len);
+        pop(ackq);
+    }
+    return true;
+}
@@ -0,0 +1,167 @@
+/*
+ Behavioural model of an nRF24L01+ for host builds of the RF24 driver.
+
+ The model speaks the SPI command set in a_nRF24L01.h, keeps the register
+ file, the three-deep TX and RX FIFOs and runs Enhanced ShockBurst with
+ auto-ack and auto-retransmit against a shared virtual air (EmuAir). Timing
+ follows the datasheet closely enough for benchmarking: 130us settling,
+ on-air time from data rate, address width, payload and CRC length, and
+ ARD/ARC from SETUP_RETR.
+ */
+
+#ifndef __RF24_EMU_H__
+#define __RF24_EMU_H__
+
+#include "hal_emu.h"
+
+/**
+ * One ESB frame on the virtual air.
+ */
+struct EmuFrame
+{
+  uint8_t channel;
+  uint8_t rate;                /**< rf24_datarate_e */
+  uint8_t addr_width;
+  uint8_t addr[5];             /**< LSB first, as written to the address registers */
+  uint8_t len;
+  uint8_t data[32];
+  bool    noack;
+};
+
+/**
+ * Anything that can hear and answer frames on the virtual air.
+ */
+class EmuAirNode
+{
+public:
+  EmuAirNode();
+  virtual ~EmuAirNode();
+
+  /**
+   * Offer a frame to this node.
+   *
+   * @param f The frame on air
+   * @param[out] ack Payload carried back in the ACK, len 0 if none
+   * @return True if this node received the frame and acknowledges it
+   */
+  virtual bool deliver(const EmuFrame& f, EmuFrame* ack) = 0;
+
+  EmuAirNode* next;
+};
+
+/**
+ * Shared medium. A transmission is offered to every other node; the first
+ * acknowledging node supplies the ACK.
+ */
+class EmuAir
+{
+public:
+  /** @return True if somebody acknowledged, @p ack filled in */
+  static bool transmit(EmuAirNode* from, const EmuFrame& f, EmuFrame* ack);
+  static uint32_t frames;
+};
+
+/**
+ * Scripted remote station: acknowledges frames on its address and can send
+ * frames of its own, without an SPI side.
+ */
+class EmuPeer : public EmuAirNode
+{
+public:
+  EmuPeer(const uint8_t* address, uint8_t addr_width = 5, uint8_t channel = 76);
+
+  bool deliver(const EmuFrame& f, EmuFrame* ack);
+
+  /** Send @p len bytes to @p address, @return true if acknowledged */
+  bool send(const uint8_t* address, const void* data, uint8_t len, bool noack = false);
+
+  uint8_t  address[5];
+  uint8_t  addr_width;
+  uint8_t  channel;
+  uint8_t  rate;
+  bool     link_ok;            /**< False to simulate an out of range peer */
+  uint32_t received;
+};
+
+/**
+ * The radio itself, attached to an SPI bus and two or three GPIOs.
+ */
+class Nrf24Emu : public EmuDevice, public EmuAirNode
+{
+public:
+  Nrf24Emu(SPI_TypeDef* spi, GPIO_TypeDef* csn_port, uint16_t csn_pin, GPIO_TypeDef* ce_port, uint16_t ce_pin,
+           GPIO_TypeDef* irq_port = NULL, uint16_t irq_pin = 0);
+
+  /* EmuDevice */
+  void    pinChanged(GPIO_TypeDef* port, uint16_t pin, bool level);
+  int     pinLevel(GPIO_TypeDef* port, uint16_t pin);
+  bool    selected(SPI_TypeDef* spi);
+  uint8_t transfer(uint8_t mosi);
+  void    step(uint64_t now_ns);
+
+  /* EmuAirNode */
+  bool deliver(const EmuFrame& f, EmuFrame* ack);
+
+  uint32_t tx_ok;              /**< Frames acknowledged, or sent with NOACK */
+  uint32_t tx_failed;          /**< Frames that hit MAX_RT */
+  uint32_t tx_retries;
+  uint32_t rx_ok;
+  uint32_t rx_dropped;         /**< Frames lost to a full RX FIFO */
+  uint32_t max_spi_hz;         /**< Above this clock MISO comes a bit late, 0 for no limit */
+
+private:
+  struct Fifo
+  {
+    uint8_t len[3];
+    uint8_t pipe[3];
+    bool    noack[3];
+    uint8_t data[3][32];
+    uint8_t count;
+  };
+
+  uint8_t exchange(uint8_t mosi);
+  uint8_t status(void) const;
+  uint8_t fifoStatus(void) const;
+  uint8_t readRegister(uint8_t reg, uint8_t idx) const;
+  void    writeRegister(uint8_t reg, uint8_t idx, uint8_t value);
+  void    endCommand(void);
+  void    startTx(bool settle);
+  void    finishTx(void);
+  uint64_t airTime(uint8_t len) const;
+  uint8_t  addrWidth(void) const;
+  bool     pipeMatch(const EmuFrame& f, uint8_t* pipe) const;
+  static void push(Fifo& q, uint8_t pipe, const uint8_t* data, uint8_t len, bool noack);
+  static void pop(Fifo& q);
+
+  SPI_TypeDef*  spi;
+  GPIO_TypeDef* csn_port;
+  uint16_t      csn_pin;
+  GPIO_TypeDef* ce_port;
+  uint16_t      ce_pin;
+  GPIO_TypeDef* irq_port;
+  uint16_t      irq_pin;
+
+  bool     csn_low;
+  bool     ce_high;
+  uint8_t  cmd;
+  uint8_t  idx;
+  uint8_t  buf[33];
+
+  uint8_t  regs[0x20];
+  uint8_t  rx_addr_p0[5];
+  uint8_t  rx_addr_p1[5];
+  uint8_t  tx_addr[5];
+
+  Fifo     txq;
+  Fifo     rxq;
+  Fifo     ackq;
+  bool     reuse;
+
+  bool     tx_busy;
+  uint64_t tx_end;
+  bool     tx_acked;
+  uint8_t  tx_attempts;
+  uint64_t now;
+};
+
+#endif // __RF24_EMU_H__
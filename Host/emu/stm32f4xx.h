@@ -0,0 +1,13 @@
+/**
+  ******************************************************************************
+  * @file    stm32f4xx.h
+  * @brief   Host stand-in for the STM32F4 device header, see stm32f4xx_hal.h.
+  ******************************************************************************
+  */
+
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+
+#include "stm32f4xx_hal.h"
+
+#endif /* __STM32F4xx_H */
@@ -0,0 +1,315 @@
+/**
+  ******************************************************************************
+  * @file    stm32f4xx_hal.h
+  * @brief   Host stand-in for the STM32F4 HAL.
+  *
+  *          Only what the firmware modules built on the host touch is
+  *          declared here. GPIO, SPI, I2C and the tick are backed by a
+  *          virtual clock in hal_emu.cpp so that delays and bus byte times
+  *          advance simulated time instead of wall time.
+  ******************************************************************************
+  */
+
+#ifndef __STM32F4xx_HAL_H
+#define __STM32F4xx_HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define __IO volatile
+#define UNUSED(X) (void)X
+
+typedef enum
+{
+  HAL_OK       = 0x00U,
+  HAL_ERROR    = 0x01U,
+  HAL_BUSY     = 0x02U,
+  HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+  HAL_UNLOCKED = 0x00U,
+  HAL_LOCKED   = 0x01U
+} HAL_LockTypeDef;
+
+#define __HAL_UNLOCK(__HANDLE__)  ((__HANDLE__)->Lock = HAL_UNLOCKED)
+
+/* GPIO ----------------------------------------------------------------------*/
+typedef struct
+{
+  uint16_t ODR;
+  uint16_t IDR;
+  uint8_t  index;
+} GPIO_TypeDef;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef emu_gpio[9];
+#define GPIOA (&emu_gpio[0])
+#define GPIOB (&emu_gpio[1])
+#define GPIOC (&emu_gpio[2])
+#define GPIOD (&emu_gpio[3])
+#define GPIOE (&emu_gpio[4])
+#define GPIOF (&emu_gpio[5])
+#define GPIOG (&emu_gpio[6])
+#define GPIOH (&emu_gpio[7])
+#define GPIOI (&emu_gpio[8])
+
+#define GPIO_PIN_0   ((uint16_t)0x0001)
+#define GPIO_PIN_1   ((uint16_t)0x0002)
+#define GPIO_PIN_2   ((uint16_t)0x0004)
+#define GPIO_PIN_3   ((uint16_t)0x0008)
+#define GPIO_PIN_4   ((uint16_t)0x0010)
+#define GPIO_PIN_5   ((uint16_t)0x0020)
+#define GPIO_PIN_6   ((uint16_t)0x0040)
+#define GPIO_PIN_7   ((uint16_t)0x0080)
+#define GPIO_PIN_8   ((uint16_t)0x0100)
+#define GPIO_PIN_9   ((uint16_t)0x0200)
+#define GPIO_PIN_10  ((uint16_t)0x0400)
+#define GPIO_PIN_11  ((uint16_t)0x0800)
+#define GPIO_PIN_12  ((uint16_t)0x1000)
+#define GPIO_PIN_13  ((uint16_t)0x2000)
+#define GPIO_PIN_14  ((uint16_t)0x4000)
+#define GPIO_PIN_15  ((uint16_t)0x8000)
+
+typedef struct
+{
+  uint32_t Pin;
+  uint32_t Mode;
+  uint32_t Pull;
+  uint32_t Speed;
+  uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_MODE_INPUT             (0x00000000U)
+#define GPIO_MODE_OUTPUT_PP         (0x00000001U)
+#define GPIO_MODE_OUTPUT_OD         (0x00000011U)
+#define GPIO_MODE_AF_PP             (0x00000002U)
+#define GPIO_MODE_AF_OD             (0x00000012U)
+#define GPIO_NOPULL                 (0x00000000U)
+#define GPIO_PULLUP                 (0x00000001U)
+#define GPIO_SPEED_FREQ_VERY_HIGH   (0x00000003U)
+
+/* Pin configuration is not modelled, the pins keep their levels */
+void          HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init);
+void          HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void          HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+
+/* SPI -----------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t CR1;
+  uint32_t SR;
+  uint32_t DR;
+  uint8_t  index;
+} SPI_TypeDef;
+
+extern SPI_TypeDef emu_spi[3];
+#define SPI1 (&emu_spi[0])
+#define SPI2 (&emu_spi[1])
+#define SPI3 (&emu_spi[2])
+
+#define SPI_CR1_BR_Pos              (3U)
+#define SPI_CR1_BR                  (0x7UL << SPI_CR1_BR_Pos)
+#define SPI_CR1_SPE                 (0x1UL << 6U)
+#define SPI_CR1_CPHA                (0x1UL << 0U)
+#define SPI_CR1_CPOL                (0x1UL << 1U)
+
+#define SPI_BAUDRATEPRESCALER_2     (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_4     (0x00000008U)
+#define SPI_BAUDRATEPRESCALER_8     (0x00000010U)
+#define SPI_BAUDRATEPRESCALER_16    (0x00000018U)
+#define SPI_BAUDRATEPRESCALER_32    (0x00000020U)
+#define SPI_BAUDRATEPRESCALER_64    (0x00000028U)
+#define SPI_BAUDRATEPRESCALER_128   (0x00000030U)
+#define SPI_BAUDRATEPRESCALER_256   (0x00000038U)
+
+#define SPI_POLARITY_LOW            (0x00000000U)
+#define SPI_POLARITY_HIGH           SPI_CR1_CPOL
+#define SPI_PHASE_1EDGE             (0x00000000U)
+#define SPI_PHASE_2EDGE             SPI_CR1_CPHA
+
+typedef struct
+{
+  uint32_t BaudRatePrescaler;
+  uint32_t CLKPolarity;
+  uint32_t CLKPhase;
+} SPI_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef DMA_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma);
+
+typedef struct
+{
+  SPI_TypeDef       *Instance;
+  SPI_InitTypeDef   Init;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+} SPI_HandleTypeDef;
+
+#define __HAL_SPI_DISABLE(__HANDLE__) ((__HANDLE__)->Instance->CR1 &= ~SPI_CR1_SPE)
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout);
+/* The interrupt and DMA variants complete at once and call the callback
+   before returning */
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* I2C -----------------------------------------------------------------------*/
+#define HAL_I2C_MODULE_ENABLED
+
+typedef struct
+{
+  uint32_t CR1;
+  uint32_t SR2;
+  uint8_t  index;
+} I2C_TypeDef;
+
+extern I2C_TypeDef emu_i2c[3];
+#define I2C1 (&emu_i2c[0])
+#define I2C2 (&emu_i2c[1])
+#define I2C3 (&emu_i2c[2])
+
+#define I2C_CR1_PE                  (0x1UL << 0U)
+#define I2C_CR1_SWRST               (0x1UL << 15U)
+#define I2C_SR2_BUSY                (0x1UL << 1U)
+
+/* Only the SR2 flags are modelled */
+#define I2C_FLAG_BUSY               (0x00100002U)
+
+#define HAL_I2C_ERROR_NONE          (0x00000000U)
+#define HAL_I2C_ERROR_BERR          (0x00000001U)
+#define HAL_I2C_ERROR_ARLO          (0x00000002U)
+#define HAL_I2C_ERROR_AF            (0x00000004U)
+#define HAL_I2C_ERROR_OVR           (0x00000008U)
+#define HAL_I2C_ERROR_DMA           (0x00000010U)
+#define HAL_I2C_ERROR_TIMEOUT       (0x00000020U)
+
+#define I2C_FIRST_FRAME             (0x00000001U)
+#define I2C_FIRST_AND_NEXT_FRAME    (0x00000002U)
+#define I2C_NEXT_FRAME              (0x00000004U)
+#define I2C_FIRST_AND_LAST_FRAME    (0x00000008U)
+#define I2C_LAST_FRAME_NO_STOP      (0x00000010U)
+#define I2C_LAST_FRAME              (0x00000020U)
+
+typedef enum
+{
+  HAL_I2C_STATE_RESET = 0x00U,
+  HAL_I2C_STATE_READY = 0x20U
+} HAL_I2C_StateTypeDef;
+
+typedef struct
+{
+  uint32_t ClockSpeed;
+} I2C_InitTypeDef;
+
+typedef struct
+{
+  I2C_TypeDef                   *Instance;
+  I2C_InitTypeDef               Init;
+  DMA_HandleTypeDef             *hdmatx;
+  DMA_HandleTypeDef             *hdmarx;
+  HAL_LockTypeDef               Lock;
+  volatile HAL_I2C_StateTypeDef State;
+  volatile uint32_t             ErrorCode;
+} I2C_HandleTypeDef;
+
+#define __HAL_I2C_ENABLE(__HANDLE__)   ((__HANDLE__)->Instance->CR1 |= I2C_CR1_PE)
+#define __HAL_I2C_DISABLE(__HANDLE__)  ((__HANDLE__)->Instance->CR1 &= ~I2C_CR1_PE)
+#define __HAL_I2C_GET_FLAG(__HANDLE__, __FLAG__) \
+  (((__HANDLE__)->Instance->SR2 & ((__FLAG__) & 0xFFFFU)) != 0U)
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+uint32_t          HAL_I2C_GetError(I2C_HandleTypeDef *hi2c);
+/* Sets HAL_I2C_ERROR_AF when no device answered */
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint32_t Trials, uint32_t Timeout);
+/* As for SPI the interrupt and DMA variants run the whole phase before
+   returning, then call the complete or the error callback */
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                 uint16_t Size, uint32_t XferOptions);
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                uint16_t Size, uint32_t XferOptions);
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                  uint16_t Size, uint32_t XferOptions);
+HAL_StatusTypeDef HAL_I2C_Master_Seq_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData,
+                                                 uint16_t Size, uint32_t XferOptions);
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+/* PCD ---------------------------------------------------------------------*/
+/* Only the endpoint fields the USB device library reads, usbd_emu.cpp
+   stands in for the controller */
+typedef struct
+{
+  uint32_t maxpacket;
+  uint8_t  *xfer_buff;
+  uint32_t xfer_len;
+  uint32_t xfer_count;
+} PCD_EPTypeDef;
+
+typedef struct
+{
+  PCD_EPTypeDef IN_ep[16];
+  PCD_EPTypeDef OUT_ep[16];
+  void          *pData;
+} PCD_HandleTypeDef;
+
+/* RCC / core ----------------------------------------------------------------*/
+extern uint32_t SystemCoreClock;
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+uint32_t HAL_GetTick(void);
+void     HAL_Delay(uint32_t Delay);
+
+/* Cycle counter, CYCCNT follows the virtual clock */
+typedef struct
+{
+  uint32_t CTRL;
+  uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type* emu_dwt(void);
+extern CoreDebug_Type emu_coredebug;
+#define DWT                          (emu_dwt())
+#define CoreDebug                    (&emu_coredebug)
+#define DWT_CTRL_CYCCNTENA_Msk       (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk   (1UL << 24U)
+
+#define __DMB()           __sync_synchronize()
+#define __DSB()           __sync_synchronize()
+#define __disable_irq()   ((void)0)
+#define __enable_irq()    ((void)0)
+#define __get_PRIMASK()   (0U)
+#define __set_PRIMASK(x)  ((void)(x))
+#define __LDREXW(p)       (*(p))
+#define __STREXW(v, p)    (*(p) = (v), 0U)
+#define __CLREX()         ((void)0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F4xx_HAL_H */
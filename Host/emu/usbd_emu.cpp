@@ -0,0 +1,278 @@
+/*
+ Model of the USB full speed device controller, see usbd_emu.h.
+ */
+
+#include "usbd_emu.h"
+#include "usbd_core.h"
+#include "usbd_cdc.h"
+#include "usbd_cdc_if.h"
+
+#define EMU_USB_PACKET      64U
+#define EMU_USB_FRAME_NS    1000000ULL
+#define EMU_USB_SOF_BITS    40U            // SOF token and the gap after it
+#define EMU_USB_XACT_BITS   116U           // token, handshake, CRC, sync, EOPs and gaps of a data transaction
+#define EMU_USB_NAK_BITS    60U            // token and NAK
+
+USBD_HandleTypeDef hUsbDeviceFS;
+
+static PCD_HandleTypeDef emu_pcd;
+static UsbCdcEmu* emu_usb;
+
+/****************************************************************************/
+
+UsbCdcEmu::UsbCdcEmu(bool dtr)
+  : isr_cycles(800),
+    // RM0090: control and status entries take 18 words, each packet 16 plus one of status
+    rx_fifo_packets((USBD_FS_RX_FIFO_WORDS - 18U) / 17U), tx_fifo_packets(USBD_FS_TX1_FIFO_WORDS / 16U),
+    in_packets(0), in_zlps(0), in_short(0), in_transfers(0), in_naks(0), out_packets(0), out_transfers(0),
+    out_naks(0), busy_ns(0), bus_ns(emu_now_ns()), frame_ns(emu_now_ns()), in_step(false), in_first(true),
+    in_buf(NULL), in_len(0), in_done(0), in_busy(false), in_ready_ns(0), out_buf(NULL), out_len(0),
+    out_armed(false), out_ready_ns(0), to_send_pos(0)
+{
+    emu_usb = this;
+    memset(&hUsbDeviceFS, 0, sizeof(hUsbDeviceFS));
+    memset(&emu_pcd, 0, sizeof(emu_pcd));
+    for (int i = 0; i < 16; i++) {
+        emu_pcd.IN_ep[i].maxpacket = EMU_USB_PACKET;
+        emu_pcd.OUT_ep[i].maxpacket = EMU_USB_PACKET;
+    }
+    emu_pcd.pData = &hUsbDeviceFS;
+    hUsbDeviceFS.pData = &emu_pcd;
+    hUsbDeviceFS.dev_speed = USBD_SPEED_FULL;
+    hUsbDeviceFS.dev_state = USBD_STATE_CONFIGURED;
+
+    // What MX_USB_DEVICE_Init() and SET_CONFIGURATION do on the board
+    USBD_RegisterClass(&hUsbDeviceFS, &USBD_CDC);
+    USBD_CDC_RegisterInterface(&hUsbDeviceFS, &USBD_Interface_fops_FS);
+    USBD_SetClassConfig(&hUsbDeviceFS, 0);
+    setDTR(dtr);
+}
+
+UsbCdcEmu::~UsbCdcEmu()
+{
+    USBD_ClrClassConfig(&hUsbDeviceFS, 0);
+    emu_usb = NULL;
+}
+
+/****************************************************************************/
+
+void UsbCdcEmu::write(const void* data, uint32_t len)
+{
+    if (to_send_pos == to_send.size()) {
+        to_send.clear();
+        to_send_pos = 0;
+    }
+    to_send.insert(to_send.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+uint32_t UsbCdcEmu::pending(void) const
+{
+    return (uint32_t)(to_send.size() - to_send_pos);
+}
+
+void UsbCdcEmu::setDTR(bool dtr)
+{
+    USBD_SetupReqTypedef req;
+
+    req.bmRequest = USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
+    req.bRequest = CDC_SET_CONTROL_LINE_STATE;
+    req.wValue = dtr ? 1 : 0;
+    req.wIndex = 0;
+    req.wLength = 0;
+    hUsbDeviceFS.pClass->Setup(&hUsbDeviceFS, &req);
+}
+
+/****************************************************************************/
+
+uint64_t UsbCdcEmu::bitsNs(uint32_t n) const
+{
+    return (uint64_t)n * 1000ULL / 12ULL;
+}
+
+uint64_t UsbCdcEmu::isrNs(void) const
+{
+    return (uint64_t)isr_cycles * 1000000000ULL / SystemCoreClock;
+}
+
+/* When the firmware runs: in the interrupt that follows a bus event, or in
+ * the main loop */
+uint64_t UsbCdcEmu::deviceNow(void) const
+{
+    if (in_step) {
+        return bus_ns + isrNs();
+    }
+    return emu_now_ns() > bus_ns ? emu_now_ns() : bus_ns;
+}
+
+bool UsbCdcEmu::frameFits(uint64_t ns) const
+{
+    return bus_ns + ns <= frame_ns + EMU_USB_FRAME_NS;
+}
+
+void UsbCdcEmu::transmit(uint8_t ep, uint8_t* buf, uint32_t len)
+{
+    in_buf = buf;
+    in_len = len;
+    in_done = 0;
+    in_busy = true;
+    in_transfers++;
+    // The FIFO empty interrupt writes the first packet
+    in_ready_ns = deviceNow() + isrNs();
+    emu_pcd.IN_ep[ep & 0x7F].xfer_buff = buf;
+    emu_pcd.IN_ep[ep & 0x7F].xfer_len = len;
+    emu_pcd.IN_ep[ep & 0x7F].xfer_count = 0;
+}
+
+void UsbCdcEmu::prepareReceive(uint8_t ep, uint8_t* buf, uint32_t len)
+{
+    out_buf = buf;
+    out_len = len;
+    out_armed = true;
+    out_ready_ns = deviceNow();
+    emu_pcd.OUT_ep[ep & 0x7F].xfer_buff = buf;
+    emu_pcd.OUT_ep[ep & 0x7F].xfer_len = len;
+    emu_pcd.OUT_ep[ep & 0x7F].xfer_count = 0;
+}
+
+/****************************************************************************/
+
+void UsbCdcEmu::inPacket(void)
+{
+    uint32_t n = in_len - in_done < EMU_USB_PACKET ? in_len - in_done : EMU_USB_PACKET;
+
+    received.insert(received.end(), in_buf + in_done, in_buf + in_done + n);
+    in_done += n;
+    bus_ns += bitsNs(8U * n + EMU_USB_XACT_BITS);
+    busy_ns += bitsNs(8U * n + EMU_USB_XACT_BITS);
+    in_packets++;
+    in_zlps += n == 0 ? 1 : 0;
+    in_short += n < EMU_USB_PACKET ? 1 : 0;
+    if (n < EMU_USB_PACKET || in_done == in_len) {
+        in_busy = false;
+        emu_pcd.IN_ep[CDC_IN_EP & 0x7F].xfer_count = in_done;
+        USBD_LL_DataInStage(&hUsbDeviceFS, CDC_IN_EP & 0x7F, in_buf);
+        CDC_TxService_FS(0);
+    } else if (tx_fifo_packets < 2) {
+        in_ready_ns = bus_ns + isrNs();
+    }
+}
+
+void UsbCdcEmu::outPacket(void)
+{
+    PCD_EPTypeDef* ep = &emu_pcd.OUT_ep[CDC_OUT_EP & 0x7F];
+    uint32_t n = pending();
+
+    n = n < EMU_USB_PACKET ? n : EMU_USB_PACKET;
+    n = n < out_len - ep->xfer_count ? n : out_len - ep->xfer_count;
+    memcpy(out_buf + ep->xfer_count, &to_send[to_send_pos], n);
+    to_send_pos += n;
+    ep->xfer_count += n;
+    bus_ns += bitsNs(8U * n + EMU_USB_XACT_BITS);
+    busy_ns += bitsNs(8U * n + EMU_USB_XACT_BITS);
+    out_packets++;
+    if (n < EMU_USB_PACKET || ep->xfer_count == out_len) {
+        out_armed = false;
+        out_transfers++;
+        USBD_LL_DataOutStage(&hUsbDeviceFS, CDC_OUT_EP, out_buf);
+    } else if (rx_fifo_packets < 2) {
+        out_ready_ns = bus_ns + isrNs();
+    }
+}
+
+void UsbCdcEmu::step(uint64_t now_ns)
+{
+    in_step = true;
+    while (bus_ns < now_ns) {
+        if (bus_ns >= frame_ns + EMU_USB_FRAME_NS) {
+            frame_ns += EMU_USB_FRAME_NS;
+            bus_ns = frame_ns + bitsNs(EMU_USB_SOF_BITS);
+            USBD_LL_SOF(&hUsbDeviceFS);
+            CDC_TxService_FS(1);
+            continue;
+        }
+
+        bool in_want = in_busy;
+        bool out_want = pending() > 0;
+        bool in_now = in_want && in_ready_ns <= bus_ns;
+        bool out_now = out_want && out_armed && out_ready_ns <= bus_ns;
+        if (in_now && out_now) {
+            in_now = in_first;
+            out_now = !in_first;
+            in_first = !in_first;
+        }
+        if (in_now || out_now) {
+            uint32_t n = in_now ? in_len - in_done : pending();
+            n = n < EMU_USB_PACKET ? n : EMU_USB_PACKET;
+            if (!frameFits(bitsNs(8U * n + EMU_USB_XACT_BITS))) {
+                bus_ns = frame_ns + EMU_USB_FRAME_NS;
+            } else if (in_now) {
+                inPacket();
+            } else {
+                outPacket();
+            }
+            continue;
+        }
+
+        // Nothing ready: the host polls, NAKed, until the device is
+        uint64_t next = frame_ns + EMU_USB_FRAME_NS < now_ns ? frame_ns + EMU_USB_FRAME_NS : now_ns;
+        if (in_want && in_ready_ns < next) {
+            next = in_ready_ns;
+        }
+        if (out_want && out_armed && out_ready_ns < next) {
+            next = out_ready_ns;
+        }
+        if (in_want || out_want) {
+            in_naks += in_want ? 1 : 0;
+            out_naks += out_want ? 1 : 0;
+            busy_ns += next - bus_ns > bitsNs(EMU_USB_NAK_BITS) ? next - bus_ns : bitsNs(EMU_USB_NAK_BITS);
+            next = next > bus_ns + bitsNs(EMU_USB_NAK_BITS) ? next : bus_ns + bitsNs(EMU_USB_NAK_BITS);
+        }
+        bus_ns = next;
+    }
+    in_step = false;
+}
+
+/****************************************************************************/
+
+/* The USBD_LL_* glue of usbd_conf.c */
+
+USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef* pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_DeInit(USBD_HandleTypeDef* pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_Start(USBD_HandleTypeDef* pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_Stop(USBD_HandleTypeDef* pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps)
+{
+    return USBD_OK;
+}
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_FlushEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_StallEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_ClearStallEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr) { return USBD_OK; }
+uint8_t USBD_LL_IsStallEP(USBD_HandleTypeDef* pdev, uint8_t ep_addr) { return 0; }
+USBD_StatusTypeDef USBD_LL_SetUSBAddress(USBD_HandleTypeDef* pdev, uint8_t dev_addr) { return USBD_OK; }
+
+USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef* pdev, uint8_t ep_addr, uint8_t* pbuf, uint16_t size)
+{
+    if ((ep_addr & 0x7F) == (CDC_IN_EP & 0x7F) && emu_usb) {
+        emu_usb->transmit(ep_addr, pbuf, size);
+    }
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef* pdev, uint8_t ep_addr, uint8_t* pbuf, uint16_t size)
+{
+    if (ep_addr == CDC_OUT_EP && emu_usb) {
+        emu_usb->prepareReceive(ep_addr, pbuf, size);
+    }
+    return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef* pdev, uint8_t ep_addr)
+{
+    return emu_pcd.OUT_ep[ep_addr & 0x7F].xfer_count;
+}
+
+void USBD_LL_Delay(uint32_t Delay)
+{
+    HAL_Delay(Delay);
+}
@@ -0,0 +1,106 @@
+/*
+ Model of the USB full speed device controller for host builds of the CDC
+ path: usbd_cdc_if.c, the CDC class and the core of the ST USB device
+ library run unchanged on top of it.
+
+ The model stands in for usbd_conf.c, the USBD_LL_* glue to the HAL PCD
+ driver, and for the host controller. It does not enumerate: the
+ constructor configures the CDC class at once and the host asserts DTR.
+
+ The bus runs in bit times at 12 Mbit/s in 1 ms frames, each starting with
+ SOF. A bulk transaction costs its data plus token, handshake and gaps, so
+ that 19 packets of 64 bytes fit a frame, a NAKed one only the token and
+ the NAK. IN and OUT take turns when both are ready, no transaction starts
+ that would not end in its frame.
+
+ The OTG core side is what limits back to back packets. Every interrupt
+ (transfer complete, TX FIFO empty, RX FIFO level) runs "isr_cycles" of the
+ core clock after its event, so the host gets NAKs:
+ - after an IN transfer ends, until the completion interrupt has started the
+   next one and the FIFO empty interrupt has written its first packet;
+ - inside an IN transfer when the TX FIFO holds less than two packets;
+ - after an OUT transfer ends, until the completion interrupt re-arms;
+ - inside an OUT transfer when the RX FIFO holds less than two packets.
+ The FIFO depths come from the USBD_FS_*_FIFO_WORDS of usbd_conf.h. An IN
+ transfer ends with a short packet or its last full one, the class adds
+ the ZLP. Like usbd_conf.c, the model calls CDC_TxService_FS() after every
+ IN transfer and every SOF. An OUT transfer ends with a short packet or
+ when full, the core updates the count of the endpoint packet by packet.
+
+ The host side keeps what it has to send in an unbounded queue, write()
+ adds to it, and everything the device sends in "received".
+ */
+
+#ifndef __USBD_EMU_H__
+#define __USBD_EMU_H__
+
+#include <vector>
+#include "hal_emu.h"
+
+class UsbCdcEmu : public EmuDevice
+{
+public:
+  UsbCdcEmu(bool dtr = true);
+  ~UsbCdcEmu();
+
+  /* EmuDevice */
+  void step(uint64_t now_ns);
+
+  /** Queue bytes for the OUT endpoint */
+  void write(const void* data, uint32_t len);
+
+  /** Bytes queued by write() and not taken by the device yet */
+  uint32_t pending(void) const;
+
+  /** DTR, like opening and closing the port on the host */
+  void setDTR(bool dtr);
+
+  /* Called through the USBD_LL_* functions */
+  void transmit(uint8_t ep, uint8_t* buf, uint32_t len);
+  void prepareReceive(uint8_t ep, uint8_t* buf, uint32_t len);
+
+  std::vector<uint8_t> received;  /**< Everything the device sent on CDC IN */
+
+  uint32_t isr_cycles;            /**< Core cycles from a USB event to its interrupt handler done */
+  uint32_t rx_fifo_packets;       /**< OUT packets the RX FIFO holds */
+  uint32_t tx_fifo_packets;       /**< IN packets the CDC IN TX FIFO holds */
+
+  uint32_t in_packets;            /**< Data packets on CDC IN, ZLPs included */
+  uint32_t in_zlps;
+  uint32_t in_short;              /**< Packets under 64 bytes, ZLPs included */
+  uint32_t in_transfers;
+  uint32_t in_naks;               /**< Times the host met an IN endpoint not ready yet */
+  uint32_t out_packets;
+  uint32_t out_transfers;
+  uint32_t out_naks;              /**< Times the host had data for an OUT endpoint not ready */
+  uint64_t busy_ns;               /**< Bus time spent on transactions, NAKs included */
+
+private:
+  uint64_t bitsNs(uint32_t n) const;
+  uint64_t isrNs(void) const;
+  uint64_t deviceNow(void) const;
+  bool     frameFits(uint64_t ns) const;
+  void     inPacket(void);
+  void     outPacket(void);
+
+  uint64_t bus_ns;                // the bus is done up to here
+  uint64_t frame_ns;              // start of the current frame
+  bool     in_step;               // callbacks run from the bus, at bus_ns
+  bool     in_first;              // IN and OUT take turns when both are ready
+
+  uint8_t* in_buf;
+  uint32_t in_len;
+  uint32_t in_done;
+  bool     in_busy;
+  uint64_t in_ready_ns;           // the TX FIFO holds the next packet from here
+
+  uint8_t* out_buf;
+  uint32_t out_len;
+  bool     out_armed;
+  uint64_t out_ready_ns;          // the endpoint takes a packet from here
+
+  std::vector<uint8_t> to_send;
+  size_t   to_send_pos;
+};
+
+#endif // __USBD_EMU_H__
@@ -0,0 +1,51 @@
+/*
+ HTU21D conversion benchmark on the host.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DHTU21D_BENCH -I HTU21D/Inc \
+       Host/htu21d_bench/htu21d_bench_host.cpp HTU21D/src/HTU21D_bench.cpp HTU21D/src/HTU21D_fixed.cpp \
+       HTU21D/src/HTU21D_psychro.cpp -o htu21d_bench
+   ./htu21d_bench [-r rounds]
+
+ Ticks are nanoseconds of the host clock, so the absolute numbers only say
+ something about the host; the errors and the speedups are what carry over.
+ The board runs the same cases with the DWT cycle counter, see mainCPP.cpp.
+ The host has no DSP extension, the plain C paths of HTU21D_fixed.cpp are
+ timed here. The exit status is the number of failed cases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HTU21D_bench.h"
+
+static uint32_t bench_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void bench_sink(const char* line, uint16_t len)
+{
+    fwrite(line, 1, len, stdout);
+}
+
+int main(int argc, char** argv)
+{
+    HTU21D_BENCH_CONFIG config = { bench_ticks, 1000, bench_sink, 2000 };
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            config.rounds = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-r rounds]\n", argv[0]);
+            return 2;
+        }
+    }
+    return HTU21D_Bench(&config, NULL);
+}
@@ -0,0 +1,281 @@
+/*
+ HTU21D driver, I2C engine and scheduler on the host, against the emulated
+ sensors in Host/emu/htu21d_emu.h.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc -I HTU21D/Inc \
+       Host/htu21d_i2c/htu21d_i2c_host.cpp Host/emu/hal_emu.cpp Host/emu/htu21d_emu.cpp \
+       HTU21D/src/HTU21D.cpp HTU21D/src/HTU21D_fixed.cpp HTU21D/src/HTU21D_scheduler.cpp \
+       -x c++ MDK-ARM/Src/i2c_bus.c -x none \
+       -o htu21d_i2c
+   ./htu21d_i2c [-k clock_hz] [-s seconds] [-w]
+
+ Checks the commands of HTU21D.cpp against the model (identity, registers,
+ heater, soft reset, blocking and no hold master readings), then the error
+ paths: checksum failure, NACK of the trigger, a conversion that outlasts
+ the NACK retries, an unplugged sensor. Last it measures acquisition
+ throughput of an HTU21D at 0x40 and a Si7013 at 0x41: blocking hold
+ master reads one sensor after the other, against HTU21D_Scheduler with
+ overlapping conversions. -k sets the SCL clock (100 kHz), -s the virtual
+ seconds of the throughput runs (60), -w uses the maximum conversion times
+ of the datasheet instead of the typical ones.
+
+ Times are virtual, at the board's 16 MHz clock, they do not depend on the
+ host. The exit status is the number of failed checks.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_emu.h"
+#include "htu21d_emu.h"
+#include "HTU21D.h"
+#include "HTU21D_scheduler.h"
+
+#define LOOP_NS       20000ULL         // one pass of the main loop
+#define TIMEOUT_MS    1000U
+
+I2C_HandleTypeDef hi2c1;
+
+static int failed;
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler\n");
+    exit(100);
+}
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+/* Centi value of the driver within @p lsb of what the environment gives */
+static bool near(float value, double expected, double lsb)
+{
+    return fabs(value - expected) <= lsb;
+}
+
+/* Main loop around an asynchronous measurement, until it is over */
+static HTU21D_STATE await(HTU21D& sensor)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (!sensor.ready() && HAL_GetTick() - start < TIMEOUT_MS) {
+        sensor.service();
+        emu_advance_ns(LOOP_NS);
+    }
+    return sensor.state();
+}
+
+static void test_commands(Htu21dEmu& chip, Htu21dEmu& si)
+{
+    HTU21D sensor(HTU21D_RES_RH12_TEMP14, 0x40);
+    HTU21D si7013(HTU21D_RES_RH12_TEMP14, 0x41);
+    char line[96];
+
+    printf("-- commands --\n");
+    check(sensor.begin(), "begin() finds the HTU21D");
+    check(si7013.begin(), "begin() finds the Si7013 at 0x41");
+    check(sensor.readDeviceID() == 21 && si7013.readDeviceID() == 7013, "readDeviceID() 21 and 7013");
+    check(sensor.readFirmwareVersion() == 1 && si7013.readFirmwareVersion() == 2, "readFirmwareVersion() 1 and 2");
+
+    sensor.setResolution(HTU21D_RES_RH10_TEMP13);
+    check((chip.userRegister() & 0x81) == HTU21D_RES_RH10_TEMP13 && (chip.userRegister() & 0x38) == 0,
+          "setResolution() keeps the reserved bits");
+    sensor.setResolution(HTU21D_RES_RH12_TEMP14);
+
+    chip.vdd_low = true;
+    check(!sensor.batteryStatus(), "batteryStatus() sees the end of battery bit");
+    chip.vdd_low = false;
+
+    chip.temperature = 21.5;
+    chip.humidity = 43.0;
+    float t = sensor.readTemperature(HTU21D_TRIGGER_TEMP_MEASURE_HOLD);
+    float rh = sensor.readHumidity(HTU21D_TRIGGER_HUMD_MEASURE_NOHOLD);
+    snprintf(line, sizeof(line), "blocking readings %.2f C %.2f %%RH", t, rh);
+    check(near(t, 21.5, 0.02) && near(rh, 43.0, 0.05), line);
+
+    float heated;
+    sensor.setHeater(HTU21D_ON);
+    heated = sensor.readTemperature();
+    sensor.setHeater(HTU21D_OFF);
+    snprintf(line, sizeof(line), "setHeater() warms the die to %.2f C", heated);
+    check(near(heated, 21.5 + chip.heater_rise, 0.02) && near(sensor.readTemperature(), 21.5, 0.02), line);
+
+    sensor.setResolution(HTU21D_RES_RH8_TEMP12);
+    sensor.setHeater(HTU21D_ON);
+    sensor.softReset();
+    check((chip.userRegister() & 0x81) == HTU21D_RES_RH12_TEMP14 && (chip.userRegister() & 0x04),
+          "softReset() restores the resolution, keeps the heater");
+    sensor.setHeater(HTU21D_OFF);
+    sensor.setResolution(HTU21D_RES_RH12_TEMP14);
+
+    si.temperature = 30.0;
+    si.humidity = 70.0;
+    rh = si7013.readHumidity();
+    t = si7013.readTemperature(SI70xx_TEMP_READ_AFTER_RH_MEASURMENT);
+    snprintf(line, sizeof(line), "Si70xx temperature of the humidity conversion %.2f C", t);
+    check(near(rh, 70.0, 0.05) && near(t, 30.0, 0.02) && si.conversions == 1, line);
+
+    /* Hold master with a repeated start: the sensor stretches SCL */
+    i2c_xfer_t xfer;
+    uint8_t cmd = HTU21D_TRIGGER_TEMP_MEASURE_HOLD;
+    uint8_t frame[3];
+    uint64_t stretched = chip.stretched_ns;
+    i2c_xfer_init(&xfer, i2c_bus_get(&hi2c1), 0x40, &cmd, 1, frame, 3);
+    HAL_StatusTypeDef status = i2c_bus_run(&xfer);
+    t = HTU21D_TemperatureCenti((frame[0] << 8) | frame[1]) / 100.0f;
+    snprintf(line, sizeof(line), "hold master read stretches SCL %.1f ms", (chip.stretched_ns - stretched) / 1e6);
+    check(status == HAL_OK && HTU21D_CRC8(frame[0], frame[1]) == frame[2] && near(t, 21.5, 0.02) &&
+          chip.stretched_ns - stretched >= 40000000ULL, line);
+
+    /* No hold master, the driver reads at the Si7021 maximum & retries */
+    uint32_t busy = chip.nacked_busy;
+    bool ok = sensor.startTemperature() && await(sensor) == HTU21D_DONE;
+    snprintf(line, sizeof(line), "startTemperature() after %u NACKed reads", chip.nacked_busy - busy);
+    check(ok && near(sensor.centi(), 2150, 2) && chip.nacked_busy > busy, line);
+}
+
+static void test_errors(Htu21dEmu& chip)
+{
+    HTU21D sensor(HTU21D_RES_RH12_TEMP14, 0x40);
+
+    printf("-- error paths --\n");
+    chip.bad_crc = 1;
+    check(sensor.startHumidity() && await(sensor) == HTU21D_FAILED, "checksum failure, asynchronous");
+    chip.bad_crc = 1;
+    check(sensor.readHumidity() == HTU21D_ERROR, "checksum failure, blocking");
+    check(sensor.startHumidity() && await(sensor) == HTU21D_DONE, "next reading after the checksum failure");
+
+    chip.nack = 1;
+    check(sensor.startTemperature() && await(sensor) == HTU21D_FAILED, "NACK of the trigger");
+
+    chip.stall_us = 200000;
+    uint32_t start = HAL_GetTick();
+    HTU21D_STATE state = sensor.startHumidity() ? await(sensor) : HTU21D_IDLE;
+    char line[96];
+    snprintf(line, sizeof(line), "NACKed until the retries run out, %u ms", HAL_GetTick() - start);
+    check(state == HTU21D_FAILED && HAL_GetTick() - start >= HTU21D_NACK_RETRIES, line);
+    chip.stall_us = 0;
+    emu_advance_ns(250000000ULL);
+    check(sensor.startHumidity() && await(sensor) == HTU21D_DONE, "next reading after the stall");
+
+    chip.present = false;
+    check(!sensor.begin(), "begin() without a sensor");
+    check(sensor.startHumidity() && await(sensor) == HTU21D_FAILED, "startHumidity() without a sensor");
+    chip.present = true;
+}
+
+/* Readings per second of both sensors, read one after the other blocking */
+static double run_blocking(uint32_t seconds, HTU21D& a, HTU21D& b)
+{
+    uint32_t start = HAL_GetTick();
+    uint32_t readings = 0;
+    uint32_t errors = 0;
+
+    while (HAL_GetTick() - start < seconds * 1000U) {
+        errors += a.readCompensatedHumidity() == HTU21D_ERROR;
+        errors += b.readHumidity() == HTU21D_ERROR;
+        errors += b.readTemperature(SI70xx_TEMP_READ_AFTER_RH_MEASURMENT) == HTU21D_ERROR;
+        readings += 2;
+    }
+    printf("blocking:  %u readings, %u errors, %.1f readings/s\n", readings, errors,
+           readings * 1000.0 / (HAL_GetTick() - start));
+    return errors ? 0 : readings * 1000.0 / (HAL_GetTick() - start);
+}
+
+static uint32_t sched_errors;
+
+static void sched_check(uint8_t slot, const HTU21D_SAMPLE* reading, void* context)
+{
+    Htu21dEmu** chips = (Htu21dEmu**)context;
+
+    if (reading->compensated == HTU21D_FIXED_ERROR || fabs(reading->humidity - chips[slot]->humidity * 100) > 5 ||
+        fabs(reading->temperature - chips[slot]->temperature * 100) > 2) {
+        sched_errors++;
+    }
+}
+
+/* Same with the scheduler, period 0 */
+static double run_scheduler(uint32_t seconds, HTU21D& a, HTU21D& b, Htu21dEmu** chips)
+{
+    HTU21D_Scheduler sensors(&hi2c1);
+    uint64_t bytes = emu_i2c_bytes();
+
+    sensors.add(&a);
+    sensors.add(&b);
+    sched_errors = 0;
+    sensors.start(0, sched_check, chips);
+
+    uint32_t start = HAL_GetTick();
+    while (HAL_GetTick() - start < seconds * 1000U) {
+        sensors.service();
+        emu_advance_ns(LOOP_NS);
+    }
+    sensors.stop();
+
+    double rate = sensors.readings * 1000.0 / (HAL_GetTick() - start);
+    printf("scheduler: %u readings, %u failures, %u wrong, %.1f readings/s, cycle %u ms, bus %u us/cycle, "
+           "%.0f bytes/s\n", sensors.readings, sensors.failures, sched_errors, rate, sensors.cycleMs,
+           sensors.busUs, (emu_i2c_bytes() - bytes) * 1000.0 / (HAL_GetTick() - start));
+    return sensors.failures || sched_errors ? 0 : rate;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t clock = 100000;
+    uint32_t seconds = 60;
+    bool worst = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            clock = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            seconds = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-w")) {
+            worst = true;
+        } else {
+            fprintf(stderr, "usage: %s [-k clock_hz] [-s seconds] [-w]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* Same I2C1 setup as MX_I2C1_Init() */
+    hi2c1.Instance = I2C1;
+    hi2c1.Init.ClockSpeed = clock;
+    HAL_I2C_Init(&hi2c1);
+
+    Htu21dEmu chip(I2C1, EMU_HTU21D, 0x40);
+    Htu21dEmu si(I2C1, EMU_SI7013, 0x41);
+    Htu21dEmu* chips[2] = { &chip, &si };
+    chip.slow = si.slow = worst;
+
+    test_commands(chip, si);
+    test_errors(chip);
+
+    printf("-- throughput, %u s at %u Hz, %s conversion times --\n", seconds, clock, worst ? "maximum" : "typical");
+    HTU21D a(HTU21D_RES_RH12_TEMP14, 0x40);
+    HTU21D b(HTU21D_RES_RH12_TEMP14, 0x41);
+    a.begin();
+    b.begin();
+    chip.temperature = 24.0;
+    chip.humidity = 55.0;
+    si.temperature = 19.0;
+    si.humidity = 35.0;
+
+    double blocking = run_blocking(seconds, a, b);
+    double scheduled = run_scheduler(seconds, a, b, chips);
+    char line[96];
+    snprintf(line, sizeof(line), "scheduler x%.2f the readings of blocking reads, all correct",
+             blocking > 0 ? scheduled / blocking : 0);
+    check(blocking > 0 && scheduled > blocking, line);
+
+    printf("%d failed\n", failed);
+    return failed;
+}
@@ -0,0 +1,143 @@
+/*
+ Accuracy of the integer psychrometrics of HTU21D_psychro.h against libm.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -I HTU21D/Inc \
+       Host/htu21d_psychro/htu21d_psychro_host.cpp HTU21D/src/HTU21D_psychro.cpp \
+       -o htu21d_psychro -lm
+   ./htu21d_psychro [-s step]
+
+ Every temperature from -40°C to 125°C and every humidity from 0.01% to
+ 100%RH, in 1/100 or in "step" 1/100, goes through the integer functions
+ and through the formulas of the example in double with libm. Humidex is
+ checked over the dew points of the same grid as given, rounded to 1/100,
+ so that its own error is not mixed with the one of the dew point.
+ Results out of the int16_t range must come back as HTU21D_FIXED_ERROR.
+
+ The largest error and where it happens is reported per function. The exit
+ status is the number of functions above HTU21D_PSYCHRO_TOLERANCE. Cycles
+ per call on the board come from HTU21D_Bench(), see HTU21D_bench.h.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HTU21D_psychro.h"
+
+struct Worst {
+    const char* name;
+    double error;
+    int temperature;
+    int input;
+    double exact;
+    int value;
+    unsigned long checked;
+    unsigned long range;      // out of int16_t, error expected and returned
+    unsigned long wrong;      // error returned or missed where it should not be
+};
+
+static double dewPointExact(double t, double rh)
+{
+    double gamma = 17.271 * t / (237.7 + t) + log(rh / 100);
+
+    return 237.7 * gamma / (17.271 - gamma);
+}
+
+static double humidexExact(double t, double td)
+{
+    double e = 6.11 * exp(5417.7530 * ((1 / 273.16) - (1 / (273.16 + td))));
+
+    return t + 0.5555 * (e - 10);
+}
+
+static double absoluteExact(double t, double rh)
+{
+    return 216.7 * (rh / 100 * 6.112 * exp(17.62 * t / (243.12 + t))) / (273.15 + t);
+}
+
+static void check(Worst* w, int temperature, int input, double exact, int value)
+{
+    exact *= 100;
+
+    if (fabs(exact - 32767) <= HTU21D_PSYCHRO_TOLERANCE) {
+        return;                 // either way within the tolerance
+    }
+    if (exact > 32767) {
+        w->range++;
+        if (value != HTU21D_FIXED_ERROR) w->wrong++;
+        return;
+    }
+    if (value == HTU21D_FIXED_ERROR) {
+        w->wrong++;
+        return;
+    }
+    double error = fabs(value - exact);
+
+    w->checked++;
+    if (error > w->error) {
+        w->error = error;
+        w->temperature = temperature;
+        w->input = input;
+        w->exact = exact;
+        w->value = value;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int step = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            step = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-s step]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (step < 1) step = 1;
+
+    Worst dew, humidex, absolute;
+
+    memset(&dew, 0, sizeof(dew));
+    memset(&humidex, 0, sizeof(humidex));
+    memset(&absolute, 0, sizeof(absolute));
+    dew.name = "dewPoint";
+    humidex.name = "humidex";
+    absolute.name = "absolute";
+
+    for (int t = -4000; t <= 12500; t += step) {
+        for (int rh = 1; rh <= 10000; rh += step) {
+            double exact = dewPointExact(t / 100.0, rh / 100.0);
+
+            check(&dew, t, rh, exact, HTU21D_DewPointCenti(t, rh));
+            check(&absolute, t, rh, absoluteExact(t / 100.0, rh / 100.0), HTU21D_AbsoluteHumidityCenti(t, rh));
+
+            if (t > 500) {
+                int td = (int)lround(exact * 100);
+
+                check(&humidex, t, td, humidexExact(t / 100.0, td / 100.0), HTU21D_HumidexCenti(t, td));
+            } else if (HTU21D_HumidexCenti(t, (int)lround(exact * 100)) != HTU21D_FIXED_ERROR) {
+                humidex.wrong++;
+            }
+        }
+    }
+
+    Worst* all[] = { &dew, &humidex, &absolute };
+    int failed = 0;
+
+    for (int i = 0; i < 3; i++) {
+        Worst* w = all[i];
+        bool fail = w->error > HTU21D_PSYCHRO_TOLERANCE || w->wrong;
+
+        printf("%-9s err %5.3f at T %7.2f in %7.2f: %9.2f for %9.2f  %lu checked %lu out of range %lu wrong  %s\n",
+               w->name, w->error / 100, w->temperature / 100.0, w->input / 100.0, w->value / 100.0, w->exact / 100,
+               w->checked, w->range, w->wrong, fail ? "FAIL" : "ok");
+        failed += fail;
+    }
+    printf("-- %d of 3 functions failed --\n", failed);
+    return failed;
+}
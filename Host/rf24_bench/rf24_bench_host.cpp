@@ -0,0 +1,121 @@
+/*
+ RF24 benchmark on the host, against the emulated radio in Host/emu.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DRF24_BENCH -DRF24_EMULATED -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc \
+       Host/rf24_bench/rf24_bench_host.cpp Host/emu/hal_emu.cpp Host/emu/rf24_emu.cpp \
+       MDK-ARM/Src/a_RF24.cpp MDK-ARM/Src/a_RF24_trace.cpp MDK-ARM/Src/a_RF24_bench.cpp \
+       -x c++ MDK-ARM/Src/spi_bus.c -x none \
+       -o rf24_bench
+   ./rf24_bench [-n packets] [-r] [-c max_hz]
+
+ -r only reports, without checking RF24_BenchBudgetsEmu. -c runs
+ RF24::calibrateSPI() first, against a radio that garbles MISO above max_hz
+ (0 for no limit); the time budgets were recorded without it and are only
+ checked at SPI1/256, the byte and polling budgets at any clock. The exit status is
+ the number of cases over budget, so the run can gate a change to the driver.
+ The numbers are virtual time at the board's 16 MHz clock and SPI1 setup,
+ they do not depend on the speed of the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_emu.h"
+#include "rf24_emu.h"
+#include "main.h"
+#include "a_RF24.h"
+#include "a_RF24_bench.h"
+
+SPI_HandleTypeDef hspi1;
+
+static EmuPeer* peer;
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler\n");
+    exit(100);
+}
+
+static uint32_t bench_micros(void)
+{
+    return emu_micros();
+}
+
+/* The peer transmits back to back, roughly one frame time each */
+static void bench_feed(uint8_t count)
+{
+    static const uint8_t address[6] = RF24_BENCH_ADDRESS;
+    uint8_t payload[RF24_BENCH_PAYLOAD];
+
+    for (uint8_t i = 0; i < count; i++) {
+        memset(payload, i, sizeof(payload));
+        peer->send(address, payload, sizeof(payload));
+        emu_advance_ns(500000);
+    }
+}
+
+static void bench_sink(const char* line, uint16_t len)
+{
+    fwrite(line, 1, len, stdout);
+}
+
+int main(int argc, char** argv)
+{
+    static const uint8_t address[6] = RF24_BENCH_ADDRESS;
+    rf24_bench_config_t config;
+    bool check = true;
+    bool calibrate = false;
+    uint32_t max_hz = 0;
+    uint16_t packets = 100;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r")) {
+            check = false;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            packets = (uint16_t)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            calibrate = true;
+            max_hz = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-n packets] [-r] [-c max_hz]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* Same SPI1 setup as MX_SPI1_Init() */
+    hspi1.Instance = SPI1;
+    hspi1.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
+    hspi1.Init.CLKPolarity = SPI_POLARITY_LOW;
+    hspi1.Init.CLKPhase = SPI_PHASE_1EDGE;
+    HAL_SPI_Init(&hspi1);
+
+    Nrf24Emu chip(SPI1, CSel_GPIO_Port, CSel_Pin, TxRx_GPIO_Port, TxRx_Pin, INT_GPIO_Port, INT_Pin);
+    EmuPeer remote(address, 5, RF24_BENCH_CHANNEL);
+    peer = &remote;
+
+    RF24 radio(NRF24L01_CE_PIN, NRF24L01_CSN_PIN);
+    RF24_TraceInit();
+
+    if (calibrate) {
+        chip.max_spi_hz = max_hz;
+        radio.begin();
+        bool found = radio.calibrateSPI();
+        printf("-- SPI clock %u Hz%s --\n", radio.getSPIClock(), found ? "" : ", radio not answering");
+    }
+
+    config.micros = bench_micros;
+    config.feed = bench_feed;
+    config.budgets = check ? &RF24_BenchBudgetsEmu : NULL;
+    config.sink = bench_sink;
+    config.packets = packets;
+
+    uint8_t failed = RF24_Bench(radio, &config, NULL);
+
+    printf("radio: tx_ok=%u tx_failed=%u retries=%u rx_ok=%u rx_dropped=%u, peer received %u\n",
+           chip.tx_ok, chip.tx_failed, chip.tx_retries, chip.rx_ok, chip.rx_dropped, remote.received);
+    return failed;
+}
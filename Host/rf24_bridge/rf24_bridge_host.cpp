@@ -0,0 +1,380 @@
+/*
+ USB to radio bridge (RF24_BRIDGE) on the host: a_RF24_bridge.cpp,
+ cdc_command.cpp, telemetry.c and the real CDC stack over the USB model of
+ Host/emu/usbd_emu.h, the radios of Host/emu/rf24_emu.h.
+
+ Build and run from the repository root, the ST USB library is C:
+
+   gcc -c -O2 -DUSE_HAL_DRIVER -DSTM32F407xx -I Host/emu -I MDK-ARM/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Core/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Inc \
+       MDK-ARM/Src/usbd_cdc_if.c \
+       Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Src/usbd_cdc.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_core.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_ctlreq.c \
+       Middlewares/ST/STM32_USB_Device_Library/Core/Src/usbd_ioreq.c
+   g++ -std=gnu++11 -O2 -DRF24_BRIDGE -DRF24_EMULATED -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc -I HTU21D/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Core/Inc \
+       -I Middlewares/ST/STM32_USB_Device_Library/Class/CDC/Inc \
+       Host/rf24_bridge/rf24_bridge_host.cpp Host/emu/hal_emu.cpp Host/emu/rf24_emu.cpp \
+       Host/emu/usbd_emu.cpp MDK-ARM/Src/a_RF24.cpp MDK-ARM/Src/a_RF24_bridge.cpp \
+       MDK-ARM/Src/cdc_command.cpp HTU21D/src/HTU21D.cpp HTU21D/src/HTU21D_fixed.cpp \
+       HTU21D/src/HTU21D_scheduler.cpp \
+       -x c++ MDK-ARM/Src/spi_bus.c MDK-ARM/Src/i2c_bus.c MDK-ARM/Src/telemetry.c -x none \
+       usbd_cdc_if.o usbd_cdc.o usbd_core.o usbd_ctlreq.o usbd_ioreq.o -o rf24_bridge
+   ./rf24_bridge [-n payloads]
+
+ The PC writes CDC_CMD_RADIO_SEND frames as fast as USB takes them, a peer
+ acknowledges them on the air; another peer sends back to back to the
+ bridge, which forwards each payload as a TELEMETRY_RADIO record. Every
+ payload carries a sequence number, the checks want them all, in order,
+ once: nothing may be lost between the PC and the air in either direction,
+ the queue filling up must stop the PC instead. The reference rate is the
+ radio alone, writeFast() in a loop, and the peer sends at that rate. One
+ radio shares the air between directions and TX goes first; two radios
+ (RF24_DUAL_RADIO wiring) must keep 90 % of the reference both ways at
+ once. Last the peer goes out of range: payloads are counted failed and the
+ bridge carries on once it is back.
+
+ Times are virtual, at the 168 MHz of CLOCK_PROFILE_MAX. The exit status
+ is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "hal_emu.h"
+#include "rf24_emu.h"
+#include "usbd_emu.h"
+#include "main.h"
+#include "a_RF24.h"
+#include "a_RF24_bridge.h"
+#include "cdc_command.h"
+#include "telemetry.h"
+#include "usbd_cdc_if.h"
+
+#define LOOP_CYCLES   200              // the rest of the main loop
+#define CHANNEL_RX    10               // GATEWAY_RX_CHANNEL of mainCPP.cpp
+#define CHANNEL_TX    90               // GATEWAY_TX_CHANNEL
+#define HOST_WINDOW   4096             // bytes the PC keeps queued for CDC OUT
+#define RUN_LIMIT_MS  60000
+
+SPI_HandleTypeDef hspi1;
+SPI_HandleTypeDef hspi2;
+I2C_HandleTypeDef hi2c1;
+
+static const uint8_t to_peer[6] = "00001";
+static const uint8_t to_bridge[6] = "00002";
+static const uint8_t nobody[6] = "00009";
+
+static int failed;
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler\n");
+    exit(100);
+}
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+/****************************************************************************/
+
+/* Far end of the TX direction, checks the sequence numbers */
+class SinkPeer : public EmuPeer
+{
+public:
+    SinkPeer(uint8_t channel) : EmuPeer(to_peer, 5, channel), next(0), out_of_order(0) {}
+
+    bool deliver(const EmuFrame& f, EmuFrame* ack)
+    {
+        if (!EmuPeer::deliver(f, ack)) {
+            return false;
+        }
+        uint32_t seq;
+        memcpy(&seq, f.data, 4);
+        out_of_order += seq < next ? 1 : 0;
+        next = seq + 1;
+        return true;
+    }
+
+    uint32_t next;
+    uint32_t out_of_order;
+};
+
+static void fill(uint8_t* payload, uint32_t seq)
+{
+    memcpy(payload, &seq, 4);
+    for (uint8_t i = 4; i < 32; i++) {
+        payload[i] = (uint8_t)(seq + i);
+    }
+}
+
+/* CDC_CMD_RADIO_SEND of one payload */
+static void host_send(UsbCdcEmu& usb, uint32_t seq)
+{
+    uint8_t frame[4 + 32];
+    uint8_t check = 0;
+
+    frame[0] = CDC_CMD_SYNC;
+    frame[1] = CDC_CMD_RADIO_SEND;
+    frame[2] = 32;
+    fill(frame + 3, seq);
+    for (uint8_t i = 1; i < 35; i++) {
+        check ^= frame[i];
+    }
+    frame[35] = check;
+    usb.write(frame, sizeof(frame));
+}
+
+/* Splits CDC IN into records, undoes COBS and checks TELEMETRY_RADIO */
+struct HostReader {
+    size_t pos;
+    std::vector<uint8_t> frame;
+    uint32_t radio, next, out_of_order, bad, stats;
+
+    void read(const std::vector<uint8_t>& in)
+    {
+        for (; pos < in.size(); pos++) {
+            if (in[pos] != 0) {
+                frame.push_back(in[pos]);
+                continue;
+            }
+            std::vector<uint8_t> r;
+            for (size_t i = 0; i < frame.size();) {
+                uint8_t code = frame[i++];
+                for (uint8_t j = 1; j < code && i < frame.size(); j++) {
+                    r.push_back(frame[i++]);
+                }
+                if (code < 0xFF && i < frame.size()) {
+                    r.push_back(0);
+                }
+            }
+            frame.clear();
+            if (r.size() < 9) {
+                bad++;
+            } else if (r[0] == TELEMETRY_RADIO && r.size() == 7 + 1 + 32 + 2) {
+                uint32_t seq;
+                memcpy(&seq, &r[8], 4);
+                out_of_order += seq < next ? 1 : 0;
+                next = seq + 1;
+                radio++;
+            } else if (r[0] == TELEMETRY_STATS) {
+                stats++;
+            } else {
+                bad++;
+            }
+        }
+    }
+};
+
+/****************************************************************************/
+
+static void setup(RF24& radio, uint8_t channel)
+{
+    while (!radio.begin()) {
+    }
+    radio.calibrateSPI();
+    radio.setPALevel(RF24_PA_LOW);
+    radio.setDataRate(RF24_1MBPS);
+    radio.setCRCLength(RF24_CRC_16);
+    radio.setChannel(channel);
+}
+
+struct Run {
+    uint32_t tx;                       // payloads the PC sends, 0 for none
+    uint32_t rx;                       // payloads the source peer sends
+    double   ms;                       // virtual time until all is through
+    double   tx_rate, rx_rate;         // payloads per second
+    uint32_t peer_refused;             // source payloads nobody acknowledged
+    rf24_bridge_stats_t stats;
+    uint32_t sink_received, sink_out_of_order;
+    HostReader host;
+    uint32_t naks;
+};
+
+/* The source peer sends back to back like the radio alone: payload, ACK and
+ * the turnaround in between */
+static uint64_t source_interval_ns;
+
+static void run_bridge(RF24& tx, RF24& rx, SinkPeer& sink, EmuPeer& source, Run* run)
+{
+    UsbCdcEmu usb;
+    rf24_bridge_config_t config = { &tx, &rx, 32, 1000 };
+    cdc_command_config_t commands = { &tx, NULL, RF24_BridgeSend };
+    uint32_t written = 0, sourced = 0;
+    uint64_t start = emu_now_ns();
+    uint64_t next_source = start;
+    uint64_t tx_done = 0, rx_done = 0;
+    uint8_t payload[32];
+
+    static const telemetry_config_t telemetry = { CDC_Transmit_FS, emu_micros };
+    telemetry_init(&telemetry);
+    run->host = HostReader{};
+    sink.next = 0;
+    sink.out_of_order = 0;
+    sink.received = 0;
+    run->peer_refused = 0;
+
+    tx.openWritingPipe(to_peer);
+    rx.openReadingPipe(1, to_bridge);
+    RF24_BridgeBegin(&config);
+    CDC_CommandBegin(&commands);
+
+    while ((!tx_done || !rx_done) && emu_now_ns() - start < RUN_LIMIT_MS * 1000000ULL) {
+        while (written < run->tx && usb.pending() < HOST_WINDOW) {
+            host_send(usb, written++);
+        }
+        while (sourced < run->rx && emu_now_ns() >= next_source) {
+            fill(payload, sourced++);
+            run->peer_refused += source.send(to_bridge, payload, 32) ? 0 : 1;
+            next_source += source_interval_ns;
+        }
+
+        CDC_CommandPoll();
+        RF24_BridgePoll();
+        emu_advance_cycles(LOOP_CYCLES);
+
+        run->host.read(usb.received);
+        const rf24_bridge_stats_t* s = RF24_BridgeStats();
+        if (!tx_done && s->sent + s->failed == run->tx) {
+            tx_done = emu_now_ns();
+        }
+        if (!rx_done && sourced == run->rx && run->host.radio + s->rx_dropped + run->peer_refused >= run->rx) {
+            rx_done = emu_now_ns();
+        }
+    }
+    run->stats = *RF24_BridgeStats();
+    run->ms = (emu_now_ns() - start) / 1e6;
+    run->tx_rate = run->tx && tx_done ? run->tx * 1e9 / (tx_done - start) : 0;
+    run->rx_rate = run->rx && rx_done ? run->host.radio * 1e9 / (rx_done - start) : 0;
+    run->sink_received = sink.received;
+    run->sink_out_of_order = sink.out_of_order;
+    run->naks = usb.out_naks;
+}
+
+static void report(const char* name, const Run& r)
+{
+    printf("%-18s tx %5u/%5u %6.0f pkt/s, failed %u, queue full %u, NAKs %u | rx %5u/%5u %6.0f pkt/s, "
+           "fifo full %u, dropped %u, not acked %u\n",
+           name, r.sink_received, r.tx, r.tx_rate, r.stats.failed, r.stats.full, r.naks, r.host.radio, r.rx, r.rx_rate,
+           r.stats.rx_fifo_full, r.stats.rx_dropped, r.peer_refused);
+}
+
+/****************************************************************************/
+
+/* The radio alone: writeFast() back to back, payloads per second */
+static double alone_tx(RF24& radio, uint32_t n)
+{
+    uint8_t payload[32];
+    uint64_t start = emu_now_ns();
+
+    radio.openWritingPipe(to_peer);
+    radio.stopListening();
+    for (uint32_t i = 0; i < n; i++) {
+        fill(payload, i);
+        radio.writeFast(payload, 32);
+    }
+    radio.txStandBy();
+    return n * 1e9 / (emu_now_ns() - start);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t n = 2000;
+    char what[128];
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            n = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-n payloads]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* mainCPP.cpp bridges at CLOCK_PROFILE_MAX, the emulated APB clocks are
+     * HCLK: calibrateSPI() ends at 5.25 MHz either way */
+    SystemCoreClock = 168000000;
+
+    /* Same SPI setup as MX_SPI1_Init() and MX_SPI2_Init() */
+    hspi1.Instance = SPI1;
+    hspi2.Instance = SPI2;
+    hspi1.Init.BaudRatePrescaler = hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
+    HAL_SPI_Init(&hspi1);
+    HAL_SPI_Init(&hspi2);
+
+    Nrf24Emu chip(SPI1, CSel_GPIO_Port, CSel_Pin, TxRx_GPIO_Port, TxRx_Pin, INT_GPIO_Port, INT_Pin);
+    Nrf24Emu chip2(SPI2, CSel2_GPIO_Port, CSel2_Pin, TxRx2_GPIO_Port, TxRx2_Pin, INT2_GPIO_Port, INT2_Pin);
+    RF24 radio(NRF24L01_CE_PIN, NRF24L01_CSN_PIN);
+    RF24 listen(&hspi2, TxRx2_GPIO_Port, TxRx2_Pin, CSel2_GPIO_Port, CSel2_Pin, INT2_GPIO_Port, INT2_Pin);
+
+    /* One radio on one channel, as wired on the board */
+    SinkPeer sink(CHANNEL_RX);
+    EmuPeer source(nobody, 5, CHANNEL_RX);
+    setup(radio, CHANNEL_RX);
+    setup(listen, CHANNEL_TX + 10);
+
+    printf("-- one radio --\n");
+    double tx_alone = alone_tx(radio, n);
+    source_interval_ns = (uint64_t)(1e9 / tx_alone);
+    printf("radio alone        tx %6.0f pkt/s, one payload every %llu us\n", tx_alone,
+           (unsigned long long)source_interval_ns / 1000);
+
+    Run tx_only = { n, 0 };
+    run_bridge(radio, radio, sink, source, &tx_only);
+    report("tx", tx_only);
+    check(tx_only.sink_received == n && tx_only.sink_out_of_order == 0 && tx_only.stats.failed == 0,
+          "every payload from the PC on the air, in order, once");
+    check(tx_only.stats.full > 0 && tx_only.naks > 0, "a full queue stops the PC with NAKs on CDC OUT");
+    snprintf(what, sizeof(what), "tx %.0f pkt/s, at least 90 %% of the radio alone", tx_only.tx_rate);
+    check(tx_only.tx_rate >= 0.9 * tx_alone, what);
+
+    Run rx_only = { 0, n };
+    run_bridge(radio, radio, sink, source, &rx_only);
+    report("rx", rx_only);
+    check(rx_only.host.radio == n && rx_only.host.out_of_order == 0 && rx_only.peer_refused == 0 &&
+          rx_only.stats.rx_dropped == 0, "every payload from the air on CDC IN, in order, once");
+
+    Run both = { n, n };
+    run_bridge(radio, radio, sink, source, &both);
+    report("both", both);
+    check(both.sink_received == n && both.sink_out_of_order == 0, "both ways: TX loses nothing");
+    check(both.host.radio + both.peer_refused == n && both.host.out_of_order == 0 && both.stats.rx_dropped == 0,
+          "both ways: RX losses are all payloads the peer saw unacknowledged");
+
+    /* The RF24_DUAL_RADIO wiring: SPI1 sends on one channel, SPI2 listens on another */
+    printf("-- two radios --\n");
+    SinkPeer sink_tx(CHANNEL_TX);
+    setup(radio, CHANNEL_TX);
+    setup(listen, CHANNEL_RX);
+    Run dual = { n, n };
+    run_bridge(radio, listen, sink_tx, source, &dual);
+    report("both", dual);
+    check(dual.sink_received == n && dual.sink_out_of_order == 0 && dual.host.radio == n &&
+          dual.host.out_of_order == 0 && dual.peer_refused == 0, "both ways at once, nothing lost");
+    snprintf(what, sizeof(what), "both ways at 90 %% of the radio alone, tx %.0f, rx %.0f pkt/s", dual.tx_rate,
+             dual.rx_rate);
+    check(dual.tx_rate >= 0.9 * tx_alone && dual.rx_rate >= 0.9 * tx_alone, what);
+
+    printf("-- peer out of range --\n");
+    sink_tx.link_ok = false;
+    Run lost = { 20, 0 };
+    run_bridge(radio, listen, sink_tx, source, &lost);
+    report("tx", lost);
+    check(lost.stats.failed == 20 && lost.stats.sent == 0, "payloads without ACK counted failed");
+    sink_tx.link_ok = true;
+    Run back = { 20, 0 };
+    run_bridge(radio, listen, sink_tx, source, &back);
+    report("tx", back);
+    check(back.stats.sent == 20 && back.sink_received == 20, "the bridge carries on once the peer is back");
+
+    printf("-- %d failed --\n", failed);
+    return failed;
+}
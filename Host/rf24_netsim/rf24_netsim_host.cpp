@@ -0,0 +1,1051 @@
+/*
+ Discrete-event simulator of a floor of RF24 nodes sending to one gateway,
+ to plan how many nodes a cell carries before they are deployed.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -pthread -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc \
+       Host/rf24_netsim/rf24_netsim_host.cpp \
+       -x c++ MDK-ARM/Src/sample_ring.c -x none \
+       -o rf24_netsim
+   ./rf24_netsim [-n nodes] [-s aloha|tdma] [-m minutes] [options]
+   ./rf24_netsim -S 50,100,300,600 [options]
+   ./rf24_netsim -t
+
+ Nodes run the application of mainCPP.cpp: an HTU21D reading every -i ms
+ into sample_ring.c, the windows of HTU21D_WINDOW and
+ HTU21D_WINDOW_SAMPLES, and a loop pass every -l ms that writes the closed
+ summaries and a 20 byte text to the gateway with radio.write(), one after
+ the other, each blocking until acknowledged or MAX_RT. Payloads are the
+ static 32 bytes, all nodes share one address, as in the firmware. The
+ gateway (the RF24_BRIDGE dongle) listens all the time, acknowledges, and
+ its main loop takes a payload out of the three-deep RX FIFO every -g us.
+
+ Schemes: aloha is the firmware as it is, every node on its own loop from
+ a random boot time, crystals off by up to -D ppm. tdma is the slotted
+ variant, for comparison: pass k of node i starts at k x loop + i x loop /
+ nodes, within -y us of sync. -d 5+ gives node i the ARD 5 + i % 11,
+ as setRetries() from the node number would, aloha+ in the report.
+
+ The channel, like Host/emu/rf24_emu.cpp for timing: 130 us settling
+ before the first transmission, air time from the data rate, address,
+ payload and CRC, the ACK 130 us after the frame, a retransmission ARD
+ after the end of the frame, ARC of them at most (setRetries(), 5 and 15
+ from begin()). Power: PA level, log-distance path loss with exponent -e on
+ a floor of -f W x H metres, gateway in the middle, a fixed log-normal
+ shadowing per link and a fading per frame. A receiver listening and idle
+ locks on the first frame it hears above its sensitivity; frames starting
+ meanwhile only interfere, and the locked one survives if it stays above
+ the sensitivity and the co-channel C/I of its data rate over all the
+ frames that overlapped it: the capture effect. Half duplex: a gateway
+ sending an ACK hears nothing. Duplicates (ACK lost, frame sent again) are
+ dropped like the radio does, a full RX FIFO drops without an ACK. A node
+ waiting for its ACK takes any frame on its address as one, another node's
+ frame or the ACK of another node included: a "false ACK", the payload is
+ lost and the node never knows.
+
+ Time jumps from event to event. The channel orders everything in a run,
+ so cores take whole runs: the nodes of a sweep or of -r replications,
+ with their own seeds, and within a lone run the application of the nodes,
+ sample_ring.c, which does not depend on the air.
+
+ Each run prints the messages offered and delivered, the goodput, the
+ latency percentiles from a message ready (its window closed, its pass
+ started) to the gateway taking it out of the FIFO, the data frames that
+ overlapped another transmission, how lost frames were lost, retries per
+ message, MAX_RT, false ACKs and the channel occupancy.
+
+ With one ARD for every node, two writes that collide retry in lockstep
+ and collide until MAX_RT, then do the same with the next summary, and
+ loops started together stay together for as many passes as the crystals
+ take to drift a frame apart: 300 nodes of the firmware lose a third of
+ their messages on a channel busy 9 % of the time, where a spread ARD or
+ slots deliver 99.5 %.
+
+ -t checks the timing against the ESB arithmetic, capture and lockstep
+ retries, pure ALOHA against e^-2G, TDMA against ALOHA and that threads do
+ not change results. The exit status is the number of failed checks.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sample_ring.h"
+
+#define SETTLE_NS        130000ULL     // Tstby2a, and the turnaround to the ACK
+#define ADDR_WIDTH       5
+#define CRC_BYTES        2             // setCRCLength(RF24_CRC_16)
+#define TEXT_BYTES       20            // the text of the loop
+#define RX_FIFO          3
+#define PATH_LOSS_1M     40.05         // dB at 1 m, 2.4 GHz
+#define HISTORY          16            // sample_ring capacity per node, the windows matter here
+
+static int failed;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000U;
+}
+
+static uint64_t splitmix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static double to_mw(double dbm)
+{
+    return pow(10.0, dbm / 10.0);
+}
+
+/****************************************************************************/
+
+enum Scheme { SCHEME_ALOHA, SCHEME_TDMA };
+enum Rate { RATE_1M, RATE_2M, RATE_250K };   // as rf24_datarate_e
+
+static const char* const scheme_names[] = { "aloha", "tdma" };
+static const char* const rate_names[] = { "1M", "2M", "250k" };
+static const double rate_sensitivity[] = { -85.0, -82.0, -94.0 };  // dBm, nRF24L01+
+static const double rate_ci[] = { 9.0, 13.0, 12.0 };               // dB, co-channel C/I
+static const double pa_dbm[] = { -18.0, -12.0, -6.0, 0.0 };        // rf24_pa_dbm_e
+
+struct Config {
+    uint32_t nodes;
+    Scheme   scheme;
+    double   minutes;
+    Rate     rate;
+    uint8_t  ard, arc;                 // setRetries(delay, count)
+    bool     ard_spread;               // node i waits ard + i % (16 - ard)
+    uint8_t  pa;                       // rf24_pa_dbm_e
+    double   width, height;            // floor, metres
+    double   exponent;                 // path loss
+    double   shadow_db, fade_db;
+    uint32_t sample_ms;                // 0, no sensor: texts only
+    uint32_t window_ms, window_samples;
+    uint32_t loop_ms;
+    uint32_t drain_us;                 // gateway main loop, per payload
+    uint32_t sync_us;                  // tdma
+    double   drift_ppm;                // aloha
+    uint64_t seed;
+
+    // For the self test
+    double   ring;                     // > 0: every node at this distance, no shadowing
+    double   poisson;                  // > 0: Poisson frames per second per node, no ACK, no application
+    double   link_loss;                // frames the gateway misses anyway
+    bool     same_boot;                // every node boots at 0
+    std::vector<double> distance;      // per node, overrides the floor
+};
+
+static Config default_config(void)
+{
+    Config c;
+
+    c.nodes = 300;
+    c.scheme = SCHEME_ALOHA;
+    c.minutes = 60;
+    c.rate = RATE_1M;
+    c.ard = 5;
+    c.ard_spread = false;
+    c.arc = 15;
+    c.pa = 1;                          // setPALevel(RF24_PA_LOW)
+    c.width = 30;
+    c.height = 20;
+    c.exponent = 2.2;
+    c.shadow_db = 4;
+    c.fade_db = 2;
+    c.sample_ms = 2000;
+    c.window_ms = 300000;              // HTU21D_WINDOW
+    c.window_samples = 16;             // HTU21D_WINDOW_SAMPLES
+    c.loop_ms = 5000;
+    c.drain_us = 60;
+    c.sync_us = 100;
+    c.drift_ppm = 20;
+    c.seed = 1;
+    c.ring = 0;
+    c.poisson = 0;
+    c.link_loss = 0;
+    c.same_boot = false;
+    return c;
+}
+
+/* On-air time of a frame of "len" bytes, as Nrf24Emu::airTime() */
+static uint64_t air_ns(Rate rate, uint8_t len)
+{
+    uint64_t bits = 8U * (1U + ADDR_WIDTH + len + CRC_BYTES) + 9U;
+
+    return rate == RATE_250K ? bits * 4000U : rate == RATE_2M ? bits * 500U : bits * 1000U;
+}
+
+struct Stats {
+    uint64_t messages, delivered;
+    uint64_t max_rt, max_rt_lost;      // MAX_RT, and of them the gateway never had
+    uint64_t false_acks;               // "acknowledged" and never delivered
+    uint64_t frames, overlapped;
+    uint64_t lost_collision, lost_fade, lost_busy, fifo_full, duplicates;
+    uint64_t acks, acks_lost;
+    uint64_t attempts;
+    uint64_t air_ns;                   // time with something on the air
+    uint64_t overruns;                 // tdma passes past their slot
+    uint64_t write_min_ns, write_max_ns;  // radio.write(), the ones acknowledged
+    uint64_t fail_max_ns;              // radio.write() ending in MAX_RT
+    uint64_t bytes;                    // delivered payload, the summaries and texts themselves
+    double   seconds;
+    std::vector<uint32_t> latency_us;  // of every delivered message, sorted
+};
+
+/****************************************************************************/
+
+/* The summaries of one node, from sample_ring.c: ready times */
+static std::vector<uint64_t> node_summaries(const Config& c, uint64_t boot, double drift, uint64_t end)
+{
+    std::vector<uint64_t> ready;
+    sample_t history[HISTORY];
+    sample_ring_t ring;
+    sample_summary_t summary;
+    sample_t s;
+
+    if (c.sample_ms == 0) {
+        return ready;
+    }
+    sample_ring_init(&ring, history, HISTORY, c.window_ms, (uint16_t)c.window_samples);
+    memset(&s, 0, sizeof(s));
+    for (uint32_t k = 1;; k++) {
+        uint64_t t = boot + (uint64_t)((double)k * c.sample_ms * 1e6 * (1.0 + drift));
+        if (t >= end) {
+            break;
+        }
+        s.time = k * c.sample_ms;      // HAL_GetTick() of the node
+        s.value[0] = (int16_t)(1200 + (int)(splitmix(k) % 50));
+        s.value[1] = (int16_t)(2150 + (int)(splitmix(k + 1) % 50));
+        sample_ring_push(&ring, &s);
+        while (sample_ring_summary(&ring, &summary)) {
+            ready.push_back(t);
+        }
+    }
+    return ready;
+}
+
+/* Runs fn(0) to fn(n - 1) on up to "threads" threads */
+template <class F> static void parallel_for(size_t n, unsigned threads, F fn)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+
+    threads = (unsigned)std::min<size_t>(std::max(1U, threads), n);
+    for (unsigned i = 1; i < threads; i++) {
+        pool.push_back(std::thread([&] {
+            for (size_t k = next++; k < n; k = next++) {
+                fn(k);
+            }
+        }));
+    }
+    for (size_t k = next++; k < n; k = next++) {
+        fn(k);
+    }
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool[i].join();
+    }
+}
+
+class Sim
+{
+public:
+    Sim(const Config& c, unsigned threads) : c_(c), rng_(c.seed), now_(0), seq_(0), active_count_(0), busy_since_(0)
+    {
+        end_ = (uint64_t)(c.minutes * 60e9);
+        ack_ns_ = air_ns(c.rate, 0);
+        data_ns_ = air_ns(c.rate, 32);
+        sensitivity_ = rate_sensitivity[c.rate];
+        place();
+
+        // The application of every node, independent of the air
+        std::vector<std::vector<uint64_t> > ready(c.nodes);
+        parallel_for(c.nodes, threads, [&](size_t i) {
+            ready[i] = node_summaries(c, nodes_[i].boot, nodes_[i].drift, end_);
+        });
+        for (uint32_t i = 0; i < c.nodes; i++) {
+            for (size_t k = 0; k < ready[i].size(); k++) {
+                nodes_[i].summaries.push_back(message(ready[i][k], i, sizeof(sample_summary_t)));
+            }
+        }
+    }
+
+    Stats run(void)
+    {
+        stats_ = Stats();
+        stats_.write_min_ns = UINT64_MAX;
+        for (uint32_t i = 0; i < c_.nodes; i++) {
+            if (c_.poisson > 0) {
+                schedule(nodes_[i].boot, EV_ARRIVAL, (int)i + 1);
+            } else {
+                schedule(first_pass(i), EV_PASS, (int)i + 1);
+            }
+        }
+        rx_[0].listening = true;
+        listening_.push_back(0);
+
+        while (!events_.empty()) {
+            Event e = events_.top();
+            events_.pop();
+            now_ = e.t;
+            switch (e.type) {
+            case EV_PASS:        pass(e.a - 1); break;
+            case EV_ARRIVAL:     arrival(e.a - 1); break;
+            case EV_TX_START:    txStart(e.a); break;
+            case EV_TX_END:      txEnd(e.a); break;
+            case EV_LISTEN:      listen(e.a); break;
+            case EV_ACK_TIMEOUT: ackTimeout(e.a - 1); break;
+            case EV_DRAIN:       drain(); break;
+            }
+        }
+
+        stats_.messages = messages_.size();
+        stats_.seconds = end_ / 1e9;
+        std::sort(stats_.latency_us.begin(), stats_.latency_us.end());
+        return stats_;
+    }
+
+private:
+    enum { EV_TX_END, EV_LISTEN, EV_TX_START, EV_ACK_TIMEOUT, EV_DRAIN, EV_PASS, EV_ARRIVAL };
+    enum { KIND_DATA, KIND_ACK };
+
+    struct Event {
+        uint64_t t;
+        uint64_t seq;
+        int type, a;
+
+        bool operator>(const Event& o) const
+        {
+            // At the same time: ends first, then receivers on, then starts
+            return t != o.t ? t > o.t : type != o.type ? type > o.type : seq > o.seq;
+        }
+    };
+
+    struct Message {
+        uint64_t ready;
+        uint32_t node;
+        uint8_t  bytes;
+        bool     delivered;
+    };
+
+    struct Frame {
+        int      from;                 // station: 0 the gateway, nodes from 1
+        int      kind;
+        int      node;                 // the sender of the data, the one an ACK answers
+        uint32_t msg;
+        uint64_t start, end;
+        bool     wants_ack;
+        bool     overlapped;
+        bool     missed;               // the gateway could not lock on it
+    };
+
+    struct Receiver {
+        bool   listening;
+        int    locked;                 // frame, -1 none
+        double interference_mw;
+    };
+
+    struct Node {
+        double   x, y;
+        double   drift;
+        uint64_t boot;
+        double   gateway_dbm;          // both ways
+        std::vector<uint32_t> summaries;
+        size_t   next_summary;
+        std::deque<uint32_t> queue;    // this pass
+        uint64_t slot_end;
+        bool     sending;
+        uint32_t msg;
+        uint8_t  attempts;
+        uint64_t write_start, data_end;
+        uint64_t ard_ns;
+        bool     acked, acked_false;
+    };
+
+    void place(void)
+    {
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+
+        nodes_.resize(c_.nodes);
+        rx_.assign(c_.nodes + 1U, Receiver());
+        for (size_t i = 0; i < rx_.size(); i++) {
+            rx_[i].locked = -1;
+            rx_[i].listening = false;
+        }
+        gx_ = c_.width / 2;
+        gy_ = c_.height / 2;
+        for (uint32_t i = 0; i < c_.nodes; i++) {
+            Node& n = nodes_[i];
+            if (i < c_.distance.size() || c_.ring > 0) {
+                double d = i < c_.distance.size() ? c_.distance[i] : c_.ring, a = 2 * M_PI * i / c_.nodes;
+                n.x = gx_ + d * cos(a);
+                n.y = gy_ + d * sin(a);
+            } else {
+                n.x = u(rng_) * c_.width;
+                n.y = u(rng_) * c_.height;
+            }
+            n.drift = (2 * u(rng_) - 1) * c_.drift_ppm * 1e-6;
+            n.boot = c_.same_boot ? 0 : (uint64_t)(u(rng_) * c_.loop_ms * 1e6);
+            n.gateway_dbm = power(i + 1, 0);
+            n.ard_ns = (c_.ard + (c_.ard_spread ? i % (16U - c_.ard) : 0U) + 1U) * 250000ULL;
+            n.next_summary = 0;
+            n.sending = false;
+        }
+    }
+
+    /* Mean power from station a at station b, dBm: path loss and the
+     * shadowing of the link, the same both ways */
+    double power(int a, int b) const
+    {
+        double ax = a ? nodes_[a - 1].x : gx_, ay = a ? nodes_[a - 1].y : gy_;
+        double bx = b ? nodes_[b - 1].x : gx_, by = b ? nodes_[b - 1].y : gy_;
+        double d = std::max(1.0, hypot(ax - bx, ay - by));
+        double shadow = 0;
+
+        if (c_.shadow_db > 0 && c_.ring <= 0 && c_.distance.empty()) {
+            uint64_t h = splitmix(c_.seed ^ ((uint64_t)std::min(a, b) << 32 | (uint64_t)std::max(a, b)));
+            double u1 = ((h >> 11) + 0.5) / 9007199254740992.0, u2 = (splitmix(h) >> 11) / 9007199254740992.0;
+            shadow = c_.shadow_db * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+        }
+        return pa_dbm[c_.pa] - PATH_LOSS_1M - 10 * c_.exponent * log10(d) - shadow;
+    }
+
+    double station_power(int a, int b)
+    {
+        return a == 0 ? nodes_[b - 1].gateway_dbm : b == 0 ? nodes_[a - 1].gateway_dbm : power(a, b);
+    }
+
+    uint32_t message(uint64_t ready, uint32_t node, uint8_t bytes)
+    {
+        Message m = { ready, node, bytes, false };
+
+        messages_.push_back(m);
+        return (uint32_t)(messages_.size() - 1);
+    }
+
+    void schedule(uint64_t t, int type, int a)
+    {
+        Event e = { t, seq_++, type, a };
+
+        events_.push(e);
+    }
+
+    uint64_t first_pass(uint32_t i)
+    {
+        if (c_.scheme == SCHEME_TDMA) {
+            return tdma_pass(i, 0);
+        }
+        return nodes_[i].boot + (uint64_t)(c_.loop_ms * 1e6 * (1.0 + nodes_[i].drift));
+    }
+
+    uint64_t tdma_pass(uint32_t i, uint64_t k)
+    {
+        std::uniform_real_distribution<double> u(-1.0, 1.0);
+        uint64_t slot = (uint64_t)c_.loop_ms * 1000000U / c_.nodes;
+        int64_t t = (int64_t)(k * c_.loop_ms * 1000000ULL + i * slot) + (int64_t)(u(rng_) * c_.sync_us * 1000);
+
+        nodes_[i].slot_end = k * c_.loop_ms * 1000000ULL + (i + 1) * slot;
+        return (uint64_t)std::max<int64_t>(t, (int64_t)now_);
+    }
+
+    /* A loop pass: the summaries closed by now, then the text */
+    void pass(uint32_t i)
+    {
+        Node& n = nodes_[i];
+
+        if (now_ >= end_) {
+            return;
+        }
+        while (n.next_summary < n.summaries.size() && messages_[n.summaries[n.next_summary]].ready <= now_) {
+            n.queue.push_back(n.summaries[n.next_summary++]);
+        }
+        n.queue.push_back(message(now_, i, TEXT_BYTES));
+        write(i);
+    }
+
+    /* Poisson traffic of the self test: every frame on its own */
+    void arrival(uint32_t i)
+    {
+        std::exponential_distribution<double> gap(c_.poisson);
+
+        if (now_ >= end_) {
+            return;
+        }
+        nodes_[i].queue.push_back(message(now_, i, 32));
+        if (!nodes_[i].sending) {
+            write(i);
+        }
+        schedule(now_ + (uint64_t)(gap(rng_) * 1e9), EV_ARRIVAL, (int)i + 1);
+    }
+
+    /* radio.write() of the next message queued, or the end of the pass */
+    void write(uint32_t i)
+    {
+        Node& n = nodes_[i];
+
+        if (n.queue.empty()) {
+            n.sending = false;
+            if (c_.poisson > 0) {
+                return;
+            }
+            if (c_.scheme == SCHEME_TDMA) {
+                stats_.overruns += now_ > n.slot_end ? 1 : 0;
+                schedule(tdma_pass(i, n.slot_end / ((uint64_t)c_.loop_ms * 1000000U) + 1), EV_PASS, (int)i + 1);
+            } else {
+                schedule(now_ + (uint64_t)(c_.loop_ms * 1e6 * (1.0 + n.drift)), EV_PASS, (int)i + 1);
+            }
+            return;
+        }
+        n.sending = true;
+        n.msg = n.queue.front();
+        n.queue.pop_front();
+        n.attempts = 0;
+        n.write_start = now_;
+        transmit(now_ + SETTLE_NS, i + 1, KIND_DATA, (int)i, n.msg, c_.poisson <= 0);
+    }
+
+    void transmit(uint64_t t, int from, int kind, int node, uint32_t msg, bool wants_ack)
+    {
+        Frame f = { from, kind, node, msg, t, t + (kind == KIND_ACK ? ack_ns_ : data_ns_), wants_ack, false, false };
+        int id;
+
+        if (!free_.empty()) {
+            id = free_.back();
+            free_.pop_back();
+            frames_[id] = f;
+        } else {
+            id = (int)frames_.size();
+            frames_.push_back(f);
+        }
+        schedule(t, EV_TX_START, id);
+    }
+
+    void txStart(int id)
+    {
+        Frame& f = frames_[id];
+
+        if (active_count_++ == 0) {
+            busy_since_ = now_;
+        }
+        for (size_t k = 0; k < active_.size(); k++) {
+            frames_[active_[k]].overlapped = true;
+            f.overlapped = true;
+        }
+        if (f.kind == KIND_DATA) {
+            stats_.frames++;
+            stats_.attempts++;
+            f.missed = !rx_[0].listening || rx_[0].locked >= 0;
+            if (!rx_[0].listening) {
+                stats_.lost_busy++;
+            } else if (rx_[0].locked >= 0) {
+                stats_.lost_collision++;
+            }
+        } else {
+            stats_.acks++;
+        }
+
+        for (size_t k = 0; k < listening_.size(); k++) {
+            Receiver& r = rx_[listening_[k]];
+            double p = station_power(f.from, listening_[k]);
+            if (listening_[k] == f.from) {
+                continue;
+            }
+            if (r.locked >= 0) {
+                r.interference_mw += to_mw(p);
+            } else if (p >= sensitivity_ - 3 * c_.fade_db) {
+                r.locked = id;
+                r.interference_mw = 0;
+                for (size_t j = 0; j < active_.size(); j++) {
+                    r.interference_mw += to_mw(station_power(frames_[active_[j]].from, listening_[k]));
+                }
+            } else if (listening_[k] == 0 && f.kind == KIND_DATA && !f.missed) {
+                f.missed = true;
+                stats_.lost_fade++;
+            }
+        }
+        active_.push_back(id);
+        schedule(f.end, EV_TX_END, id);
+    }
+
+    /* Whether the receiver of a locked frame decodes it */
+    bool decoded(int station, const Frame& f, bool* faded)
+    {
+        std::normal_distribution<double> fade(0.0, 1.0);
+        double p = station_power(f.from, station) + (c_.fade_db > 0 ? c_.fade_db * fade(rng_) : 0.0);
+        Receiver& r = rx_[station];
+
+        *faded = p < sensitivity_;
+        if (station == 0 && c_.link_loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < c_.link_loss) {
+            *faded = true;
+        }
+        return !*faded && (r.interference_mw == 0 || p - 10 * log10(r.interference_mw) >= rate_ci[c_.rate]);
+    }
+
+    void txEnd(int id)
+    {
+        Frame f = frames_[id];
+
+        active_.erase(std::find(active_.begin(), active_.end(), id));
+        if (--active_count_ == 0) {
+            stats_.air_ns += now_ - busy_since_;
+        }
+        stats_.overlapped += f.kind == KIND_DATA && f.overlapped ? 1 : 0;
+
+        // The gateway answering stops listening: the receivers first
+        std::vector<int> locked;
+        for (size_t k = 0; k < listening_.size(); k++) {
+            if (rx_[listening_[k]].locked == id) {
+                locked.push_back(listening_[k]);
+                rx_[listening_[k]].locked = -1;
+            }
+        }
+        for (size_t k = 0; k < locked.size(); k++) {
+            int station = locked[k];
+            bool faded;
+            bool ok = decoded(station, f, &faded);
+            if (station == 0) {
+                if (!ok) {
+                    stats_.lost_fade += faded ? 1 : 0;
+                    stats_.lost_collision += faded ? 0 : 1;
+                } else {
+                    received(f);
+                }
+            } else if (ok) {
+                Node& n = nodes_[station - 1];
+                n.acked = true;
+                n.acked_false = f.kind != KIND_ACK || f.node != station - 1;
+            }
+        }
+        if (f.kind == KIND_ACK) {
+            stats_.acks_lost += nodes_[f.node].acked && !nodes_[f.node].acked_false ? 0 : 1;
+            schedule(now_ + SETTLE_NS, EV_LISTEN, 0);   // back to RX
+        } else if (f.wants_ack) {
+            Node& n = nodes_[f.node];
+            n.data_end = now_;
+            n.acked = false;
+            schedule(now_ + SETTLE_NS, EV_LISTEN, f.from);
+            schedule(now_ + SETTLE_NS + ack_ns_, EV_ACK_TIMEOUT, f.from);
+        } else {
+            done(f.node, true);
+        }
+        free_.push_back(id);
+    }
+
+    /* A data frame the gateway decoded */
+    void received(const Frame& f)
+    {
+        bool duplicate = last_.size() > (size_t)f.node && last_[f.node] == f.msg + 1;
+
+        if (fifo_.size() == RX_FIFO) {
+            stats_.fifo_full++;
+            return;                    // no ACK
+        }
+        if (duplicate) {
+            stats_.duplicates++;
+        } else {
+            last_.resize(std::max(last_.size(), (size_t)f.node + 1), 0);
+            last_[f.node] = f.msg + 1;
+            fifo_.push_back(f.msg);
+            if (fifo_.size() == 1) {
+                schedule(now_ + c_.drain_us * 1000ULL, EV_DRAIN, 0);
+            }
+        }
+        if (f.wants_ack) {
+            unlisten(0);
+            transmit(now_ + SETTLE_NS, 0, KIND_ACK, f.node, f.msg, false);
+        }
+    }
+
+    void drain(void)
+    {
+        Message& m = messages_[fifo_.front()];
+
+        fifo_.pop_front();
+        if (!m.delivered) {
+            m.delivered = true;
+            stats_.delivered++;
+            stats_.bytes += m.bytes;
+            stats_.latency_us.push_back((uint32_t)std::min<uint64_t>((now_ - m.ready) / 1000U, UINT32_MAX));
+        }
+        if (!fifo_.empty()) {
+            schedule(now_ + c_.drain_us * 1000ULL, EV_DRAIN, 0);
+        }
+    }
+
+    void listen(int station)
+    {
+        if (!rx_[station].listening) {
+            rx_[station].listening = true;
+            rx_[station].locked = -1;
+            listening_.push_back(station);
+        }
+    }
+
+    void unlisten(int station)
+    {
+        std::vector<int>::iterator it = std::find(listening_.begin(), listening_.end(), station);
+
+        rx_[station].listening = false;
+        rx_[station].locked = -1;
+        if (it != listening_.end()) {
+            listening_.erase(it);
+        }
+    }
+
+    void ackTimeout(uint32_t i)
+    {
+        Node& n = nodes_[i];
+
+        if (rx_[i + 1].locked >= 0) {
+            // An address matched in time: the radio takes the whole frame
+            schedule(frames_[rx_[i + 1].locked].end, EV_ACK_TIMEOUT, (int)i + 1);
+            return;
+        }
+        unlisten((int)i + 1);
+        if (n.acked) {
+            stats_.false_acks += n.acked_false && !messages_[n.msg].delivered && !inFifo(n.msg) ? 1 : 0;
+            done(i, true);
+            return;
+        }
+        if (n.attempts >= c_.arc) {
+            done(i, false);
+            return;
+        }
+        n.attempts++;
+        transmit(std::max(now_, n.data_end + n.ard_ns), (int)i + 1, KIND_DATA, (int)i, n.msg, true);
+    }
+
+    /* The end of radio.write() */
+    void done(uint32_t i, bool ok)
+    {
+        Node& n = nodes_[i];
+        uint64_t took = now_ - n.write_start;
+
+        if (ok) {
+            stats_.write_min_ns = std::min(stats_.write_min_ns, took);
+            stats_.write_max_ns = std::max(stats_.write_max_ns, took);
+        } else {
+            stats_.max_rt++;
+            stats_.max_rt_lost += messages_[n.msg].delivered || inFifo(n.msg) ? 0 : 1;
+            stats_.fail_max_ns = std::max(stats_.fail_max_ns, took);
+        }
+        write(i);
+    }
+
+    bool inFifo(uint32_t msg) const
+    {
+        return std::find(fifo_.begin(), fifo_.end(), msg) != fifo_.end();
+    }
+
+    Config c_;
+    std::mt19937_64 rng_;
+    uint64_t end_, now_;
+    uint64_t ack_ns_, data_ns_;
+    double sensitivity_;
+    double gx_, gy_;
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events_;
+    uint64_t seq_;
+    std::vector<Node> nodes_;
+    std::vector<Receiver> rx_;         // 0 the gateway
+    std::vector<int> listening_;
+    std::vector<Frame> frames_;
+    std::vector<int> free_;
+    std::vector<int> active_;          // frames on the air
+    uint32_t active_count_;
+    uint64_t busy_since_;
+    std::vector<Message> messages_;
+    std::deque<uint32_t> fifo_;        // gateway RX FIFO
+    std::vector<uint32_t> last_;       // per node, last message + 1: duplicates
+    Stats stats_;
+};
+
+/****************************************************************************/
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+static void header(void)
+{
+    printf("%5s %-6s %8s %7s %8s %27s %7s %21s %6s %6s %6s %5s\n", "nodes", "", "msg/s", "deliv", "B/s",
+           "latency p50/p90/p99/max ms", "overlap", "lost coll/fade/busy", "tries", "MAX_RT", "false", "air");
+}
+
+static void report(const Config& c, const Stats& s)
+{
+    char scheme[8];
+
+    snprintf(scheme, sizeof(scheme), "%s%s", scheme_names[c.scheme], c.ard_spread ? "+" : "");
+    printf("%5u %-6s %8.2f %6.2f%% %8.0f %6.1f/%6.1f/%6.1f/%6.0f %6.2f%% %6.2f/%6.2f/%6.2f%% %6.3f %6llu %6llu %4.1f%%\n",
+           c.nodes, scheme, s.messages / s.seconds,
+           s.messages ? 100.0 * s.delivered / s.messages : 0.0, s.bytes / s.seconds,
+           percentile(s.latency_us, 0.5) / 1e3, percentile(s.latency_us, 0.9) / 1e3,
+           percentile(s.latency_us, 0.99) / 1e3, percentile(s.latency_us, 1.0) / 1e3,
+           s.frames ? 100.0 * s.overlapped / s.frames : 0.0,
+           s.frames ? 100.0 * s.lost_collision / s.frames : 0.0, s.frames ? 100.0 * s.lost_fade / s.frames : 0.0,
+           s.frames ? 100.0 * s.lost_busy / s.frames : 0.0, s.messages ? (double)s.attempts / s.messages : 0.0,
+           (unsigned long long)s.max_rt, (unsigned long long)s.false_acks, 100.0 * s.air_ns / (s.seconds * 1e9));
+}
+
+/* Every run on its own thread, the nodes of a lone run across them */
+static std::vector<Stats> run_all(const std::vector<Config>& configs, unsigned threads)
+{
+    std::vector<Stats> results(configs.size());
+    unsigned inner = configs.size() < threads ? threads : 1;
+
+    parallel_for(configs.size(), threads, [&](size_t k) {
+        Sim sim(configs[k], inner);
+        results[k] = sim.run();
+    });
+    return results;
+}
+
+/****************************************************************************/
+
+static bool same_stats(const Stats& a, const Stats& b)
+{
+    return a.messages == b.messages && a.delivered == b.delivered && a.frames == b.frames &&
+           a.overlapped == b.overlapped && a.max_rt == b.max_rt && a.false_acks == b.false_acks &&
+           a.air_ns == b.air_ns && a.latency_us == b.latency_us;
+}
+
+static void self_test(void)
+{
+    char what[160];
+    Config c;
+    Stats s;
+
+    printf("-- timing --\n");
+    check(air_ns(RATE_1M, 32) == 329000 && air_ns(RATE_2M, 32) == 164500 && air_ns(RATE_250K, 32) == 1316000 &&
+          air_ns(RATE_1M, 0) == 73000, "air time: 329 us for 32 bytes at 1 Mbps, 73 us for an ACK");
+
+    // One node next to the gateway, texts only
+    c = default_config();
+    c.nodes = 1;
+    c.minutes = 1;
+    c.sample_ms = 0;
+    c.ring = 2;
+    c.fade_db = 0;
+    c.same_boot = true;                // passes at 5 s, 10 s, ... 55 s
+    s = Sim(c, 1).run();
+    snprintf(what, sizeof(what), "one node: %llu of %llu delivered in %.3f ms, write() %.3f ms",
+             (unsigned long long)s.delivered, (unsigned long long)s.messages, percentile(s.latency_us, 1.0) / 1e3,
+             s.write_max_ns / 1e6);
+    check(s.messages == 11 && s.delivered == 11 && s.attempts == 11 && s.latency_us.front() == 130 + 329 + 60 &&
+          s.latency_us.back() == 130 + 329 + 60 && s.write_min_ns == 662000 && s.write_max_ns == 662000, what);
+
+    c.link_loss = 1;
+    s = Sim(c, 1).run();
+    snprintf(what, sizeof(what), "link down: MAX_RT after 16 frames, 15 ARD of 1.5 ms, %.3f ms", s.fail_max_ns / 1e6);
+    check(s.delivered == 0 && s.max_rt == 11 && s.attempts == 11 * 16 &&
+          s.fail_max_ns == 130000 + 16 * 329000 + 15 * 1500000 + 130000 + 73000, what);
+
+    printf("-- collisions --\n");
+    c = default_config();
+    c.nodes = 2;
+    c.minutes = 0.09;                  // one pass
+    c.sample_ms = 0;
+    c.same_boot = true;
+    c.drift_ppm = 0;
+    c.fade_db = 0;
+    c.distance.push_back(3);
+    c.distance.push_back(3);
+    s = Sim(c, 1).run();
+    check(s.messages == 2 && s.delivered == 0 && s.max_rt == 2 && s.overlapped == 32,
+          "same ARD, same start: every retry collides again, both MAX_RT");
+
+    c.distance[0] = 1;
+    c.distance[1] = 10;
+    s = Sim(c, 1).run();
+    snprintf(what, sizeof(what), "capture: the near node through, the far one takes its ACK: %llu delivered, %llu false",
+             (unsigned long long)s.delivered, (unsigned long long)s.false_acks);
+    check(s.delivered == 1 && s.false_acks == 1 && s.max_rt == 0, what);
+
+    // Pure ALOHA: success e^-2G when only frames that overlap nothing get through
+    c = default_config();
+    c.nodes = 100;
+    c.minutes = 5;
+    c.ring = 5;
+    c.fade_db = 0;
+    c.poisson = 0.25 / 100 / 329e-6;
+    s = Sim(c, 1).run();
+    double success = (double)s.delivered / s.messages, expect = exp(-2 * 0.25);
+    snprintf(what, sizeof(what), "pure ALOHA at G = 0.25: %.4f of %llu frames through, e^-2G = %.4f", success,
+             (unsigned long long)s.messages, expect);
+    check(fabs(success - expect) < 0.01, what);
+
+    printf("-- 300 nodes, 30 minutes --\n");
+    std::vector<Config> configs;
+    c = default_config();
+    c.minutes = 30;
+    configs.push_back(c);
+    c.scheme = SCHEME_TDMA;
+    configs.push_back(c);
+    c.scheme = SCHEME_ALOHA;
+    c.ard_spread = true;
+    configs.push_back(c);
+    c.nodes = 600;
+    configs.push_back(c);
+
+    uint64_t start = now_us();
+    std::vector<Stats> serial = run_all(configs, 1);
+    double serial_s = (now_us() - start) / 1e6;
+    start = now_us();
+    std::vector<Stats> parallel = run_all(configs, 4);
+    double parallel_s = (now_us() - start) / 1e6;
+    header();
+    for (size_t k = 0; k < configs.size(); k++) {
+        report(configs[k], parallel[k]);
+    }
+    bool same = true;
+    for (size_t k = 0; k < configs.size(); k++) {
+        same = same && same_stats(serial[k], parallel[k]);
+    }
+    snprintf(what, sizeof(what), "4 threads give the results of 1: %.2f s, %.2f s on %ld cores", serial_s, parallel_s,
+             sysconf(_SC_NPROCESSORS_ONLN));
+    check(same, what);
+
+    const Stats& aloha = parallel[0];
+    const Stats& tdma = parallel[1];
+    const Stats& spread = parallel[2];
+    snprintf(what, sizeof(what), "TDMA: %.1f times fewer overlaps than ALOHA, more delivered, %llu slot overruns",
+             (double)aloha.overlapped / std::max<uint64_t>(1, tdma.overlapped), (unsigned long long)tdma.overruns);
+    check(tdma.overlapped * 4 < aloha.overlapped && tdma.delivered > aloha.delivered, what);
+    snprintf(what, sizeof(what), "ARD per node: retries out of lockstep, %.1f %% delivered against %.1f %%",
+             100.0 * spread.delivered / spread.messages, 100.0 * aloha.delivered / aloha.messages);
+    check(spread.delivered > aloha.delivered && spread.overlapped < aloha.overlapped, what);
+    check(aloha.messages > 300 * 360 && aloha.delivered + aloha.max_rt_lost + aloha.false_acks == aloha.messages,
+          "every message delivered, MAX_RT or lost to a false ACK");
+}
+
+/****************************************************************************/
+
+int main(int argc, char** argv)
+{
+    Config c = default_config();
+    std::vector<uint32_t> sweep;
+    unsigned threads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    unsigned replications = 1;
+    bool usage = false;
+
+    if (argc == 2 && !strcmp(argv[1], "-t")) {
+        self_test();
+        printf("-- %d failed --\n", failed);
+        return failed;
+    }
+    for (int i = 1; i < argc && !usage; i++) {
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        usage = v == NULL;
+        if (usage) {
+            break;
+        }
+        i++;
+        if (!strcmp(argv[i - 1], "-n")) {
+            c.nodes = (uint32_t)atoi(v);
+        } else if (!strcmp(argv[i - 1], "-s")) {
+            usage = strcmp(v, "aloha") && strcmp(v, "tdma");
+            c.scheme = !strcmp(v, "tdma") ? SCHEME_TDMA : SCHEME_ALOHA;
+        } else if (!strcmp(argv[i - 1], "-m")) {
+            c.minutes = atof(v);
+        } else if (!strcmp(argv[i - 1], "-R")) {
+            usage = strcmp(v, "1M") && strcmp(v, "2M") && strcmp(v, "250k");
+            c.rate = !strcmp(v, "2M") ? RATE_2M : !strcmp(v, "250k") ? RATE_250K : RATE_1M;
+        } else if (!strcmp(argv[i - 1], "-d")) {
+            c.ard = (uint8_t)(atoi(v) & 15);
+            c.ard_spread = strchr(v, '+') != NULL;
+        } else if (!strcmp(argv[i - 1], "-c")) {
+            c.arc = (uint8_t)(atoi(v) & 15);
+        } else if (!strcmp(argv[i - 1], "-p")) {
+            c.pa = (uint8_t)(atoi(v) & 3);
+        } else if (!strcmp(argv[i - 1], "-f")) {
+            usage = sscanf(v, "%lfx%lf", &c.width, &c.height) != 2;
+        } else if (!strcmp(argv[i - 1], "-e")) {
+            c.exponent = atof(v);
+        } else if (!strcmp(argv[i - 1], "-i")) {
+            c.sample_ms = (uint32_t)atoi(v);
+        } else if (!strcmp(argv[i - 1], "-l")) {
+            c.loop_ms = (uint32_t)atoi(v);
+        } else if (!strcmp(argv[i - 1], "-g")) {
+            c.drain_us = (uint32_t)atoi(v);
+        } else if (!strcmp(argv[i - 1], "-y")) {
+            c.sync_us = (uint32_t)atoi(v);
+        } else if (!strcmp(argv[i - 1], "-D")) {
+            c.drift_ppm = atof(v);
+        } else if (!strcmp(argv[i - 1], "-x")) {
+            c.seed = strtoull(v, NULL, 0);
+        } else if (!strcmp(argv[i - 1], "-r")) {
+            replications = (unsigned)std::max(1, atoi(v));
+        } else if (!strcmp(argv[i - 1], "-j")) {
+            threads = (unsigned)std::max(1, atoi(v));
+        } else if (!strcmp(argv[i - 1], "-S")) {
+            for (const char* p = v; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p)) {
+                sweep.push_back((uint32_t)atoi(p));
+            }
+        } else {
+            usage = true;
+        }
+    }
+    if (usage || c.nodes == 0 || c.minutes <= 0 || c.loop_ms == 0) {
+        fprintf(stderr, "usage: %s [-n nodes] [-s aloha|tdma] [-m minutes] [-S n,n,...] [-r runs] [-j threads]\n"
+                        "          [-R 1M|2M|250k] [-d ard[+]] [-c arc] [-p pa 0-3] [-f WxH m] [-e exponent]\n"
+                        "          [-i sample ms, 0 none] [-l loop ms] [-g gateway us] [-y sync us] [-D ppm] [-x seed]\n"
+                        "       %s -t\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    // A sweep runs both schemes at every size
+    std::vector<Config> configs;
+    if (sweep.empty()) {
+        sweep.push_back(c.nodes);
+    }
+    for (size_t k = 0; k < sweep.size(); k++) {
+        for (int scheme = 0; scheme < 2; scheme++) {
+            if (sweep.size() == 1 && argc > 1 && scheme != c.scheme) {
+                continue;
+            }
+            for (unsigned r = 0; r < replications; r++) {
+                Config run = c;
+                run.nodes = sweep[k];
+                run.scheme = (Scheme)scheme;
+                run.seed = c.seed + r;
+                configs.push_back(run);
+            }
+        }
+    }
+
+    printf("%s, ARD %u us%s, ARC %u, PA %.0f dBm, %.0f x %.0f m, %.0f min, sample %u ms, loop %u ms\n",
+           rate_names[c.rate], (c.ard + 1U) * 250U, c.ard_spread ? " and up" : "", c.arc, pa_dbm[c.pa], c.width, c.height, c.minutes, c.sample_ms,
+           c.loop_ms);
+    header();
+    std::vector<Stats> results = run_all(configs, threads);
+    for (size_t k = 0; k < configs.size(); k++) {
+        report(configs[k], results[k]);
+    }
+    return 0;
+}
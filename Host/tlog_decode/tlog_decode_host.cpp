@@ -0,0 +1,482 @@
+/*
+ Decoder of the CDC telemetry stream (telemetry.h) that formats the
+ tokenized log records of tlog.h on the host.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc \
+       Host/tlog_decode/tlog_decode_host.cpp \
+       -x c++ MDK-ARM/Src/tlog.c MDK-ARM/Src/telemetry.c -x none \
+       -o tlog_decode
+   ./tlog_decode MDK-ARM/iobee/iobee.axf capture.bin
+   ./tlog_decode -t
+
+ The format strings are read back from the image the board runs: the .axf
+ of the Keil build (tlog_strings$$Base) or any ELF built with GCC
+ (__start_tlog_strings), 32 or 64 bit. A token is the offset of its string
+ from that symbol. capture.bin is the raw byte stream of the CDC port, -
+ for stdin. TELEMETRY_TEXT and TELEMETRY_LOG records are printed with their
+ sequence and time, the time of a TELEMETRY_LOG record being when
+ tlog_drain() sent it. Other records are counted, bad ones too.
+
+ -t checks the round trip instead: this program logs with TLOG() into the
+ ring of tlog.c, drains it through telemetry.c into memory and decodes that
+ against its own executable. It checks the arguments, ring wrap and the
+ drop count when the ring is full. The exit status is the number of failed
+ checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "telemetry.h"
+#include "tlog.h"
+
+/* Type, sequence, time */
+#define RECORD_HEADER 7
+
+static int failed;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+/****************************************************************************/
+
+/* Format strings of one image, token to string */
+struct Strings {
+    std::vector<char> image;
+    size_t base;                       // file offset of token 0
+    size_t size;                       // bytes from there to the end of its section
+
+    const char* find(uint16_t token) const
+    {
+        if (token >= size || memchr(&image[base + token], 0, size - token) == NULL) {
+            return NULL;
+        }
+        return &image[base + token];
+    }
+};
+
+static uint64_t get(const std::vector<char>& f, size_t off, unsigned bytes)
+{
+    uint64_t value = 0;
+
+    if (off + bytes > f.size()) {
+        return 0;
+    }
+    for (unsigned i = bytes; i-- > 0;) {
+        value = (value << 8) | (uint8_t)f[off + i];
+    }
+    return value;
+}
+
+static bool read_file(const char* path, std::vector<char>* out)
+{
+    FILE* f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    char chunk[4096];
+    size_t n;
+
+    if (f == NULL) {
+        return false;
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        out->insert(out->end(), chunk, chunk + n);
+    }
+    if (f != stdin) {
+        fclose(f);
+    }
+    return true;
+}
+
+/* Finds the base symbol in the symbol table, then the section that holds
+ * its address. Little endian ELF only, like both targets */
+static bool load_strings(const char* path, Strings* s)
+{
+    std::vector<char>& f = s->image;
+
+    if (!read_file(path, &f) || f.size() < 64 || memcmp(&f[0], "\177ELF", 4) || f[5] != 1) {
+        fprintf(stderr, "%s: not a little endian ELF file\n", path);
+        return false;
+    }
+    bool wide = f[4] == 2;
+    unsigned word = wide ? 8 : 4;
+    uint64_t shoff = get(f, wide ? 0x28 : 0x20, word);
+    unsigned shentsize = (unsigned)get(f, wide ? 0x3A : 0x2E, 2);
+    unsigned shnum = (unsigned)get(f, wide ? 0x3C : 0x30, 2);
+
+    struct Section {
+        uint32_t type;
+        uint64_t addr, offset, size, entsize;
+        uint32_t link;
+    };
+    std::vector<Section> sections(shnum);
+    for (unsigned i = 0; i < shnum; i++) {
+        size_t h = (size_t)(shoff + (uint64_t)i * shentsize);
+        Section& sec = sections[i];
+        sec.type = (uint32_t)get(f, h + 4, 4);
+        sec.addr = get(f, h + (wide ? 0x10 : 0x0C), word);
+        sec.offset = get(f, h + (wide ? 0x18 : 0x10), word);
+        sec.size = get(f, h + (wide ? 0x20 : 0x14), word);
+        sec.link = (uint32_t)get(f, h + (wide ? 0x28 : 0x18), 4);
+        sec.entsize = get(f, h + (wide ? 0x38 : 0x24), word);
+    }
+
+    static const char* const bases[] = { "tlog_strings$$Base", "__start_tlog_strings" };
+    for (unsigned i = 0; i < shnum; i++) {
+        const Section& symtab = sections[i];
+        if (symtab.type != 2 /* SHT_SYMTAB */ || symtab.entsize == 0 || symtab.link >= shnum) {
+            continue;
+        }
+        const Section& strtab = sections[symtab.link];
+        for (uint64_t sym = symtab.offset; sym + symtab.entsize <= symtab.offset + symtab.size; sym += symtab.entsize) {
+            uint64_t name = strtab.offset + get(f, (size_t)sym, 4);
+            uint64_t value = get(f, (size_t)sym + (wide ? 8 : 4), word);
+
+            if (name >= f.size() || (strcmp(&f[name], bases[0]) && strcmp(&f[name], bases[1]))) {
+                continue;
+            }
+            for (unsigned j = 0; j < shnum; j++) {
+                const Section& sec = sections[j];
+                if (sec.type == 8 /* SHT_NOBITS */ || sec.addr == 0 || value < sec.addr ||
+                    value >= sec.addr + sec.size || sec.offset + sec.size > f.size()) {
+                    continue;
+                }
+                s->base = (size_t)(sec.offset + value - sec.addr);
+                s->size = (size_t)(sec.addr + sec.size - value);
+                return true;
+            }
+        }
+    }
+    fprintf(stderr, "%s: no tlog_strings, built without TLOG() or stripped\n", path);
+    return false;
+}
+
+/****************************************************************************/
+
+/* printf with the arguments of one record, integers only */
+static std::string format(const char* fmt, const uint32_t* args, unsigned count)
+{
+    std::string out;
+    unsigned next = 0;
+
+    while (*fmt) {
+        if (*fmt != '%') {
+            out += *fmt++;
+            continue;
+        }
+        if (fmt[1] == '%') {
+            out += '%';
+            fmt += 2;
+            continue;
+        }
+
+        std::string spec = "%";
+        fmt++;
+        while (*fmt && strchr("-+ #0", *fmt)) {
+            spec += *fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            spec += *fmt++;
+        }
+        if (*fmt == '.') {
+            spec += *fmt++;
+            while (*fmt >= '0' && *fmt <= '9') {
+                spec += *fmt++;
+            }
+        }
+        while (*fmt && strchr("hlzjt", *fmt)) {
+            fmt++;                     // every argument is 32 bits on the wire
+        }
+
+        char conv = *fmt ? *fmt++ : '\0';
+        char text[64];
+        if (!strchr("diuxXoc", conv) || conv == '\0') {
+            snprintf(text, sizeof(text), "<%%%c?>", conv ? conv : ' ');
+        } else if (next >= count) {
+            snprintf(text, sizeof(text), "<missing>");
+        } else if (conv == 'd' || conv == 'i') {
+            snprintf(text, sizeof(text), (spec + "ld").c_str(), (long)(int32_t)args[next++]);
+        } else if (conv == 'c') {
+            snprintf(text, sizeof(text), (spec + "c").c_str(), (int)(uint8_t)args[next++]);
+        } else {
+            snprintf(text, sizeof(text), (spec + "l" + conv).c_str(), (unsigned long)args[next++]);
+        }
+        out += text;
+    }
+    return out;
+}
+
+/* Decodes the entries of one TELEMETRY_LOG payload into lines */
+static unsigned decode_log(const Strings& strings, const uint8_t* p, unsigned len, std::vector<std::string>* lines)
+{
+    unsigned bad = 0;
+
+    while (len > 0) {
+        unsigned n = p[0];
+        if (n < 3 || n > len) {
+            lines->push_back("<bad log entry>");
+            return bad + 1;
+        }
+
+        uint16_t token = (uint16_t)(p[1] | (p[2] << 8));
+        uint32_t args[TLOG_ARGS];
+        unsigned count = 0;
+        for (unsigned i = 3; i < n && count < TLOG_ARGS; count++) {
+            uint32_t value = 0;
+            for (unsigned shift = 0; i < n && shift < 35; shift += 7) {
+                value |= (uint32_t)(p[i] & 0x7F) << shift;
+                if (!(p[i++] & 0x80)) {
+                    break;
+                }
+            }
+            args[count] = value;
+        }
+
+        const char* fmt = strings.find(token);
+        if (fmt == NULL) {
+            char text[32];
+            snprintf(text, sizeof(text), "<token %u?>", token);
+            lines->push_back(text);
+            bad++;
+        } else {
+            lines->push_back(format(fmt, args, count));
+        }
+        p += n;
+        len -= n;
+    }
+    return bad;
+}
+
+static uint16_t crc16(const uint8_t* p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc ^= (uint16_t)(*p++ << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+struct Counts {
+    unsigned records, bad, lost, other;
+};
+
+/* Splits the stream on 0x00, undoes COBS, checks the CRC and decodes the
+ * text of TELEMETRY_TEXT and TELEMETRY_LOG records, one line each */
+static Counts decode_stream(const Strings& strings, const std::vector<char>& stream, std::vector<std::string>* lines)
+{
+    Counts counts = { 0, 0, 0, 0 };
+    std::vector<uint8_t> frame, record;
+    bool first = true;
+    uint16_t expected = 0;
+
+    for (size_t pos = 0; pos < stream.size(); pos++) {
+        if (stream[pos] != 0) {
+            frame.push_back((uint8_t)stream[pos]);
+            continue;
+        }
+
+        record.clear();
+        for (size_t i = 0; i < frame.size();) {
+            unsigned code = frame[i++];
+            for (unsigned j = 1; j < code && i < frame.size(); j++) {
+                record.push_back(frame[i++]);
+            }
+            if (code < 0xFF && i < frame.size()) {
+                record.push_back(0);
+            }
+        }
+        frame.clear();
+        if (record.size() < RECORD_HEADER + 2 ||
+            crc16(&record[0], record.size() - 2) != (record[record.size() - 2] | (record[record.size() - 1] << 8))) {
+            counts.bad++;
+            continue;
+        }
+
+        uint8_t type = record[0];
+        uint16_t seq = (uint16_t)(record[1] | (record[2] << 8));
+        uint32_t time = record[3] | (record[4] << 8) | (record[5] << 16) | ((uint32_t)record[6] << 24);
+        const uint8_t* payload = &record[RECORD_HEADER];
+        unsigned len = (unsigned)record.size() - RECORD_HEADER - 2;
+        char head[40];
+
+        if (!first) {
+            counts.lost += (uint16_t)(seq - expected);
+        }
+        first = false;
+        expected = (uint16_t)(seq + 1);
+        counts.records++;
+        snprintf(head, sizeof(head), "%5u %10.6f  ", seq, time / 1e6);
+
+        if (type == TELEMETRY_TEXT) {
+            std::string text((const char*)payload, len);
+            while (!text.empty() && (text[text.size() - 1] == '\n' || text[text.size() - 1] == '\r')) {
+                text.erase(text.size() - 1);
+            }
+            lines->push_back(head + text);
+        } else if (type == TELEMETRY_LOG) {
+            std::vector<std::string> entries;
+            counts.bad += decode_log(strings, payload, len, &entries);
+            for (size_t i = 0; i < entries.size(); i++) {
+                std::string text = entries[i];
+                while (!text.empty() && text[text.size() - 1] == '\n') {
+                    text.erase(text.size() - 1);
+                }
+                lines->push_back(head + text);
+            }
+        } else {
+            counts.other++;
+        }
+    }
+    return counts;
+}
+
+/****************************************************************************/
+
+/* The CDC port of the self test */
+static std::vector<char> captured;
+
+static uint8_t capture(uint8_t* buf, uint16_t len)
+{
+    captured.insert(captured.end(), buf, buf + len);
+    return 0;
+}
+
+static uint32_t micros(void)
+{
+    static uint32_t now;
+    return now += 125;
+}
+
+/* A decoded line without its sequence and time */
+static std::string text_of(const std::string& line)
+{
+    size_t time = line.find_first_not_of(' ', line.find(' ', line.find_first_not_of(' ')));
+    return line.substr(line.find(' ', time) + 2);
+}
+
+/* Last line of the decoded capture, without its sequence and time */
+static std::string decoded_tail(const Strings& strings, std::vector<std::string>* lines, Counts* counts)
+{
+    lines->clear();
+    *counts = decode_stream(strings, captured, lines);
+    return lines->empty() ? "" : text_of(lines->back());
+}
+
+static void self_test(void)
+{
+    static const telemetry_config_t config = { capture, micros };
+    Strings strings;
+    std::vector<std::string> lines;
+    Counts counts;
+    char what[96];
+
+    printf("-- tlog round trip --\n");
+    telemetry_init(&config);
+    if (!load_strings("/proc/self/exe", &strings)) {
+        check(false, "tlog_strings found in /proc/self/exe");
+        return;
+    }
+
+    TLOG0("RF24 IRQ table full\n");
+    tlog_drain();
+    check(decoded_tail(strings, &lines, &counts) == "RF24 IRQ table full", "TLOG0() without arguments");
+
+    TLOG("RF24 SPI clock %lu Hz (/%u)\n", (uint32_t)10500000, (uint32_t)(2U << 2));
+    tlog_drain();
+    check(decoded_tail(strings, &lines, &counts) == "RF24 SPI clock 10500000 Hz (/8)", "%lu and %u");
+
+    TLOG("t=%d rh=%-5d|%05u|%#x|%08X|%c%c|100%%", (uint32_t)-1234, (uint32_t)56, (uint32_t)42, (uint32_t)0xBEEF);
+    TLOG("%08X|%c%c", (uint32_t)0xFFFFFFFF, (uint32_t)'o', (uint32_t)'k');
+    tlog_drain();
+    std::string last = decoded_tail(strings, &lines, &counts);
+    std::string before = text_of(lines[lines.size() - 2]);
+    check(lines[lines.size() - 2].substr(0, 6) == lines.back().substr(0, 6), "two entries before a drain, one record");
+    check(before == "t=-1234 rh=56   |00042|0xbeef|<missing>|<missing><missing>|100%", "flags, width, sign, missing arguments");
+    check(last == "FFFFFFFF|ok", "%08X of 0xFFFFFFFF and %c");
+
+    /* Several times around the ring, batches of up to TELEMETRY_MAX_PAYLOAD */
+    size_t start = lines.size();
+    bool in_order = true;
+    for (uint32_t i = 0; i < 3 * TLOG_BUFFER / 8; i++) {
+        TLOG("n %u", i);
+        if (i % 40 == 39) {
+            tlog_drain();
+        }
+    }
+    tlog_drain();
+    decoded_tail(strings, &lines, &counts);
+    for (uint32_t i = 0; i < 3 * TLOG_BUFFER / 8; i++) {
+        snprintf(what, sizeof(what), "n %u", i);
+        if (start + i >= lines.size() || text_of(lines[start + i]) != what) {
+            in_order = false;
+            break;
+        }
+    }
+    snprintf(what, sizeof(what), "%u records in order across the ring wrap", 3 * TLOG_BUFFER / 8);
+    check(in_order && counts.lost == 0 && counts.bad == 0, what);
+
+    /* Nothing drained: the ring fills and the rest is counted */
+    uint32_t dropped = tlog_get_stats()->dropped;
+    start = lines.size();
+    for (uint32_t i = 0; i < TLOG_BUFFER; i++) {
+        TLOG("fill %u", (uint32_t)0xFFFFFFFF);
+    }
+    uint32_t kept = TLOG_BUFFER / 8;             // 8 bytes a record
+    snprintf(what, sizeof(what), "full ring keeps %u records, drops %u", kept, TLOG_BUFFER - kept);
+    check(tlog_get_stats()->dropped - dropped == TLOG_BUFFER - kept, what);
+    while (tlog_drain()) {
+    }
+    decoded_tail(strings, &lines, &counts);
+    check(lines.size() - start == kept && tlog_get_stats()->peak == TLOG_BUFFER, "kept records all decoded, peak is the ring");
+
+    TLOG0("after the overflow\n");
+    tlog_drain();
+    check(decoded_tail(strings, &lines, &counts) == "after the overflow", "ring usable after the overflow");
+
+    check(strings.find((uint16_t)strings.size) == NULL, "token past the strings refused");
+}
+
+/****************************************************************************/
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "-t")) {
+        self_test();
+        printf("-- %d failed --\n", failed);
+        return failed;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s image.axf capture.bin|-\n       %s -t\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    Strings strings;
+    std::vector<char> stream;
+    std::vector<std::string> lines;
+    if (!load_strings(argv[1], &strings)) {
+        return 2;
+    }
+    if (!read_file(argv[2], &stream)) {
+        fprintf(stderr, "%s: cannot read\n", argv[2]);
+        return 2;
+    }
+
+    Counts counts = decode_stream(strings, stream, &lines);
+    for (size_t i = 0; i < lines.size(); i++) {
+        printf("%s\n", lines[i].c_str());
+    }
+    fprintf(stderr, "%u records, %u lost, %u bad, %u of other types\n", counts.records, counts.lost, counts.bad,
+            counts.other);
+    return counts.bad ? 1 : 0;
+}
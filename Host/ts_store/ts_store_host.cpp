@@ -0,0 +1,1178 @@
+/*
+ Time-series store for the sensor data of the network: every value of
+ every node goes to a column of its own, (node, metric), appended to
+ memory-mapped segment files with Gorilla compression (Pelkonen et al.,
+ VLDB 2015) and an index of blocks. Range queries and downsampling read
+ the index and the blocks they need through the mapping, never the whole
+ column.
+
+ Build and run from the repository root:
+
+   g++ -std=gnu++11 -O2 -DUSE_HAL_DRIVER -DSTM32F407xx \
+       -I Host/emu -I MDK-ARM/Inc \
+       Host/ts_store/ts_store_host.cpp -o ts_store
+   ./cdc_gateway -c | ./ts_store -d dir ingest
+   ./ts_store -d dir list
+   ./ts_store -d dir query node metric from to [step]
+   ./ts_store -t
+
+ ingest reads the lines of cdc_gateway -c. TELEMETRY_SAMPLE records are
+ the sensors of the gateway board: node is the source, metric the index of
+ the value. Radio payloads that read as a sample_summary_t come from the
+ nodes: node is 256 x (pipe + 1) + source, the value stored is the mean
+ of the window. Values are the raw fixed point of the records, 1/100 for
+ the HTU21D, missing ones (SAMPLE_RING_NONE) are left out. Times are the
+ arrival at the gateway, ms since the epoch.
+
+ query prints time,value for every point of [from, to), times in ms since
+ the epoch; with a step it prints start,count,min,max,mean of every
+ bucket [from + k step, from + (k + 1) step) that has points.
+
+ Layout: dir/<node>.<metric>/<first time, hex>.seg. A segment is a page of
+ header, SEGMENT_BLOCKS index entries of 64 bytes and the data of the
+ blocks. A block holds up to BLOCK_POINTS points and never crosses a
+ quarter hour (BLOCK_SPAN_MS): its entry has the first and last time, the
+ count, min, max and sum, so that buckets of whole quarter hours come from
+ the index alone and only the blocks a bucket edge cuts are decoded. At
+ 1 Hz a segment holds three weeks, and is cut to what it uses when full.
+
+ Within a block, timestamps are delta of deltas in the buckets of Gorilla
+ ('0', '10' + 7 bits, '110' + 9, '1110' + 12, '1111' + 32, in ms) and
+ values the XOR with the previous one as doubles, leading and trailing
+ zeros reused when they fit. A value that does not change costs a bit, a
+ sample once a second with a few ms of jitter 9 to 10 bits.
+
+ One process appends; queries from others see every point whose count
+ was stored: the data of a point is written before its count, a block
+ before the count of blocks. A store reopened for writing picks the open
+ block up where it was.
+
+ -t writes a year of 1 Hz samples to one column and a day to 300 more,
+ checks every query against the data written and times them. The exit
+ status is the number of failed checks.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "telemetry.h"
+
+#define SEGMENT_MAGIC    0x47455354U   // "TSEG"
+#define SEGMENT_VERSION  1
+#define SEGMENT_HEADER   4096U
+#define SEGMENT_BLOCKS   2048U
+#define BLOCK_POINTS     1024U
+#define BLOCK_SPAN_MS    900000        // blocks end on the quarter hours
+#define BLOCK_MAX_BYTES  ((BLOCK_POINTS * (36U + 77U) + 7U) / 8U + 16U)  // every point at its worst, and slack
+#define SEGMENT_DATA     (SEGMENT_HEADER + SEGMENT_BLOCKS * 64U)
+#define SEGMENT_SIZE     ((size_t)SEGMENT_DATA + (size_t)SEGMENT_BLOCKS * BLOCK_MAX_BYTES)
+#define BUCKETS_MAX      10000000U     // per query
+
+static int failed;
+static volatile sig_atomic_t stop;
+
+static void check(bool ok, const char* what)
+{
+    printf("%-6s %s\n", ok ? "ok" : "FAIL", what);
+    failed += ok ? 0 : 1;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000U;
+}
+
+static uint64_t load_be64(const uint8_t* p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+}
+
+static void store_be64(uint8_t* p, uint64_t v)
+{
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+/****************************************************************************/
+
+/* Bits, most significant first, into a zeroed area with 8 bytes to spare */
+class BitWriter
+{
+public:
+    BitWriter(uint8_t* p, uint64_t bit) : p_(p), bit_(bit) {}
+
+    void put(uint64_t v, unsigned n)
+    {
+        if (n > 32) {
+            put(v >> 32, n - 32);
+            n = 32;
+        }
+        v &= (1ULL << n) - 1U;
+        uint8_t* at = p_ + (bit_ >> 3);
+        store_be64(at, load_be64(at) | (v << (64U - (unsigned)(bit_ & 7U) - n)));
+        bit_ += n;
+    }
+
+    uint64_t bits(void) const { return bit_; }
+
+private:
+    uint8_t* p_;
+    uint64_t bit_;
+};
+
+class BitReader
+{
+public:
+    BitReader(const uint8_t* p) : p_(p), bit_(0) {}
+
+    uint64_t get(unsigned n)
+    {
+        if (n > 32) {
+            uint64_t high = get(n - 32);
+            return (high << 32) | get(32);
+        }
+        uint64_t word = load_be64(p_ + (bit_ >> 3)) << (bit_ & 7U);
+        bit_ += n;
+        return n ? word >> (64U - n) : 0;
+    }
+
+    uint64_t bits(void) const { return bit_; }
+
+private:
+    const uint8_t* p_;
+    uint64_t bit_;
+};
+
+/* Gorilla, one block: the first time is in the index, the first value
+ * whole, then delta of deltas and XORs */
+struct Codec {
+    uint32_t count;
+    int64_t  time, delta;
+    uint64_t value;
+    unsigned lead, trail;              // of the last XOR stored whole, lead 64 none yet
+
+    void reset(void)
+    {
+        count = 0;
+    }
+
+    void encode(BitWriter* w, int64_t t, double v)
+    {
+        uint64_t bits;
+
+        memcpy(&bits, &v, sizeof(bits));
+        if (count++ == 0) {
+            w->put(bits, 64);
+            time = t;
+            delta = 0;
+            value = bits;
+            lead = 64;
+            trail = 0;
+            return;
+        }
+
+        int64_t d = t - time, dod = d - delta;
+        if (dod == 0) {
+            w->put(0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            w->put((2ULL << 7) | (uint64_t)(dod + 63), 9);
+        } else if (dod >= -255 && dod <= 256) {
+            w->put((6ULL << 9) | (uint64_t)(dod + 255), 12);
+        } else if (dod >= -2047 && dod <= 2048) {
+            w->put((14ULL << 12) | (uint64_t)(dod + 2047), 16);
+        } else {
+            w->put(15, 4);
+            w->put((uint32_t)(int32_t)dod, 32);
+        }
+        time = t;
+        delta = d;
+
+        uint64_t x = bits ^ value;
+        value = bits;
+        if (x == 0) {
+            w->put(0, 1);
+            return;
+        }
+        unsigned l = std::min(31U, (unsigned)__builtin_clzll(x)), tr = (unsigned)__builtin_ctzll(x);
+        if (lead < 64 && l >= lead && tr >= trail) {
+            w->put(2, 2);
+            w->put(x >> trail, 64U - lead - trail);
+        } else {
+            unsigned significant = 64U - l - tr;
+            w->put(3, 2);
+            w->put(l, 5);
+            w->put(significant & 63U, 6);  // 64 as 0
+            w->put(x >> tr, significant);
+            lead = l;
+            trail = tr;
+        }
+    }
+
+    void decode(BitReader* r, int64_t first, int64_t* t, double* v)
+    {
+        if (count++ == 0) {
+            time = first;
+            delta = 0;
+            value = r->get(64);
+            lead = 64;
+            trail = 0;
+        } else {
+            int64_t dod;
+            if (!r->get(1)) {
+                dod = 0;
+            } else if (!r->get(1)) {
+                dod = (int64_t)r->get(7) - 63;
+            } else if (!r->get(1)) {
+                dod = (int64_t)r->get(9) - 255;
+            } else if (!r->get(1)) {
+                dod = (int64_t)r->get(12) - 2047;
+            } else {
+                dod = (int32_t)(uint32_t)r->get(32);
+            }
+            delta += dod;
+            time += delta;
+
+            if (r->get(1)) {
+                if (!r->get(1)) {
+                    value ^= r->get(64U - lead - trail) << trail;
+                } else {
+                    lead = (unsigned)r->get(5);
+                    unsigned significant = (unsigned)r->get(6);
+                    significant = significant ? significant : 64U;
+                    trail = 64U - lead - significant;
+                    value ^= r->get(significant) << trail;
+                }
+            }
+        }
+        *t = time;
+        memcpy(v, &value, sizeof(*v));
+    }
+};
+
+/****************************************************************************/
+
+struct SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node;
+    uint16_t metric;
+    uint16_t sealed;                   // full, cut to size, read only
+    uint32_t blocks;                   // index entries in use, the last one open unless sealed
+};
+
+struct BlockIndex {
+    int64_t  first_time, last_time;    // ms
+    uint64_t offset;                   // of its data, from SEGMENT_DATA
+    uint32_t bits;
+    uint32_t count;                    // stored after the rest
+    double   min, max, sum;
+    uint64_t reserved;
+};
+
+struct Point {
+    int64_t time;
+    double  value;
+};
+
+struct Bucket {
+    uint64_t count;
+    double   min, max, sum;
+};
+
+static void bucket_add(Bucket* b, double min, double max, double sum, uint64_t count)
+{
+    if (b->count == 0 || min < b->min) {
+        b->min = min;
+    }
+    if (b->count == 0 || max > b->max) {
+        b->max = max;
+    }
+    b->sum += sum;
+    b->count += count;
+}
+
+class Segment
+{
+public:
+    /* A new segment for (node, metric), its first point at "first" */
+    static Segment* create(const std::string& path, uint32_t node, uint16_t metric)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        Segment* s = NULL;
+
+        if (fd >= 0 && ftruncate(fd, (off_t)SEGMENT_SIZE) == 0) {
+            s = new Segment(path, fd, SEGMENT_SIZE, true);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (s != NULL && s->base_ == NULL) {
+            delete s;
+            s = NULL;
+        }
+        if (s != NULL) {
+            SegmentHeader* h = (SegmentHeader*)s->base_;
+            h->magic = SEGMENT_MAGIC;
+            h->version = SEGMENT_VERSION;
+            h->node = node;
+            h->metric = metric;
+        }
+        return s;
+    }
+
+    /* An existing segment, writable if "write" and not sealed */
+    static Segment* open(const std::string& path, bool write)
+    {
+        int fd = ::open(path.c_str(), (write ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+        struct stat st;
+        Segment* s = NULL;
+
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= SEGMENT_DATA) {
+            s = new Segment(path, fd, (size_t)st.st_size, write);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (s != NULL && (s->base_ == NULL || s->header()->magic != SEGMENT_MAGIC ||
+                          s->header()->version != SEGMENT_VERSION || s->blocks() > SEGMENT_BLOCKS)) {
+            delete s;
+            s = NULL;
+        }
+        if (s != NULL && s->writable_) {
+            s->resume();
+        }
+        return s;
+    }
+
+    ~Segment()
+    {
+        if (base_ != NULL) {
+            munmap(base_, size_);
+        }
+    }
+
+    const SegmentHeader* header(void) const { return (const SegmentHeader*)base_; }
+
+    uint32_t blocks(void) const
+    {
+        return __atomic_load_n(&header()->blocks, __ATOMIC_ACQUIRE);
+    }
+
+    bool empty(void) const { return blocks() == 0; }
+    int64_t firstTime(void) const { return index(0).first_time; }
+    int64_t lastTime(void) const { return index(blocks() - 1).last_time; }
+
+    uint64_t points(void) const
+    {
+        uint64_t n = 0;
+
+        for (uint32_t i = 0; i < blocks(); i++) {
+            n += __atomic_load_n(&index(i).count, __ATOMIC_ACQUIRE);
+        }
+        return n;
+    }
+
+    /* False when full: seal() it and start another */
+    bool append(int64_t t, double v)
+    {
+        SegmentHeader* h = (SegmentHeader*)base_;
+        uint32_t n = h->blocks;
+        BlockIndex* b = n ? &index(n - 1) : NULL;
+
+        if (b == NULL || b->count == BLOCK_POINTS || t / BLOCK_SPAN_MS != b->first_time / BLOCK_SPAN_MS) {
+            if (n == SEGMENT_BLOCKS) {
+                return false;
+            }
+            BlockIndex* next = &index(n);
+            next->offset = b ? b->offset + (b->bits + 7U) / 8U : 0;
+            next->first_time = t;
+            next->bits = 0;
+            next->count = 0;
+            next->min = next->max = v;
+            next->sum = 0;
+            codec_.reset();
+            __atomic_store_n(&h->blocks, n + 1, __ATOMIC_RELEASE);
+            b = next;
+        }
+
+        BitWriter w(base_ + SEGMENT_DATA + b->offset, b->bits);
+        codec_.encode(&w, t, v);
+        b->bits = (uint32_t)w.bits();
+        b->last_time = t;
+        b->min = std::min(b->min, v);
+        b->max = std::max(b->max, v);
+        b->sum += v;
+        __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /* Full: cut to the data in use and read only from now on */
+    void seal(void)
+    {
+        SegmentHeader* h = (SegmentHeader*)base_;
+        const BlockIndex& b = index(h->blocks - 1);
+        size_t used = SEGMENT_DATA + b.offset + (b.bits + 7U) / 8U + 8U;  // the reader loads 8 bytes at a time
+
+        h->sealed = 1;
+        msync(base_, size_, MS_SYNC);
+        munmap(base_, size_);
+        base_ = NULL;
+        if (truncate(path_.c_str(), (off_t)used) == 0) {
+            int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+            map(fd, used, false);
+            close(fd);
+        }
+    }
+
+    /* Points of [from, to) */
+    void range(int64_t from, int64_t to, std::vector<Point>* out) const
+    {
+        uint32_t n = blocks();
+
+        for (uint32_t i = find(from, n); i < n && index(i).first_time < to; i++) {
+            decode(i, [&](int64_t t, double v) {
+                if (t >= from && t < to) {
+                    Point p = { t, v };
+                    out->push_back(p);
+                }
+            });
+        }
+    }
+
+    /* Adds [from, to) to buckets of "step" ms: the whole blocks of a bucket
+     * from their index entry */
+    void downsample(int64_t from, int64_t to, int64_t step, Bucket* buckets) const
+    {
+        uint32_t n = blocks();
+
+        for (uint32_t i = find(from, n); i < n && index(i).first_time < to; i++) {
+            const BlockIndex& b = index(i);
+            bool open = !header()->sealed && i == n - 1;   // its sums may be ahead of its count
+            if (!open && b.first_time >= from && b.last_time < to &&
+                (b.first_time - from) / step == (b.last_time - from) / step) {
+                bucket_add(&buckets[(b.first_time - from) / step], b.min, b.max, b.sum, b.count);
+                continue;
+            }
+            decode(i, [&](int64_t t, double v) {
+                if (t >= from && t < to) {
+                    bucket_add(&buckets[(t - from) / step], v, v, v, 1);
+                }
+            });
+        }
+    }
+
+    /* Decoded blocks, for the self test */
+    mutable uint64_t decoded;
+
+private:
+    Segment(const std::string& path, int fd, size_t size, bool write) : decoded(0), path_(path), base_(NULL),
+                                                                          size_(0), writable_(false)
+    {
+        map(fd, size, write);
+        writable_ = base_ != NULL && write && !header()->sealed;
+        if (base_ != NULL && write && header()->sealed) {
+            munmap(base_, size_);
+            base_ = NULL;
+            map(fd, size, false);
+        }
+    }
+
+    void map(int fd, size_t size, bool write)
+    {
+        void* p = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+        base_ = p == MAP_FAILED ? NULL : (uint8_t*)p;
+        size_ = size;
+    }
+
+    BlockIndex& index(uint32_t i) const
+    {
+        return ((BlockIndex*)(base_ + SEGMENT_HEADER))[i];
+    }
+
+    /* The first block that ends at or after t */
+    uint32_t find(int64_t t, uint32_t n) const
+    {
+        uint32_t lo = 0, hi = n;
+
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (index(mid).last_time < t) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    template <class F> void decode(uint32_t i, F f) const
+    {
+        const BlockIndex& b = index(i);
+        uint32_t count = __atomic_load_n(&b.count, __ATOMIC_ACQUIRE);
+        BitReader r(base_ + SEGMENT_DATA + b.offset);
+        Codec c;
+        int64_t t;
+        double v;
+
+        c.reset();
+        for (uint32_t k = 0; k < count; k++) {
+            c.decode(&r, b.first_time, &t, &v);
+            f(t, v);
+        }
+        decoded++;
+    }
+
+    /* Reopened for writing: the codec state of the open block, and zeros
+     * after its last bit in case a write was cut short */
+    void resume(void)
+    {
+        uint32_t n = header()->blocks;
+
+        codec_.reset();
+        if (n == 0) {
+            return;
+        }
+        BlockIndex& b = index(n - 1);
+        uint8_t* data = base_ + SEGMENT_DATA + b.offset;
+        BitReader r(data);
+        int64_t t;
+        double v;
+        for (uint32_t k = 0; k < b.count; k++) {
+            codec_.decode(&r, b.first_time, &t, &v);
+        }
+        if (b.bits & 7U) {
+            data[b.bits / 8U] &= (uint8_t)(0xFF00U >> (b.bits & 7U));
+        }
+        memset(data + (b.bits + 7U) / 8U, 0, BLOCK_MAX_BYTES - (b.bits + 7U) / 8U);
+    }
+
+    std::string path_;
+    uint8_t* base_;
+    size_t size_;
+    bool writable_;
+    Codec codec_;                      // of the open block
+};
+
+/****************************************************************************/
+
+/* One column: its segments in time order */
+class Series
+{
+public:
+    Series(const std::string& dir, uint32_t node, uint16_t metric) : rejected(0), dir_(dir), node_(node),
+                                                                      metric_(metric)
+    {
+    }
+
+    ~Series()
+    {
+        for (size_t i = 0; i < segments_.size(); i++) {
+            delete segments_[i];
+        }
+    }
+
+    bool load(bool write)
+    {
+        DIR* d = opendir(dir_.c_str());
+        std::vector<std::string> names;
+
+        if (d == NULL) {
+            return false;
+        }
+        for (struct dirent* e = readdir(d); e != NULL; e = readdir(d)) {
+            size_t len = strlen(e->d_name);
+            if (len > 4 && !strcmp(e->d_name + len - 4, ".seg")) {
+                names.push_back(e->d_name);
+            }
+        }
+        closedir(d);
+        std::sort(names.begin(), names.end());      // fixed width hex: in time order
+        for (size_t i = 0; i < names.size(); i++) {
+            Segment* s = Segment::open(dir_ + "/" + names[i], write && i + 1 == names.size());
+            if (s == NULL || s->empty()) {
+                delete s;
+                continue;
+            }
+            segments_.push_back(s);
+        }
+        return true;
+    }
+
+    /* In time order only: false for a point older than the last one */
+    bool append(int64_t t, double v)
+    {
+        if (t < 0 || (!segments_.empty() && t < segments_.back()->lastTime())) {
+            rejected++;
+            return false;
+        }
+        if (segments_.empty() || !segments_.back()->append(t, v)) {
+            char name[32];
+            if (!segments_.empty()) {
+                segments_.back()->seal();
+            }
+            snprintf(name, sizeof(name), "/%016llx.seg", (unsigned long long)t);
+            Segment* s = Segment::create(dir_ + name, node_, metric_);
+            if (s == NULL) {
+                perror((dir_ + name).c_str());
+                rejected++;
+                return false;
+            }
+            segments_.push_back(s);
+            s->append(t, v);
+        }
+        return true;
+    }
+
+    void range(int64_t from, int64_t to, std::vector<Point>* out) const
+    {
+        for (size_t i = first(from); i < segments_.size() && segments_[i]->firstTime() < to; i++) {
+            segments_[i]->range(from, to, out);
+        }
+    }
+
+    /* Buckets of [from, to), empty ones included */
+    bool downsample(int64_t from, int64_t to, int64_t step, std::vector<Bucket>* out) const
+    {
+        if (step <= 0 || to <= from || (uint64_t)((to - from + step - 1) / step) > BUCKETS_MAX) {
+            return false;
+        }
+        out->assign((size_t)((to - from + step - 1) / step), Bucket());
+        for (size_t i = first(from); i < segments_.size() && segments_[i]->firstTime() < to; i++) {
+            segments_[i]->downsample(from, to, step, &(*out)[0]);
+        }
+        return true;
+    }
+
+    uint64_t points(void) const
+    {
+        uint64_t n = 0;
+
+        for (size_t i = 0; i < segments_.size(); i++) {
+            n += segments_[i]->points();
+        }
+        return n;
+    }
+
+    int64_t firstTime(void) const { return segments_.empty() ? 0 : segments_.front()->firstTime(); }
+    int64_t lastTime(void) const { return segments_.empty() ? 0 : segments_.back()->lastTime(); }
+    const std::vector<Segment*>& segments(void) const { return segments_; }
+
+    uint64_t rejected;                 // out of order
+
+private:
+    /* The segment holding "from", or the first one after it */
+    size_t first(int64_t from) const
+    {
+        size_t lo = 0, hi = segments_.size();
+
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (segments_[mid]->lastTime() < from) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    std::string dir_;
+    uint32_t node_;
+    uint16_t metric_;
+    std::vector<Segment*> segments_;
+};
+
+/* The columns of a directory, opened when first used */
+class Store
+{
+public:
+    Store(const std::string& dir, bool write) : dir_(dir), write_(write)
+    {
+        if (write) {
+            mkdir(dir.c_str(), 0755);
+        }
+    }
+
+    ~Store()
+    {
+        for (std::map<uint64_t, Series*>::iterator it = series_.begin(); it != series_.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    /* NULL if the column does not exist and the store is read only */
+    Series* series(uint32_t node, uint16_t metric)
+    {
+        uint64_t key = (uint64_t)node << 16 | metric;
+        std::map<uint64_t, Series*>::iterator it = series_.find(key);
+        char name[32];
+
+        if (it != series_.end()) {
+            return it->second;
+        }
+        snprintf(name, sizeof(name), "/%u.%u", node, metric);
+        if (write_) {
+            mkdir((dir_ + name).c_str(), 0755);
+        }
+        Series* s = new Series(dir_ + name, node, metric);
+        if (!s->load(write_)) {
+            delete s;
+            return NULL;
+        }
+        series_[key] = s;
+        return s;
+    }
+
+    /* Every column on disk, as node << 16 | metric */
+    std::vector<uint64_t> list(void) const
+    {
+        std::vector<uint64_t> keys;
+        DIR* d = opendir(dir_.c_str());
+        unsigned node, metric;
+
+        for (struct dirent* e = d ? readdir(d) : NULL; e != NULL; e = readdir(d)) {
+            if (sscanf(e->d_name, "%u.%u", &node, &metric) == 2 && metric <= 0xFFFF) {
+                keys.push_back((uint64_t)node << 16 | metric);
+            }
+        }
+        if (d != NULL) {
+            closedir(d);
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+private:
+    std::string dir_;
+    bool write_;
+    std::map<uint64_t, Series*> series_;
+};
+
+/****************************************************************************/
+
+static unsigned hex_bytes(const char* hex, uint8_t* out, unsigned max)
+{
+    unsigned n = 0, byte;
+
+    while (n < max && sscanf(hex + 2 * n, "%2x", &byte) == 1) {
+        out[n++] = (uint8_t)byte;
+    }
+    return n;
+}
+
+static int16_t i16(const uint8_t* p)
+{
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+/* A radio payload that reads as a sample_summary_t, not any 32 bytes */
+static bool summary_valid(const uint8_t* p)
+{
+    uint32_t start, end;
+
+    memcpy(&start, p, 4);
+    memcpy(&end, p + 4, 4);
+    if ((p[8] | (p[9] << 8)) == 0 || p[11] != 0 || end < start || end - start > 86400000U) {
+        return false;
+    }
+    for (unsigned k = 0; k < SAMPLE_RING_VALUES; k++) {
+        const uint8_t* v = p + 12 + 8 * k;
+        int16_t min = i16(v), max = i16(v + 2), mean = i16(v + 4), last = i16(v + 6);
+        bool none = min == SAMPLE_RING_NONE && max == SAMPLE_RING_NONE && mean == SAMPLE_RING_NONE &&
+                    last == SAMPLE_RING_NONE;
+        if (!none && (min > mean || mean > max || min > last || last > max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* Lines of cdc_gateway -c: arrival (s, monotonic), sequence, time, type,
+ * payload in hex */
+static int ingest(Store* store, FILE* in)
+{
+    struct timespec real, mono;
+    char line[512], hex[400];
+    double arrival;
+    unsigned seq, time, type;
+    uint8_t p[200];
+    uint64_t records = 0, points = 0, rejected = 0;
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t offset = ((int64_t)real.tv_sec - mono.tv_sec) * 1000 + (real.tv_nsec - mono.tv_nsec) / 1000000;
+
+    while (!stop && fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "%lf %u %u %u %399s", &arrival, &seq, &time, &type, hex) != 5) {
+            continue;
+        }
+        unsigned len = hex_bytes(hex, p, sizeof(p));
+        int64_t t = (int64_t)(arrival * 1000) + offset;
+        records++;
+
+        if (type == TELEMETRY_SAMPLE && len == 5 + 2 * SAMPLE_RING_VALUES) {
+            for (unsigned k = 0; k < SAMPLE_RING_VALUES; k++) {
+                int16_t v = i16(p + 5 + 2 * k);
+                if (v != SAMPLE_RING_NONE) {
+                    bool ok = store->series(p[0], (uint16_t)k)->append(t, v);
+                    points += ok ? 1 : 0;
+                    rejected += ok ? 0 : 1;
+                }
+            }
+        } else if (type == TELEMETRY_RADIO && len >= 1 + sizeof(sample_summary_t) && summary_valid(p + 1)) {
+            uint32_t node = 256U * (p[0] + 1U) + p[1 + 10];
+            for (unsigned k = 0; k < SAMPLE_RING_VALUES; k++) {
+                int16_t v = i16(p + 1 + 12 + 8 * k + 4);
+                if (v != SAMPLE_RING_NONE) {
+                    bool ok = store->series(node, (uint16_t)k)->append(t, v);
+                    points += ok ? 1 : 0;
+                    rejected += ok ? 0 : 1;
+                }
+            }
+        }
+    }
+    fprintf(stderr, "%llu records, %llu points stored, %llu out of order\n", (unsigned long long)records,
+            (unsigned long long)points, (unsigned long long)rejected);
+    return 0;
+}
+
+/****************************************************************************/
+
+#define TEST_T0        1735689600000LL // 2025-01-01 00:00 UTC
+#define TEST_YEAR      (365U * 86400U) // points, 1 Hz
+#define TEST_NODES     300
+#define TEST_DAY       86400U
+
+/* Point i of a column: a second apart and a few ms of jitter, a daily and
+ * a faster swing of a temperature in 1/100 */
+static uint32_t test_hash(uint32_t i)
+{
+    i ^= i >> 16;
+    i *= 0x7FEB352DU;
+    i ^= i >> 15;
+    i *= 0x846CA68BU;
+    return i ^ (i >> 16);
+}
+
+static int64_t test_time(uint32_t node, uint32_t i)
+{
+    return TEST_T0 + (int64_t)i * 1000 + test_hash(i ^ node << 24) % 4U;
+}
+
+static double test_value(uint32_t node, uint32_t i)
+{
+    return floor(2150.0 + node + 300.0 * sin(2 * M_PI * i / 86400.0) + 20.0 * sin(2 * M_PI * i / 3600.0 * 7.3) + 0.5) +
+           (test_hash(i + node) % 97U == 0 ? 1 : 0);
+}
+
+static int test_remove(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+/* The buckets of "step" from "from" computed from the points themselves */
+static std::vector<Bucket> test_buckets(uint32_t node, uint32_t points, int64_t from, int64_t to, int64_t step)
+{
+    std::vector<Bucket> b((size_t)((to - from + step - 1) / step), Bucket());
+
+    int64_t first = std::max<int64_t>(0, (from - TEST_T0) / 1000 - 1);
+    int64_t last = std::min<int64_t>(points, (to - TEST_T0) / 1000 + 1);
+
+    for (uint32_t i = (uint32_t)first; (int64_t)i < last; i++) {
+        int64_t t = test_time(node, i);
+        if (t >= from && t < to) {
+            double v = test_value(node, i);
+            bucket_add(&b[(size_t)((t - from) / step)], v, v, v, 1);
+        }
+    }
+    return b;
+}
+
+static bool test_same(const std::vector<Bucket>& a, const std::vector<Bucket>& b)
+{
+    bool same = a.size() == b.size();
+
+    for (size_t i = 0; same && i < a.size(); i++) {
+        same = a[i].count == b[i].count && (a[i].count == 0 || (a[i].min == b[i].min && a[i].max == b[i].max &&
+                                                                fabs(a[i].sum - b[i].sum) < 1e-6 * fabs(b[i].sum) + 1e-9));
+    }
+    return same;
+}
+
+static uint64_t test_decoded(const Series* s)
+{
+    uint64_t n = 0;
+
+    for (size_t i = 0; i < s->segments().size(); i++) {
+        n += s->segments()[i]->decoded;
+    }
+    return n;
+}
+
+static uint64_t test_disk(const char* dir)
+{
+    std::string cmd = std::string("du -sk ") + dir;
+    FILE* p = popen(cmd.c_str(), "r");
+    unsigned long long kb = 0;
+
+    if (p != NULL) {
+        if (fscanf(p, "%llu", &kb) != 1) {
+            kb = 0;
+        }
+        pclose(p);
+    }
+    return kb * 1024U;
+}
+
+static void self_test(void)
+{
+    char dir[64], what[160];
+    uint64_t start;
+
+    snprintf(dir, sizeof(dir), "/tmp/ts_store_test.%d", (int)getpid());
+    nftw(dir, test_remove, 16, FTW_DEPTH | FTW_PHYS);
+
+    printf("-- codec --\n");
+    {
+        std::vector<uint8_t> buf(BLOCK_MAX_BYTES);
+        static const double values[] = { 0.0, -0.0, 1.0, 1.0, 21.37, -1e300, 1e-300, NAN, INFINITY, 2150.0, 2151.0, 2150.0 };
+        static const int64_t times[] = { 0, 1000, 1000, 1001, 1000000, 1000001, 1000001 + 2048, 1000001 + 4096,
+                                         1000001 + 4096 + 70, 1000001 + 4096 + 140, 2000000, 2000000 };
+        BitWriter w(&buf[0], 0);
+        Codec c;
+        c.reset();
+        for (size_t i = 0; i < 12; i++) {
+            c.encode(&w, times[i], values[i]);
+        }
+        BitReader r(&buf[0]);
+        bool same = true;
+        c.reset();
+        for (size_t i = 0; i < 12; i++) {
+            int64_t t;
+            double v;
+            c.decode(&r, times[0], &t, &v);
+            same = same && t == times[i] && memcmp(&v, &values[i], sizeof(v)) == 0;
+        }
+        check(same && r.bits() == w.bits(), "every bucket of times and values, NaN, infinity and -0 included");
+    }
+
+    printf("-- a year at 1 Hz in one column --\n");
+    Store* store = new Store(dir, true);
+    Series* s = store->series(1, 0);
+    start = now_us();
+    for (uint32_t i = 0; i < TEST_YEAR - 1000; i++) {
+        s->append(test_time(1, i), test_value(1, i));
+    }
+    // Out of order, refused
+    check(!s->append(test_time(1, TEST_YEAR - 1002), 0) && s->rejected == 1, "a point older than the last refused");
+    delete store;
+
+    // Reopened, the open block goes on
+    store = new Store(dir, true);
+    s = store->series(1, 0);
+    for (uint32_t i = TEST_YEAR - 1000; i < TEST_YEAR; i++) {
+        s->append(test_time(1, i), test_value(1, i));
+    }
+    double seconds = (now_us() - start) / 1e6;
+    uint64_t disk = test_disk(dir);
+    snprintf(what, sizeof(what), "%u points in %.2f s, %.1f M/s, %.2f bytes each on disk, %zu segments", TEST_YEAR,
+             seconds, TEST_YEAR / seconds / 1e6, (double)disk / TEST_YEAR, s->segments().size());
+    check(s->points() == TEST_YEAR && disk < TEST_YEAR * 2ULL, what);
+    delete store;
+
+    // Queried read only, like another process would
+    Store reader(dir, false);
+    const Series* q = reader.series(1, 0);
+    check(q != NULL && q->points() == TEST_YEAR && q->firstTime() == test_time(1, 0) &&
+          q->lastTime() == test_time(1, TEST_YEAR - 1), "read back: every point, first and last time");
+
+    std::vector<Point> points;
+    bool same = true;
+    start = now_us();
+    for (uint32_t k = 0; k < 100; k++) {
+        uint32_t first = test_hash(k) % (TEST_YEAR - 3600);
+        int64_t from = TEST_T0 + (int64_t)first * 1000 + 500;  // past the jitter of point "first"
+        points.clear();
+        q->range(from, from + 3600000, &points);
+        same = same && points.size() == 3600;
+        for (uint32_t j = 0; same && j < points.size(); j++) {
+            same = points[j].time == test_time(1, first + 1 + j) && points[j].value == test_value(1, first + 1 + j);
+        }
+    }
+    snprintf(what, sizeof(what), "100 ranges of an hour anywhere in the year: every point, %.3f ms each",
+             (now_us() - start) / 1e3 / 100);
+    check(same, what);
+
+    // The year by day and by hour: the index alone
+    std::vector<Bucket> got, want;
+    int64_t year_end = TEST_T0 + 365LL * 86400000;
+    uint64_t decoded = test_decoded(q);
+    start = now_us();
+    q->downsample(TEST_T0, year_end, 86400000, &got);
+    double day_ms = (now_us() - start) / 1e3;
+    want = test_buckets(1, TEST_YEAR, TEST_T0, year_end, 86400000);
+    snprintf(what, sizeof(what), "the year by day in %.2f ms, %llu blocks decoded", day_ms,
+             (unsigned long long)(test_decoded(q) - decoded));
+    check(test_same(got, want) && day_ms < 50, what);
+
+    decoded = test_decoded(q);
+    start = now_us();
+    q->downsample(TEST_T0, year_end, 3600000, &got);
+    double hour_ms = (now_us() - start) / 1e3;
+    want = test_buckets(1, TEST_YEAR, TEST_T0, year_end, 3600000);
+    snprintf(what, sizeof(what), "the year by hour in %.2f ms, %llu blocks decoded", hour_ms,
+             (unsigned long long)(test_decoded(q) - decoded));
+    check(test_same(got, want) && hour_ms < 50, what);
+
+    // Buckets that cut blocks: decoded at the edges
+    int64_t from = TEST_T0 + 123456, to = from + 30LL * 86400000;
+    start = now_us();
+    q->downsample(from, to, 7 * 60000, &got);
+    double cut_ms = (now_us() - start) / 1e3;
+    want = test_buckets(1, TEST_YEAR, from, to, 7 * 60000);
+    snprintf(what, sizeof(what), "30 days by 7 minutes, off the quarter hours, in %.1f ms", cut_ms);
+    check(test_same(got, want), what);
+
+    q->downsample(year_end, year_end + 86400000, 3600000, &got);
+    bool empty = true;
+    for (size_t i = 0; i < got.size(); i++) {
+        empty = empty && got[i].count == 0;
+    }
+    points.clear();
+    q->range(TEST_T0 - 86400000, TEST_T0, &points);
+    check(empty && points.empty() && reader.series(2, 0) == NULL, "nothing outside the data, no such column");
+
+    printf("-- a day at 1 Hz from %d nodes --\n", TEST_NODES);
+    store = new Store(dir, true);
+    start = now_us();
+    for (uint32_t i = 0; i < TEST_DAY; i++) {
+        for (uint32_t node = 100; node < 100 + TEST_NODES; node++) {
+            store->series(node, 1)->append(test_time(node, i), test_value(node, i));
+        }
+    }
+    seconds = (now_us() - start) / 1e6;
+    snprintf(what, sizeof(what), "%u points in %.2f s, interleaved across the columns", TEST_DAY * TEST_NODES, seconds);
+    check(true, what);
+    delete store;
+
+    Store nodes(dir, false);
+    same = nodes.list().size() == TEST_NODES + 1;
+    start = now_us();
+    for (uint32_t node = 100; node < 100 + TEST_NODES; node++) {
+        const Series* n = nodes.series(node, 1);
+        same = same && n != NULL && n->downsample(TEST_T0, TEST_T0 + 86400000, 900000, &got) &&
+               got.size() == 96 && got[0].count == 900 && got[95].count == 900;
+    }
+    double all_ms = (now_us() - start) / 1e3;
+    want = test_buckets(250, TEST_DAY, TEST_T0, TEST_T0 + 86400000, 900000);
+    nodes.series(250, 1)->downsample(TEST_T0, TEST_T0 + 86400000, 900000, &got);
+    snprintf(what, sizeof(what), "every node's day by quarter hour in %.1f ms, opening the columns included", all_ms);
+    check(same && test_same(got, want), what);
+
+    nftw(dir, test_remove, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/****************************************************************************/
+
+int main(int argc, char** argv)
+{
+    const char* dir = NULL;
+    int i = 1;
+
+    if (argc == 2 && !strcmp(argv[1], "-t")) {
+        self_test();
+        printf("-- %d failed --\n", failed);
+        return failed;
+    }
+    if (argc >= 4 && !strcmp(argv[1], "-d")) {
+        dir = argv[2];
+        i = 3;
+    }
+    if (dir != NULL && argc == 4 && !strcmp(argv[i], "ingest")) {
+        Store store(dir, true);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        return ingest(&store, stdin);
+    }
+    if (dir != NULL && argc == 4 && !strcmp(argv[i], "list")) {
+        Store store(dir, false);
+        std::vector<uint64_t> keys = store.list();
+        printf("node,metric,points,first,last,segments\n");
+        for (size_t k = 0; k < keys.size(); k++) {
+            const Series* s = store.series((uint32_t)(keys[k] >> 16), (uint16_t)keys[k]);
+            if (s != NULL) {
+                printf("%u,%u,%llu,%lld,%lld,%zu\n", (unsigned)(keys[k] >> 16), (unsigned)(keys[k] & 0xFFFF),
+                       (unsigned long long)s->points(), (long long)s->firstTime(), (long long)s->lastTime(),
+                       s->segments().size());
+            }
+        }
+        return 0;
+    }
+    if (dir != NULL && (argc == 8 || argc == 9) && !strcmp(argv[i], "query")) {
+        Store store(dir, false);
+        const Series* s = store.series((uint32_t)strtoul(argv[4], NULL, 0), (uint16_t)strtoul(argv[5], NULL, 0));
+        int64_t from = strtoll(argv[6], NULL, 0), to = strtoll(argv[7], NULL, 0);
+        if (s == NULL) {
+            fprintf(stderr, "no such column\n");
+            return 1;
+        }
+        if (argc == 8) {
+            std::vector<Point> points;
+            s->range(from, to, &points);
+            for (size_t k = 0; k < points.size(); k++) {
+                printf("%lld,%.17g\n", (long long)points[k].time, points[k].value);
+            }
+            return 0;
+        }
+        std::vector<Bucket> buckets;
+        int64_t step = strtoll(argv[8], NULL, 0);
+        if (!s->downsample(from, to, step, &buckets)) {
+            fprintf(stderr, "step: more than %u buckets or none\n", BUCKETS_MAX);
+            return 2;
+        }
+        for (size_t k = 0; k < buckets.size(); k++) {
+            const Bucket& b = buckets[k];
+            if (b.count) {
+                printf("%lld,%llu,%.17g,%.17g,%.17g\n", (long long)(from + (int64_t)k * step),
+                       (unsigned long long)b.count, b.min, b.max, b.sum / b.count);
+            }
+        }
+        return 0;
+    }
+    fprintf(stderr, "usage: %s -d dir ingest\n"
+                    "       %s -d dir list\n"
+                    "       %s -d dir query node metric from to [step]\n"
+                    "       %s -t\n", argv[0], argv[0], argv[0], argv[0]);
+    return 2;
+}
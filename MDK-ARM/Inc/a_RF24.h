@@ -50,6 +50,22 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
 
+/**
+ * Arguments for maskIRQ(), 1 keeps the event off the IRQ pin
+ */
+#define IRQ_TX_OK_DIS     1
+#define IRQ_TX_OK_EN      0
+#define IRQ_TX_FAIL_DIS   1
+#define IRQ_TX_FAIL_EN    0
+#define IRQ_RX_READY_DIS  1
+#define IRQ_RX_READY_EN   0
+
+/**
+ * Bytes from readRegisters(): registers 0x00 to 0x1D, the 3 address
+ * registers 5 bytes each
+ */
+#define RF24_REGISTER_DUMP  42
+
 class SerialPI
 {
 	private:
@@ -57,6 +73,21 @@ class SerialPI
 	protected:
 		
 	public:
+	#if defined(USE_HAL_DRIVER)
+	SerialPI(SPI_HandleTypeDef* _hspi);
+	~SerialPI();
+	SPI_HandleTypeDef* hspi; /**< Bus this radio sits on */
+	spi_device_t dev; /**< The radio as seen by the bus arbiter, CSN stays with RF24::csn() */
+	uint8_t frame_start; /**< Next byte opens a command, the radio answers with STATUS */
+	uint8_t calibrating; /**< Errors are expected, do not count them */
+	uint8_t errors; /**< Corrupt STATUS bytes since error_tick */
+	uint32_t error_tick;
+	volatile uint8_t error_burst; /**< RF24_SPI_ERROR_BURST errors within RF24_SPI_ERROR_WINDOW ms */
+	void beginTransaction();
+	void endTransaction();
+	void setPrescaler(uint32_t prescaler);
+	uint32_t clock();
+	#endif
 	uint8_t transfer(uint8_t send);
 	void begin();
 };
@@ -78,6 +109,16 @@ private:
 
   uint16_t ce_pin; /**< "Chip Enable" pin, activates the RX or TX role */
   uint16_t csn_pin; /**< SPI Chip select */
+#if defined (USE_HAL_DRIVER)
+  SerialPI spi; /**< SPI bus of this instance, _SPI in the driver */
+  GPIO_TypeDef* ce_port;
+  GPIO_TypeDef* csn_port;
+  GPIO_TypeDef* irq_port; /**< NULL when the IRQ pin is not wired */
+  uint16_t irq_pin;
+  volatile uint8_t irq_count; /**< IRQ edges not yet taken by irqPending() */
+  void (*irq_callback)(RF24* radio);
+  static RF24* irq_instances[RF24_MAX_INSTANCES];
+#endif
   uint16_t spi_speed; /**< SPI Bus Speed */
 #if defined (RF24_LINUX) || defined (XMEGA_D3)
   uint8_t spi_rxbuff[32+1] ; //SPI receive buffer (payload max 32 bytes)
@@ -93,11 +134,13 @@ private:
 
  
 
-#endif
 
 
 #if defined(USE_HAL_DRIVER)
 void digitalWrite(uint16_t pin, bool state);
+void pinWrite(GPIO_TypeDef* port, uint16_t pin, bool state);
+void irqRegister(void);
+#endif
 protected:
   /**
    * SPI transactions
@@ -151,6 +194,86 @@ public:
   RF24(uint16_t _cepin, uint16_t _cspin, uint32_t spispeed );
   //#endif
 
+  #if defined (USE_HAL_DRIVER)
+  /**
+   * STM32 HAL Constructor
+   *
+   * Binds this instance to its own SPI bus, CE, CSN and optionally IRQ pin,
+   * so several radios can run side by side, each on its own bus. The
+   * two-pin constructor above uses the NRF24L01_* defaults of a_RF24_config.h.
+   *
+   * @code
+   * RF24 radio_rx(&hspi2, CE2_GPIO_Port, CE2_Pin, CSel2_GPIO_Port, CSel2_Pin, INT2_GPIO_Port, INT2_Pin);
+   * @endcode
+   *
+   * @param _hspi SPI handle, initialised by MX_SPIx_Init()
+   * @param _ce_port Port of the Chip Enable pin
+   * @param _cepin Chip Enable pin
+   * @param _csn_port Port of the Chip Select pin
+   * @param _cspin Chip Select pin
+   * @param _irq_port Port of the IRQ pin, NULL if it is not wired
+   * @param _irqpin IRQ pin, configured as EXTI falling edge
+   */
+  RF24(SPI_HandleTypeDef* _hspi, GPIO_TypeDef* _ce_port, uint16_t _cepin, GPIO_TypeDef* _csn_port, uint16_t _cspin,
+       GPIO_TypeDef* _irq_port = NULL, uint16_t _irqpin = 0);
+
+  ~RF24();
+
+  /**
+   * Call @p callback from the EXTI interrupt when this radio pulls its IRQ
+   * pin low. The callback runs in interrupt context; keep SPI traffic out of
+   * it unless nothing else uses this radio, and prefer irqPending() from the
+   * main loop.
+   *
+   * @param callback Function to call, NULL to only count
+   */
+  void attachInterrupt(void (*callback)(RF24* radio));
+
+  /**
+   * Takes the IRQ edges seen since the last call.
+   *
+   * @return True if the IRQ pin fired, follow up with whatHappened()
+   */
+  bool irqPending(void);
+
+  /**
+   * Routes an EXTI line to the radio wired to it. Call from
+   * HAL_GPIO_EXTI_Callback().
+   *
+   * @param GPIO_Pin The pin passed to HAL_GPIO_EXTI_Callback()
+   * @return True if a radio owns the pin
+   */
+  static bool handleIRQ(uint16_t GPIO_Pin);
+
+  /**
+   * Finds the fastest SPI clock the radio follows reliably.
+   *
+   * Steps the prescaler down from 256 and, at each step, writes patterns to
+   * TX_ADDR and reads them back. Stops at the first mismatch or above
+   * RF24_SPI_MAX_HZ, then backs off @p margin steps from the fastest clock
+   * that passed. TX_ADDR is restored afterwards. With CDC_LOG the result is
+   * printed; getSPIClock() returns it.
+   *
+   * @param margin Prescaler steps to back off from the fastest passing clock
+   * @return False if the radio did not answer even at the slowest clock,
+   * which is then kept
+   */
+  bool calibrateSPI(uint8_t margin = RF24_SPI_CAL_MARGIN);
+
+  /**
+   * Re-runs calibrateSPI() when a burst of corrupt STATUS bytes has been seen
+   * since the last call. Call from the main loop, not from an interrupt.
+   *
+   * @return True if the clock was calibrated again
+   */
+  bool checkSPI(void);
+
+  /**
+   * @return SPI clock of this radio in Hz
+   */
+  uint32_t getSPIClock(void);
+  #endif
+
   #if defined (RF24_LINUX)
   virtual ~RF24() {};
   #endif
@@ -337,6 +460,16 @@ s   *
    */
   void printDetails(void);
 
+  /**
+   * Registers 0x00 to 0x1D in order, for a host tool rather than printf.
+   * RX_ADDR_P0, RX_ADDR_P1 and TX_ADDR take 5 bytes each whatever the
+   * address width, SETUP_AW tells how many are used.
+   *
+   * @param[out] buf At least RF24_REGISTER_DUMP bytes
+   * @return RF24_REGISTER_DUMP
+   */
+  uint8_t readRegisters(uint8_t* buf);
+
   /**
    * Test whether there are bytes available to be read in the
    * FIFO buffers. 
@@ -361,6 +494,12 @@ s   *
    */
   bool rxFifoFull();
 
+  /**
+   * Check if every payload written has left the radio, sent or flushed.
+   * @return True if the TX FIFO is empty
+   */
+  bool txFifoEmpty();
+
   /**
    * Enter low-power mode
    *
@@ -563,6 +702,15 @@ s   *
    */
   void whatHappened(bool& tx_ok,bool& tx_fail,bool& rx_ready);
 
+  /**
+   * Clear the given interrupt flags only, for polling get_status() without
+   * the race of whatHappened(): a flag raised while whatHappened() writes
+   * STATUS back is cleared unseen, here it stays set.
+   *
+   * @param flags STATUS bits to clear, _BV(RX_DR), _BV(TX_DS), _BV(MAX_RT)
+   */
+  void clearStatus(uint8_t flags);
+
   /**
    * Non-blocking write to the open writing pipe used for buffered writes
    *
@@ -0,0 +1,118 @@
+/**
+ * @file a_RF24_bench.h
+ *
+ * Throughput and cost benchmark for the RF24 driver.
+ *
+ * Enabled by defining RF24_BENCH (see a_RF24_config.h), which also turns on
+ * RF24_TRACE since the SPI byte counts come from the trace totals. The same
+ * code runs on the board and on the host against the emulated radio in
+ * Host/emu, only the time source, the peer and the budget table differ.
+ *
+ * Every case reports packets per second, microseconds per operation, SPI
+ * bytes per packet and the SPI time per packet spent polling the radio, then
+ * compares the last three against the budget recorded for it. A budget of 0
+ * is not checked. RF24_Bench() returns the number of cases that failed, so a
+ * host run can be used as a regression gate.
+ *
+ * The bytes a wait loop clocks grow with the SPI clock, so the byte budget
+ * leaves them out and holds at any clock. The time those polls keep the bus
+ * busy is bounded by the radio, whatever the clock. The time per operation
+ * holds only at the SPI clock it was recorded at.
+ *
+ * The write cases need a station acknowledging on RF24_BENCH_ADDRESS, the
+ * read case a station sending to it. On the host both are EmuPeer instances,
+ * on the board a second node running the same channel and rate.
+ */
+
+#ifndef __RF24_BENCH_H__
+#define __RF24_BENCH_H__
+
+#include <stdint.h>
+#include "a_RF24_trace.h"
+
+class RF24;
+
+/** Address the benchmark talks to, pipe 1 listens on it as well */
+#define RF24_BENCH_ADDRESS  "BENCH"
+#define RF24_BENCH_CHANNEL  76
+#define RF24_BENCH_PAYLOAD  32
+
+/**
+ * Benchmark cases, in the order they run.
+ */
+typedef enum {
+  RF24_BENCH_BEGIN = 0,       /**< begin(), full re-initialisation */
+  RF24_BENCH_WRITE,           /**< write(), one acknowledged packet at a time */
+  RF24_BENCH_WRITE_FAST,      /**< writeFast() bursts closed by txStandBy() */
+  RF24_BENCH_WRITE_BLOCKING,  /**< writeBlocking() bursts closed by txStandBy(timeout) */
+  RF24_BENCH_TX_STANDBY,      /**< txStandBy() alone, after a three packet burst */
+  RF24_BENCH_READ,            /**< available()/read() draining the RX FIFO */
+  RF24_BENCH_ROLE_SWITCH,     /**< startListening() + stopListening() */
+  RF24_BENCH_COUNT
+} rf24_bench_case_e;
+
+/**
+ * Limits for one case. 0 disables the check.
+ */
+typedef struct {
+  uint32_t us_per_op;
+  uint16_t bytes_per_pkt;     /**< Polling excluded */
+  uint16_t poll_us_per_pkt;   /**< SPI time spent polling */
+} rf24_bench_budget_t;
+
+/**
+ * Limits for every case.
+ */
+typedef struct {
+  uint32_t spi_hz;            /**< SPI clock us_per_op was recorded at, 0 for none */
+  rf24_bench_budget_t cases[RF24_BENCH_COUNT];
+} rf24_bench_budgets_t;
+
+/**
+ * Result of one case.
+ */
+typedef struct {
+  uint16_t ops;               /**< Operations attempted */
+  uint16_t ok;                /**< Operations that succeeded (packet acknowledged or read) */
+  uint32_t elapsed_us;
+  uint32_t pkts_per_s;
+  uint32_t us_per_op;
+  uint16_t bytes_per_pkt;     /**< SPI bytes per packet, polling excluded */
+  uint16_t poll_per_pkt;      /**< SPI bytes per packet spent polling the radio */
+  uint16_t poll_us_per_pkt;   /**< The time they took on the bus */
+  uint8_t  failed;            /**< Over budget, or no packet got through */
+} rf24_bench_result_t;
+
+/**
+ * How to run the suite.
+ */
+typedef struct {
+  uint32_t (*micros)(void);                    /**< Free running microsecond clock */
+  void     (*feed)(uint8_t count);             /**< Make the peer send @p count packets, NULL on the board */
+  const rf24_bench_budgets_t* budgets;         /**< NULL to only report */
+  rf24_trace_sink_t sink;                      /**< Report lines, NULL for none */
+  uint16_t packets;                            /**< Packets per throughput case */
+} rf24_bench_config_t;
+
+/** Budgets recorded against the host emulator. */
+extern const rf24_bench_budgets_t RF24_BenchBudgetsEmu;
+
+/** Budgets for the STM32F407 board in the start-up low-power clock profile. */
+extern const rf24_bench_budgets_t RF24_BenchBudgetsBoard;
+
+/** Short name of a case, as printed in the report. */
+const char* RF24_BenchName(uint8_t bench);
+
+/**
+ * Run every case and report through @p config->sink.
+ *
+ * Leaves the radio in standby with the benchmark addresses configured.
+ *
+ * @param radio An RF24 that has been constructed, begin() is part of the run
+ * @param config Clock, peer hook, budgets and sink
+ * @param[out] results RF24_BENCH_COUNT entries, may be NULL
+ * @return Number of failed cases
+ */
+uint8_t RF24_Bench(RF24& radio, const rf24_bench_config_t* config, rf24_bench_result_t* results);
+
+#endif // __RF24_BENCH_H__
@@ -0,0 +1,90 @@
+/**
+ * @file a_RF24_bridge.h
+ *
+ * USB to radio bridge: the board as a radio dongle for the PC.
+ *
+ * Enabled by defining RF24_BRIDGE (see a_RF24_config.h). The host sends
+ * CDC_CMD_RADIO_SEND commands (cdc_command.h), one radio payload each, and
+ * gets every payload received on any pipe back as a TELEMETRY_RADIO record
+ * (telemetry.h): pipe and payload, the record time being when the payload
+ * left the RX FIFO. The other commands still set the channel, addresses and
+ * the rest of the TX radio.
+ *
+ * Flow control goes all the way back to the host. A payload that finds the
+ * RF24_BRIDGE_QUEUE slots full stays in the CDC receive buffer, the
+ * commands after it wait too, and once that buffer is full the OUT
+ * endpoint NAKs until the radio has caught up. Nothing is overwritten.
+ *
+ * The TX radio keeps two payloads in its FIFO, so that the next one is
+ * uploaded while the last one waits for its ACK, and each one is counted
+ * sent or failed from TX_DS and MAX_RT. A payload that runs out of retries
+ * is dropped, the one behind it is written again.
+ *
+ * With one radio, TX takes the air whenever the queue holds a payload and
+ * the radio listens again once it is empty: what comes in meanwhile is
+ * lost in the air. With RF24_DUAL_RADIO the second radio only listens and
+ * both directions run at once. Losses on the way in are counted: RX FIFO
+ * found full (the radio may have dropped more) and records the CDC IN path
+ * refused. The counters go out as TELEMETRY_STATS_BRIDGE every
+ * stats_interval ms.
+ */
+
+#ifndef __RF24_BRIDGE_H__
+#define __RF24_BRIDGE_H__
+
+#include <stdint.h>
+#include "a_RF24.h"
+
+/** Payloads between CDC and the TX radio, power of two */
+#ifndef RF24_BRIDGE_QUEUE
+#define RF24_BRIDGE_QUEUE     16
+#endif
+
+/** ms without TX_DS or MAX_RT before the TX FIFO is given up, longer than 15 retries of 4 ms */
+#define RF24_BRIDGE_TIMEOUT   100
+
+/**
+ * The radios to bridge, set up by the caller (rate, CRC, addresses).
+ */
+typedef struct {
+  RF24*    tx;                                 /**< Sends the payloads from CDC */
+  RF24*    rx;                                 /**< Listens on every pipe, may be tx */
+  uint8_t  payload_size;                       /**< 0 for dynamic payloads, else the fixed size on the air */
+  uint16_t stats_interval;                     /**< ms between TELEMETRY_STATS_BRIDGE records, 0 for none */
+} rf24_bridge_config_t;
+
+typedef struct {
+  uint32_t queued;            /**< Payloads taken from CDC */
+  uint32_t sent;              /**< Acknowledged, or sent when auto-ack is off */
+  uint32_t failed;            /**< Out of retries or timed out, dropped */
+  uint32_t full;              /**< Times CDC found the queue full and had to wait */
+  uint32_t received;          /**< Payloads read from the RX radio */
+  uint32_t rx_fifo_full;      /**< Reads that found the RX FIFO full, payloads may have been lost in the radio */
+  uint32_t rx_dropped;        /**< Received payloads the CDC IN path refused */
+} rf24_bridge_stats_t;
+
+/**
+ * Start bridging: the RX radio listens, the queue is empty.
+ *
+ * @param config Kept by reference
+ */
+void RF24_BridgeBegin(const rf24_bridge_config_t* config);
+
+/**
+ * Queue one payload for the TX radio, the send hook of
+ * cdc_command_config_t.
+ *
+ * @return 1 if queued, 0 if the queue is full and the payload must wait
+ */
+uint8_t RF24_BridgeSend(const uint8_t* payload, uint8_t len);
+
+/**
+ * Forward what the RX radio received, move the TX state on and send the
+ * counters when due. Call in a tight loop, never blocks.
+ */
+void RF24_BridgePoll(void);
+
+/** Counters since RF24_BridgeBegin(). */
+const rf24_bridge_stats_t* RF24_BridgeStats(void);
+
+#endif // __RF24_BRIDGE_H__
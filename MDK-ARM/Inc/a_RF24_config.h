@@ -24,6 +24,14 @@
 //#define MINIMAL
 //#define SPI_UART  // Requires library from https://github.com/TMRh20/Sketches/tree/master/SPI_UART
 //#define SOFTSPI   // Requires library from https://github.com/greiman/DigitalIO
+//#define RF24_TRACE // Count SPI transactions, bytes, CSN toggles and cycles per API call, see a_RF24_trace.h
+//#define RF24_BENCH // Build the benchmark suite in a_RF24_bench.h, implies RF24_TRACE
+//#define RF24_SNIFFER // Build the promiscuous pcap capture in a_RF24_sniffer.h
+//#define RF24_BRIDGE // Build the USB to radio bridge in a_RF24_bridge.h
+
+#if defined (RF24_BENCH) && !defined (RF24_TRACE)
+  #define RF24_TRACE
+#endif
   
 /**********************/
 #define rf24_max(a,b) (a>b?a:b)
@@ -32,9 +40,11 @@
 #define _BV(x) (1<<(x))
 
 #if defined (CDC_LOG)
-#include "usbd_cdc_if.h"
+/* Log lines go out tokenized, TLOG()/TLOG0(), the host formats them */
+#include "tlog.h"
 #endif
 #if defined (USE_HAL_DRIVER)
+#include "stm32f4xx_hal.h"
 #define	 millis() 			HAL_GetTick()
 #define  HIGH 					1
 #define  LOW						0
@@ -64,6 +74,12 @@ extern SPI_HandleTypeDef 			NRF24L01_SPI;
 #error "CE Pin is set on default"
 #endif
 
+/* Interrupt pin, used by the two-pin constructor */
+#ifndef NRF24L01_IRQ_PORT
+#define NRF24L01_IRQ_PORT			INT_GPIO_Port
+#define NRF24L01_IRQ_PIN			INT_Pin
+#endif
+
 /* Pins configuration */
 #define NRF24L01_CE_LOW				HAL_GPIO_WritePin(NRF24L01_CE_PORT,NRF24L01_CE_PIN,GPIO_PIN_RESET)
 #define NRF24L01_CE_HIGH			HAL_GPIO_WritePin(NRF24L01_CE_PORT,NRF24L01_CE_PIN,GPIO_PIN_SET) 
@@ -76,6 +92,39 @@ extern SPI_HandleTypeDef 			NRF24L01_SPI;
 #define NRF24L01_IRQ_MAX_RT         0x10 /*!< Max retransmissions reached, last transmission failed */
 #endif
 
+/* Radios that can have their IRQ pin routed by RF24::handleIRQ() */
+#ifndef RF24_MAX_INSTANCES
+#define RF24_MAX_INSTANCES		2
+#endif
+
+/* Every instance has its own bus, see RF24::spi */
+#define _SPI spi
+
+/* The bus may be shared with other chips, every register access claims it
+   from the arbiter in spi_bus.c */
+#include "spi_bus.h"
+#define RF24_SPI_TRANSACTIONS
+#ifndef RF24_SPI_CLAIM_TIMEOUT
+#define RF24_SPI_CLAIM_TIMEOUT	100
+#endif
+
+/* SPI clock calibration, see RF24::calibrateSPI() */
+#ifndef RF24_SPI_MAX_HZ
+#define RF24_SPI_MAX_HZ			10000000UL	/* nRF24L01+ datasheet limit */
+#endif
+#ifndef RF24_SPI_CAL_MARGIN
+#define RF24_SPI_CAL_MARGIN		1			/* steps back from the fastest passing clock */
+#endif
+#ifndef RF24_SPI_CAL_ROUNDS
+#define RF24_SPI_CAL_ROUNDS		4			/* passes over the patterns at each step */
+#endif
+#ifndef RF24_SPI_ERROR_BURST
+#define RF24_SPI_ERROR_BURST	3			/* corrupt STATUS bytes ... */
+#endif
+#ifndef RF24_SPI_ERROR_WINDOW
+#define RF24_SPI_ERROR_WINDOW	1000		/* ... within this many ms mark a burst */
+#endif
+
 #endif
 
 #if defined (SPI_HAS_TRANSACTION) && !defined (SPI_UART) && !defined (SOFTSPI)
@@ -0,0 +1,118 @@
+/**
+ * @file a_RF24_sniffer.h
+ *
+ * Promiscuous capture of Enhanced ShockBurst frames, streamed as pcap.
+ *
+ * Enabled by defining RF24_SNIFFER (see a_RF24_config.h). The radio listens
+ * with a 2 byte address of 0x00AA / 0x0055, CRC and auto-ack off and a fixed
+ * 32 byte payload, so that a preamble followed by noise opens a capture of
+ * whatever comes next: the real address, the packet control field, the
+ * payload and its CRC. RF24_SnifferDecode() finds the frame in those 256 bits
+ * by trying every bit offset and checking the CRC, reading the length from
+ * the packet control field. With 5 byte addresses only payloads of up to 23
+ * bytes fit in a capture.
+ *
+ * Each frame becomes one pcap record of link type RF24_SNIFFER_LINKTYPE
+ * (LINKTYPE_USER0), made of an rf24_sniffer_header_t, the address and the
+ * payload. Timestamps are microseconds, taken in the IRQ edge when the pin
+ * is wired and at the FIFO read otherwise.
+ *
+ * Records are packed into one of two RF24_SNIFFER_BUFFER byte buffers while
+ * the other is being sent, and handed to the transmit hook as soon as it is
+ * free. Only when both are full is a frame dropped, and counted.
+ */
+
+#ifndef __RF24_SNIFFER_H__
+#define __RF24_SNIFFER_H__
+
+#include <stdint.h>
+#include "a_RF24.h"
+
+/** LINKTYPE_USER0, tell Wireshark the layout with a DLT_USER entry */
+#define RF24_SNIFFER_LINKTYPE 147
+
+/** Bytes per TX buffer, two of them */
+#ifndef RF24_SNIFFER_BUFFER
+#define RF24_SNIFFER_BUFFER   2048
+#endif
+
+/** rf24_sniffer_header_t::flags */
+#define RF24_SNIFFER_CRC_OK   0x01  /**< Decoded with a good CRC, else the raw capture */
+#define RF24_SNIFFER_NO_ACK   0x02  /**< The NO_ACK bit of the packet control field */
+
+/**
+ * Start of every pcap record.
+ */
+typedef struct {
+  uint8_t version;            /**< 1 */
+  uint8_t channel;
+  uint8_t data_rate;          /**< rf24_datarate_e */
+  uint8_t flags;              /**< RF24_SNIFFER_* */
+  uint8_t addr_len;           /**< Address bytes following the header, 0 for a raw capture */
+  uint8_t payload_len;        /**< Payload bytes after the address */
+  uint8_t pid;                /**< Packet id, 2 bits */
+  uint8_t bit_offset;         /**< Where the frame started in the capture */
+} rf24_sniffer_header_t;
+
+/**
+ * One decoded frame.
+ */
+typedef struct {
+  uint8_t address[5];
+  uint8_t addr_len;
+  uint8_t payload[32];
+  uint8_t payload_len;
+  uint8_t pid;
+  uint8_t no_ack;
+  uint8_t bit_offset;
+} rf24_esb_frame_t;
+
+/**
+ * How to capture.
+ */
+typedef struct {
+  uint8_t channel;
+  rf24_datarate_e data_rate;
+  uint8_t addr_width;                          /**< Width used on the channel, 3 to 5 */
+  uint8_t keep_bad;                            /**< Also record captures that do not decode */
+  uint32_t (*micros)(void);                    /**< Free running microsecond clock */
+  uint8_t  (*transmit)(uint8_t* buf, uint16_t len); /**< 0 once taken, like CDC_Transmit_FS() */
+} rf24_sniffer_config_t;
+
+typedef struct {
+  uint32_t captures;          /**< Payloads read from the radio */
+  uint32_t frames;            /**< Captures that decoded */
+  uint32_t crc_errors;        /**< Captures that did not */
+  uint32_t fifo_full;         /**< Reads that found the RX FIFO full, frames may have been lost in the radio */
+  uint32_t dropped;           /**< Records lost with both buffers full */
+  uint32_t bytes;             /**< Handed to the transmit hook */
+} rf24_sniffer_stats_t;
+
+/**
+ * Configure @p radio for capture and queue the pcap file header.
+ *
+ * @param radio An RF24 after begin()
+ * @param config Kept by reference until the capture stops
+ */
+void RF24_SnifferBegin(RF24& radio, const rf24_sniffer_config_t* config);
+
+/**
+ * Drain the RX FIFO into records and hand a full buffer on. Call in a tight
+ * loop.
+ */
+void RF24_SnifferPoll(RF24& radio);
+
+/** Counters since RF24_SnifferBegin(). */
+const rf24_sniffer_stats_t* RF24_SnifferStats(void);
+
+/**
+ * Look for an ESB frame in a 32 byte capture.
+ *
+ * @param raw The capture, bits in air order
+ * @param addr_width Address width used on the channel
+ * @param[out] frame Filled on success
+ * @return True if a frame with a good CRC was found
+ */
+bool RF24_SnifferDecode(const uint8_t* raw, uint8_t addr_width, rf24_esb_frame_t* frame);
+
+#endif // __RF24_SNIFFER_H__
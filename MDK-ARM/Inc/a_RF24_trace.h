@@ -0,0 +1,214 @@
+/**
+ * @file a_RF24_trace.h
+ *
+ * Optional SPI cost accounting for the RF24 driver.
+ *
+ * Enabled by defining RF24_TRACE (see a_RF24_config.h). Every public RF24 call
+ * opens a trace scope; while it is open the driver counts SPI transactions,
+ * bytes clocked, CSN toggles and core cycles. When the outermost scope closes
+ * one record is pushed into a single-producer/single-consumer ring which can
+ * be drained with RF24_TracePop() or RF24_TraceDump() without stopping the
+ * producer. Per-API running totals are kept as well so a whole run can be
+ * compared against a previous one.
+ *
+ * Without RF24_TRACE all hooks compile to nothing.
+ */
+
+#ifndef __RF24_TRACE_H__
+#define __RF24_TRACE_H__
+
+#include <stdint.h>
+
+/**
+ * Public RF24 calls that are accounted for.
+ *
+ * Keep RF24_API_COUNT last, it sizes the totals table.
+ */
+typedef enum {
+  RF24_API_NONE = 0,
+  RF24_API_BEGIN,
+  RF24_API_START_LISTENING,
+  RF24_API_STOP_LISTENING,
+  RF24_API_AVAILABLE,
+  RF24_API_READ,
+  RF24_API_WRITE,
+  RF24_API_WRITE_FAST,
+  RF24_API_WRITE_BLOCKING,
+  RF24_API_TX_STANDBY,
+  RF24_API_START_FAST_WRITE,
+  RF24_API_START_WRITE,
+  RF24_API_REUSE_TX,
+  RF24_API_WRITE_ACK_PAYLOAD,
+  RF24_API_WHAT_HAPPENED,
+  RF24_API_OPEN_WRITING_PIPE,
+  RF24_API_OPEN_READING_PIPE,
+  RF24_API_POWER_UP,
+  RF24_API_POWER_DOWN,
+  RF24_API_CONFIG,            /**< setChannel(), setPALevel(), setDataRate() and the other setters */
+  RF24_API_QUERY,             /**< getChannel(), get_status(), rxFifoFull() and the other getters */
+  RF24_API_COUNT
+} rf24_api_e;
+
+/**
+ * One finished public call.
+ */
+typedef struct {
+  uint8_t  api;               /**< rf24_api_e */
+  uint8_t  transactions;      /**< CSN low..high frames */
+  uint16_t bytes;             /**< Bytes clocked through SerialPI::transfer() */
+  uint16_t poll_bytes;        /**< Of those, bytes clocked while waiting on the radio */
+  uint16_t csn_toggles;       /**< Every CSN edge, both directions */
+  uint32_t cycles;            /**< Elapsed core cycles, DWT->CYCCNT */
+} rf24_trace_record_t;
+
+/**
+ * Running totals for one API since the last RF24_TraceReset().
+ */
+typedef struct {
+  uint32_t calls;
+  uint32_t transactions;
+  uint32_t bytes;
+  uint32_t poll_bytes;
+  uint32_t csn_toggles;
+  uint32_t cycles;
+} rf24_trace_totals_t;
+
+/** Receives one formatted line from RF24_TraceDump(). */
+typedef void (*rf24_trace_sink_t)(const char* line, uint16_t len);
+
+#if defined (RF24_TRACE)
+
+/* Number of records kept, must be a power of two */
+#ifndef RF24_TRACE_DEPTH
+#define RF24_TRACE_DEPTH 64
+#endif
+
+#if (RF24_TRACE_DEPTH & (RF24_TRACE_DEPTH - 1)) != 0
+#error "RF24_TRACE_DEPTH must be a power of two"
+#endif
+
+/* Cycle source, may be overridden for host builds */
+#ifndef RF24_TRACE_CYCLES
+#define RF24_TRACE_CYCLES() (DWT->CYCCNT)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Counters of the call that is currently in flight. */
+typedef struct {
+  volatile uint8_t  depth;
+  uint8_t           api;
+  uint8_t           transactions;
+  uint8_t           polling;
+  uint16_t          bytes;
+  uint16_t          poll_bytes;
+  uint16_t          csn_toggles;
+  uint32_t          start;
+} rf24_trace_ctx_t;
+
+extern rf24_trace_ctx_t rf24_trace_ctx;
+
+/** Enables the DWT cycle counter and clears the ring and the totals. */
+void RF24_TraceInit(void);
+
+/** Clears the ring and the totals. */
+void RF24_TraceReset(void);
+
+/** Closes the outermost scope and publishes its record. */
+void RF24_TraceCommit(void);
+
+/**
+ * Takes the oldest record out of the ring.
+ *
+ * @return 1 if @p rec was filled, 0 if the ring is empty
+ */
+uint8_t RF24_TracePop(rf24_trace_record_t* rec);
+
+/** Number of records lost because the ring was full. */
+uint32_t RF24_TraceDropped(void);
+
+/** Totals of @p api since the last reset, NULL for an unknown api. */
+const rf24_trace_totals_t* RF24_TraceTotals(uint8_t api);
+
+/** Printable name of @p api. */
+const char* RF24_TraceName(uint8_t api);
+
+/**
+ * Drains the ring and then prints the totals table, one line per call to @p sink.
+ */
+void RF24_TraceDump(rf24_trace_sink_t sink);
+
+#ifdef __cplusplus
+}
+
+/**
+ * Scope guard placed at the top of every public RF24 method.
+ *
+ * Only the outermost scope is recorded, nested public calls (write() calling
+ * startFastWrite() for instance) are charged to the caller.
+ */
+class RF24TraceScope
+{
+public:
+  RF24TraceScope(uint8_t api)
+  {
+    if (rf24_trace_ctx.depth++ == 0) {
+      rf24_trace_ctx.api = api;
+      rf24_trace_ctx.transactions = 0;
+      rf24_trace_ctx.bytes = 0;
+      rf24_trace_ctx.poll_bytes = 0;
+      rf24_trace_ctx.csn_toggles = 0;
+      rf24_trace_ctx.start = RF24_TRACE_CYCLES();
+    }
+  }
+  ~RF24TraceScope()
+  {
+    if (--rf24_trace_ctx.depth == 0) {
+      RF24_TraceCommit();
+    }
+  }
+};
+
+/**
+ * Scope guard around a loop that waits on the radio.
+ *
+ * The bytes such a loop clocks grow with the SPI clock, they are counted in
+ * poll_bytes as well so that the rest of the traffic can be compared across
+ * clocks.
+ */
+class RF24TracePoll
+{
+public:
+  RF24TracePoll() : saved(rf24_trace_ctx.polling)
+  {
+    rf24_trace_ctx.polling = 1;
+  }
+  ~RF24TracePoll()
+  {
+    rf24_trace_ctx.polling = saved;
+  }
+private:
+  uint8_t saved;
+};
+
+#define RF24_TRACE_API(api)       RF24TraceScope rf24_trace_scope(api)
+#define RF24_TRACE_POLL()         RF24TracePoll rf24_trace_poll
+#endif // __cplusplus
+
+#define RF24_TRACE_TRANSACTION()  (rf24_trace_ctx.transactions++)
+#define RF24_TRACE_BYTE()         (rf24_trace_ctx.bytes++, rf24_trace_ctx.poll_bytes += rf24_trace_ctx.polling)
+#define RF24_TRACE_CSN()          (rf24_trace_ctx.csn_toggles++)
+
+#else // !defined(RF24_TRACE)
+
+#define RF24_TRACE_API(api)
+#define RF24_TRACE_POLL()
+#define RF24_TRACE_TRANSACTION()
+#define RF24_TRACE_BYTE()
+#define RF24_TRACE_CSN()
+
+#endif // defined(RF24_TRACE)
+
+#endif // __RF24_TRACE_H__
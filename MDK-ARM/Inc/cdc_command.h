@@ -0,0 +1,113 @@
+/**
+ * @file cdc_command.h
+ *
+ * Binary commands from the host on the CDC OUT endpoint, answered on CDC IN.
+ *
+ * A request is
+ *
+ *   CDC_CMD_SYNC  id  len  payload[len]  check
+ *
+ * where check is the XOR of every byte after the sync byte, so that the XOR
+ * of a whole frame but its sync byte is 0. The response is a
+ * TELEMETRY_RESPONSE record (telemetry.h) of id, status and payload, in
+ * line with the rest of the telemetry. Multi-byte fields are little
+ * endian. Bytes that do not start a frame, and frames with a bad check,
+ * are skipped until the next CDC_CMD_SYNC: a bad frame gets no response,
+ * the host times out and sends it again.
+ *
+ * Frames are parsed where they landed in the receive buffer of
+ * usbd_cdc_if.c (CDC_RxData_FS()), only a command cut by the end of that
+ * buffer is moved. CDC_CommandPoll() runs the commands from the main loop:
+ * the radio and the I2C bus are never touched from the USB interrupt.
+ *
+ * CDC_CMD_RADIO_SEND is only answered when it fails, so that a stream of
+ * payloads costs no IN bandwidth. With a send hook (RF24_BRIDGE) the
+ * payload is queued; when the queue is full the frame and the ones after
+ * it stay in the receive buffer until the next poll, and once that buffer
+ * is full the OUT endpoint NAKs.
+ *
+ * Commands and their payloads, request / response:
+ *
+ *   CDC_CMD_PING          - / version, HAL_GetTick() u32
+ *   CDC_CMD_RADIO_CHANNEL channel 0..125 / -
+ *   CDC_CMD_RADIO_PA      rf24_pa_dbm_e / -
+ *   CDC_CMD_RADIO_RATE    rf24_datarate_e / -
+ *   CDC_CMD_RADIO_TX_ADDR 3 to 5 address bytes, LSB first / -
+ *   CDC_CMD_RADIO_RX_ADDR pipe, 3 to 5 address bytes / -
+ *   CDC_CMD_RADIO_CONFIG  - / channel, PA, rate, CRC length, payload size, SPI clock u32
+ *   CDC_CMD_RADIO_REGS    - / RF24_REGISTER_DUMP bytes, see RF24::readRegisters()
+ *   CDC_CMD_RADIO_SEND    1 to 32 payload bytes / -, answered only on failure
+ *   CDC_CMD_HTU_TRIGGER   slot / -
+ *   CDC_CMD_HTU_READ      slot / slot, chip u16, humidity, compensated & temperature
+ *                         i16 (1/100), time & temperature time u32 (ms)
+ *   CDC_CMD_STATS         - / cdc_command_stats_t, CDC_TxStats_FS queued, sent &
+ *                         dropped, scheduler cycles, readings & failures, all u32
+ *
+ * The address commands set the address width of every pipe to the length
+ * given, the radio has one width for all of them.
+ */
+
+#ifndef __CDC_COMMAND_H__
+#define __CDC_COMMAND_H__
+
+#include <stdint.h>
+#include "a_RF24.h"
+#include "HTU21D_scheduler.h"
+
+#define CDC_CMD_SYNC          0xA5
+#define CDC_CMD_VERSION       1
+#define CDC_CMD_MAX_PAYLOAD   62           /**< Longest payload either way, a response fits TELEMETRY_MAX_PAYLOAD */
+
+/** Request ids, echoed in the response */
+#define CDC_CMD_PING          0x01
+#define CDC_CMD_RADIO_CHANNEL 0x10
+#define CDC_CMD_RADIO_PA      0x11
+#define CDC_CMD_RADIO_RATE    0x12
+#define CDC_CMD_RADIO_TX_ADDR 0x13
+#define CDC_CMD_RADIO_RX_ADDR 0x14
+#define CDC_CMD_RADIO_CONFIG  0x15
+#define CDC_CMD_RADIO_REGS    0x16
+#define CDC_CMD_RADIO_SEND    0x17
+#define CDC_CMD_HTU_TRIGGER   0x20
+#define CDC_CMD_HTU_READ      0x21
+#define CDC_CMD_STATS         0x30
+
+/** Response status */
+#define CDC_CMD_OK            0x00
+#define CDC_CMD_UNKNOWN       0x01         /**< No such id */
+#define CDC_CMD_BAD_LENGTH    0x02         /**< Payload too short or too long for the id */
+#define CDC_CMD_BAD_VALUE     0x03         /**< A field out of range */
+#define CDC_CMD_FAILED        0x04         /**< The radio refused, no sensor or no reading yet */
+
+/**
+ * What the commands act on.
+ */
+typedef struct {
+  RF24*             radio;
+  HTU21D_Scheduler* sensors;               /**< NULL without sensors */
+  uint8_t (*send)(const uint8_t* payload, uint8_t len); /**< Queues CDC_CMD_RADIO_SEND, 0 when full; NULL to write() at once */
+} cdc_command_config_t;
+
+typedef struct {
+  uint32_t commands;                       /**< Frames run, whatever their status */
+  uint32_t errors;                         /**< Of them, answered with another status than CDC_CMD_OK */
+  uint32_t bad_check;                      /**< Frames dropped on their check byte or length */
+  uint32_t skipped;                        /**< Bytes skipped looking for CDC_CMD_SYNC */
+  uint32_t lost;                           /**< Responses telemetry_send() dropped */
+} cdc_command_stats_t;
+
+/**
+ * @param config Kept by reference
+ */
+void CDC_CommandBegin(const cdc_command_config_t* config);
+
+/**
+ * Run the commands received since the last call and answer them. Call from
+ * the main loop, never from an interrupt.
+ */
+void CDC_CommandPoll(void);
+
+/** Counters since CDC_CommandBegin(). */
+const cdc_command_stats_t* CDC_CommandStats(void);
+
+#endif // __CDC_COMMAND_H__
@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file    clock_profile.h
+  * @brief   Run-time clock profiles.
+  *
+  *          The PLL runs from the 8 MHz HSE at a fixed 336 MHz VCO, giving
+  *          168 MHz on P and the 48 MHz USB clock on Q. A profile only sets
+  *          the AHB/APB dividers and the flash wait states, which the RCC
+  *          changes without stopping the PLL, so USB keeps running through a
+  *          switch.
+  *
+  *          Profile      HCLK   APB1   APB2   Flash WS
+  *          MAX          168    42     84     5
+  *          BALANCED     84     42     84     2
+  *          LOW_POWER    21     21     21     0
+  *
+  *          LOW_POWER is the start-up profile set by SystemClock_Config(). It
+  *          cannot go lower: USB OTG FS needs HCLK above 14.2 MHz.
+  *
+  *          clock_profile_set() first asks every listener whether the switch
+  *          may happen (CLOCK_PROFILE_PREPARE, non-zero refuses), switches
+  *          with interrupts masked, then tells them (CLOCK_PROFILE_CHANGED) so
+  *          that peripherals can recompute their prescalers. SysTick is
+  *          reloaded by the HAL and clock_micros() follows it.
+  ******************************************************************************
+  */
+
+#ifndef __CLOCK_PROFILE_H__
+#define __CLOCK_PROFILE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+typedef enum
+{
+  CLOCK_PROFILE_LOW_POWER = 0,
+  CLOCK_PROFILE_BALANCED,
+  CLOCK_PROFILE_MAX,
+  CLOCK_PROFILE_COUNT
+} clock_profile_e;
+
+typedef enum
+{
+  CLOCK_PROFILE_PREPARE = 0,    /*!< Before the switch, interrupts masked */
+  CLOCK_PROFILE_CHANGED         /*!< After the switch, SystemCoreClock is updated */
+} clock_profile_event_e;
+
+typedef struct clock_listener_s clock_listener_t;
+
+/**
+  * @brief A module told about profile switches, see clock_profile_listen().
+  */
+struct clock_listener_s
+{
+  /* Return non-zero on CLOCK_PROFILE_PREPARE to refuse the switch */
+  uint8_t           (*notify)(clock_profile_event_e event, clock_profile_e profile, void *context);
+  void              *context;
+  clock_listener_t  *next;
+};
+
+void              clock_profile_init(clock_profile_e profile);
+HAL_StatusTypeDef clock_profile_set(clock_profile_e profile);
+clock_profile_e   clock_profile_get(void);
+const char        *clock_profile_name(clock_profile_e profile);
+void              clock_profile_listen(clock_listener_t *listener);
+
+uint32_t clock_micros(void);
+void     clock_delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CLOCK_PROFILE_H__ */
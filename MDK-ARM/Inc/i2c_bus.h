@@ -0,0 +1,149 @@
+/**
+  ******************************************************************************
+  * @file    i2c_bus.h
+  * @brief   Shared I2C bus transaction engine.
+  *
+  *          Sensor drivers queue i2c_xfer_t transactions on one I2C master,
+  *          the engine runs them one after the other without the CPU
+  *          waiting: write, read, or write then read with a repeated start.
+  *          Transfers of I2C_BUS_DMA_MIN bytes or more use DMA when the
+  *          handle has DMA linked, shorter ones use interrupts.
+  *
+  *          Two ways to use the bus, as with spi_bus.h:
+  *          - i2c_bus_submit() of an i2c_xfer_t, its complete callback runs
+  *            from the I2C/DMA interrupt;
+  *          - i2c_bus_claim() / i2c_bus_release() around blocking HAL calls
+  *            such as HAL_I2C_IsDeviceReady(), queued work waits meanwhile.
+  *          i2c_bus_run() submits and waits, for code that needs the answer
+  *          before going on.
+  *
+  *          Ownership is a single pointer swapped with LDREX/STREX, submit
+  *          is safe from any context without masking interrupts.
+  *
+  *          Stuck bus: call i2c_bus_tick() every millisecond (SysTick). A
+  *          transfer that runs longer than I2C_BUS_TIMEOUT_MS is aborted.
+  *          After a timeout or a bus error, and before a transfer when
+  *          SDA or BUSY are held low on an idle bus, the engine clocks SCL
+  *          up to 9 times until the slave lets SDA go, sends a STOP and
+  *          resets the peripheral. Set the pins with i2c_bus_set_pins().
+  *
+  *          Latency: every transfer records its time in the queue and on
+  *          the wire in microseconds (clock_micros()), the bus keeps the
+  *          last and the largest.
+  *
+  *          Clock: the HAL computes CCR from PCLK1 in HAL_I2C_Init(), call it
+  *          again after the APB clocks change, while i2c_bus_busy() is false.
+  ******************************************************************************
+  */
+
+#ifndef __I2C_BUS_H__
+#define __I2C_BUS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+/* Buses that i2c_bus_get() can hand out */
+#ifndef I2C_BUS_COUNT
+#define I2C_BUS_COUNT     3
+#endif
+
+/* Shortest transfer handed to DMA, shorter ones cost less with interrupts */
+#ifndef I2C_BUS_DMA_MIN
+#define I2C_BUS_DMA_MIN   4
+#endif
+
+/* Longest a started transfer may take before it is aborted, ms */
+#ifndef I2C_BUS_TIMEOUT_MS
+#define I2C_BUS_TIMEOUT_MS  25
+#endif
+
+/* i2c_xfer_t states */
+#define I2C_XFER_IDLE     0U
+#define I2C_XFER_QUEUED   1U
+#define I2C_XFER_ACTIVE   2U
+#define I2C_XFER_DONE     3U
+
+typedef struct i2c_bus_s  i2c_bus_t;
+typedef struct i2c_xfer_s i2c_xfer_t;
+
+/**
+  * @brief A queued transaction. With both tx_len and rx_len set the bytes
+  *        of tx are written, then rx_len bytes are read after a repeated
+  *        start, as for a register read.
+  */
+struct i2c_xfer_s
+{
+  i2c_bus_t     *bus;
+  uint8_t       addr;           /*!< 7-bit address */
+  uint8_t       priority;       /*!< Higher runs first among queued transfers */
+  const uint8_t *tx;
+  uint16_t      tx_len;
+  uint8_t       *rx;
+  uint16_t      rx_len;
+  void          (*complete)(i2c_xfer_t *xfer);  /*!< Called from the I2C/DMA interrupt, may be NULL */
+  void          *context;
+  volatile HAL_StatusTypeDef status;
+  volatile uint32_t error;      /*!< HAL_I2C_ERROR_*, HAL_I2C_ERROR_AF when the slave NACKed */
+  volatile uint8_t state;       /*!< I2C_XFER_* */
+  uint8_t       phase;          /*!< 0 while writing, 1 while reading */
+  uint32_t      queued_us;      /*!< clock_micros() at submit */
+  uint32_t      started_us;     /*!< clock_micros() when the START went out */
+  uint32_t      wait_us;        /*!< Time in the queue */
+  uint32_t      latency_us;     /*!< Submit to complete */
+  i2c_xfer_t    *next;
+};
+
+/**
+  * @brief Engine state of one I2C peripheral.
+  */
+struct i2c_bus_s
+{
+  I2C_HandleTypeDef       *hi2c;
+  void * volatile         owner;      /*!< Claimer or active transfer, NULL when free */
+  i2c_xfer_t * volatile   incoming;   /*!< Submitted, not yet sorted (lock-free stack) */
+  i2c_xfer_t              *pending;   /*!< Sorted by priority, only touched by the owner */
+  i2c_xfer_t * volatile   active;
+  volatile uint32_t       started;    /*!< HAL_GetTick() when active went out */
+  volatile uint32_t       waiting;    /*!< Blocking claimers spinning right now */
+  GPIO_TypeDef            *scl_port;  /*!< NULL, no stuck bus recovery */
+  uint16_t                scl_pin;
+  GPIO_TypeDef            *sda_port;
+  uint16_t                sda_pin;
+  uint8_t                 alternate;  /*!< GPIO_AFx_I2Cx of both pins */
+  /* Statistics */
+  uint32_t                transfers;
+  uint32_t                errors;     /*!< Bus errors, arbitration losses and timeouts */
+  uint32_t                nacks;
+  uint32_t                recoveries;
+  uint32_t                last_latency_us;
+  uint32_t                max_latency_us;
+  uint32_t                max_wait_us;
+};
+
+i2c_bus_t *i2c_bus_get(I2C_HandleTypeDef *hi2c);
+void    i2c_bus_set_pins(i2c_bus_t *bus, GPIO_TypeDef *scl_port, uint16_t scl_pin,
+                         GPIO_TypeDef *sda_port, uint16_t sda_pin, uint8_t alternate);
+
+void    i2c_xfer_init(i2c_xfer_t *xfer, i2c_bus_t *bus, uint8_t addr,
+                      const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len);
+
+uint8_t i2c_bus_try_claim(i2c_bus_t *bus, void *owner);
+uint8_t i2c_bus_claim(i2c_bus_t *bus, void *owner, uint32_t timeout_ms);
+void    i2c_bus_release(i2c_bus_t *bus, void *owner);
+
+HAL_StatusTypeDef i2c_bus_submit(i2c_xfer_t *xfer);
+HAL_StatusTypeDef i2c_bus_run(i2c_xfer_t *xfer);
+void    i2c_bus_irq(I2C_HandleTypeDef *hi2c, HAL_StatusTypeDef status);
+void    i2c_bus_tick(void);
+void    i2c_bus_recover(i2c_bus_t *bus);
+
+uint8_t i2c_bus_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I2C_BUS_H__ */
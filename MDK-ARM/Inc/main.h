@@ -75,7 +75,14 @@ void Error_Handler(void);
 #define LED_BLUE_Pin GPIO_PIN_15
 #define LED_BLUE_GPIO_Port GPIOD
 /* USER CODE BEGIN Private defines */
-#define CPU_Freq_MHZ 16
+
+/* Second radio on SPI2 (PB13 SCK, PB14 MISO, PB15 MOSI) */
+#define CSel2_Pin GPIO_PIN_12				//CSN PIN
+#define CSel2_GPIO_Port GPIOB
+#define TxRx2_Pin GPIO_PIN_11				// CE pin
+#define TxRx2_GPIO_Port GPIOB
+#define INT2_Pin GPIO_PIN_6
+#define INT2_GPIO_Port GPIOC
 
 
 /* USER CODE END Private defines */
@@ -0,0 +1,136 @@
+/**
+  ******************************************************************************
+  * @file    sample_ring.h
+  * @brief   Sensor sample history and windowed summaries.
+  *
+  *          A fixed-capacity ring keeps the last samples of every source
+  *          (a sensor slot), the oldest are overwritten. Alongside, each
+  *          source has an open window that collects the min, max, mean and
+  *          last of every value. A window closes after window_ms, aligned on
+  *          multiples of window_ms so that nodes agree on the boundaries,
+  *          or after window_count samples, whichever comes first. Closed
+  *          windows wait in a small queue as sample_summary_t, which fits
+  *          one 32-byte radio payload: send one summary per window instead
+  *          of every sample.
+  *
+  *          A time window closes on the first sample past its end. A source
+  *          that stops reporting leaves its window open and sends nothing,
+  *          the missing summary is the sign.
+  *
+  *          Raw samples stay available through sample_ring_history() until
+  *          they are overwritten, for a gateway that asks for the detail
+  *          behind a summary.
+  *
+  *          Contexts: one producer calls sample_ring_push(), an interrupt
+  *          is fine, and one consumer calls sample_ring_summary() and
+  *          sample_ring_history(). Neither masks interrupts; history copies
+  *          are checked against the write count and retried if the producer
+  *          overwrote them meanwhile.
+  ******************************************************************************
+  */
+
+#ifndef __SAMPLE_RING_H__
+#define __SAMPLE_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+/* Values per sample, dew point and temperature for the HTU21D */
+#ifndef SAMPLE_RING_VALUES
+#define SAMPLE_RING_VALUES    2
+#endif
+
+/* Sources with a window of their own, as HTU21D_SCHED_SLOTS */
+#ifndef SAMPLE_RING_SOURCES
+#define SAMPLE_RING_SOURCES   8
+#endif
+
+/* Closed windows waiting for the consumer, power of two */
+#ifndef SAMPLE_RING_SUMMARIES
+#define SAMPLE_RING_SUMMARIES 8
+#endif
+
+/* Missing value, left out of the window, same as HTU21D_FIXED_ERROR */
+#define SAMPLE_RING_NONE      (-32767 - 1)
+
+/* sample_ring_history() of every source */
+#define SAMPLE_RING_ANY       0xFFU
+
+/**
+  * @brief One raw sample.
+  */
+typedef struct
+{
+  uint32_t  time;                       /*!< HAL_GetTick() */
+  uint8_t   source;
+  int16_t   value[SAMPLE_RING_VALUES];  /*!< SAMPLE_RING_NONE when missing */
+} sample_t;
+
+/**
+  * @brief Summary of one closed window, 28 bytes with two values.
+  */
+typedef struct
+{
+  uint32_t  start;                      /*!< Window start, HAL_GetTick() */
+  uint32_t  end;                        /*!< Time of its last sample */
+  uint16_t  count;                      /*!< Samples in the window */
+  uint8_t   source;
+  uint8_t   reserved;
+  struct
+  {
+    int16_t min;
+    int16_t max;
+    int16_t mean;                       /*!< Rounded to nearest */
+    int16_t last;
+  } value[SAMPLE_RING_VALUES];          /*!< All SAMPLE_RING_NONE if never present */
+} sample_summary_t;
+
+/**
+  * @brief Open window of one source.
+  */
+typedef struct
+{
+  uint32_t  start;
+  uint32_t  end;
+  uint16_t  count;
+  uint16_t  n[SAMPLE_RING_VALUES];      /*!< Samples where the value was present */
+  int32_t   sum[SAMPLE_RING_VALUES];
+  int16_t   min[SAMPLE_RING_VALUES];
+  int16_t   max[SAMPLE_RING_VALUES];
+  int16_t   last[SAMPLE_RING_VALUES];
+} sample_window_t;
+
+typedef struct
+{
+  sample_t          *buffer;
+  uint16_t          capacity;
+  uint32_t          window_ms;          /*!< 0, no time limit */
+  uint16_t          window_count;       /*!< 0, no count limit */
+  volatile uint32_t head;               /*!< Samples ever pushed */
+  sample_window_t   window[SAMPLE_RING_SOURCES];
+  sample_summary_t  summary[SAMPLE_RING_SUMMARIES];
+  volatile uint8_t  summary_head;       /*!< Written by the producer */
+  volatile uint8_t  summary_tail;       /*!< Written by the consumer */
+  /* Statistics */
+  uint32_t          summaries;
+  uint32_t          dropped;            /*!< Summaries lost to a full queue */
+} sample_ring_t;
+
+void     sample_ring_init(sample_ring_t *ring, sample_t *buffer, uint16_t capacity,
+                          uint32_t window_ms, uint16_t window_count);
+void     sample_ring_push(sample_ring_t *ring, const sample_t *sample);
+void     sample_ring_close(sample_ring_t *ring, uint8_t source);
+
+uint8_t  sample_ring_summary(sample_ring_t *ring, sample_summary_t *summary);
+uint16_t sample_ring_history(sample_ring_t *ring, uint8_t source, uint32_t since,
+                             sample_t *out, uint16_t max);
+uint16_t sample_ring_count(sample_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SAMPLE_RING_H__ */
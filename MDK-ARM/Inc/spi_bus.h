@@ -0,0 +1,148 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus.h
+  * @brief   Shared SPI bus arbiter.
+  *
+  *          Several devices (the radio, a flash, an ADC ...) can share one SPI
+  *          peripheral. Each device carries its own mode, prescaler and chip
+  *          select and the arbiter reprograms CR1 only when the owner changes.
+  *
+  *          Two ways to use the bus:
+  *          - spi_bus_claim() / spi_bus_release() around blocking HAL calls,
+  *            as the RF24 driver does for every register access;
+  *          - spi_bus_submit() of an spi_xfer_t, run by the arbiter with DMA
+  *            (or interrupts when the handle has no DMA linked) in chunks of
+  *            SPI_BUS_CHUNK bytes, highest priority first.
+  *
+  *          Ownership is a single pointer swapped with LDREX/STREX, so claim,
+  *          release and submit are safe from any context without masking
+  *          interrupts. A blocking claim must not be made from an interrupt
+  *          that preempts the SPI/DMA interrupts; use spi_bus_try_claim() or
+  *          spi_bus_submit() there.
+  *
+  *          Latency: a claimer never waits for more than one chunk of a
+  *          transfer whose device is flagged SPI_DEV_SPLIT, the arbiter drops
+  *          CS and hands the bus over at the next chunk boundary. Devices
+  *          that cannot tolerate CS going high mid-transfer keep the bus for
+  *          the whole transfer, so keep their transfers short.
+  *
+  *          Clock: a device set with spi_device_set_clock() keeps the fastest
+  *          prescaler at or below its clock; call spi_bus_retune() after the
+  *          APB clocks change, while spi_bus_busy() is false.
+  ******************************************************************************
+  */
+
+#ifndef __SPI_BUS_H__
+#define __SPI_BUS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+/* Buses that spi_bus_get() can hand out */
+#ifndef SPI_BUS_COUNT
+#define SPI_BUS_COUNT     3
+#endif
+
+/* Largest piece of a queued transfer, bounds the wait of other devices */
+#ifndef SPI_BUS_CHUNK
+#define SPI_BUS_CHUNK     32
+#endif
+
+/* Prescaler value meaning "leave whatever the bus has" */
+#define SPI_BUS_KEEP      0xFFFFFFFFU
+
+/* spi_device_t flags */
+#define SPI_DEV_SPLIT     0x01U     /*!< Transfers may be split into several CS frames */
+
+/* spi_xfer_t states */
+#define SPI_XFER_IDLE     0U
+#define SPI_XFER_QUEUED   1U
+#define SPI_XFER_ACTIVE   2U
+#define SPI_XFER_DONE     3U
+
+typedef struct spi_bus_s    spi_bus_t;
+typedef struct spi_device_s spi_device_t;
+typedef struct spi_xfer_s   spi_xfer_t;
+
+/**
+  * @brief One chip on a bus.
+  */
+struct spi_device_s
+{
+  spi_bus_t     *bus;
+  uint32_t      cr1;            /*!< CPOL, CPHA and BR wanted in CR1 */
+  uint32_t      cr1_mask;       /*!< Bits of CR1 this device cares about */
+  GPIO_TypeDef  *cs_port;       /*!< NULL when the driver drives CS itself */
+  uint16_t      cs_pin;
+  uint8_t       priority;       /*!< Higher runs first among queued transfers */
+  uint8_t       flags;          /*!< SPI_DEV_SPLIT */
+  uint32_t      max_hz;         /*!< Clock kept across bus clock changes, 0 for a fixed prescaler */
+  spi_device_t  *next;          /*!< Devices of the same bus */
+};
+
+/**
+  * @brief A queued full-duplex transfer.
+  */
+struct spi_xfer_s
+{
+  spi_device_t  *dev;
+  const uint8_t *tx;            /*!< NULL to clock out 0xFF */
+  uint8_t       *rx;            /*!< NULL to discard */
+  uint16_t      len;
+  uint16_t      pos;            /*!< Bytes done so far */
+  void          (*complete)(spi_xfer_t *xfer);  /*!< Called from the SPI/DMA interrupt, may be NULL */
+  void          *context;
+  volatile HAL_StatusTypeDef status;
+  volatile uint8_t state;       /*!< SPI_XFER_* */
+  spi_xfer_t    *next;
+};
+
+/**
+  * @brief Arbiter state of one SPI peripheral.
+  */
+struct spi_bus_s
+{
+  SPI_HandleTypeDef       *hspi;
+  void * volatile         owner;      /*!< spi_device_t holding the bus, NULL when free */
+  spi_xfer_t * volatile   incoming;   /*!< Submitted, not yet sorted (lock-free stack) */
+  spi_xfer_t              *pending;   /*!< Sorted by priority, only touched by the owner */
+  spi_xfer_t              *active;
+  spi_device_t            *devices;
+  uint16_t                chunk;      /*!< Length of the chunk of active in flight */
+  volatile uint32_t       waiting;    /*!< Blocking claimers spinning right now */
+  uint8_t                 tx_fill[SPI_BUS_CHUNK];
+  uint8_t                 rx_sink[SPI_BUS_CHUNK];
+  /* Statistics */
+  uint32_t                claims;
+  uint32_t                contended;  /*!< Claims that had to wait */
+  uint32_t                yields;     /*!< Split transfers that gave the bus away */
+  uint32_t                max_wait_us;
+};
+
+spi_bus_t *spi_bus_get(SPI_HandleTypeDef *hspi);
+
+void spi_device_init(spi_device_t *dev, spi_bus_t *bus, uint32_t polarity, uint32_t phase, uint32_t prescaler,
+                     GPIO_TypeDef *cs_port, uint16_t cs_pin);
+void spi_device_deinit(spi_device_t *dev);
+void spi_device_set_prescaler(spi_device_t *dev, uint32_t prescaler);
+void spi_device_set_clock(spi_device_t *dev, uint32_t max_hz);
+uint32_t spi_device_clock(const spi_device_t *dev);
+
+uint8_t spi_bus_try_claim(spi_device_t *dev);
+uint8_t spi_bus_claim(spi_device_t *dev, uint32_t timeout_ms);
+void    spi_bus_release(spi_device_t *dev);
+
+HAL_StatusTypeDef spi_bus_submit(spi_xfer_t *xfer);
+void    spi_bus_irq(SPI_HandleTypeDef *hspi, HAL_StatusTypeDef status);
+
+uint8_t spi_bus_busy(void);
+void    spi_bus_retune(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPI_BUS_H__ */
@@ -0,0 +1,94 @@
+/**
+  ******************************************************************************
+  * @file    telemetry.h
+  * @brief   Binary telemetry records on CDC, COBS framed.
+  *
+  *          Every record is
+  *
+  *            type  sequence u16  time u32  payload  CRC u16
+  *
+  *          COBS encoded and followed by a 0x00 delimiter, so the host
+  *          finds the next record after any loss by looking for a zero.
+  *          Multi-byte fields are little endian. time is clock_micros() when
+  *          the record was made, sequence counts every record made, sent or
+  *          not: a gap tells the host how many were lost. The CRC is
+  *          CRC-16/CCITT-FALSE (0x1021, from 0xFFFF) over type to payload.
+  *
+  *          Payloads, by type:
+  *
+  *            TELEMETRY_RADIO     pipe, radio payload as received
+  *            TELEMETRY_SAMPLE    source, time u32 (ms), SAMPLE_RING_VALUES i16
+  *            TELEMETRY_SUMMARY   sample_summary_t as in memory
+  *            TELEMETRY_STATS     TELEMETRY_STATS_* source, u32 counters
+  *            TELEMETRY_TEXT      a log line, no terminating NUL
+  *            TELEMETRY_RESPONSE  command id, status, payload, see cdc_command.h
+  *            TELEMETRY_LOG       tokenized log records, see tlog.h
+  *
+  *          The record is encoded in one pass, CRC and COBS together, into
+  *          a buffer on the stack and handed whole to the transmit hook,
+  *          which copies it (CDC_Transmit_FS()). Records can be made from
+  *          any context, an interrupt included. A record the hook refuses
+  *          is dropped and counted.
+  *
+  *          Bench builds (RF24_BENCH, HTU21D_BENCH) print their reports as
+  *          plain text before the first record, the host skips them as one
+  *          bad record. RF24_SNIFFER builds stream pcap instead.
+  ******************************************************************************
+  */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+#include "sample_ring.h"
+
+/* Longest payload of a record */
+#define TELEMETRY_MAX_PAYLOAD 64
+
+/* Record types */
+#define TELEMETRY_RADIO       0x01
+#define TELEMETRY_SAMPLE      0x02
+#define TELEMETRY_SUMMARY     0x03
+#define TELEMETRY_STATS       0x04
+#define TELEMETRY_TEXT        0x05
+#define TELEMETRY_RESPONSE    0x06
+#define TELEMETRY_LOG         0x07
+
+/* Sources of TELEMETRY_STATS */
+#define TELEMETRY_STATS_LINK    0   /*!< telemetry records, dropped, CDC queued, sent, dropped */
+#define TELEMETRY_STATS_SENSORS 1   /*!< scheduler cycles, readings, failures, summaries, dropped */
+#define TELEMETRY_STATS_BRIDGE  2   /*!< rf24_bridge_stats_t, see a_RF24_bridge.h */
+
+typedef struct
+{
+  uint8_t  (*transmit)(uint8_t *buf, uint16_t len); /*!< 0 once taken, like CDC_Transmit_FS() */
+  uint32_t (*micros)(void);                         /*!< Free running microsecond clock */
+} telemetry_config_t;
+
+typedef struct
+{
+  uint32_t records;                     /*!< Handed to the transmit hook */
+  uint32_t bytes;                       /*!< Of them, delimiters included */
+  uint32_t dropped;                     /*!< Refused by the hook or too long */
+} telemetry_stats_t;
+
+void    telemetry_init(const telemetry_config_t *config);
+
+uint8_t telemetry_send(uint8_t type, const void *head, uint16_t head_len, const void *data, uint16_t len);
+uint8_t telemetry_radio(uint8_t pipe, const void *payload, uint8_t len);
+uint8_t telemetry_sample(const sample_t *sample);
+uint8_t telemetry_summary(const sample_summary_t *summary);
+uint8_t telemetry_stats(uint8_t source, const uint32_t *counters, uint8_t count);
+uint8_t telemetry_text(const char *text, uint16_t len);
+
+const telemetry_stats_t *telemetry_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TELEMETRY_H__ */
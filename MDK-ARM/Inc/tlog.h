@@ -0,0 +1,99 @@
+/**
+  ******************************************************************************
+  * @file    tlog.h
+  * @brief   Tokenized logging, the host formats the text.
+  *
+  *          TLOG("RF24 SPI clock %lu Hz\n", hz) keeps its format string in
+  *          the tlog_strings section and logs only the offset of the string
+  *          in that section, a 16-bit token, and the arguments as raw
+  *          integers. No printf on the MCU: a call costs a few varints and
+  *          a copy into a lock-free byte ring. Host/tlog_decode reads the
+  *          strings back from the tlog_strings section of the .axf and
+  *          prints the text.
+  *
+  *          Arguments are integers, characters or enums, up to TLOG_ARGS,
+  *          cast to uint32_t and sent as LEB128 varints; the host decides
+  *          by the conversion (%d, %u, %x, %c, with flags, width and l)
+  *          how to print them. %s is not supported: pick between two
+  *          strings in the code instead.
+  *
+  *          A record in the ring is
+  *
+  *            len  token u16  varints
+  *
+  *          where len counts the whole record. Producers, interrupts
+  *          included, reserve their bytes with LDREX/STREX on the head and
+  *          commit by writing len last; a record with len 0 is not written
+  *          yet and the consumer waits for it. tlog_drain() in the main loop
+  *          moves the committed records into TELEMETRY_LOG records, as many
+  *          as fit, and zeroes what it took. A record that finds no room is
+  *          dropped and counted.
+  ******************************************************************************
+  */
+
+#ifndef __TLOG_H__
+#define __TLOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+/* Ring bytes, power of two */
+#ifndef TLOG_BUFFER
+#define TLOG_BUFFER           1024
+#endif
+
+/* Arguments per call */
+#define TLOG_ARGS             4
+
+/* Longest record: len, token and TLOG_ARGS varints of 5 bytes */
+#define TLOG_RECORD_MAX       (3 + 5 * TLOG_ARGS)
+
+#if defined(__CC_ARM)
+#define TLOG_SECTION          __attribute__((section("tlog_strings")))
+extern const char tlog_strings$$Base[];
+#define TLOG_BASE             tlog_strings$$Base
+#else
+#define TLOG_SECTION          __attribute__((section("tlog_strings"), used))
+extern const char __start_tlog_strings[];
+#define TLOG_BASE             __start_tlog_strings
+#endif
+
+#define TLOG_TOKEN(fmt)       ((uint16_t)((fmt) - TLOG_BASE))
+
+/* A format string without arguments */
+#define TLOG0(fmt)                                                         \
+  do                                                                       \
+  {                                                                        \
+    static const char tlog_fmt[] TLOG_SECTION = fmt;                       \
+    tlog_write(TLOG_TOKEN(tlog_fmt), NULL, 0);                             \
+  } while (0)
+
+/* A format string and 1 to TLOG_ARGS integer arguments */
+#define TLOG(fmt, ...)                                                     \
+  do                                                                       \
+  {                                                                        \
+    static const char tlog_fmt[] TLOG_SECTION = fmt;                       \
+    const uint32_t tlog_args[] = { __VA_ARGS__ };                          \
+    tlog_write(TLOG_TOKEN(tlog_fmt), tlog_args, sizeof(tlog_args) / sizeof(tlog_args[0])); \
+  } while (0)
+
+typedef struct
+{
+  uint32_t  records;                    /*!< Written to the ring */
+  uint32_t  dropped;                    /*!< No room in the ring */
+  uint16_t  peak;                       /*!< Highest fill in bytes */
+} tlog_stats_t;
+
+void    tlog_write(uint16_t token, const uint32_t *args, uint8_t count);
+uint8_t tlog_drain(void);
+
+const tlog_stats_t *tlog_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TLOG_H__ */
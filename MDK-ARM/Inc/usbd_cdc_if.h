@@ -62,7 +62,17 @@
   */
 
 /* USER CODE BEGIN EXPORTED_TYPES */
-
+/**
+  * @brief  TX ring counters
+  */
+typedef struct
+{
+  uint32_t queued;      /*!< Bytes taken by CDC_Transmit_FS                 */
+  uint32_t sent;        /*!< Bytes the host has read                        */
+  uint32_t dropped;     /*!< Writes refused whole, the ring was full        */
+  uint32_t transfers;   /*!< IN transfers started                           */
+  uint16_t peak;        /*!< Highest fill of the ring in bytes              */
+} CDC_TxStatsTypeDef;
 /* USER CODE END EXPORTED_TYPES */
 
 /**
@@ -91,7 +101,7 @@
 extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 
 /* USER CODE BEGIN EXPORTED_VARIABLES */
-
+extern CDC_TxStatsTypeDef CDC_TxStats_FS;
 /* USER CODE END EXPORTED_VARIABLES */
 
 /**
@@ -106,7 +116,11 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
-
+void CDC_TxService_FS(uint8_t sof);
+uint16_t CDC_TxPending_FS(void);
+uint8_t CDC_IsOpen_FS(void);
+uint16_t CDC_RxData_FS(uint8_t** data);
+void CDC_RxRelease_FS(uint16_t Len);
 /* USER CODE END EXPORTED_FUNCTIONS */
 
 /**
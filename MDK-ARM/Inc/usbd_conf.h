@@ -83,6 +83,20 @@
 #define DEVICE_FS 		0
 #define DEVICE_HS 		1
 
+/* OTG FS FIFO RAM, in 32 bit words, 320 in all (1.25 KB). The RX FIFO is
+   shared by all OUT endpoints: 18 words of SETUP and status entries (RM0090),
+   17 per 64 byte packet, 0x60 holds 4 packets so the core takes the next
+   ones while the interrupt empties the first. TX FIFO 1, CDC data IN, gets
+   the rest, 12 packets. EP0 and the 8 byte CDC notification endpoint need
+   the minimum of 16 */
+#define USBD_FS_RX_FIFO_WORDS     0x60U
+#define USBD_FS_TX0_FIFO_WORDS    0x10U
+#define USBD_FS_TX1_FIFO_WORDS    0xC0U
+#define USBD_FS_TX2_FIFO_WORDS    0x10U
+#if (USBD_FS_RX_FIFO_WORDS + USBD_FS_TX0_FIFO_WORDS + USBD_FS_TX1_FIFO_WORDS + USBD_FS_TX2_FIFO_WORDS) > 320U
+#error "USB OTG FS FIFOs exceed the 320 words of FIFO RAM"
+#endif
+
 /**
   * @}
   */
@@ -9,87 +9,131 @@
 #include "a_nRF24L01.h"
 #include "a_RF24_config.h"
 #include "a_RF24.h"
+#include "a_RF24_trace.h"
 #include "tm_stm32_nrf24l01.h"
+#include "stdio.h"
 
 
 
 
+#if !defined(RF24_EMULATED)
+#include "clock_profile.h"
 void delayMicroseconds(uint32_t delayus)
 {
-	uint32_t cc = 1.0625 * CPU_Freq_MHZ *delayus;
-	while(cc-- > 0);
+	clock_delay_us(delayus); // follows the clock profile
 }
+#else
+void delayMicroseconds(uint32_t delayus); // advances the virtual clock, Host/emu
+#endif
 
 
 #if defined(USE_HAL_DRIVER)
 
+SerialPI::SerialPI(SPI_HandleTypeDef* _hspi)
+	: hspi(_hspi), frame_start(0), calibrating(0), errors(0), error_tick(0), error_burst(0)
+{
+	// Mode 0, the clock is whatever MX_SPIx_Init() set
+	spi_device_init(&dev, spi_bus_get(hspi), SPI_POLARITY_LOW, SPI_PHASE_1EDGE, SPI_BUS_KEEP, NULL, 0);
+}
+SerialPI::~SerialPI()
+{
+	spi_device_deinit(&dev);
+}
+void SerialPI::beginTransaction()
+{
+	if (!spi_bus_claim(&dev, RF24_SPI_CLAIM_TIMEOUT))
+	{
+		#if defined(CDC_LOG)
+		TLOG0("SPI bus claim TIMEOUT\n");
+		#endif
+		Error_Handler();
+	}
+	frame_start = 1;
+}
+void SerialPI::endTransaction()
+{
+	spi_bus_release(&dev);
+}
+void SerialPI::setPrescaler(uint32_t prescaler)
+{
+	spi_device_set_prescaler(&dev, prescaler);
+}
+uint32_t SerialPI::clock()
+{
+	return spi_device_clock(&dev);
+}
 void SerialPI::begin()
 {
-	NRF24L01_CSN_HIGH;
+	// The bus is set up by MX_SPIx_Init(), CSN is driven by RF24::csn()
 }
 uint8_t SerialPI::transfer(uint8_t send)
 {
 	uint8_t receive ,transmision_status;
-	transmision_status = HAL_SPI_TransmitReceive(&NRF24L01_SPI, &send, &receive,1 ,100);
+	RF24_TRACE_BYTE();
+	transmision_status = HAL_SPI_TransmitReceive(hspi, &send, &receive,1 ,100);
 	#if defined(CDC_LOG)
 	if (transmision_status != HAL_OK)
 	{
-		if(transmision_status == HAL_ERROR)
-		{
-			uint8_t print_buf[50] = "Transmision HAL ERROR\n";
-			CDC_Transmit_FS(print_buf,strlen((const char * )print_buf));
-		}
-		if(transmision_status == HAL_BUSY)
-		{
-			uint8_t print_buf[50] = "Transmision HAL BUSY\n";
-			CDC_Transmit_FS(print_buf, strlen((const char * )print_buf));
-		}
-		if(transmision_status == HAL_TIMEOUT)
-		{
-			uint8_t print_buf[50] = "Transmision HAL TIMEOUT\n";
-			CDC_Transmit_FS(print_buf, strlen((const char * )print_buf));
-		}		
+		// 1 HAL_ERROR, 2 HAL_BUSY, 3 HAL_TIMEOUT
+		TLOG("Transmision HAL status %u\n", (uint32_t)transmision_status);
 	}
+	#if nrf_del
 	HAL_Delay(nrf_del);
 	#endif
+	#endif
 	if (transmision_status != HAL_OK)
 	{
 		Error_Handler();
 		return HAL_ERROR;
 	}
-	else
-		return receive;
+	// Bit 7 of STATUS always reads 0, anything else is a garbled byte
+	if (frame_start)
+	{
+		frame_start = 0;
+		if ((receive & 0x80) && !calibrating)
+		{
+			uint32_t now = HAL_GetTick();
+			if (now - error_tick > RF24_SPI_ERROR_WINDOW)
+			{
+				error_tick = now;
+				errors = 0;
+			}
+			if (++errors >= RF24_SPI_ERROR_BURST)
+				error_burst = 1;
+		}
+	}
+	return receive;
 	
 }
 
-SerialPI _SPI;
+RF24* RF24::irq_instances[RF24_MAX_INSTANCES];
+
+void RF24::pinWrite(GPIO_TypeDef* port, uint16_t pin, bool state)
+{
+	// HAL_Delay(0) still waits for the next tick, only pay for a delay that was asked for
+	#if nrf_del
+	HAL_Delay(nrf_del);
+	#endif
+	HAL_GPIO_WritePin(port, pin, state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	#if nrf_del
+	HAL_Delay(nrf_del);
+	#endif
+}
 
 void RF24::digitalWrite(uint16_t pin, bool state)
 {
 	if(pin == csn_pin)
 	{
-		HAL_Delay(nrf_del);
-		if (state)
-			NRF24L01_CSN_HIGH;
-		else
-			NRF24L01_CSN_LOW;
-		HAL_Delay(nrf_del);
+		pinWrite(csn_port, csn_pin, state);
 	}
 	else if(pin == ce_pin)
 	{
-		HAL_Delay(nrf_del);
-		if (state)
-			NRF24L01_CE_HIGH;
-		else
-			NRF24L01_CE_LOW;
-		HAL_Delay(nrf_del);
+		pinWrite(ce_port, ce_pin, state);
 	}
 	else
 	{
 		#if defined(CDC_LOG)
-		uint8_t print_buf[100];
-		//sprintf(print_buf, "Digital write pin unknown ERROR\n");
-		CDC_Transmit_FS((uint8_t *)"Digital write pin unknown ERROR\n", 32);
+		TLOG0("Digital write pin unknown ERROR\n");
 		Error_Handler();
 		#endif
 	}
@@ -150,7 +194,12 @@ void RF24::csn(bool mode)
       _SPI.chipSelect(csn_pin);
     #endif // defined(RF24_RPi)
 
-    #if !defined(RF24_LINUX)
+    #if defined(USE_HAL_DRIVER)
+    RF24_TRACE_CSN();
+    pinWrite(csn_port, csn_pin, mode);
+    delayMicroseconds(csDelay);
+    #elif !defined(RF24_LINUX)
+    RF24_TRACE_CSN();
     digitalWrite(csn_pin, mode);
     delayMicroseconds(csDelay);
     #endif // !defined(RF24_LINUX)
@@ -162,17 +211,25 @@ void RF24::csn(bool mode)
 
 void RF24::ce(bool level)
 {
+    #if defined(USE_HAL_DRIVER)
+    // CE and CSN may share a pin number on different ports
+    pinWrite(ce_port, ce_pin, level);
+    #else
     //Allow for 3-pin use on ATTiny
     if (ce_pin != csn_pin) {
         digitalWrite(ce_pin, level);
     }
+    #endif
 }
 
 /****************************************************************************/
 
 inline void RF24::beginTransaction()
 {
-    #if defined(RF24_SPI_TRANSACTIONS)
+    RF24_TRACE_TRANSACTION();
+    #if defined(RF24_SPI_TRANSACTIONS) && defined(USE_HAL_DRIVER)
+    _SPI.beginTransaction();
+    #elif defined(RF24_SPI_TRANSACTIONS)
     _SPI.beginTransaction(SPISettings(RF24_SPI_SPEED, MSBFIRST, SPI_MODE0));
     #endif // defined(RF24_SPI_TRANSACTIONS)
     csn(LOW);
@@ -425,6 +482,7 @@ uint8_t RF24::read_payload(void* buf, uint8_t data_len)
 
 uint8_t RF24::flush_rx(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     return spiTrans(FLUSH_RX);
 }
 
@@ -432,6 +490,7 @@ uint8_t RF24::flush_rx(void)
 
 uint8_t RF24::flush_tx(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     return spiTrans(FLUSH_TX);
 }
 
@@ -453,6 +512,7 @@ uint8_t RF24::spiTrans(uint8_t cmd)
 
 uint8_t RF24::get_status(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     return spiTrans(RF24_NOP);
 }
 
@@ -521,12 +581,179 @@ void RF24::print_address_register(const char* name, uint8_t reg, uint8_t qty)
 /****************************************************************************/
 
 RF24::RF24(uint16_t _cepin, uint16_t _cspin)
-        :ce_pin(_cepin), csn_pin(_cspin), p_variant(false), payload_size(32), dynamic_payloads_enabled(false), addr_width(5),
+        :ce_pin(_cepin), csn_pin(_cspin),
+         #if defined(USE_HAL_DRIVER)
+         spi(&NRF24L01_SPI), ce_port(NRF24L01_CE_PORT), csn_port(NRF24L01_CSN_PORT),
+         irq_port(NRF24L01_IRQ_PORT), irq_pin(NRF24L01_IRQ_PIN), irq_count(0), irq_callback(NULL),
+         #endif
+         p_variant(false), payload_size(32), dynamic_payloads_enabled(false), addr_width(5),
          csDelay(5)//,pipe0_reading_address(0)
 {
     pipe0_reading_address[0] = 0;
+    #if defined(USE_HAL_DRIVER)
+    irqRegister();
+    #endif
+}
+
+/****************************************************************************/
+
+#if defined(USE_HAL_DRIVER)
+
+RF24::RF24(SPI_HandleTypeDef* _hspi, GPIO_TypeDef* _ce_port, uint16_t _cepin, GPIO_TypeDef* _csn_port, uint16_t _cspin,
+           GPIO_TypeDef* _irq_port, uint16_t _irqpin)
+        :ce_pin(_cepin), csn_pin(_cspin), spi(_hspi), ce_port(_ce_port), csn_port(_csn_port),
+         irq_port(_irq_port), irq_pin(_irqpin), irq_count(0), irq_callback(NULL),
+         p_variant(false), payload_size(32), dynamic_payloads_enabled(false), addr_width(5), csDelay(5)
+{
+    pipe0_reading_address[0] = 0;
+    irqRegister();
+}
+
+RF24::~RF24()
+{
+    for (uint8_t i = 0; i < RF24_MAX_INSTANCES; i++) {
+        if (irq_instances[i] == this) {
+            irq_instances[i] = NULL;
+        }
+    }
+}
+
+/****************************************************************************/
+
+void RF24::irqRegister(void)
+{
+    if (!irq_port) {
+        return;
+    }
+    // One EXTI line per pin number, whatever the port
+    for (uint8_t i = 0; i < RF24_MAX_INSTANCES; i++) {
+        if (!irq_instances[i]) {
+            irq_instances[i] = this;
+            return;
+        }
+    }
+    #if defined(CDC_LOG)
+    TLOG0("RF24 IRQ table full\n");
+    #endif
+}
+
+void RF24::attachInterrupt(void (*callback)(RF24* radio))
+{
+    irq_callback = callback;
+}
+
+bool RF24::irqPending(void)
+{
+    if (!irq_count) {
+        return false;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    irq_count = 0;
+    __set_PRIMASK(primask);
+    return true;
+}
+
+bool RF24::handleIRQ(uint16_t GPIO_Pin)
+{
+    bool handled = false;
+
+    for (uint8_t i = 0; i < RF24_MAX_INSTANCES; i++) {
+        RF24* radio = irq_instances[i];
+        if (radio && radio->irq_pin == GPIO_Pin) {
+            radio->irq_count++;
+            if (radio->irq_callback) {
+                radio->irq_callback(radio);
+            }
+            handled = true;
+        }
+    }
+    return handled;
+}
+
+/****************************************************************************/
+
+bool RF24::calibrateSPI(uint8_t margin)
+{
+    static const uint8_t patterns[][5] = {
+        { 0x55, 0xAA, 0x55, 0xAA, 0x55 },
+        { 0xAA, 0x55, 0xAA, 0x55, 0xAA },
+        { 0xFF, 0x00, 0xFF, 0x00, 0xFF },
+        { 0x01, 0x02, 0x04, 0x08, 0x10 },
+        { 0xFE, 0xFD, 0xFB, 0xF7, 0xEF },
+    };
+    uint8_t saved[5], check[5];
+    int8_t best = -1;
+
+    spi.calibrating = 1;
+    spi.setPrescaler(SPI_BAUDRATEPRESCALER_256);
+    read_register(TX_ADDR, saved, addr_width);
+
+    // BR = 7 is /256, BR = 0 is /2
+    for (int8_t br = 7; br >= 0; br--) {
+        bool ok = true;
+
+        spi.setPrescaler((uint32_t)br << SPI_CR1_BR_Pos);
+        if (spi.clock() > RF24_SPI_MAX_HZ) {
+            break;
+        }
+        for (uint8_t round = 0; ok && round < RF24_SPI_CAL_ROUNDS; round++) {
+            for (uint8_t i = 0; ok && i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+                write_register(TX_ADDR, patterns[i], addr_width);
+                read_register(TX_ADDR, check, addr_width);
+                ok = memcmp(check, patterns[i], addr_width) == 0;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        best = br;
+    }
+
+    bool found = best >= 0;
+    int8_t chosen = found ? best + margin : 7;
+    if (chosen > 7) {
+        chosen = 7;
+    }
+
+    spi.setPrescaler((uint32_t)chosen << SPI_CR1_BR_Pos);
+    uint32_t hz = spi.clock();
+    spi.setPrescaler(SPI_BAUDRATEPRESCALER_256);
+    write_register(TX_ADDR, saved, addr_width);
+    // Kept as a clock so that a clock profile change keeps the radio in range
+    if (found) {
+        spi_device_set_clock(&spi.dev, hz);
+    }
+    spi.errors = 0;
+    spi.error_burst = 0;
+    spi.calibrating = 0;
+
+    #if defined(CDC_LOG)
+    if (found) {
+        TLOG("RF24 SPI clock %lu Hz (/%u)\n", spi.clock(), (uint32_t)(2U << chosen));
+    } else {
+        TLOG("RF24 SPI clock %lu Hz (/%u), radio not answering\n", spi.clock(), (uint32_t)(2U << chosen));
+    }
+    #endif
+    return found;
+}
+
+bool RF24::checkSPI(void)
+{
+    if (!spi.error_burst) {
+        return false;
+    }
+    calibrateSPI();
+    return true;
+}
+
+uint32_t RF24::getSPIClock(void)
+{
+    return spi.clock();
 }
 
+#endif // defined(USE_HAL_DRIVER)
+
 /****************************************************************************/
 
 #if defined(RF24_LINUX) && !defined(MRAA)//RPi constructor
@@ -542,12 +769,14 @@ RF24::RF24(uint16_t _cepin, uint16_t _cspin, uint32_t _spi_speed):
 
 void RF24::setChannel(uint8_t channel)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     const uint8_t max_channel = 125;
     write_register(RF_CH, rf24_min(channel, max_channel));
 }
 
 uint8_t RF24::getChannel()
 {
+    RF24_TRACE_API(RF24_API_QUERY);
 
     return read_register(RF_CH);
 }
@@ -684,8 +913,23 @@ void RF24::printDetails(void)
 
 /****************************************************************************/
 
+uint8_t RF24::readRegisters(uint8_t* buf)
+{
+    uint8_t len = 0;
+
+    for (uint8_t reg = NRF_CONFIG; reg <= FEATURE; reg++) {
+        uint8_t width = (reg == RX_ADDR_P0 || reg == RX_ADDR_P1 || reg == TX_ADDR) ? 5 : 1;
+        read_register(reg, buf + len, width);
+        len += width;
+    }
+    return len;
+}
+
+/****************************************************************************/
+
 bool RF24::begin(void)
 {
+    RF24_TRACE_API(RF24_API_BEGIN);
 
     uint8_t setup = 0;
 
@@ -822,6 +1066,7 @@ bool RF24::begin(void)
 
 bool RF24::isChipConnected()
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     uint8_t setup = read_register(SETUP_AW);
     if (setup >= 1 && setup <= 3) {
         return true;
@@ -834,6 +1079,7 @@ bool RF24::isChipConnected()
 
 void RF24::startListening(void)
 {
+    RF24_TRACE_API(RF24_API_START_LISTENING);
     #if !defined(RF24_TINY) && !defined(LITTLEWIRE)
     powerUp();
     #endif
@@ -863,6 +1109,7 @@ static const uint8_t child_pipe_enable[]
 
 void RF24::stopListening(void)
 {
+    RF24_TRACE_API(RF24_API_STOP_LISTENING);
     ce(LOW);
 
     delayMicroseconds(txDelay);
@@ -891,6 +1138,7 @@ void RF24::stopListening(void)
 
 void RF24::powerDown(void)
 {
+    RF24_TRACE_API(RF24_API_POWER_DOWN);
     ce(LOW); // Guarantee CE is low on powerDown
     write_register(NRF_CONFIG, read_register(NRF_CONFIG) & ~_BV(PWR_UP));
 }
@@ -900,6 +1148,7 @@ void RF24::powerDown(void)
 //Power up now. Radio will not power down unless instructed by MCU for config changes etc.
 void RF24::powerUp(void)
 {
+    RF24_TRACE_API(RF24_API_POWER_UP);
     uint8_t cfg = read_register(NRF_CONFIG);
 
     // if not powered up then power up and wait for the radio to initialize
@@ -934,6 +1183,7 @@ void RF24::errNotify()
 //Similar to the previous write, clears the interrupt flags
 bool RF24::write(const void* buf, uint8_t len, const bool multicast)
 {
+    RF24_TRACE_API(RF24_API_WRITE);
     //Start Writing
     startFastWrite(buf, len, multicast);
 
@@ -942,17 +1192,20 @@ bool RF24::write(const void* buf, uint8_t len, const bool multicast)
     uint32_t timer = millis();
     #endif // defined(FAILURE_HANDLING) || defined(RF24_LINUX)
 
-    while (!(get_status() & (_BV(TX_DS) | _BV(MAX_RT)))) {
-        #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
-        if (millis() - timer > 95) {
-            errNotify();
-            #if defined(FAILURE_HANDLING)
-            return 0;
-            #else
-            delay(100);
+    {
+        RF24_TRACE_POLL();
+        while (!(get_status() & (_BV(TX_DS) | _BV(MAX_RT)))) {
+            #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
+            if (millis() - timer > 95) {
+                errNotify();
+                #if defined(FAILURE_HANDLING)
+                return 0;
+                #else
+                delay(100);
+                #endif
+            }
             #endif
         }
-        #endif
     }
 
     ce(LOW);
@@ -977,6 +1230,7 @@ bool RF24::write(const void* buf, uint8_t len)
 //For general use, the interrupt flags are not important to clear
 bool RF24::writeBlocking(const void* buf, uint8_t len, uint32_t timeout)
 {
+    RF24_TRACE_API(RF24_API_WRITE_BLOCKING);
     //Block until the FIFO is NOT full.
     //Keep track of the MAX retries and set auto-retry if seeing failures
     //This way the FIFO will fill up and allow blocking until packets go through
@@ -984,24 +1238,27 @@ bool RF24::writeBlocking(const void* buf, uint8_t len, uint32_t timeout)
 
     uint32_t timer = millis();                              //Get the time that the payload transmission started
 
-    while ((get_status()
-            & (_BV(TX_FULL)))) {          //Blocking only if FIFO is full. This will loop and block until TX is successful or timeout
-
-        if (get_status() & _BV(MAX_RT)) {                      //If MAX Retries have been reached
-            reUseTX();                                          //Set re-transmit and clear the MAX_RT interrupt flag
-            if (millis() - timer > timeout) {
+    {
+        RF24_TRACE_POLL();
+        while ((get_status()
+                & (_BV(TX_FULL)))) {          //Blocking only if FIFO is full. This will loop and block until TX is successful or timeout
+
+            if (get_status() & _BV(MAX_RT)) {                      //If MAX Retries have been reached
+                reUseTX();                                          //Set re-transmit and clear the MAX_RT interrupt flag
+                if (millis() - timer > timeout) {
+                    return 0;
+                }          //If this payload has exceeded the user-defined timeout, exit and return 0
+            }
+            #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
+            if (millis() - timer > (timeout + 95)) {
+                errNotify();
+                #if defined(FAILURE_HANDLING)
                 return 0;
-            }          //If this payload has exceeded the user-defined timeout, exit and return 0
-        }
-        #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
-        if (millis() - timer > (timeout + 95)) {
-            errNotify();
-            #if defined(FAILURE_HANDLING)
-            return 0;
+                #endif
+            }
             #endif
-        }
-        #endif
 
+        }
     }
 
     //Start Writing
@@ -1014,6 +1271,7 @@ bool RF24::writeBlocking(const void* buf, uint8_t len, uint32_t timeout)
 
 void RF24::reUseTX()
 {
+    RF24_TRACE_API(RF24_API_REUSE_TX);
     write_register(NRF_STATUS, _BV(MAX_RT));              //Clear max retry flag
     spiTrans(REUSE_TX_PL);
     ce(LOW);                                          //Re-Transfer packet
@@ -1024,6 +1282,7 @@ void RF24::reUseTX()
 
 bool RF24::writeFast(const void* buf, uint8_t len, const bool multicast)
 {
+    RF24_TRACE_API(RF24_API_WRITE_FAST);
     //Block until the FIFO is NOT full.
     //Keep track of the MAX retries and set auto-retry if seeing failures
     //Return 0 so the user can control the retrys and set a timer or failure counter if required
@@ -1034,21 +1293,24 @@ bool RF24::writeFast(const void* buf, uint8_t len, const bool multicast)
     #endif
 
     //Blocking only if FIFO is full. This will loop and block until TX is successful or fail
-    while ((get_status() & (_BV(TX_FULL)))) {
-        if (get_status() & _BV(MAX_RT)) {
-            //reUseTX();                                 //Set re-transmit
-            write_register(NRF_STATUS, _BV(MAX_RT));     //Clear max retry flag
-            return 0;                                    //Return 0. The previous payload has been retransmitted
-            // From the user perspective, if you get a 0, just keep trying to send the same payload
-        }
-        #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
-        if (millis() - timer > 95) {
-            errNotify();
-            #if defined(FAILURE_HANDLING)
-            return 0;
-            #endif // defined(FAILURE_HANDLING)
+    {
+        RF24_TRACE_POLL();
+        while ((get_status() & (_BV(TX_FULL)))) {
+            if (get_status() & _BV(MAX_RT)) {
+                //reUseTX();                                 //Set re-transmit
+                write_register(NRF_STATUS, _BV(MAX_RT));     //Clear max retry flag
+                return 0;                                    //Return 0. The previous payload has been retransmitted
+                // From the user perspective, if you get a 0, just keep trying to send the same payload
+            }
+            #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
+            if (millis() - timer > 95) {
+                errNotify();
+                #if defined(FAILURE_HANDLING)
+                return 0;
+                #endif // defined(FAILURE_HANDLING)
+            }
+            #endif
         }
-        #endif
     }
     //Start Writing
     startFastWrite(buf, len, multicast);
@@ -1070,6 +1332,7 @@ bool RF24::writeFast(const void* buf, uint8_t len)
 
 void RF24::startFastWrite(const void* buf, uint8_t len, const bool multicast, bool startTx)
 { //TMRh20
+    RF24_TRACE_API(RF24_API_START_FAST_WRITE);
 
     //write_payload( buf,len);
     write_payload(buf, len, multicast ? W_TX_PAYLOAD_NO_ACK : W_TX_PAYLOAD);
@@ -1085,6 +1348,7 @@ void RF24::startFastWrite(const void* buf, uint8_t len, const bool multicast, bo
 //Allows the library to pass all tests
 void RF24::startWrite(const void* buf, uint8_t len, const bool multicast)
 {
+    RF24_TRACE_API(RF24_API_START_WRITE);
 
     // Send the payload
 
@@ -1101,32 +1365,45 @@ void RF24::startWrite(const void* buf, uint8_t len, const bool multicast)
 
 bool RF24::rxFifoFull()
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     return read_register(FIFO_STATUS) & _BV(RX_FULL);
 }
 
 /****************************************************************************/
 
+bool RF24::txFifoEmpty()
+{
+    RF24_TRACE_API(RF24_API_QUERY);
+    return read_register(FIFO_STATUS) & _BV(TX_EMPTY);
+}
+
+/****************************************************************************/
+
 bool RF24::txStandBy()
 {
+    RF24_TRACE_API(RF24_API_TX_STANDBY);
 
     #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
     uint32_t timeout = millis();
     #endif
-    while (!(read_register(FIFO_STATUS) & _BV(TX_EMPTY))) {
-        if (get_status() & _BV(MAX_RT)) {
-            write_register(NRF_STATUS, _BV(MAX_RT));
-            ce(LOW);
-            flush_tx();    //Non blocking, flush the data
-            return 0;
-        }
-        #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
-        if (millis() - timeout > 95) {
-            errNotify();
-            #if defined(FAILURE_HANDLING)
-            return 0;
+    {
+        RF24_TRACE_POLL();
+        while (!(read_register(FIFO_STATUS) & _BV(TX_EMPTY))) {
+            if (get_status() & _BV(MAX_RT)) {
+                write_register(NRF_STATUS, _BV(MAX_RT));
+                ce(LOW);
+                flush_tx();    //Non blocking, flush the data
+                return 0;
+            }
+            #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
+            if (millis() - timeout > 95) {
+                errNotify();
+                #if defined(FAILURE_HANDLING)
+                return 0;
+                #endif
+            }
             #endif
         }
-        #endif
     }
 
     ce(LOW);               //Set STANDBY-I mode
@@ -1137,6 +1414,7 @@ bool RF24::txStandBy()
 
 bool RF24::txStandBy(uint32_t timeout, bool startTx)
 {
+    RF24_TRACE_API(RF24_API_TX_STANDBY);
 
     if (startTx) {
         stopListening();
@@ -1144,25 +1422,28 @@ bool RF24::txStandBy(uint32_t timeout, bool startTx)
     }
     uint32_t start = millis();
 
-    while (!(read_register(FIFO_STATUS) & _BV(TX_EMPTY))) {
-        if (get_status() & _BV(MAX_RT)) {
-            write_register(NRF_STATUS, _BV(MAX_RT));
-            ce(LOW); // Set re-transmit
-            ce(HIGH);
-            if (millis() - start >= timeout) {
-                ce(LOW);
-                flush_tx();
+    {
+        RF24_TRACE_POLL();
+        while (!(read_register(FIFO_STATUS) & _BV(TX_EMPTY))) {
+            if (get_status() & _BV(MAX_RT)) {
+                write_register(NRF_STATUS, _BV(MAX_RT));
+                ce(LOW); // Set re-transmit
+                ce(HIGH);
+                if (millis() - start >= timeout) {
+                    ce(LOW);
+                    flush_tx();
+                    return 0;
+                }
+            }
+            #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
+            if (millis() - start > (timeout + 95)) {
+                errNotify();
+                #if defined(FAILURE_HANDLING)
                 return 0;
+                #endif
             }
-        }
-        #if defined(FAILURE_HANDLING) || defined(RF24_LINUX)
-        if (millis() - start > (timeout + 95)) {
-            errNotify();
-            #if defined(FAILURE_HANDLING)
-            return 0;
             #endif
         }
-        #endif
     }
 
     ce(LOW);  //Set STANDBY-I mode
@@ -1174,6 +1455,7 @@ bool RF24::txStandBy(uint32_t timeout, bool startTx)
 
 void RF24::maskIRQ(bool tx, bool fail, bool rx)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
 
     uint8_t config = read_register(NRF_CONFIG);
     /* clear the interrupt flags */
@@ -1187,6 +1469,7 @@ void RF24::maskIRQ(bool tx, bool fail, bool rx)
 
 uint8_t RF24::getDynamicPayloadSize(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     uint8_t result = 0;
 
     #if defined(RF24_LINUX)
@@ -1222,6 +1505,7 @@ bool RF24::available(void)
 
 bool RF24::available(uint8_t* pipe_num)
 {
+    RF24_TRACE_API(RF24_API_AVAILABLE);
     if (!(read_register(FIFO_STATUS) & _BV(RX_EMPTY))) {
 
         // If the caller wants the pipe number, include that
@@ -1241,6 +1525,7 @@ bool RF24::available(uint8_t* pipe_num)
 
 void RF24::read(void* buf, uint8_t len)
 {
+    RF24_TRACE_API(RF24_API_READ);
 
     // Fetch the payload
     read_payload(buf, len);
@@ -1254,6 +1539,7 @@ void RF24::read(void* buf, uint8_t len)
 
 void RF24::whatHappened(bool& tx_ok, bool& tx_fail, bool& rx_ready)
 {
+    RF24_TRACE_API(RF24_API_WHAT_HAPPENED);
     // Read the status & reset the status in one easy call
     // Or is that such a good idea?
     uint8_t status = write_register(NRF_STATUS, _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT));
@@ -1266,8 +1552,17 @@ void RF24::whatHappened(bool& tx_ok, bool& tx_fail, bool& rx_ready)
 
 /****************************************************************************/
 
+void RF24::clearStatus(uint8_t flags)
+{
+    RF24_TRACE_API(RF24_API_WHAT_HAPPENED);
+    write_register(NRF_STATUS, flags & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT)));
+}
+
+/****************************************************************************/
+
 void RF24::openWritingPipe(uint64_t value)
 {
+    RF24_TRACE_API(RF24_API_OPEN_WRITING_PIPE);
     // Note that AVR 8-bit uC's store this LSB first, and the NRF24L01(+)
     // expects it LSB first too, so we're good.
 
@@ -1283,6 +1578,7 @@ void RF24::openWritingPipe(uint64_t value)
 /****************************************************************************/
 void RF24::openWritingPipe(const uint8_t* address)
 {
+    RF24_TRACE_API(RF24_API_OPEN_WRITING_PIPE);
     // Note that AVR 8-bit uC's store this LSB first, and the NRF24L01(+)
     // expects it LSB first too, so we're good.
     write_register(RX_ADDR_P0, address, addr_width);
@@ -1301,6 +1597,7 @@ static const uint8_t child_payload_size[]
 
 void RF24::openReadingPipe(uint8_t child, uint64_t address)
 {
+    RF24_TRACE_API(RF24_API_OPEN_READING_PIPE);
     // If this is pipe 0, cache the address.  This is needed because
     // openWritingPipe() will overwrite the pipe 0 address, so
     // startListening() will have to restore it.
@@ -1328,6 +1625,7 @@ void RF24::openReadingPipe(uint8_t child, uint64_t address)
 /****************************************************************************/
 void RF24::setAddressWidth(uint8_t a_width)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
 
     if (a_width -= 2) {
         write_register(SETUP_AW, a_width % 4);
@@ -1343,6 +1641,7 @@ void RF24::setAddressWidth(uint8_t a_width)
 
 void RF24::openReadingPipe(uint8_t child, const uint8_t* address)
 {
+    RF24_TRACE_API(RF24_API_OPEN_READING_PIPE);
     // If this is pipe 0, cache the address.  This is needed because
     // openWritingPipe() will overwrite the pipe 0 address, so
     // startListening() will have to restore it.
@@ -1370,6 +1669,7 @@ void RF24::openReadingPipe(uint8_t child, const uint8_t* address)
 
 void RF24::closeReadingPipe(uint8_t pipe)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     write_register(EN_RXADDR, read_register(EN_RXADDR) & ~_BV(pgm_read_byte(&child_pipe_enable[pipe])));
 }
 
@@ -1387,6 +1687,7 @@ void RF24::toggle_features(void)
 
 void RF24::enableDynamicPayloads(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     // Enable dynamic payload throughout the system
 
     //toggle_features();
@@ -1406,6 +1707,7 @@ void RF24::enableDynamicPayloads(void)
 /****************************************************************************/
 void RF24::disableDynamicPayloads(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     // Disables dynamic payload throughout the system.  Also disables Ack Payloads
 
     //toggle_features();
@@ -1426,6 +1728,7 @@ void RF24::disableDynamicPayloads(void)
 
 void RF24::enableAckPayload(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     //
     // enable ack payload and dynamic payload features
     //
@@ -1446,6 +1749,7 @@ void RF24::enableAckPayload(void)
 
 void RF24::enableDynamicAck(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     //
     // enable dynamic ack features
     //
@@ -1461,6 +1765,7 @@ void RF24::enableDynamicAck(void)
 
 void RF24::writeAckPayload(uint8_t pipe, const void* buf, uint8_t len)
 {
+    RF24_TRACE_API(RF24_API_WRITE_ACK_PAYLOAD);
     const uint8_t* current = reinterpret_cast<const uint8_t*>(buf);
 
     uint8_t data_len = rf24_min(len, 32);
@@ -1493,6 +1798,7 @@ void RF24::writeAckPayload(uint8_t pipe, const void* buf, uint8_t len)
 
 bool RF24::isAckPayloadAvailable(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     return !(read_register(FIFO_STATUS) & _BV(RX_EMPTY));
 }
 
@@ -1507,6 +1813,7 @@ bool RF24::isPVariant(void)
 
 void RF24::setAutoAck(bool enable)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     if (enable) {
         write_register(EN_AA, 0x3F);
     } else {
@@ -1518,6 +1825,7 @@ void RF24::setAutoAck(bool enable)
 
 void RF24::setAutoAck(uint8_t pipe, bool enable)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     if (pipe <= 6) {
         uint8_t en_aa = read_register(EN_AA);
         if (enable) {
@@ -1533,6 +1841,7 @@ void RF24::setAutoAck(uint8_t pipe, bool enable)
 
 bool RF24::testCarrier(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     return (read_register(CD) & 1);
 }
 
@@ -1540,6 +1849,7 @@ bool RF24::testCarrier(void)
 
 bool RF24::testRPD(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     return (read_register(RPD) & 1);
 }
 
@@ -1547,6 +1857,7 @@ bool RF24::testRPD(void)
 
 void RF24::setPALevel(uint8_t level)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
 
     uint8_t setup = read_register(RF_SETUP) & 0xF8;
 
@@ -1563,6 +1874,7 @@ void RF24::setPALevel(uint8_t level)
 
 uint8_t RF24::getPALevel(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
 
     return (read_register(RF_SETUP) & (_BV(RF_PWR_LOW) | _BV(RF_PWR_HIGH))) >> 1;
 }
@@ -1571,6 +1883,7 @@ uint8_t RF24::getPALevel(void)
 
 uint8_t RF24::getARC(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
 
     return read_register(OBSERVE_TX) & 0x0F;
 }
@@ -1579,6 +1892,7 @@ uint8_t RF24::getARC(void)
 
 bool RF24::setDataRate(rf24_datarate_e speed)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     bool result = false;
     uint8_t setup = read_register(RF_SETUP);
 
@@ -1624,6 +1938,7 @@ bool RF24::setDataRate(rf24_datarate_e speed)
 
 rf24_datarate_e RF24::getDataRate(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     rf24_datarate_e result;
     uint8_t dr = read_register(RF_SETUP) & (_BV(RF_DR_LOW) | _BV(RF_DR_HIGH));
 
@@ -1646,6 +1961,7 @@ rf24_datarate_e RF24::getDataRate(void)
 
 void RF24::setCRCLength(rf24_crclength_e length)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     uint8_t config = read_register(NRF_CONFIG) & ~(_BV(CRCO) | _BV(EN_CRC));
 
     // switch uses RAM (evil!)
@@ -1664,6 +1980,7 @@ void RF24::setCRCLength(rf24_crclength_e length)
 
 rf24_crclength_e RF24::getCRCLength(void)
 {
+    RF24_TRACE_API(RF24_API_QUERY);
     rf24_crclength_e result = RF24_CRC_DISABLED;
 
     uint8_t config = read_register(NRF_CONFIG) & (_BV(CRCO) | _BV(EN_CRC));
@@ -1684,6 +2001,7 @@ rf24_crclength_e RF24::getCRCLength(void)
 
 void RF24::disableCRC(void)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     uint8_t disable = read_register(NRF_CONFIG) & ~_BV(EN_CRC);
     write_register(NRF_CONFIG, disable);
 }
@@ -1691,6 +2009,7 @@ void RF24::disableCRC(void)
 /****************************************************************************/
 void RF24::setRetries(uint8_t delay, uint8_t count)
 {
+    RF24_TRACE_API(RF24_API_CONFIG);
     write_register(SETUP_RETR, (delay & 0xf) << ARD | (count & 0xf) << ARC);
 }
 
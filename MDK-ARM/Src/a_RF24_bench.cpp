@@ -0,0 +1,286 @@
+/**
+ * @file a_RF24_bench.cpp
+ *
+ * Throughput and cost benchmark for the RF24 driver, see a_RF24_bench.h.
+ */
+
+#include "a_nRF24L01.h"
+#include "a_RF24_config.h"
+#include "a_RF24.h"
+#include "a_RF24_trace.h"
+#include "a_RF24_bench.h"
+#include "string.h"
+#include "stdio.h"
+
+#if defined(RF24_BENCH)
+
+/* Recorded with Host/rf24_bench at the default 16 MHz core clock and
+ * SPI1/256, plus 25% headroom. The bytes were the same from SPI1/256 to
+ * SPI1/4 (rf24_bench -c), the polling time was the longest at SPI1/256.
+ * Re-record after changing the driver on purpose. */
+const rf24_bench_budgets_t RF24_BenchBudgetsEmu = {
+  62500,
+  {
+    /* us/op    B/pkt  poll us */
+    {   21900,     48,       0 },   // begin
+    {    7000,     45,     800 },   // write
+    {    5900,     42,     160 },   // writeFast
+    {    5900,     42,     160 },   // writeBlocking
+    {     910,      1,     800 },   // txStandBy
+    {    6700,     48,       0 },   // read
+    {    4700,     30,       0 },   // role switch
+  }
+};
+
+/* The bytes outside polling and the polling time are set by the driver and
+ * the radio, the emulator's budgets hold. The time per operation is left
+ * unchecked until it has been recorded on the board. */
+const rf24_bench_budgets_t RF24_BenchBudgetsBoard = {
+  0,
+  {
+    /* us/op    B/pkt  poll us */
+    {       0,     48,       0 },   // begin
+    {       0,     45,     800 },   // write
+    {       0,     42,     160 },   // writeFast
+    {       0,     42,     160 },   // writeBlocking
+    {       0,      1,     800 },   // txStandBy
+    {       0,     48,       0 },   // read
+    {       0,     30,       0 },   // role switch
+  }
+};
+
+static const char * const bench_names[RF24_BENCH_COUNT] = {
+  "begin",
+  "write",
+  "writeFast",
+  "writeBlocking",
+  "txStandBy",
+  "read",
+  "roleSwitch",
+};
+
+static const uint8_t bench_address[6] = RF24_BENCH_ADDRESS;
+static uint8_t bench_payload[RF24_BENCH_PAYLOAD];
+
+/****************************************************************************/
+
+const char* RF24_BenchName(uint8_t bench)
+{
+    return bench < RF24_BENCH_COUNT ? bench_names[bench] : "?";
+}
+
+/****************************************************************************/
+
+/* Bytes clocked by @p api, or by every API for RF24_API_NONE, and of them
+ * the bytes spent polling the radio */
+static uint32_t bench_bytes(uint8_t api, uint32_t* poll)
+{
+    uint32_t bytes = 0;
+
+    *poll = 0;
+    for (uint8_t i = 0; i < RF24_API_COUNT; i++) {
+        if (api == RF24_API_NONE || api == i) {
+            bytes += RF24_TraceTotals(i)->bytes;
+            *poll += RF24_TraceTotals(i)->poll_bytes;
+        }
+    }
+    return bytes;
+}
+
+/****************************************************************************/
+
+static void bench_setup(RF24& radio)
+{
+    radio.setChannel(RF24_BENCH_CHANNEL);
+    radio.setDataRate(RF24_1MBPS);
+    radio.setCRCLength(RF24_CRC_16);
+    radio.setPayloadSize(RF24_BENCH_PAYLOAD);
+    radio.setAutoAck(true);
+    radio.setRetries(5, 15);
+    radio.openWritingPipe(bench_address);
+    radio.openReadingPipe(1, bench_address);
+    radio.stopListening();
+    radio.flush_tx();
+    radio.flush_rx();
+}
+
+/****************************************************************************/
+
+static void bench_finish(const rf24_bench_config_t* config, uint32_t spi_hz, uint8_t bench, uint8_t api,
+                         rf24_bench_result_t* r)
+{
+    uint32_t pkts = r->ok ? r->ok : 1;
+    uint32_t elapsed = r->elapsed_us ? r->elapsed_us : 1;
+    uint32_t poll;
+    uint32_t bytes = bench_bytes(api, &poll);
+
+    r->pkts_per_s = (uint32_t)((uint64_t)r->ok * 1000000UL / elapsed);
+    r->us_per_op = r->ops ? r->elapsed_us / r->ops : 0;
+    r->bytes_per_pkt = (uint16_t)((bytes - poll + pkts / 2) / pkts);
+    r->poll_per_pkt = (uint16_t)((poll + pkts / 2) / pkts);
+    r->poll_us_per_pkt = spi_hz ? (uint16_t)((uint64_t)poll * 8000000UL / spi_hz / pkts) : 0;
+    r->failed = (r->ok == 0);
+
+    const rf24_bench_budget_t* b = config->budgets ? &config->budgets->cases[bench] : NULL;
+    if (b && b->us_per_op && spi_hz == config->budgets->spi_hz && r->us_per_op > b->us_per_op) {
+        r->failed = 1;
+    }
+    if (b && b->bytes_per_pkt && r->bytes_per_pkt > b->bytes_per_pkt) {
+        r->failed = 1;
+    }
+    if (b && b->poll_us_per_pkt && r->poll_us_per_pkt > b->poll_us_per_pkt) {
+        r->failed = 1;
+    }
+
+    if (config->sink) {
+        char line[144];
+        int len = snprintf(line, sizeof(line), "%-14s n=%-4u ok=%-4u %6lu pkt/s %8lu us/op %4u B/pkt %4u B %4u us poll  budget %lu us %u B %u us  %s\r\n",
+                           bench_names[bench], r->ops, r->ok, (unsigned long)r->pkts_per_s,
+                           (unsigned long)r->us_per_op, r->bytes_per_pkt, r->poll_per_pkt, r->poll_us_per_pkt,
+                           (unsigned long)(b ? b->us_per_op : 0), b ? b->bytes_per_pkt : 0,
+                           b ? b->poll_us_per_pkt : 0, r->failed ? "FAIL" : "ok");
+        if (len > (int)sizeof(line) - 1) {
+            len = sizeof(line) - 1;
+        }
+        config->sink(line, (uint16_t)len);
+    }
+}
+
+/****************************************************************************/
+
+uint8_t RF24_Bench(RF24& radio, const rf24_bench_config_t* config, rf24_bench_result_t* results)
+{
+    rf24_bench_result_t local[RF24_BENCH_COUNT];
+    rf24_bench_result_t* r;
+    uint16_t packets = config->packets ? config->packets : 100;
+    uint8_t failed = 0;
+    uint32_t spi_hz = radio.getSPIClock();
+    uint32_t t;
+
+    if (!results) {
+        results = local;
+    }
+    memset(results, 0, sizeof(rf24_bench_result_t) * RF24_BENCH_COUNT);
+    for (uint8_t i = 0; i < RF24_BENCH_PAYLOAD; i++) {
+        bench_payload[i] = i;
+    }
+
+    if (config->sink) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "-- RF24 bench, %u packets of %u bytes --\r\n", packets,
+                           RF24_BENCH_PAYLOAD);
+        config->sink(line, (uint16_t)len);
+    }
+
+    /* begin() */
+    r = &results[RF24_BENCH_BEGIN];
+    RF24_TraceReset();
+    for (r->ops = 0; r->ops < 4; r->ops++) {
+        t = config->micros();
+        r->ok += radio.begin();
+        r->elapsed_us += config->micros() - t;
+    }
+    bench_finish(config, spi_hz, RF24_BENCH_BEGIN, RF24_API_NONE, r);
+    bench_setup(radio);
+
+    /* write() */
+    r = &results[RF24_BENCH_WRITE];
+    RF24_TraceReset();
+    t = config->micros();
+    for (r->ops = 0; r->ops < packets; r->ops++) {
+        r->ok += radio.write(bench_payload, RF24_BENCH_PAYLOAD);
+    }
+    r->elapsed_us = config->micros() - t;
+    bench_finish(config, spi_hz, RF24_BENCH_WRITE, RF24_API_NONE, r);
+
+    /* writeFast() bursts. A failed txStandBy() flushes whatever was still
+     * queued, at most the three FIFO slots. */
+    r = &results[RF24_BENCH_WRITE_FAST];
+    RF24_TraceReset();
+    t = config->micros();
+    for (r->ops = 0; r->ops < packets; r->ops++) {
+        r->ok += radio.writeFast(bench_payload, RF24_BENCH_PAYLOAD);
+    }
+    if (!radio.txStandBy()) {
+        r->ok = r->ok > 3 ? r->ok - 3 : 0;
+    }
+    r->elapsed_us = config->micros() - t;
+    bench_finish(config, spi_hz, RF24_BENCH_WRITE_FAST, RF24_API_NONE, r);
+
+    /* writeBlocking() */
+    r = &results[RF24_BENCH_WRITE_BLOCKING];
+    RF24_TraceReset();
+    t = config->micros();
+    for (r->ops = 0; r->ops < packets; r->ops++) {
+        r->ok += radio.writeBlocking(bench_payload, RF24_BENCH_PAYLOAD, 100);
+    }
+    if (!radio.txStandBy(100)) {
+        r->ok = r->ok > 3 ? r->ok - 3 : 0;
+    }
+    r->elapsed_us = config->micros() - t;
+    bench_finish(config, spi_hz, RF24_BENCH_WRITE_BLOCKING, RF24_API_NONE, r);
+
+    /* txStandBy() alone, only its own time and bytes are counted */
+    r = &results[RF24_BENCH_TX_STANDBY];
+    RF24_TraceReset();
+    for (r->ops = 0; r->ops < packets / 3; r->ops++) {
+        radio.writeFast(bench_payload, RF24_BENCH_PAYLOAD);
+        radio.writeFast(bench_payload, RF24_BENCH_PAYLOAD);
+        radio.writeFast(bench_payload, RF24_BENCH_PAYLOAD);
+        t = config->micros();
+        r->ok += radio.txStandBy();
+        r->elapsed_us += config->micros() - t;
+    }
+    bench_finish(config, spi_hz, RF24_BENCH_TX_STANDBY, RF24_API_TX_STANDBY, r);
+
+    /* available()/read() drain, three packets at a time. Without a feed
+     * hook the remote node is expected to be streaming already; give up
+     * after two seconds of silence. */
+    r = &results[RF24_BENCH_READ];
+    radio.startListening();
+    RF24_TraceReset();
+    uint32_t idle = config->micros();
+    while (r->ok < packets && config->micros() - idle < 2000000UL) {
+        if (config->feed) {
+            config->feed(3);
+        }
+        t = config->micros();
+        if (!radio.available()) {
+            continue;
+        }
+        while (radio.available()) {
+            radio.read(bench_payload, RF24_BENCH_PAYLOAD);
+            r->ok++;
+        }
+        r->elapsed_us += config->micros() - t;
+        idle = config->micros();
+    }
+    r->ops = r->ok;
+    radio.stopListening();
+    bench_finish(config, spi_hz, RF24_BENCH_READ, RF24_API_NONE, r);
+
+    /* startListening() + stopListening() */
+    r = &results[RF24_BENCH_ROLE_SWITCH];
+    RF24_TraceReset();
+    t = config->micros();
+    for (r->ops = 0; r->ops < packets / 4; r->ops++) {
+        radio.startListening();
+        radio.stopListening();
+        r->ok++;
+    }
+    r->elapsed_us = config->micros() - t;
+    bench_finish(config, spi_hz, RF24_BENCH_ROLE_SWITCH, RF24_API_NONE, r);
+
+    for (uint8_t i = 0; i < RF24_BENCH_COUNT; i++) {
+        failed += results[i].failed;
+    }
+    if (config->sink) {
+        char line[48];
+        int len = snprintf(line, sizeof(line), "-- %u of %u cases failed --\r\n", failed, RF24_BENCH_COUNT);
+        config->sink(line, (uint16_t)len);
+    }
+    RF24_TraceReset();
+    return failed;
+}
+
+#endif // defined(RF24_BENCH)
@@ -0,0 +1,207 @@
+/**
+ * @file a_RF24_bridge.cpp
+ *
+ * USB to radio bridge, see a_RF24_bridge.h.
+ */
+
+#include "a_nRF24L01.h"
+#include "a_RF24_config.h"
+#include "a_RF24.h"
+#include "a_RF24_bridge.h"
+#include "telemetry.h"
+#include "string.h"
+
+#if defined(RF24_BRIDGE)
+
+#if (RF24_BRIDGE_QUEUE & (RF24_BRIDGE_QUEUE - 1)) != 0
+#error "RF24_BRIDGE_QUEUE must be a power of two"
+#endif
+
+/* Payloads kept in the TX FIFO, one on the air and the next one ready */
+#define BRIDGE_IN_RADIO    2
+
+typedef struct {
+  uint8_t len;
+  uint8_t data[32];
+} bridge_payload_t;
+
+static const rf24_bridge_config_t* bridge_config;
+static rf24_bridge_stats_t bridge_stats;
+
+/* head and tail run free, the payloads from tail to tail + bridge_inflight
+ * are in the radio and leave the queue once counted */
+static bridge_payload_t bridge_queue[RF24_BRIDGE_QUEUE];
+static uint8_t bridge_head, bridge_tail;
+static uint8_t bridge_inflight;
+static uint8_t bridge_transmitting;   // the TX radio is out of RX mode
+static uint32_t bridge_since;         // last TX progress, ms
+static uint32_t bridge_stats_at;
+
+/****************************************************************************/
+
+static void bridge_done(uint8_t count, uint32_t* counter)
+{
+    bridge_tail += count;
+    bridge_inflight -= count;
+    *counter += count;
+    bridge_since = HAL_GetTick();
+}
+
+/* Counts what the TX radio did with the payloads in its FIFO. STATUS is
+ * read first and only the flags seen are cleared, whatHappened() would lose
+ * a TX_DS raised during its write. TX_DS is one bit for both payloads:
+ * with two in flight, an empty FIFO read after clearing it says whether
+ * the second one is done too, and its TX_DS, set before or after, is
+ * cleared with the count */
+static void bridge_account(RF24* tx)
+{
+    uint8_t status = tx->get_status() & (_BV(TX_DS) | _BV(MAX_RT));
+
+    if (status & _BV(MAX_RT)) {
+        // The head ran out of retries, the one behind it was never sent.
+        // Flushed first: clearing MAX_RT with CE high sends the head again
+        tx->flush_tx();
+        tx->clearStatus(status);
+        if ((status & _BV(TX_DS)) && bridge_inflight > 1) {
+            bridge_done(1, &bridge_stats.sent);
+        }
+        bridge_done(1, &bridge_stats.failed);
+        bridge_inflight = 0;
+    } else if (status & _BV(TX_DS)) {
+        tx->clearStatus(status);
+        if (bridge_inflight > 1 && tx->txFifoEmpty()) {
+            tx->clearStatus(_BV(TX_DS));
+            bridge_done(bridge_inflight, &bridge_stats.sent);
+        } else {
+            bridge_done(1, &bridge_stats.sent);
+        }
+    } else if (HAL_GetTick() - bridge_since > RF24_BRIDGE_TIMEOUT) {
+        // Not answering: give up what is in the radio and check the bus
+        tx->flush_tx();
+        bridge_done(bridge_inflight, &bridge_stats.failed);
+        tx->checkSPI();
+    }
+}
+
+static void bridge_transmit(void)
+{
+    RF24* tx = bridge_config->tx;
+    bool shared = bridge_config->tx == bridge_config->rx;
+
+    if (bridge_inflight == 0 && bridge_head == bridge_tail) {
+        if (bridge_transmitting) {
+            tx->txStandBy();
+            bridge_transmitting = 0;
+            if (shared) {
+                tx->startListening();
+            }
+        }
+        return;
+    }
+    if (!bridge_transmitting) {
+        if (shared) {
+            tx->stopListening();
+        }
+        bridge_transmitting = 1;
+        bridge_since = HAL_GetTick();
+    }
+    if (bridge_inflight) {
+        bridge_account(tx);
+    }
+    while (bridge_inflight < BRIDGE_IN_RADIO && (uint8_t)(bridge_tail + bridge_inflight) != bridge_head) {
+        const bridge_payload_t* p = &bridge_queue[(uint8_t)(bridge_tail + bridge_inflight) & (RF24_BRIDGE_QUEUE - 1)];
+        tx->startFastWrite(p->data, p->len, 0);
+        if (bridge_inflight++ == 0) {
+            bridge_since = HAL_GetTick();
+        }
+    }
+}
+
+static void bridge_receive(void)
+{
+    RF24* rx = bridge_config->rx;
+    uint8_t payload[32];
+    uint8_t pipe;
+
+    if (bridge_transmitting && rx == bridge_config->tx) {
+        return;
+    }
+    if (rx->available(&pipe) && rx->rxFifoFull()) {
+        bridge_stats.rx_fifo_full++;
+    }
+    while (rx->available(&pipe)) {
+        uint8_t len = bridge_config->payload_size ? bridge_config->payload_size : rx->getDynamicPayloadSize();
+        if (len == 0) {
+            continue;                   // a bad length, the radio flushed its FIFO
+        }
+        rx->read(payload, len);
+        bridge_stats.received++;
+        if (!telemetry_radio(pipe, payload, len)) {
+            bridge_stats.rx_dropped++;
+        }
+    }
+}
+
+/****************************************************************************/
+
+void RF24_BridgeBegin(const rf24_bridge_config_t* config)
+{
+    bridge_config = config;
+    memset(&bridge_stats, 0, sizeof(bridge_stats));
+    bridge_head = bridge_tail = 0;
+    bridge_inflight = 0;
+    bridge_transmitting = 0;
+    bridge_stats_at = HAL_GetTick();
+
+    if (config->payload_size) {
+        config->tx->setPayloadSize(config->payload_size);
+        config->rx->setPayloadSize(config->payload_size);
+    } else {
+        config->tx->enableDynamicPayloads();
+        config->rx->enableDynamicPayloads();
+    }
+    if (config->tx != config->rx) {
+        config->tx->stopListening();
+    }
+    config->tx->flush_tx();
+    config->rx->flush_rx();
+    config->rx->startListening();
+}
+
+/****************************************************************************/
+
+uint8_t RF24_BridgeSend(const uint8_t* payload, uint8_t len)
+{
+    if ((uint8_t)(bridge_head - bridge_tail) == RF24_BRIDGE_QUEUE) {
+        bridge_stats.full++;
+        return 0;
+    }
+    bridge_payload_t* p = &bridge_queue[bridge_head & (RF24_BRIDGE_QUEUE - 1)];
+    p->len = len;
+    memcpy(p->data, payload, len);
+    bridge_head++;
+    bridge_stats.queued++;
+    return 1;
+}
+
+/****************************************************************************/
+
+void RF24_BridgePoll(void)
+{
+    bridge_receive();
+    bridge_transmit();
+
+    if (bridge_config->stats_interval && HAL_GetTick() - bridge_stats_at >= bridge_config->stats_interval) {
+        bridge_stats_at = HAL_GetTick();
+        telemetry_stats(TELEMETRY_STATS_BRIDGE, &bridge_stats.queued, sizeof(bridge_stats) / sizeof(uint32_t));
+    }
+}
+
+/****************************************************************************/
+
+const rf24_bridge_stats_t* RF24_BridgeStats(void)
+{
+    return &bridge_stats;
+}
+
+#endif // defined(RF24_BRIDGE)
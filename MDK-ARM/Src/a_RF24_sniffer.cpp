@@ -0,0 +1,293 @@
+/**
+ * @file a_RF24_sniffer.cpp
+ *
+ * Promiscuous capture of Enhanced ShockBurst frames, see a_RF24_sniffer.h.
+ */
+
+#include "a_nRF24L01.h"
+#include "a_RF24_config.h"
+#include "a_RF24.h"
+#include "a_RF24_sniffer.h"
+#include "string.h"
+
+#if defined(RF24_SNIFFER)
+
+/* USB full speed bulk packets, a transfer that fills its last one needs a
+ * zero length packet to end, so one byte is held back instead */
+#define SNIFFER_USB_PACKET 64
+
+/* IRQ edges not yet matched with a payload */
+#define SNIFFER_STAMPS     4
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t  thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t network;
+} pcap_file_header_t;
+
+typedef struct {
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t incl_len;
+  uint32_t orig_len;
+} pcap_record_header_t;
+
+static const rf24_sniffer_config_t* sniffer_config;
+static rf24_sniffer_stats_t sniffer_stats;
+
+static uint8_t sniffer_buf[2][RF24_SNIFFER_BUFFER];
+static uint16_t sniffer_fill;         // bytes in sniffer_buf[sniffer_active]
+static uint8_t sniffer_active;        // buffer being filled, the other one may be in flight
+
+static volatile uint32_t sniffer_stamp[SNIFFER_STAMPS];
+static volatile uint8_t sniffer_stamp_head, sniffer_stamp_tail;
+
+static uint32_t sniffer_last_us;      // 64 bit time from the 32 bit clock
+static uint32_t sniffer_wraps;
+
+/****************************************************************************/
+
+/* Bits in air order, most significant bit of each byte first */
+static uint8_t sniffer_bits(const uint8_t* raw, uint16_t bit, uint8_t count)
+{
+    uint8_t value = 0;
+
+    while (count--) {
+        value = (value << 1) | ((raw[bit >> 3] >> (7 - (bit & 7))) & 1);
+        bit++;
+    }
+    return value;
+}
+
+/* CRC-16-CCITT, 0x1021 from 0xFFFF, over @p count bits from @p bit */
+static uint16_t sniffer_crc(const uint8_t* raw, uint16_t bit, uint16_t count)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (count--) {
+        uint16_t in = (raw[bit >> 3] >> (7 - (bit & 7))) & 1;
+        crc = ((crc >> 15) ^ in) ? (crc << 1) ^ 0x1021 : crc << 1;
+        bit++;
+    }
+    return crc;
+}
+
+bool RF24_SnifferDecode(const uint8_t* raw, uint8_t addr_width, rf24_esb_frame_t* frame)
+{
+    for (uint8_t offset = 0; offset < 8; offset++) {
+        uint16_t bit = offset + addr_width * 8;
+        uint16_t pcf = ((uint16_t)sniffer_bits(raw, bit, 8) << 1) | sniffer_bits(raw, bit + 8, 1);
+        uint8_t len = pcf >> 3;
+
+        bit += 9;
+        if (len > 32 || bit + len * 8 + 16 > 32 * 8) {
+            continue;
+        }
+        uint16_t crc = sniffer_crc(raw, offset, bit + len * 8 - offset);
+        uint16_t sent = ((uint16_t)sniffer_bits(raw, bit + len * 8, 8) << 8) | sniffer_bits(raw, bit + len * 8 + 8, 8);
+        if (crc != sent) {
+            continue;
+        }
+
+        for (uint8_t i = 0; i < addr_width; i++) {
+            frame->address[i] = sniffer_bits(raw, offset + i * 8, 8);
+        }
+        for (uint8_t i = 0; i < len; i++) {
+            frame->payload[i] = sniffer_bits(raw, bit + i * 8, 8);
+        }
+        frame->addr_len = addr_width;
+        frame->payload_len = len;
+        frame->pid = (pcf >> 1) & 0x03;
+        frame->no_ack = pcf & 0x01;
+        frame->bit_offset = offset;
+        return true;
+    }
+    return false;
+}
+
+/****************************************************************************/
+
+/* Hand the active buffer on if the other one has been sent */
+static void sniffer_flush(void)
+{
+    uint8_t* buf = sniffer_buf[sniffer_active];
+    uint16_t len = sniffer_fill;
+
+    if (len == 0) {
+        return;
+    }
+    if (len % SNIFFER_USB_PACKET == 0) {
+        len--;
+    }
+    if (len == 0 || sniffer_config->transmit(buf, len) != 0) {
+        return;
+    }
+    sniffer_stats.bytes += len;
+    sniffer_active ^= 1;
+    sniffer_fill -= len;
+    if (sniffer_fill) {
+        sniffer_buf[sniffer_active][0] = buf[len];
+    }
+}
+
+static bool sniffer_reserve(uint16_t len)
+{
+    if (sniffer_fill + len <= RF24_SNIFFER_BUFFER) {
+        return true;
+    }
+    sniffer_flush();
+    return sniffer_fill + len <= RF24_SNIFFER_BUFFER;
+}
+
+static void sniffer_put(const void* data, uint16_t len)
+{
+    memcpy(&sniffer_buf[sniffer_active][sniffer_fill], data, len);
+    sniffer_fill += len;
+}
+
+/****************************************************************************/
+
+static void sniffer_irq(RF24* radio)
+{
+    uint8_t next = (sniffer_stamp_head + 1) % SNIFFER_STAMPS;
+
+    if (next != sniffer_stamp_tail) {
+        sniffer_stamp[sniffer_stamp_head] = sniffer_config->micros();
+        sniffer_stamp_head = next;
+    }
+}
+
+static uint32_t sniffer_time(uint32_t* sec)
+{
+    uint32_t us;
+
+    if (sniffer_stamp_tail != sniffer_stamp_head) {
+        us = sniffer_stamp[sniffer_stamp_tail];
+        sniffer_stamp_tail = (sniffer_stamp_tail + 1) % SNIFFER_STAMPS;
+    } else {
+        us = sniffer_config->micros();
+    }
+    if (us < sniffer_last_us) {
+        sniffer_wraps++;
+    }
+    sniffer_last_us = us;
+
+    uint64_t t = ((uint64_t)sniffer_wraps << 32) | us;
+    *sec = (uint32_t)(t / 1000000UL);
+    return (uint32_t)(t % 1000000UL);
+}
+
+static void sniffer_record(const uint8_t* raw)
+{
+    rf24_esb_frame_t frame;
+    rf24_sniffer_header_t h;
+    pcap_record_header_t r;
+    const uint8_t* payload;
+
+    r.ts_usec = sniffer_time(&r.ts_sec);
+    h.version = 1;
+    h.channel = sniffer_config->channel;
+    h.data_rate = sniffer_config->data_rate;
+
+    if (RF24_SnifferDecode(raw, sniffer_config->addr_width, &frame)) {
+        sniffer_stats.frames++;
+        h.flags = RF24_SNIFFER_CRC_OK | (frame.no_ack ? RF24_SNIFFER_NO_ACK : 0);
+        h.addr_len = frame.addr_len;
+        h.payload_len = frame.payload_len;
+        h.pid = frame.pid;
+        h.bit_offset = frame.bit_offset;
+        payload = frame.payload;
+    } else {
+        sniffer_stats.crc_errors++;
+        if (!sniffer_config->keep_bad) {
+            return;
+        }
+        h.flags = 0;
+        h.addr_len = 0;
+        h.payload_len = 32;
+        h.pid = 0;
+        h.bit_offset = 0;
+        payload = raw;
+    }
+
+    r.incl_len = r.orig_len = sizeof(h) + h.addr_len + h.payload_len;
+    if (!sniffer_reserve(sizeof(r) + r.incl_len)) {
+        sniffer_stats.dropped++;
+        return;
+    }
+    sniffer_put(&r, sizeof(r));
+    sniffer_put(&h, sizeof(h));
+    sniffer_put(frame.address, h.addr_len);
+    sniffer_put(payload, h.payload_len);
+}
+
+/****************************************************************************/
+
+void RF24_SnifferBegin(RF24& radio, const rf24_sniffer_config_t* config)
+{
+    pcap_file_header_t f;
+
+    sniffer_config = config;
+    memset(&sniffer_stats, 0, sizeof(sniffer_stats));
+    sniffer_fill = 0;
+    sniffer_active = 0;
+    sniffer_stamp_head = sniffer_stamp_tail = 0;
+    sniffer_last_us = 0;
+    sniffer_wraps = 0;
+
+    radio.stopListening();
+    radio.setChannel(config->channel);
+    radio.setDataRate(config->data_rate);
+    radio.setAutoAck(false);
+    radio.disableCRC();
+    radio.setAddressWidth(2);
+    radio.setPayloadSize(32);
+    // A preamble of either polarity, then the zeros of an idle channel
+    radio.openReadingPipe(0, 0x00AAULL);
+    radio.openReadingPipe(1, 0x0055ULL);
+    radio.maskIRQ(IRQ_TX_OK_DIS, IRQ_TX_FAIL_DIS, IRQ_RX_READY_EN);
+    radio.attachInterrupt(sniffer_irq);
+    radio.flush_rx();
+    radio.startListening();
+
+    f.magic = 0xa1b2c3d4;
+    f.version_major = 2;
+    f.version_minor = 4;
+    f.thiszone = 0;
+    f.sigfigs = 0;
+    f.snaplen = sizeof(rf24_sniffer_header_t) + 5 + 32;
+    f.network = RF24_SNIFFER_LINKTYPE;
+    sniffer_put(&f, sizeof(f));
+    sniffer_flush();
+}
+
+/****************************************************************************/
+
+void RF24_SnifferPoll(RF24& radio)
+{
+    uint8_t raw[32];
+    uint8_t drained = 0;
+
+    while (radio.available()) {
+        radio.read(raw, sizeof(raw));
+        sniffer_stats.captures++;
+        if (++drained == 3) {
+            sniffer_stats.fifo_full++;
+        }
+        sniffer_record(raw);
+    }
+    sniffer_flush();
+}
+
+/****************************************************************************/
+
+const rf24_sniffer_stats_t* RF24_SnifferStats(void)
+{
+    return &sniffer_stats;
+}
+
+#endif // defined(RF24_SNIFFER)
@@ -0,0 +1,178 @@
+/**
+ * @file a_RF24_trace.cpp
+ *
+ * SPI cost accounting for the RF24 driver, see a_RF24_trace.h.
+ */
+
+#include "a_RF24_config.h"
+#include "a_RF24_trace.h"
+#include "string.h"
+#include "stdio.h"
+
+#if defined(RF24_TRACE)
+
+rf24_trace_ctx_t rf24_trace_ctx;
+
+/* Single producer (the code calling RF24) and single consumer (the dump).
+ * head is only written by the producer, tail only by the consumer. */
+static rf24_trace_record_t trace_ring[RF24_TRACE_DEPTH];
+static volatile uint32_t trace_head;
+static volatile uint32_t trace_tail;
+static volatile uint32_t trace_dropped;
+static rf24_trace_totals_t trace_totals[RF24_API_COUNT];
+
+static const char * const trace_names[RF24_API_COUNT] = {
+  "none",
+  "begin",
+  "startListening",
+  "stopListening",
+  "available",
+  "read",
+  "write",
+  "writeFast",
+  "writeBlocking",
+  "txStandBy",
+  "startFastWrite",
+  "startWrite",
+  "reUseTX",
+  "writeAckPayload",
+  "whatHappened",
+  "openWritingPipe",
+  "openReadingPipe",
+  "powerUp",
+  "powerDown",
+  "config",
+  "query",
+};
+
+/****************************************************************************/
+
+void RF24_TraceInit(void)
+{
+    #if defined(DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    #endif
+    RF24_TraceReset();
+}
+
+/****************************************************************************/
+
+void RF24_TraceReset(void)
+{
+    trace_tail = trace_head;
+    trace_dropped = 0;
+    memset(trace_totals, 0, sizeof(trace_totals));
+}
+
+/****************************************************************************/
+
+void RF24_TraceCommit(void)
+{
+    uint32_t cycles = RF24_TRACE_CYCLES() - rf24_trace_ctx.start;
+    uint8_t api = rf24_trace_ctx.api;
+
+    if (api < RF24_API_COUNT) {
+        rf24_trace_totals_t* t = &trace_totals[api];
+        t->calls++;
+        t->transactions += rf24_trace_ctx.transactions;
+        t->bytes += rf24_trace_ctx.bytes;
+        t->poll_bytes += rf24_trace_ctx.poll_bytes;
+        t->csn_toggles += rf24_trace_ctx.csn_toggles;
+        t->cycles += cycles;
+    }
+
+    uint32_t head = trace_head;
+    if (head - trace_tail >= RF24_TRACE_DEPTH) {
+        trace_dropped++;
+        return;
+    }
+
+    rf24_trace_record_t* rec = &trace_ring[head & (RF24_TRACE_DEPTH - 1)];
+    rec->api = api;
+    rec->transactions = rf24_trace_ctx.transactions;
+    rec->bytes = rf24_trace_ctx.bytes;
+    rec->poll_bytes = rf24_trace_ctx.poll_bytes;
+    rec->csn_toggles = rf24_trace_ctx.csn_toggles;
+    rec->cycles = cycles;
+
+    // Record must be visible before the consumer sees the new head
+    __DMB();
+    trace_head = head + 1;
+}
+
+/****************************************************************************/
+
+uint8_t RF24_TracePop(rf24_trace_record_t* rec)
+{
+    uint32_t tail = trace_tail;
+    if (tail == trace_head) {
+        return 0;
+    }
+    __DMB();
+    *rec = trace_ring[tail & (RF24_TRACE_DEPTH - 1)];
+    __DMB();
+    trace_tail = tail + 1;
+    return 1;
+}
+
+/****************************************************************************/
+
+uint32_t RF24_TraceDropped(void)
+{
+    return trace_dropped;
+}
+
+/****************************************************************************/
+
+const rf24_trace_totals_t* RF24_TraceTotals(uint8_t api)
+{
+    if (api >= RF24_API_COUNT) {
+        return NULL;
+    }
+    return &trace_totals[api];
+}
+
+/****************************************************************************/
+
+const char* RF24_TraceName(uint8_t api)
+{
+    if (api >= RF24_API_COUNT) {
+        return "?";
+    }
+    return trace_names[api];
+}
+
+/****************************************************************************/
+
+void RF24_TraceDump(rf24_trace_sink_t sink)
+{
+    char line[112];
+    int len;
+    rf24_trace_record_t rec;
+
+    while (RF24_TracePop(&rec)) {
+        len = snprintf(line, sizeof(line), "%-16s tr=%u bytes=%u poll=%u csn=%u cyc=%lu\r\n",
+                       RF24_TraceName(rec.api), rec.transactions, rec.bytes, rec.poll_bytes, rec.csn_toggles,
+                       (unsigned long)rec.cycles);
+        sink(line, (uint16_t)len);
+    }
+
+    len = snprintf(line, sizeof(line), "-- totals, %lu dropped --\r\n", (unsigned long)trace_dropped);
+    sink(line, (uint16_t)len);
+
+    for (uint8_t api = 1; api < RF24_API_COUNT; api++) {
+        const rf24_trace_totals_t* t = &trace_totals[api];
+        if (!t->calls) {
+            continue;
+        }
+        len = snprintf(line, sizeof(line), "%-16s n=%lu tr/call=%lu bytes/call=%lu poll/call=%lu cyc/call=%lu\r\n",
+                       trace_names[api], (unsigned long)t->calls, (unsigned long)(t->transactions / t->calls),
+                       (unsigned long)(t->bytes / t->calls), (unsigned long)(t->poll_bytes / t->calls),
+                       (unsigned long)(t->cycles / t->calls));
+        sink(line, (uint16_t)len);
+    }
+}
+
+#endif // defined(RF24_TRACE)
@@ -0,0 +1,263 @@
+/**
+ * @file cdc_command.cpp
+ *
+ * Binary commands on CDC, see cdc_command.h.
+ */
+
+#include "cdc_command.h"
+#include "usbd_cdc_if.h"
+#include "telemetry.h"
+#include "string.h"
+
+/* Sync, id, len */
+#define CMD_HEADER   3
+
+/* command_run() results that are not sent: done without a response, and
+ * not done yet, the frame waits in the receive buffer */
+#define CMD_QUIET    0xFE
+#define CMD_RETRY    0xFF
+
+static const cdc_command_config_t* command_config;
+static cdc_command_stats_t command_stats;
+
+/* Payload of one response at a time, telemetry_send() copies it */
+static uint8_t command_rsp[CDC_CMD_MAX_PAYLOAD];
+
+/****************************************************************************/
+
+static uint8_t command_check(const uint8_t* data, uint16_t len)
+{
+    uint8_t check = 0;
+
+    while (len--) {
+        check ^= *data++;
+    }
+    return check;
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value)
+{
+    p = put16(p, (uint16_t)value);
+    return put16(p, (uint16_t)(value >> 16));
+}
+
+static void command_respond(uint8_t id, uint8_t status, uint8_t len)
+{
+    uint8_t head[2] = { id, status };
+
+    command_stats.commands++;
+    if (status != CDC_CMD_OK) {
+        command_stats.errors++;
+    }
+    if (!telemetry_send(TELEMETRY_RESPONSE, head, sizeof(head), command_rsp, len)) {
+        command_stats.lost++;
+    }
+}
+
+/****************************************************************************/
+
+/* Runs one command, its payload still in the receive buffer, and fills the
+ * response payload. Returns the status, *len the response length */
+static uint8_t command_run(uint8_t id, const uint8_t* payload, uint8_t size, uint8_t* len)
+{
+    RF24* radio = command_config->radio;
+    HTU21D_Scheduler* sensors = command_config->sensors;
+    uint8_t* out = command_rsp;
+    uint8_t* p = out;
+
+    switch (id) {
+    case CDC_CMD_PING:
+        *p++ = CDC_CMD_VERSION;
+        p = put32(p, HAL_GetTick());
+        break;
+
+    case CDC_CMD_RADIO_CHANNEL:
+        if (size != 1) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (payload[0] > 125) {
+            return CDC_CMD_BAD_VALUE;
+        }
+        radio->setChannel(payload[0]);
+        break;
+
+    case CDC_CMD_RADIO_PA:
+        if (size != 1) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (payload[0] > RF24_PA_MAX) {
+            return CDC_CMD_BAD_VALUE;
+        }
+        radio->setPALevel(payload[0]);
+        break;
+
+    case CDC_CMD_RADIO_RATE:
+        if (size != 1) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (payload[0] > RF24_250KBPS) {
+            return CDC_CMD_BAD_VALUE;
+        }
+        if (!radio->setDataRate((rf24_datarate_e)payload[0])) {
+            return CDC_CMD_FAILED;
+        }
+        break;
+
+    case CDC_CMD_RADIO_TX_ADDR:
+        if (size < 3 || size > 5) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        radio->setAddressWidth(size);
+        radio->openWritingPipe(payload);
+        break;
+
+    case CDC_CMD_RADIO_RX_ADDR:
+        if (size < 4 || size > 6) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (payload[0] > 5) {
+            return CDC_CMD_BAD_VALUE;
+        }
+        radio->setAddressWidth(size - 1);
+        radio->openReadingPipe(payload[0], payload + 1);
+        break;
+
+    case CDC_CMD_RADIO_CONFIG:
+        *p++ = radio->getChannel();
+        *p++ = radio->getPALevel();
+        *p++ = (uint8_t)radio->getDataRate();
+        *p++ = (uint8_t)radio->getCRCLength();
+        *p++ = radio->getPayloadSize();
+        p = put32(p, radio->getSPIClock());
+        break;
+
+    case CDC_CMD_RADIO_REGS:
+        p += radio->readRegisters(p);
+        break;
+
+    case CDC_CMD_RADIO_SEND:
+        if (size < 1 || size > 32) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (command_config->send) {
+            return command_config->send(payload, size) ? CMD_QUIET : CMD_RETRY;
+        }
+        return radio->write(payload, size) ? CMD_QUIET : CDC_CMD_FAILED;
+
+    case CDC_CMD_HTU_TRIGGER:
+    case CDC_CMD_HTU_READ:
+        if (size != 1) {
+            return CDC_CMD_BAD_LENGTH;
+        }
+        if (sensors == NULL || payload[0] >= sensors->count()) {
+            return CDC_CMD_BAD_VALUE;
+        }
+        if (id == CDC_CMD_HTU_TRIGGER) {
+            sensors->trigger(payload[0]);
+        } else {
+            HTU21D_SAMPLE reading;
+
+            if (!sensors->reading(payload[0], &reading)) {
+                return CDC_CMD_FAILED;
+            }
+            *p++ = payload[0];
+            p = put16(p, sensors->chip(payload[0]));
+            p = put16(p, (uint16_t)reading.humidity);
+            p = put16(p, (uint16_t)reading.compensated);
+            p = put16(p, (uint16_t)reading.temperature);
+            p = put32(p, reading.time);
+            p = put32(p, reading.temperatureTime);
+        }
+        break;
+
+    case CDC_CMD_STATS:
+        p = put32(p, command_stats.commands);
+        p = put32(p, command_stats.errors);
+        p = put32(p, command_stats.bad_check);
+        p = put32(p, command_stats.skipped);
+        p = put32(p, command_stats.lost);
+        p = put32(p, CDC_TxStats_FS.queued);
+        p = put32(p, CDC_TxStats_FS.sent);
+        p = put32(p, CDC_TxStats_FS.dropped);
+        p = put32(p, sensors ? sensors->cycles : 0);
+        p = put32(p, sensors ? sensors->readings : 0);
+        p = put32(p, sensors ? sensors->failures : 0);
+        break;
+
+    default:
+        return CDC_CMD_UNKNOWN;
+    }
+    *len = (uint8_t)(p - out);
+    return CDC_CMD_OK;
+}
+
+/****************************************************************************/
+
+void CDC_CommandBegin(const cdc_command_config_t* config)
+{
+    command_config = config;
+    memset(&command_stats, 0, sizeof(command_stats));
+}
+
+/****************************************************************************/
+
+void CDC_CommandPoll(void)
+{
+    uint8_t* data;
+    uint16_t size = CDC_RxData_FS(&data);
+    uint16_t pos = 0;
+
+    while (pos < size) {
+        uint16_t frame;
+        uint8_t len = 0;
+        uint8_t status;
+
+        if (data[pos] != CDC_CMD_SYNC) {
+            command_stats.skipped++;
+            pos++;
+            continue;
+        }
+        if (size - pos < CMD_HEADER) {
+            break;                            // the rest of the header is still to come
+        }
+        if (data[pos + 2] > CDC_CMD_MAX_PAYLOAD) {
+            command_stats.bad_check++;        // not a frame, look for the next sync
+            pos++;
+            continue;
+        }
+        frame = CMD_HEADER + data[pos + 2] + 1;
+        if (size - pos < frame) {
+            break;
+        }
+        if (command_check(data + pos + 1, frame - 1) != 0) {
+            command_stats.bad_check++;
+            pos++;
+            continue;
+        }
+        status = command_run(data[pos + 1], data + pos + CMD_HEADER, data[pos + 2], &len);
+        if (status == CMD_RETRY) {
+            break;                            // flow control, see cdc_command.h
+        }
+        if (status == CMD_QUIET) {
+            command_stats.commands++;
+        } else {
+            command_respond(data[pos + 1], status, status == CDC_CMD_OK ? len : 0);
+        }
+        pos += frame;
+    }
+    CDC_RxRelease_FS(pos);
+}
+
+/****************************************************************************/
+
+const cdc_command_stats_t* CDC_CommandStats(void)
+{
+    return &command_stats;
+}
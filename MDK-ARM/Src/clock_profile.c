@@ -0,0 +1,163 @@
+/**
+  ******************************************************************************
+  * @file    clock_profile.c
+  * @brief   Run-time clock profiles, see clock_profile.h.
+  ******************************************************************************
+  */
+
+#include "clock_profile.h"
+
+typedef struct
+{
+  const char  *name;
+  uint32_t    ahb;
+  uint32_t    apb1;
+  uint32_t    apb2;
+  uint32_t    latency;          /*!< 2.7 V to 3.6 V: one wait state per 30 MHz */
+} clock_profile_cfg_t;
+
+/* Ordered as clock_profile_e, APB1 stays at or below 42 MHz, APB2 at or below 84 MHz */
+static const clock_profile_cfg_t clock_profiles[CLOCK_PROFILE_COUNT] =
+{
+  { "low-power", RCC_SYSCLK_DIV8, RCC_HCLK_DIV1, RCC_HCLK_DIV1, FLASH_LATENCY_0 },
+  { "balanced",  RCC_SYSCLK_DIV2, RCC_HCLK_DIV2, RCC_HCLK_DIV1, FLASH_LATENCY_2 },
+  { "max",       RCC_SYSCLK_DIV1, RCC_HCLK_DIV4, RCC_HCLK_DIV2, FLASH_LATENCY_5 },
+};
+
+static clock_profile_e clock_current = CLOCK_PROFILE_LOW_POWER;
+static clock_listener_t *clock_listeners;
+static uint32_t clock_us_cycles = 16;
+
+/* Prefetch only pays with wait states, the caches always do */
+static void clock_art(uint32_t latency)
+{
+  if (latency == FLASH_LATENCY_0)
+  {
+    __HAL_FLASH_PREFETCH_BUFFER_DISABLE();
+  }
+  else
+  {
+    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+  }
+  __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+  __HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+/**
+  * @brief  Records @p profile as the one SystemClock_Config() set up and
+  *         starts the cycle counter used by clock_delay_us().
+  */
+void clock_profile_init(clock_profile_e profile)
+{
+  clock_current = profile;
+  clock_us_cycles = SystemCoreClock / 1000000U;
+  clock_art(clock_profiles[profile].latency);
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * @brief  Switches to @p profile. Call from thread context.
+  * @retval HAL_BUSY if a listener refused, HAL_ERROR if the RCC did
+  */
+HAL_StatusTypeDef clock_profile_set(clock_profile_e profile)
+{
+  const clock_profile_cfg_t *cfg;
+  RCC_ClkInitTypeDef clk = {0};
+  clock_listener_t *l;
+  uint32_t primask;
+
+  if (profile >= CLOCK_PROFILE_COUNT)
+  {
+    return HAL_ERROR;
+  }
+  if (profile == clock_current)
+  {
+    return HAL_OK;
+  }
+
+  /* Masked from the question to the switch so that no transfer can start in between */
+  primask = __get_PRIMASK();
+  __disable_irq();
+  for (l = clock_listeners; l; l = l->next)
+  {
+    if (l->notify(CLOCK_PROFILE_PREPARE, profile, l->context))
+    {
+      __set_PRIMASK(primask);
+      return HAL_BUSY;
+    }
+  }
+
+  cfg = &clock_profiles[profile];
+  clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+  clk.AHBCLKDivider = cfg->ahb;
+  clk.APB1CLKDivider = cfg->apb1;
+  clk.APB2CLKDivider = cfg->apb2;
+  /* Raises the wait states before a faster HCLK and lowers them after a slower one,
+     then reloads SysTick */
+  if (HAL_RCC_ClockConfig(&clk, cfg->latency) != HAL_OK)
+  {
+    __set_PRIMASK(primask);
+    return HAL_ERROR;
+  }
+  clock_art(cfg->latency);
+  clock_current = profile;
+  clock_us_cycles = SystemCoreClock / 1000000U;
+  __set_PRIMASK(primask);
+
+  for (l = clock_listeners; l; l = l->next)
+  {
+    l->notify(CLOCK_PROFILE_CHANGED, profile, l->context);
+  }
+  return HAL_OK;
+}
+
+clock_profile_e clock_profile_get(void)
+{
+  return clock_current;
+}
+
+const char *clock_profile_name(clock_profile_e profile)
+{
+  return profile < CLOCK_PROFILE_COUNT ? clock_profiles[profile].name : "?";
+}
+
+/**
+  * @brief  Adds @p listener, it must stay valid for good.
+  */
+void clock_profile_listen(clock_listener_t *listener)
+{
+  listener->next = clock_listeners;
+  clock_listeners = listener;
+}
+
+/**
+  * @brief  Microseconds since reset, from the HAL tick and the SysTick counter.
+  * @retval Microseconds, wraps after about 71 minutes
+  */
+uint32_t clock_micros(void)
+{
+  uint32_t ms, val;
+
+  do
+  {
+    ms = HAL_GetTick();
+    val = SysTick->VAL;
+  } while (ms != HAL_GetTick());
+  return ms * 1000U + (SysTick->LOAD - val) / (SystemCoreClock / 1000000U);
+}
+
+/**
+  * @brief  Busy waits @p us microseconds on the cycle counter, also with
+  *         interrupts masked.
+  */
+void clock_delay_us(uint32_t us)
+{
+  uint32_t start = DWT->CYCCNT;
+  uint32_t cycles = us * clock_us_cycles;
+
+  while (DWT->CYCCNT - start < cycles)
+  {
+  }
+}
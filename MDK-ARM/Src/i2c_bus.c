@@ -0,0 +1,618 @@
+/**
+  ******************************************************************************
+  * @file    i2c_bus.c
+  * @brief   Shared I2C bus transaction engine, see i2c_bus.h.
+  ******************************************************************************
+  */
+
+#include "i2c_bus.h"
+#include "clock_profile.h"
+#include "string.h"
+
+/* Owner value while the engine itself is picking the next queued transfer */
+#define BUS_ENGINE(bus)   ((void *)(bus))
+
+/* Longest BUSY may stay up after the STOP of the previous transfer */
+#define BUS_SETTLE_US     100U
+
+/* Half an SCL period while clocking a stuck slave free, 100 kHz */
+#define BUS_HALF_BIT_US   5U
+
+/* Errors after which the bus state is unknown */
+#define BUS_ERROR_FATAL   (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_OVR | \
+                           HAL_I2C_ERROR_DMA | HAL_I2C_ERROR_TIMEOUT)
+
+static i2c_bus_t i2c_buses[I2C_BUS_COUNT];
+
+static void bus_kick(i2c_bus_t *bus);
+
+/**
+  * @brief  Pointer compare-and-swap on the exclusive monitor.
+  * @retval 1 if *ptr was expect and is now desired
+  */
+static uint8_t bus_cas(void * volatile *ptr, void *expect, void *desired)
+{
+#if defined(__CC_ARM) || defined(__arm__)
+  do
+  {
+    if ((void *)__LDREXW((volatile uint32_t *)ptr) != expect)
+    {
+      __CLREX();
+      return 0;
+    }
+  } while (__STREXW((uint32_t)desired, (volatile uint32_t *)ptr));
+  __DMB();
+  return 1;
+#else
+  /* Host builds */
+  return __sync_bool_compare_and_swap(ptr, expect, desired);
+#endif
+}
+
+static void bus_add(volatile uint32_t *value, int32_t delta)
+{
+#if defined(__CC_ARM) || defined(__arm__)
+  uint32_t v;
+  do
+  {
+    v = __LDREXW(value);
+  } while (__STREXW(v + delta, value));
+  __DMB();
+#else
+  __sync_fetch_and_add(value, delta);
+#endif
+}
+
+/* Microseconds from @p since to now, 0 if the clock stepped back: clock_micros()
+   lags by a millisecond when read in an interrupt that holds off SysTick */
+static uint32_t bus_elapsed_us(uint32_t since)
+{
+  int32_t us = (int32_t)(clock_micros() - since);
+
+  return us > 0 ? (uint32_t)us : 0;
+}
+
+/******************************************************************************/
+
+/**
+  * @brief  Returns the engine of @p hi2c, binding a free one on first use.
+  * @note   Bind every bus from thread context before interrupts use it.
+  * @retval NULL when I2C_BUS_COUNT buses are already bound
+  */
+i2c_bus_t *i2c_bus_get(I2C_HandleTypeDef *hi2c)
+{
+  uint8_t i;
+
+  for (i = 0; i < I2C_BUS_COUNT; i++)
+  {
+    if (i2c_buses[i].hi2c == hi2c)
+    {
+      return &i2c_buses[i];
+    }
+  }
+  for (i = 0; i < I2C_BUS_COUNT; i++)
+  {
+    if (i2c_buses[i].hi2c == NULL)
+    {
+      memset(&i2c_buses[i], 0, sizeof(i2c_bus_t));
+      i2c_buses[i].hi2c = hi2c;
+      return &i2c_buses[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+  * @brief  Pins of @p bus, as configured by HAL_I2C_MspInit(), for the stuck
+  *         bus recovery. Without them only the peripheral is reset.
+  * @param  alternate GPIO_AFx_I2Cx the pins run on
+  */
+void i2c_bus_set_pins(i2c_bus_t *bus, GPIO_TypeDef *scl_port, uint16_t scl_pin,
+                      GPIO_TypeDef *sda_port, uint16_t sda_pin, uint8_t alternate)
+{
+  bus->scl_port = scl_port;
+  bus->scl_pin = scl_pin;
+  bus->sda_port = sda_port;
+  bus->sda_pin = sda_pin;
+  bus->alternate = alternate;
+}
+
+/**
+  * @brief  Describes a transaction with device @p addr (7-bit) on @p bus.
+  * @param  tx bytes to write, NULL with @p tx_len 0 for a plain read
+  * @param  rx buffer to read into, NULL with @p rx_len 0 for a plain write
+  */
+void i2c_xfer_init(i2c_xfer_t *xfer, i2c_bus_t *bus, uint8_t addr,
+                   const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len)
+{
+  memset(xfer, 0, sizeof(i2c_xfer_t));
+  xfer->bus = bus;
+  xfer->addr = addr;
+  xfer->tx = tx;
+  xfer->tx_len = tx_len;
+  xfer->rx = rx;
+  xfer->rx_len = rx_len;
+  xfer->status = HAL_OK;
+  xfer->state = I2C_XFER_IDLE;
+}
+
+/******************************************************************************/
+
+static uint8_t bus_sda_low(i2c_bus_t *bus)
+{
+  return bus->sda_port && HAL_GPIO_ReadPin(bus->sda_port, bus->sda_pin) == GPIO_PIN_RESET;
+}
+
+static uint8_t bus_line_busy(i2c_bus_t *bus)
+{
+  return __HAL_I2C_GET_FLAG(bus->hi2c, I2C_FLAG_BUSY) || bus_sda_low(bus);
+}
+
+/* True when nobody of ours is on the bus and it still does not go idle */
+static uint8_t bus_stuck(i2c_bus_t *bus)
+{
+  uint32_t start, cycles;
+
+  if (!bus_line_busy(bus))
+  {
+    return 0;
+  }
+  start = DWT->CYCCNT;
+  cycles = BUS_SETTLE_US * (SystemCoreClock / 1000000U);
+  while (DWT->CYCCNT - start < cycles)
+  {
+    if (!bus_line_busy(bus))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void bus_pins(i2c_bus_t *bus, uint32_t mode)
+{
+  GPIO_InitTypeDef gpio = {0};
+
+  gpio.Mode = mode;
+  gpio.Pull = GPIO_PULLUP;
+  gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  gpio.Alternate = bus->alternate;
+  gpio.Pin = bus->scl_pin;
+  HAL_GPIO_Init(bus->scl_port, &gpio);
+  gpio.Pin = bus->sda_pin;
+  HAL_GPIO_Init(bus->sda_port, &gpio);
+}
+
+static void bus_scl(i2c_bus_t *bus, GPIO_PinState state)
+{
+  HAL_GPIO_WritePin(bus->scl_port, bus->scl_pin, state);
+  clock_delay_us(BUS_HALF_BIT_US);
+}
+
+static void bus_sda(i2c_bus_t *bus, GPIO_PinState state)
+{
+  HAL_GPIO_WritePin(bus->sda_port, bus->sda_pin, state);
+  clock_delay_us(BUS_HALF_BIT_US);
+}
+
+/**
+  * @brief  Frees a stuck bus and resets the peripheral. A slave reset in the
+  *         middle of a read holds SDA low until it has clocked out the rest
+  *         of its byte: SCL is pulsed up to 9 times until SDA is released,
+  *         then a STOP puts every slave back to idle.
+  * @note   Only from the owner of @p bus, with the I2C and DMA interrupts of
+  *         the bus unable to preempt the caller. Takes about 100 us.
+  */
+void i2c_bus_recover(i2c_bus_t *bus)
+{
+  I2C_HandleTypeDef *hi2c = bus->hi2c;
+  uint8_t i;
+
+  __HAL_I2C_DISABLE(hi2c);
+  if (hi2c->hdmatx)
+  {
+    HAL_DMA_Abort(hi2c->hdmatx);
+  }
+  if (hi2c->hdmarx)
+  {
+    HAL_DMA_Abort(hi2c->hdmarx);
+  }
+
+  if (bus->scl_port && bus->sda_port)
+  {
+    HAL_GPIO_WritePin(bus->scl_port, bus->scl_pin, GPIO_PIN_SET);
+    HAL_GPIO_WritePin(bus->sda_port, bus->sda_pin, GPIO_PIN_SET);
+    bus_pins(bus, GPIO_MODE_OUTPUT_OD);
+    clock_delay_us(BUS_HALF_BIT_US);
+
+    for (i = 0; i < 9 && bus_sda_low(bus); i++)
+    {
+      bus_scl(bus, GPIO_PIN_RESET);
+      bus_scl(bus, GPIO_PIN_SET);
+    }
+    /* STOP: SDA rises while SCL is high */
+    bus_scl(bus, GPIO_PIN_RESET);
+    bus_sda(bus, GPIO_PIN_RESET);
+    bus_scl(bus, GPIO_PIN_SET);
+    bus_sda(bus, GPIO_PIN_SET);
+
+    bus_pins(bus, GPIO_MODE_AF_OD);
+  }
+
+  /* SWRST clears a BUSY flag latched by a glitch, HAL_I2C_Init() then
+     reprograms everything; a handle not in RESET state skips the MSP */
+  hi2c->Instance->CR1 |= I2C_CR1_SWRST;
+  hi2c->Instance->CR1 &= ~I2C_CR1_SWRST;
+  hi2c->State = HAL_I2C_STATE_READY;
+  __HAL_UNLOCK(hi2c);
+  HAL_I2C_Init(hi2c);
+  bus->recoveries++;
+}
+
+/******************************************************************************/
+
+/**
+  * @brief  Takes the bus for blocking HAL calls if it is free. Safe from any
+  *         context. A stuck bus is recovered first.
+  * @param  owner any pointer naming the claimer, passed again to release
+  * @retval 1 on success
+  */
+uint8_t i2c_bus_try_claim(i2c_bus_t *bus, void *owner)
+{
+  if (!bus_cas(&bus->owner, NULL, owner))
+  {
+    return 0;
+  }
+  if (bus_stuck(bus))
+  {
+    i2c_bus_recover(bus);
+  }
+  return 1;
+}
+
+/**
+  * @brief  Takes the bus, waiting for the transfer in flight; queued
+  *         transfers wait until the release.
+  * @retval 1 on success, 0 after @p timeout_ms
+  */
+uint8_t i2c_bus_claim(i2c_bus_t *bus, void *owner, uint32_t timeout_ms)
+{
+  uint32_t start, us;
+
+  if (i2c_bus_try_claim(bus, owner))
+  {
+    return 1;
+  }
+
+  bus_add(&bus->waiting, 1);
+  start = HAL_GetTick();
+  us = clock_micros();
+  while (!i2c_bus_try_claim(bus, owner))
+  {
+    if (HAL_GetTick() - start > timeout_ms)
+    {
+      bus_add(&bus->waiting, -1);
+      return 0;
+    }
+  }
+  bus_add(&bus->waiting, -1);
+
+  us = bus_elapsed_us(us);
+  if (us > bus->max_wait_us)
+  {
+    bus->max_wait_us = us;
+  }
+  return 1;
+}
+
+/**
+  * @brief  Frees the bus and starts queued work.
+  */
+void i2c_bus_release(i2c_bus_t *bus, void *owner)
+{
+  if (bus->owner != owner)
+  {
+    return;
+  }
+  __DMB();
+  bus->owner = NULL;
+  bus_kick(bus);
+}
+
+/******************************************************************************/
+
+/* Moves submitted transfers into the priority ordered pending list.
+   Only called by the owner of the bus. */
+static void bus_collect(i2c_bus_t *bus)
+{
+  i2c_xfer_t *list, *rev = NULL, *next, **p;
+
+  do
+  {
+    list = bus->incoming;
+  } while (list && !bus_cas((void * volatile *)&bus->incoming, list, NULL));
+
+  /* The stack is newest first, restore submission order */
+  while (list)
+  {
+    next = list->next;
+    list->next = rev;
+    rev = list;
+    list = next;
+  }
+  while (rev)
+  {
+    next = rev->next;
+    p = &bus->pending;
+    while (*p && (*p)->priority >= rev->priority)
+    {
+      p = &(*p)->next;
+    }
+    rev->next = *p;
+    *p = rev;
+    rev = next;
+  }
+}
+
+static void bus_finish(i2c_bus_t *bus, HAL_StatusTypeDef status, uint32_t error);
+
+/* Puts the current phase of the active transfer on the wire */
+static void bus_start(i2c_bus_t *bus)
+{
+  i2c_xfer_t *xfer = bus->active;
+  I2C_HandleTypeDef *hi2c = bus->hi2c;
+  uint16_t addr = (uint16_t)xfer->addr << 1;
+  HAL_StatusTypeDef status;
+  uint32_t options;
+
+  if (xfer->phase == 0)
+  {
+    options = xfer->rx_len ? I2C_FIRST_FRAME : I2C_FIRST_AND_LAST_FRAME;
+    if (hi2c->hdmatx && xfer->tx_len >= I2C_BUS_DMA_MIN)
+    {
+      status = HAL_I2C_Master_Seq_Transmit_DMA(hi2c, addr, (uint8_t *)xfer->tx, xfer->tx_len, options);
+    }
+    else
+    {
+      status = HAL_I2C_Master_Seq_Transmit_IT(hi2c, addr, (uint8_t *)xfer->tx, xfer->tx_len, options);
+    }
+  }
+  else
+  {
+    /* After a write this is a repeated start */
+    options = xfer->tx_len ? I2C_LAST_FRAME : I2C_FIRST_AND_LAST_FRAME;
+    if (hi2c->hdmarx && xfer->rx_len >= I2C_BUS_DMA_MIN)
+    {
+      status = HAL_I2C_Master_Seq_Receive_DMA(hi2c, addr, xfer->rx, xfer->rx_len, options);
+    }
+    else
+    {
+      status = HAL_I2C_Master_Seq_Receive_IT(hi2c, addr, xfer->rx, xfer->rx_len, options);
+    }
+  }
+  if (status != HAL_OK)
+  {
+    bus_finish(bus, status, HAL_I2C_GetError(hi2c));
+  }
+}
+
+static void bus_finish(i2c_bus_t *bus, HAL_StatusTypeDef status, uint32_t error)
+{
+  i2c_xfer_t *xfer = bus->active;
+
+  bus->active = NULL;
+  if (error & BUS_ERROR_FATAL)
+  {
+    bus->errors++;
+    i2c_bus_recover(bus);
+  }
+  else if (error & HAL_I2C_ERROR_AF)
+  {
+    bus->nacks++;
+  }
+  bus->transfers++;
+
+  xfer->latency_us = bus_elapsed_us(xfer->queued_us);
+  bus->last_latency_us = xfer->latency_us;
+  if (xfer->latency_us > bus->max_latency_us)
+  {
+    bus->max_latency_us = xfer->latency_us;
+  }
+  xfer->error = error;
+  xfer->status = status;
+  xfer->state = I2C_XFER_DONE;
+  __DMB();
+  bus->owner = NULL;
+  if (xfer->complete)
+  {
+    xfer->complete(xfer);
+  }
+  bus_kick(bus);
+}
+
+/* Starts the next queued transfer if the bus is free and nobody is spinning for it */
+static void bus_kick(i2c_bus_t *bus)
+{
+  i2c_xfer_t *xfer;
+
+  while (bus->incoming || bus->pending)
+  {
+    if (bus->waiting)
+    {
+      return;   /* the claimer kicks again on release */
+    }
+    if (!bus_cas(&bus->owner, NULL, BUS_ENGINE(bus)))
+    {
+      return;   /* so does the current owner */
+    }
+    bus_collect(bus);
+    xfer = bus->pending;
+    if (xfer == NULL)
+    {
+      bus->owner = NULL;
+      continue;  /* something may have been pushed after the collect */
+    }
+    bus->pending = xfer->next;
+    if (bus_stuck(bus))
+    {
+      i2c_bus_recover(bus);
+    }
+    bus->owner = xfer;
+    xfer->phase = xfer->tx_len ? 0 : 1;
+    xfer->state = I2C_XFER_ACTIVE;
+    xfer->started_us = clock_micros();
+    xfer->wait_us = bus_elapsed_us(xfer->queued_us);
+    if (xfer->wait_us > bus->max_wait_us)
+    {
+      bus->max_wait_us = xfer->wait_us;
+    }
+    bus->started = HAL_GetTick();
+    __DMB();
+    bus->active = xfer;
+    bus_start(bus);
+    return;
+  }
+}
+
+/**
+  * @brief  Queues @p xfer, it starts as soon as the bus is free. Safe from
+  *         any context; @p xfer must stay valid until it is I2C_XFER_DONE.
+  * @retval HAL_BUSY if @p xfer is still queued or running
+  */
+HAL_StatusTypeDef i2c_bus_submit(i2c_xfer_t *xfer)
+{
+  i2c_bus_t *bus = xfer->bus;
+  i2c_xfer_t *head;
+
+  if (bus == NULL || (xfer->tx_len == 0 && xfer->rx_len == 0))
+  {
+    return HAL_ERROR;
+  }
+  if (xfer->state == I2C_XFER_QUEUED || xfer->state == I2C_XFER_ACTIVE)
+  {
+    return HAL_BUSY;
+  }
+  xfer->status = HAL_BUSY;
+  xfer->error = HAL_I2C_ERROR_NONE;
+  xfer->state = I2C_XFER_QUEUED;
+  xfer->queued_us = clock_micros();
+  do
+  {
+    head = bus->incoming;
+    xfer->next = head;
+  } while (!bus_cas((void * volatile *)&bus->incoming, head, xfer));
+
+  bus_kick(bus);
+  return HAL_OK;
+}
+
+/**
+  * @brief  Submits @p xfer and waits for it, from thread context only and
+  *         never while holding a claim on the same bus. The watchdog of
+  *         i2c_bus_tick() bounds the wait.
+  * @retval Status of the transfer, see @p xfer->error on HAL_ERROR
+  */
+HAL_StatusTypeDef i2c_bus_run(i2c_xfer_t *xfer)
+{
+  HAL_StatusTypeDef status = i2c_bus_submit(xfer);
+
+  if (status != HAL_OK)
+  {
+    return status;
+  }
+  while (xfer->state != I2C_XFER_DONE)
+  {
+  }
+  return xfer->status;
+}
+
+/**
+  * @brief  End of a phase of the active transfer, from the I2C/DMA callbacks.
+  */
+void i2c_bus_irq(I2C_HandleTypeDef *hi2c, HAL_StatusTypeDef status)
+{
+  i2c_bus_t *bus = i2c_bus_get(hi2c);
+  i2c_xfer_t *xfer = bus ? bus->active : NULL;
+
+  if (xfer == NULL)
+  {
+    return;
+  }
+  if (status != HAL_OK)
+  {
+    bus_finish(bus, status, HAL_I2C_GetError(hi2c));
+    return;
+  }
+  if (xfer->phase == 0 && xfer->rx_len)
+  {
+    xfer->phase = 1;
+    bus_start(bus);
+    return;
+  }
+  bus_finish(bus, HAL_OK, HAL_I2C_ERROR_NONE);
+}
+
+/**
+  * @brief  Watchdog, call every millisecond from SysTick_Handler() at the
+  *         priority of the I2C interrupts. Aborts and recovers a transfer
+  *         stuck on the wire, restarts work nobody kicked.
+  */
+void i2c_bus_tick(void)
+{
+  i2c_bus_t *bus;
+  uint8_t i;
+
+  for (i = 0; i < I2C_BUS_COUNT; i++)
+  {
+    bus = &i2c_buses[i];
+    if (bus->hi2c == NULL)
+    {
+      continue;
+    }
+    if (bus->active)
+    {
+      if (HAL_GetTick() - bus->started > I2C_BUS_TIMEOUT_MS)
+      {
+        bus_finish(bus, HAL_TIMEOUT, HAL_I2C_ERROR_TIMEOUT);
+      }
+    }
+    else if (bus->owner == NULL && (bus->incoming || bus->pending))
+    {
+      bus_kick(bus);
+    }
+  }
+}
+
+/******************************************************************************/
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+  i2c_bus_irq(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+  i2c_bus_irq(hi2c, HAL_OK);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+  i2c_bus_irq(hi2c, HAL_ERROR);
+}
+
+/**
+  * @brief  True while any bus is owned or has transfers queued.
+  */
+uint8_t i2c_bus_busy(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < I2C_BUS_COUNT; i++)
+  {
+    if (i2c_buses[i].owner || i2c_buses[i].incoming || i2c_buses[i].pending)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
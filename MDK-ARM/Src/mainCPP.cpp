@@ -28,6 +28,21 @@
 #include "tm_stm32_nrf24l01.h"
 #include <a_nRF24L01.h>
 #include "a_RF24.h"
+#include "a_RF24_trace.h"
+#include "a_RF24_bench.h"
+#include "a_RF24_sniffer.h"
+#include "a_RF24_bridge.h"
+#include "clock_profile.h"
+#include "i2c_bus.h"
+#include "HTU21D.h"
+#include "HTU21D_scheduler.h"
+#include "HTU21D_adaptive.h"
+#include "HTU21D_psychro.h"
+#include "HTU21D_bench.h"
+#include "sample_ring.h"
+#include "cdc_command.h"
+#include "telemetry.h"
+#include "tlog.h"
 #include "stdio.h"
 
 //#define CDC_LOG
@@ -40,7 +55,17 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
-
+//#define RF24_DUAL_RADIO	// Gateway: the SPI2 radio only receives, the SPI1 radio forwards
+#define GATEWAY_RX_CHANNEL	10
+#define GATEWAY_TX_CHANNEL	90
+#define SNIFFER_CHANNEL		76		// RF24_SNIFFER: channel, rate and address width to capture
+#define SNIFFER_DATA_RATE	RF24_2MBPS
+#define SNIFFER_ADDR_WIDTH	5
+#define BRIDGE_PAYLOAD_SIZE	32		// RF24_BRIDGE: fixed size like the other nodes, 0 for dynamic payloads
+#define BRIDGE_STATS_INTERVAL	1000	// ms
+#define HTU21D_WINDOW		300000	// ms, longest summary window sent by radio
+#define HTU21D_WINDOW_SAMPLES	16		// readings per summary, windows shorten while readings are fast
+#define HTU21D_HISTORY		128		// raw readings kept for sample_ring_history()
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -50,19 +75,26 @@
 
 /* Private variables ---------------------------------------------------------*/
 I2C_HandleTypeDef hi2c1;
+DMA_HandleTypeDef hdma_i2c1_rx;
+DMA_HandleTypeDef hdma_i2c1_tx;
 SPI_HandleTypeDef hspi1;
+SPI_HandleTypeDef hspi2;
 UART_HandleTypeDef huart4;
 
 /* USER CODE BEGIN PV */
 uint8_t print_buffer[100] ,nrf_receive [100] , radio_PayLoadData[35];
 uint8_t radio_channel ,radio_PAlevel, radio_DataRate, radio_crcLength, radio_PayLoadSize;
+sample_t htu_history[HTU21D_HISTORY];
+sample_ring_t htu_samples;					// readings pushed from the I2C interrupt, summaries taken by the loop
 //const uint8_t tx_address[6] = "00001";
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_SPI1_Init(void);
+static void MX_SPI2_Init(void);
 static void MX_UART4_Init(void);
 static void MX_I2C1_Init(void);
 /* USER CODE BEGIN PFP */
@@ -71,6 +103,15 @@ void R_Register (uint8_t addr[], uint8_t byte_to_read ,uint8_t * readed_bytes);
 const char text[] = "Hello\nThis is a test";
 void Blink_LED(uint16_t Pin, uint32_t Delay);
 void print_CDC(const char * str);
+void print_CDC(const char * str, uint8_t var1);
+#if defined(RF24_TRACE) || defined(HTU21D_BENCH)
+void trace_CDC(const char * line, uint16_t len);
+#endif
+#if defined(HTU21D_BENCH)
+static uint32_t bench_cycles(void);
+#endif
+static uint8_t clock_changed(clock_profile_event_e event, clock_profile_e profile, void * context);
+static void htu_done(uint8_t slot, const HTU21D_SAMPLE * reading, void * context);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -103,16 +144,22 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+	clock_profile_init(CLOCK_PROFILE_LOW_POWER);
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_SPI1_Init();
+  MX_SPI2_Init();
   MX_UART4_Init();
+  MX_I2C1_Init();
   MX_USB_DEVICE_Init();
   /* USER CODE BEGIN 2 */
-
+	static clock_listener_t clock_listener = { clock_changed, NULL, NULL };
+	clock_profile_listen(&clock_listener);
+	static const telemetry_config_t telemetry_config = { CDC_Transmit_FS, clock_micros };
+	telemetry_init(&telemetry_config);
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -126,8 +173,33 @@ int main(void)
 	
 	//while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin));
 	RF24 radio(NRF24L01_CE_PIN, NRF24L01_CSN_PIN);
+	#if defined(RF24_TRACE)
+	RF24_TraceInit();
+	#endif
+	#if defined(RF24_BENCH)
+	// Needs a second node acknowledging and streaming on RF24_BENCH_ADDRESS
+	rf24_bench_config_t bench_config = { clock_micros, NULL, &RF24_BenchBudgetsBoard, trace_CDC, 100 };
+	while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin));
+	Blink_LED(RF24_Bench(radio, &bench_config, NULL) ? LED_RED_Pin : LED_GREEN_Pin, 1000);
+	#endif
+	#if defined(HTU21D_BENCH)
+	// Float against fixed-point conversion, no sensor needed
+	HTU21D_BENCH_CONFIG htu_bench_config = { bench_cycles, SystemCoreClock / 1000000U, trace_CDC, 10 };
+	while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin));
+	Blink_LED(HTU21D_Bench(&htu_bench_config, NULL) ? LED_RED_Pin : LED_GREEN_Pin, 1000);
+	#endif
 	while(!radio.begin())
 		Blink_LED(LED_RED_Pin, 200);
+	radio.calibrateSPI();
+	#if defined(RF24_SNIFFER)
+	// Capture mode, streams pcap through CDC and never returns
+	static const rf24_sniffer_config_t sniffer_config = { SNIFFER_CHANNEL, SNIFFER_DATA_RATE, SNIFFER_ADDR_WIDTH, 0,
+	                                                      clock_micros, CDC_Transmit_FS };
+	clock_profile_set(CLOCK_PROFILE_MAX);
+	RF24_SnifferBegin(radio, &sniffer_config);
+	while (1)
+		RF24_SnifferPoll(radio);
+	#endif
 	radio.maskIRQ(IRQ_TX_OK_DIS ,IRQ_TX_FAIL_DIS, IRQ_RX_READY_EN);
 	radio.openWritingPipe(address);
 	radio.openReadingPipe(0, address);
@@ -137,6 +209,75 @@ int main(void)
   radio.setChannel(10);
 	radio.stopListening();
 	
+	#if defined(RF24_BRIDGE)
+	// Dongle mode: payloads from CDC out by radio, the ones received back on CDC, never returns
+	RF24* bridge_rx = &radio;
+	#if defined(RF24_DUAL_RADIO)
+	// Apart from the TX channel, so that the listening radio does not answer its twin
+	RF24 radio_listen(&hspi2, TxRx2_GPIO_Port, TxRx2_Pin, CSel2_GPIO_Port, CSel2_Pin, INT2_GPIO_Port, INT2_Pin);
+	while(!radio_listen.begin())
+		Blink_LED(LED_RED_Pin, 200);
+	radio_listen.calibrateSPI();
+	radio_listen.setPALevel(RF24_PA_LOW);
+	radio_listen.setDataRate(RF24_1MBPS);
+	radio_listen.setCRCLength(RF24_CRC_16);
+	radio_listen.setChannel(GATEWAY_RX_CHANNEL);
+	radio_listen.openReadingPipe(1, address);
+	radio.setChannel(GATEWAY_TX_CHANNEL);
+	bridge_rx = &radio_listen;
+	#endif
+	rf24_bridge_config_t bridge_config = { &radio, bridge_rx, BRIDGE_PAYLOAD_SIZE, BRIDGE_STATS_INTERVAL };
+	cdc_command_config_t bridge_commands = { &radio, NULL, RF24_BridgeSend };
+	clock_profile_set(CLOCK_PROFILE_MAX);
+	RF24_BridgeBegin(&bridge_config);
+	CDC_CommandBegin(&bridge_commands);
+	while (1)
+	{
+		CDC_CommandPoll();
+		RF24_BridgePoll();
+		tlog_drain();
+	}
+	#endif
+	
+	#if defined(RF24_DUAL_RADIO)
+	RF24 radio_rx(&hspi2, TxRx2_GPIO_Port, TxRx2_Pin, CSel2_GPIO_Port, CSel2_Pin, INT2_GPIO_Port, INT2_Pin);
+	while(!radio_rx.begin())
+		Blink_LED(LED_RED_Pin, 200);
+	radio_rx.calibrateSPI();
+	radio_rx.maskIRQ(IRQ_TX_OK_DIS ,IRQ_TX_FAIL_DIS, IRQ_RX_READY_EN);
+	radio_rx.setPALevel(RF24_PA_LOW);
+	radio_rx.setDataRate(RF24_1MBPS);
+	radio_rx.setCRCLength(RF24_CRC_16);
+	radio_rx.setChannel(GATEWAY_RX_CHANNEL);
+	radio_rx.openReadingPipe(1, address);
+	radio_rx.startListening();
+	radio.setChannel(GATEWAY_TX_CHANNEL);
+	
+	// No turnaround: radio_rx never leaves RX, radio never leaves TX
+	while (1)
+	{
+		// The pin check catches an edge that came while the FIFO was being drained
+		if(!radio_rx.irqPending() && HAL_GPIO_ReadPin(INT2_GPIO_Port, INT2_Pin))
+		{
+			clock_profile_set(CLOCK_PROFILE_LOW_POWER);
+			continue;
+		}
+		clock_profile_set(CLOCK_PROFILE_MAX);
+		while(radio_rx.available())
+		{
+			radio_rx.read(nrf_receive, 32);
+			if(!radio.writeFast(nrf_receive, 32))
+				HAL_GPIO_TogglePin(LED_RED_GPIO_Port, LED_RED_Pin);
+		}
+		if(!radio.txStandBy())
+			HAL_GPIO_TogglePin(LED_RED_GPIO_Port, LED_RED_Pin);
+		HAL_GPIO_TogglePin(LED_BLUE_GPIO_Port, LED_BLUE_Pin);
+		radio.checkSPI();
+		tlog_drain();
+		radio_rx.checkSPI();
+	}
+	#endif
+	
 	
 //  radio_channel = radio.getChannel();
 //  radio_crcLength = radio.getCRCLength();
@@ -148,24 +289,48 @@ int main(void)
 // // CDC_Transmit_FS(print_buffer, strlen((const char *)print_buffer));
 //  CDC_Transmit_FS(print_buffer, 32);
 
+	HTU21D htu;
+	HTU21D_Scheduler sensors;
+	HTU21D_Adaptive sampler(&sensors);		// resolution & interval follow how fast the readings change
+	sample_ring_init(&htu_samples, htu_history, HTU21D_HISTORY, HTU21D_WINDOW, HTU21D_WINDOW_SAMPLES);
+	if(sensors.add(&htu) >= 0)
+		sampler.start(htu_done, NULL);
+	cdc_command_config_t command_config = { &radio, &sensors, NULL };
+	CDC_CommandBegin(&command_config);
+	
 	while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin));
 	Blink_LED(LED_ORANGE_Pin, 100);
 	
 	while (1)
   {
 		uint32_t  ms = HAL_GetTick();
-		while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin) && (ms + 5000 > HAL_GetTick() ));
+		while(!HAL_GPIO_ReadPin(BLUE_PB_GPIO_Port ,BLUE_PB_Pin) && (ms + 5000 > HAL_GetTick() ))
+		{
+			// No hold master: the sensors convert while the loop keeps going
+			sampler.service();
+			CDC_CommandPoll();
+			tlog_drain();
+		}
+		clock_profile_set(CLOCK_PROFILE_MAX);
+		
+		sample_summary_t summary;
+		while(sample_ring_summary(&htu_samples, &summary))
+		{
+			telemetry_summary(&summary);
+			if(!radio.write(&summary, sizeof(summary)))
+				Blink_LED(LED_RED_Pin, 50);
+		}
 		
 		//HAL_GPIO_WritePin(LED_ORANGE_GPIO_Port, LED_ORANGE_Pin, HAL_GPIO_ReadPin(INT_GPIO_Port, INT_Pin));
 		if(radio.write(&text, 20))
 		{
 			radio.startListening();
 			Blink_LED(LED_GREEN_Pin, 50);
-			if(radio.available() /*&& (!HAL_GPIO_ReadPin(INT_GPIO_Port, INT_Pin))*/)
+			uint8_t pipe;
+			if(radio.available(&pipe) /*&& (!HAL_GPIO_ReadPin(INT_GPIO_Port, INT_Pin))*/)
 			{
 				radio.read(nrf_receive , 32);
-				print_CDC((const char *)nrf_receive);
-				print_CDC("\n");
+				telemetry_radio(pipe, nrf_receive, 32);
 				Blink_LED(LED_BLUE_Pin, 100);
 			}
 			radio.stopListening();
@@ -174,11 +339,23 @@ int main(void)
 		{
 			Blink_LED(LED_RED_Pin, 50);
 		}
+		#if defined(RF24_TRACE)
+		RF24_TraceDump(trace_CDC);
+		#endif
+		const telemetry_stats_t * link = telemetry_get_stats();
+		uint32_t link_stats[5] = { link->records, link->dropped, CDC_TxStats_FS.queued, CDC_TxStats_FS.sent,
+		                           CDC_TxStats_FS.dropped };
+		uint32_t sensor_stats[5] = { sensors.cycles, sensors.readings, sensors.failures, htu_samples.summaries,
+		                             htu_samples.dropped };
+		telemetry_stats(TELEMETRY_STATS_LINK, link_stats, 5);
+		telemetry_stats(TELEMETRY_STATS_SENSORS, sensor_stats, 5);
+		radio.checkSPI();
 		
 	
 		
 		
 		
+		clock_profile_set(CLOCK_PROFILE_LOW_POWER);
 		HAL_Delay(500);
 			/* USER CODE END WHILE */
 		/* USER CODE BEGIN 3 */
@@ -208,10 +385,10 @@ void SystemClock_Config(void)
   RCC_OscInitStruct.HSEState = RCC_HSE_ON;
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
   RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-  RCC_OscInitStruct.PLL.PLLM = 4;
-  RCC_OscInitStruct.PLL.PLLN = 96;
-  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV6;
-  RCC_OscInitStruct.PLL.PLLQ = 4;
+  RCC_OscInitStruct.PLL.PLLM = 8;
+  RCC_OscInitStruct.PLL.PLLN = 336;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+  RCC_OscInitStruct.PLL.PLLQ = 7;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
     Error_Handler();
@@ -221,11 +398,11 @@ void SystemClock_Config(void)
   RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                               |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
   RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV2;
+  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV8;
   RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
   RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
 
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_1) != HAL_OK)
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
   {
     Error_Handler();
   }
@@ -268,6 +445,44 @@ static void MX_SPI1_Init(void)
 
 }
 
+/**
+  * @brief SPI2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_SPI2_Init(void)
+{
+
+  /* USER CODE BEGIN SPI2_Init 0 */
+
+  /* USER CODE END SPI2_Init 0 */
+
+  /* USER CODE BEGIN SPI2_Init 1 */
+
+  /* USER CODE END SPI2_Init 1 */
+  /* SPI2 parameter configuration*/
+  hspi2.Instance = SPI2;
+  hspi2.Init.Mode = SPI_MODE_MASTER;
+  hspi2.Init.Direction = SPI_DIRECTION_2LINES;
+  hspi2.Init.DataSize = SPI_DATASIZE_8BIT;
+  hspi2.Init.CLKPolarity = SPI_POLARITY_LOW;
+  hspi2.Init.CLKPhase = SPI_PHASE_1EDGE;
+  hspi2.Init.NSS = SPI_NSS_SOFT;
+  hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256; // same as SPI1
+  hspi2.Init.FirstBit = SPI_FIRSTBIT_MSB;
+  hspi2.Init.TIMode = SPI_TIMODE_DISABLE;
+  hspi2.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+  hspi2.Init.CRCPolynomial = 10;
+  if (HAL_SPI_Init(&hspi2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN SPI2_Init 2 */
+
+  /* USER CODE END SPI2_Init 2 */
+
+}
+
 /**
   * @brief UART4 Initialization Function
   * @param None
@@ -289,7 +504,7 @@ static void MX_I2C1_Init(void)
 
   /* USER CODE END I2C1_Init 1 */
   hi2c1.Instance = I2C1;
-  hi2c1.Init.ClockSpeed = 1000;
+  hi2c1.Init.ClockSpeed = 400000;
   hi2c1.Init.DutyCycle = I2C_DUTYCYCLE_2;
   hi2c1.Init.OwnAddress1 = 0;
   hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -302,7 +517,7 @@ static void MX_I2C1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN I2C1_Init 2 */
-
+	i2c_bus_set_pins(i2c_bus_get(&hi2c1), GPIOB, GPIO_PIN_6, GPIOB, GPIO_PIN_9, GPIO_AF4_I2C1);
   /* USER CODE END I2C1_Init 2 */
 
 }
@@ -335,6 +550,25 @@ static void MX_UART4_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Stream0_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+  /* DMA1_Stream6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -358,7 +592,7 @@ static void MX_GPIO_Init(void)
   HAL_GPIO_WritePin(GPIOC, GPIO_PIN_4|INT_Pin, GPIO_PIN_RESET);
 
   /*Configure GPIO pin Output Level */
-  HAL_GPIO_WritePin(TxRx_GPIO_Port, TxRx_Pin, GPIO_PIN_RESET);
+  HAL_GPIO_WritePin(GPIOB, TxRx_Pin|TxRx2_Pin|CSel2_Pin, GPIO_PIN_RESET);
 
   /*Configure GPIO pin Output Level */
   HAL_GPIO_WritePin(GPIOD, LED_GREEN_Pin|LED_ORANGE_Pin|LED_RED_Pin|LED_BLUE_Pin, GPIO_PIN_RESET);
@@ -376,19 +610,19 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(CSel_GPIO_Port, &GPIO_InitStruct);
 
-  /*Configure GPIO pins : INT_Pin */
-  GPIO_InitStruct.Pin = INT_Pin;
+  /*Configure GPIO pins : INT_Pin INT2_Pin */
+  GPIO_InitStruct.Pin = INT_Pin|INT2_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
   GPIO_InitStruct.Pull = GPIO_PULLDOWN;
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
 
-  /*Configure GPIO pin : TxRx_Pin */
-  GPIO_InitStruct.Pin = TxRx_Pin;
+  /*Configure GPIO pins : TxRx_Pin TxRx2_Pin CSel2_Pin */
+  GPIO_InitStruct.Pin = TxRx_Pin|TxRx2_Pin|CSel2_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-  HAL_GPIO_Init(TxRx_GPIO_Port, &GPIO_InitStruct);
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
   /*Configure GPIO pins : LED_GREEN_Pin LED_ORANGE_Pin LED_RED_Pin LED_BLUE_Pin */
   GPIO_InitStruct.Pin = LED_GREEN_Pin|LED_ORANGE_Pin|LED_RED_Pin|LED_BLUE_Pin;
@@ -396,34 +630,117 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
+
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
 	
 }
 
 /* USER CODE BEGIN 4 */
 
 /**
-  * @brief  Print through CDC (Virtual COM port).
+  * @brief  Log line through CDC (Virtual COM port), as a TELEMETRY_TEXT record.
   * @retval None
 */
 void print_CDC(const char * str)
 {
-	uint8_t buf[100];
-	sprintf((char *)buf, str);
-	CDC_Transmit_FS((uint8_t *)buf, strlen((char *)buf));
+	telemetry_text(str, strlen(str));
 }
 
 void print_CDC(const char * str, uint8_t var1)
 {
-	uint8_t buf[100];
-	sprintf((char *)buf, str, var1);
-	CDC_Transmit_FS((uint8_t *)buf, strlen((char *)buf));
+	char buf[TELEMETRY_MAX_PAYLOAD + 1];
+	int len = snprintf(buf, sizeof(buf), str, var1);
+	telemetry_text(buf, len < (int)sizeof(buf) ? len : TELEMETRY_MAX_PAYLOAD);
 }
 
 void print_CDC(const char * str, uint8_t var1, uint8_t var2)
 {
-	uint8_t buf[100];
-	sprintf((char *)buf, str, var1, var2);
-	CDC_Transmit_FS((uint8_t *)buf, strlen((char *)buf));
+	char buf[TELEMETRY_MAX_PAYLOAD + 1];
+	int len = snprintf(buf, sizeof(buf), str, var1, var2);
+	telemetry_text(buf, len < (int)sizeof(buf) ? len : TELEMETRY_MAX_PAYLOAD);
+}
+
+#if defined(RF24_TRACE) || defined(HTU21D_BENCH)
+/**
+  * @brief  Trace dump sink, sends one line through CDC (Virtual COM port).
+  * @retval None
+*/
+void trace_CDC(const char * line, uint16_t len)
+{
+	uint32_t start = HAL_GetTick();
+
+	// A dump is bulk output: wait a little for room in the TX ring rather than lose lines
+	while (CDC_Transmit_FS((uint8_t *)line, len) != USBD_OK && CDC_IsOpen_FS() && HAL_GetTick() - start < 20) {
+	}
+}
+#endif
+
+#if defined(HTU21D_BENCH)
+/**
+  * @brief  Bench tick source, the DWT cycle counter started by clock_profile_init().
+  * @retval Core clock cycles
+*/
+static uint32_t bench_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+#endif
+
+/**
+  * @brief  EXTI callback, hands the radio IRQ pins to their RF24 instance.
+  * @retval None
+*/
+extern "C" void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+	RF24::handleIRQ(GPIO_Pin);
+}
+
+/**
+  * @brief  Clock profile listener, holds a switch while an SPI or I2C bus is in use
+  *         and refits the peripheral prescalers after it. The USB turnaround time
+  *         depends on HCLK and the PCD only sets it on a bus reset.
+  * @retval Non-zero to refuse the switch
+*/
+static uint8_t clock_changed(clock_profile_event_e event, clock_profile_e profile, void * context)
+{
+	if(event == CLOCK_PROFILE_PREPARE)
+		return spi_bus_busy() || i2c_bus_busy();
+	spi_bus_retune();
+	USB_SetTurnaroundTime(USB_OTG_FS, HAL_RCC_GetHCLKFreq(), USB_OTG_SPEED_FULL);
+	HAL_UART_Init(&huart4);
+	#if defined(HAL_I2C_MODULE_ENABLED)
+	HAL_I2C_Init(&hi2c1);
+	#endif
+	return 0;
+}
+
+/**
+  * @brief  Humidity sensor reading callback, runs in the I2C interrupt.
+  *         Adds the dew point & temperature to the summary window of its sensor,
+  *         the mean of the dew point holds where the one of %RH would not, and
+  *         sends the sample as telemetry.
+  * @retval None
+*/
+static void htu_done(uint8_t slot, const HTU21D_SAMPLE * reading, void * context)
+{
+	sample_t sample;
+	sample.time = reading->time;
+	sample.source = slot;
+	if (reading->humidity == HTU21D_FIXED_ERROR)
+	{
+		// Failed cycle: compensated & temperature are stale, store it as missing
+		sample.value[0] = SAMPLE_RING_NONE;
+		sample.value[1] = SAMPLE_RING_NONE;
+	}
+	else
+	{
+		sample.value[0] = HTU21D_DewPointCenti(reading->temperature, reading->compensated);
+		sample.value[1] = reading->temperature;
+	}
+	sample_ring_push(&htu_samples, &sample);
+	telemetry_sample(&sample);
 }
 
 /**
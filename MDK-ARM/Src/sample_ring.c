@@ -0,0 +1,257 @@
+/**
+  ******************************************************************************
+  * @file    sample_ring.c
+  * @brief   Sensor sample history and windowed summaries, see sample_ring.h.
+  ******************************************************************************
+  */
+
+#include "sample_ring.h"
+#include <string.h>
+
+/* Copies of the history the producer overwrote before they were checked */
+#define SAMPLE_RING_RETRIES   4
+
+static void window_reset(sample_window_t *w)
+{
+  uint8_t i;
+
+  w->count = 0;
+  for (i = 0; i < SAMPLE_RING_VALUES; i++)
+  {
+    w->n[i] = 0;
+    w->sum[i] = 0;
+  }
+}
+
+/* Moves the window of @p source to the summary queue, producer side */
+static void window_close(sample_ring_t *ring, uint8_t source)
+{
+  sample_window_t *w = &ring->window[source];
+  sample_summary_t *s;
+  uint8_t head = ring->summary_head;
+  uint8_t i;
+  int32_t half;
+
+  if (w->count == 0)
+  {
+    return;
+  }
+  if ((uint8_t)(head - ring->summary_tail) >= SAMPLE_RING_SUMMARIES)
+  {
+    ring->dropped++;
+    window_reset(w);
+    return;
+  }
+
+  s = &ring->summary[head & (SAMPLE_RING_SUMMARIES - 1U)];
+  s->start = w->start;
+  s->end = w->end;
+  s->count = w->count;
+  s->source = source;
+  s->reserved = 0;
+  for (i = 0; i < SAMPLE_RING_VALUES; i++)
+  {
+    if (w->n[i] == 0)
+    {
+      s->value[i].min = SAMPLE_RING_NONE;
+      s->value[i].max = SAMPLE_RING_NONE;
+      s->value[i].mean = SAMPLE_RING_NONE;
+      s->value[i].last = SAMPLE_RING_NONE;
+      continue;
+    }
+    half = w->n[i] / 2;
+    s->value[i].min = w->min[i];
+    s->value[i].max = w->max[i];
+    s->value[i].mean = (int16_t)((w->sum[i] + (w->sum[i] < 0 ? -half : half)) / (int32_t)w->n[i]);
+    s->value[i].last = w->last[i];
+  }
+
+  /* The summary is complete before the consumer can see it */
+  __DMB();
+  ring->summary_head = head + 1U;
+  ring->summaries++;
+  window_reset(w);
+}
+
+/**
+  * @brief  Sets up @p ring over @p capacity samples at @p buffer.
+  * @param  window_ms: Window length, 0 for none
+  * @param  window_count: Samples per window, 0 for none
+  */
+void sample_ring_init(sample_ring_t *ring, sample_t *buffer, uint16_t capacity,
+                      uint32_t window_ms, uint16_t window_count)
+{
+  uint8_t i;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->buffer = buffer;
+  ring->capacity = capacity;
+  ring->window_ms = window_ms;
+  ring->window_count = window_count;
+  for (i = 0; i < SAMPLE_RING_SOURCES; i++)
+  {
+    window_reset(&ring->window[i]);
+  }
+}
+
+/**
+  * @brief  Stores @p sample and adds it to the window of its source, which
+  *         may close before or after it. Producer side.
+  */
+void sample_ring_push(sample_ring_t *ring, const sample_t *sample)
+{
+  sample_window_t *w;
+  uint32_t head = ring->head;
+  uint8_t i;
+  int16_t v;
+
+  if (ring->capacity != 0)
+  {
+    ring->buffer[head % ring->capacity] = *sample;
+    /* The slot is written before the count says so */
+    __DMB();
+    ring->head = head + 1U;
+  }
+
+  if (sample->source >= SAMPLE_RING_SOURCES)
+  {
+    return;
+  }
+  w = &ring->window[sample->source];
+
+  if (w->count != 0 && ring->window_ms != 0 && sample->time - w->start >= ring->window_ms)
+  {
+    window_close(ring, sample->source);
+  }
+  if (w->count == 0)
+  {
+    w->start = ring->window_ms != 0 ? sample->time - sample->time % ring->window_ms : sample->time;
+  }
+
+  w->count++;
+  w->end = sample->time;
+  for (i = 0; i < SAMPLE_RING_VALUES; i++)
+  {
+    v = sample->value[i];
+    if (v == SAMPLE_RING_NONE)
+    {
+      continue;
+    }
+    if (w->n[i] == 0 || v < w->min[i])
+    {
+      w->min[i] = v;
+    }
+    if (w->n[i] == 0 || v > w->max[i])
+    {
+      w->max[i] = v;
+    }
+    w->n[i]++;
+    w->sum[i] += v;
+    w->last[i] = v;
+  }
+
+  if ((ring->window_count != 0 && w->count >= ring->window_count) || w->count == 0xFFFFU)
+  {
+    window_close(ring, sample->source);
+  }
+}
+
+/**
+  * @brief  Closes the window of @p source now, e.g. before sleeping.
+  *         Producer side.
+  */
+void sample_ring_close(sample_ring_t *ring, uint8_t source)
+{
+  if (source < SAMPLE_RING_SOURCES)
+  {
+    window_close(ring, source);
+  }
+}
+
+/**
+  * @brief  Takes the oldest closed window. Consumer side.
+  * @retval 1 if @p summary was written, 0 if none is waiting
+  */
+uint8_t sample_ring_summary(sample_ring_t *ring, sample_summary_t *summary)
+{
+  uint8_t tail = ring->summary_tail;
+
+  if (tail == ring->summary_head)
+  {
+    return 0;
+  }
+  __DMB();
+  *summary = ring->summary[tail & (SAMPLE_RING_SUMMARIES - 1U)];
+  /* Copied before the producer may reuse the entry */
+  __DMB();
+  ring->summary_tail = tail + 1U;
+  return 1;
+}
+
+/**
+  * @brief  Copies raw samples of @p source, or SAMPLE_RING_ANY, taken at or
+  *         after @p since, oldest first. Consumer side. When more than
+  *         @p max match, the oldest are returned: ask again from the time
+  *         of the last one plus one.
+  * @retval Samples written to @p out
+  */
+uint16_t sample_ring_history(sample_ring_t *ring, uint8_t source, uint32_t since,
+                             sample_t *out, uint16_t max)
+{
+  uint32_t head, oldest, first, idx;
+  uint16_t count = 0;
+  uint8_t retries;
+
+  if (ring->capacity == 0)
+  {
+    return 0;
+  }
+  for (retries = 0; retries < SAMPLE_RING_RETRIES; retries++)
+  {
+    head = ring->head;
+    __DMB();
+    /* The oldest entry is the one the next push overwrites, skipped */
+    oldest = head >= ring->capacity ? head - ring->capacity + 1U : 0;
+    first = head;
+    count = 0;
+
+    for (idx = oldest; idx != head && count < max; idx++)
+    {
+      out[count] = ring->buffer[idx % ring->capacity];
+      if ((source != SAMPLE_RING_ANY && out[count].source != source) ||
+          (int32_t)(out[count].time - since) < 0)
+      {
+        continue;
+      }
+      if (count == 0)
+      {
+        first = idx;
+      }
+      count++;
+    }
+
+    /* The producer writes entry head while it still counts as entry
+       head - capacity, the copy holds only if the first survived */
+    __DMB();
+    if (count == 0 || first + ring->capacity > ring->head)
+    {
+      return count;
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  Raw samples sample_ring_history() can return right now, at
+  *         most capacity - 1.
+  */
+uint16_t sample_ring_count(sample_ring_t *ring)
+{
+  uint32_t head = ring->head;
+
+  if (ring->capacity == 0)
+  {
+    return 0;
+  }
+  return head >= ring->capacity ? ring->capacity - 1U : (uint16_t)head;
+}
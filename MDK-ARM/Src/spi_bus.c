@@ -0,0 +1,560 @@
+/**
+  ******************************************************************************
+  * @file    spi_bus.c
+  * @brief   Shared SPI bus arbiter, see spi_bus.h.
+  ******************************************************************************
+  */
+
+#include "spi_bus.h"
+#include "string.h"
+
+/* Owner value while the arbiter itself is picking the next queued transfer */
+#define BUS_ENGINE(bus)   ((void *)(bus))
+
+static spi_bus_t spi_buses[SPI_BUS_COUNT];
+
+static void bus_kick(spi_bus_t *bus);
+
+/**
+  * @brief  Pointer compare-and-swap on the exclusive monitor.
+  * @retval 1 if *ptr was expect and is now desired
+  */
+static uint8_t bus_cas(void * volatile *ptr, void *expect, void *desired)
+{
+#if defined(__CC_ARM) || defined(__arm__)
+  do
+  {
+    if ((void *)__LDREXW((volatile uint32_t *)ptr) != expect)
+    {
+      __CLREX();
+      return 0;
+    }
+  } while (__STREXW((uint32_t)desired, (volatile uint32_t *)ptr));
+  __DMB();
+  return 1;
+#else
+  /* Host builds */
+  return __sync_bool_compare_and_swap(ptr, expect, desired);
+#endif
+}
+
+static void bus_add(volatile uint32_t *value, int32_t delta)
+{
+#if defined(__CC_ARM) || defined(__arm__)
+  uint32_t v;
+  do
+  {
+    v = __LDREXW(value);
+  } while (__STREXW(v + delta, value));
+  __DMB();
+#else
+  __sync_fetch_and_add(value, delta);
+#endif
+}
+
+static uint32_t bus_cycles(void)
+{
+#if defined(DWT)
+  return DWT->CYCCNT;
+#else
+  return 0;
+#endif
+}
+
+/******************************************************************************/
+
+/**
+  * @brief  Returns the arbiter of @p hspi, binding a free one on first use.
+  * @note   Bind every bus from thread context before interrupts use it.
+  * @retval NULL when SPI_BUS_COUNT buses are already bound
+  */
+spi_bus_t *spi_bus_get(SPI_HandleTypeDef *hspi)
+{
+  uint8_t i;
+
+  for (i = 0; i < SPI_BUS_COUNT; i++)
+  {
+    if (spi_buses[i].hspi == hspi)
+    {
+      return &spi_buses[i];
+    }
+  }
+  for (i = 0; i < SPI_BUS_COUNT; i++)
+  {
+    if (spi_buses[i].hspi == NULL)
+    {
+      memset(&spi_buses[i], 0, sizeof(spi_bus_t));
+      memset(spi_buses[i].tx_fill, 0xFF, SPI_BUS_CHUNK);
+      spi_buses[i].hspi = hspi;
+      return &spi_buses[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+  * @brief  Describes one chip on @p bus.
+  * @param  polarity SPI_POLARITY_LOW or SPI_POLARITY_HIGH
+  * @param  phase SPI_PHASE_1EDGE or SPI_PHASE_2EDGE
+  * @param  prescaler SPI_BAUDRATEPRESCALER_x, or SPI_BUS_KEEP
+  * @param  cs_port NULL when the caller drives chip select
+  */
+void spi_device_init(spi_device_t *dev, spi_bus_t *bus, uint32_t polarity, uint32_t phase, uint32_t prescaler,
+                     GPIO_TypeDef *cs_port, uint16_t cs_pin)
+{
+  dev->bus = bus;
+  dev->cr1 = polarity | phase;
+  dev->cr1_mask = SPI_CR1_CPOL | SPI_CR1_CPHA;
+  dev->cs_port = cs_port;
+  dev->cs_pin = cs_pin;
+  dev->priority = 0;
+  dev->flags = 0;
+  dev->max_hz = 0;
+  spi_device_set_prescaler(dev, prescaler);
+  if (bus)
+  {
+    dev->next = bus->devices;
+    bus->devices = dev;
+  }
+}
+
+/**
+  * @brief  Takes @p dev off its bus, it must not own it.
+  */
+void spi_device_deinit(spi_device_t *dev)
+{
+  spi_device_t **p;
+
+  if (dev->bus == NULL)
+  {
+    return;
+  }
+  for (p = &dev->bus->devices; *p; p = &(*p)->next)
+  {
+    if (*p == dev)
+    {
+      *p = dev->next;
+      break;
+    }
+  }
+  dev->bus = NULL;
+}
+
+/**
+  * @brief  Changes the clock of @p dev, applied on its next claim.
+  */
+void spi_device_set_prescaler(spi_device_t *dev, uint32_t prescaler)
+{
+  dev->max_hz = 0;
+  if (prescaler == SPI_BUS_KEEP)
+  {
+    dev->cr1 &= ~SPI_CR1_BR;
+    dev->cr1_mask &= ~SPI_CR1_BR;
+  }
+  else
+  {
+    dev->cr1 = (dev->cr1 & ~SPI_CR1_BR) | (prescaler & SPI_CR1_BR);
+    dev->cr1_mask |= SPI_CR1_BR;
+  }
+}
+
+static uint32_t bus_pclk(spi_bus_t *bus)
+{
+  return bus->hspi->Instance == SPI1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+}
+
+static void device_fit(spi_device_t *dev)
+{
+  uint32_t pclk = bus_pclk(dev->bus);
+  uint32_t br = 0;
+
+  while (br < 7 && pclk / (2U << br) > dev->max_hz)
+  {
+    br++;
+  }
+  dev->cr1 = (dev->cr1 & ~SPI_CR1_BR) | (br << SPI_CR1_BR_Pos);
+  dev->cr1_mask |= SPI_CR1_BR;
+}
+
+/**
+  * @brief  Runs @p dev at the fastest prescaler not above @p max_hz, now and
+  *         after every spi_bus_retune(). /256 when even that is faster.
+  */
+void spi_device_set_clock(spi_device_t *dev, uint32_t max_hz)
+{
+  dev->max_hz = max_hz;
+  device_fit(dev);
+}
+
+/**
+  * @brief  SCK of @p dev at the current APB clock, Hz.
+  */
+uint32_t spi_device_clock(const spi_device_t *dev)
+{
+  uint32_t br = (dev->cr1_mask & SPI_CR1_BR) ? dev->cr1 : dev->bus->hspi->Init.BaudRatePrescaler;
+
+  return bus_pclk(dev->bus) / (2U << ((br & SPI_CR1_BR) >> SPI_CR1_BR_Pos));
+}
+
+/******************************************************************************/
+
+/* Reprogram CR1 for the new owner, only when it differs */
+static void bus_apply(spi_bus_t *bus, spi_device_t *dev)
+{
+  SPI_HandleTypeDef *hspi = bus->hspi;
+  uint32_t cr1 = hspi->Instance->CR1;
+
+  if ((cr1 & dev->cr1_mask) == dev->cr1)
+  {
+    return;
+  }
+  /* Mode and baud rate may only change with the peripheral off, the HAL
+     enables it again on the next transfer */
+  cr1 &= ~SPI_CR1_SPE;
+  hspi->Instance->CR1 = cr1;
+  cr1 = (cr1 & ~dev->cr1_mask) | dev->cr1;
+  hspi->Instance->CR1 = cr1;
+  hspi->Init.BaudRatePrescaler = cr1 & SPI_CR1_BR;
+  hspi->Init.CLKPolarity = cr1 & SPI_CR1_CPOL;
+  hspi->Init.CLKPhase = cr1 & SPI_CR1_CPHA;
+}
+
+static void bus_select(spi_device_t *dev, GPIO_PinState state)
+{
+  if (dev->cs_port)
+  {
+    HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, state);
+  }
+}
+
+/**
+  * @brief  Takes the bus if it is free. Safe from any context.
+  * @retval 1 on success, CS of @p dev is asserted and its settings applied
+  */
+uint8_t spi_bus_try_claim(spi_device_t *dev)
+{
+  spi_bus_t *bus = dev->bus;
+
+  if (!bus_cas(&bus->owner, NULL, dev))
+  {
+    return 0;
+  }
+  bus->claims++;
+  bus_apply(bus, dev);
+  bus_select(dev, GPIO_PIN_RESET);
+  return 1;
+}
+
+/**
+  * @brief  Takes the bus, waiting for the current owner. A split transfer in
+  *         progress gives way at its next chunk boundary.
+  * @retval 1 on success, 0 after @p timeout_ms
+  */
+uint8_t spi_bus_claim(spi_device_t *dev, uint32_t timeout_ms)
+{
+  spi_bus_t *bus = dev->bus;
+  uint32_t start, cycles, us;
+
+  if (spi_bus_try_claim(dev))
+  {
+    return 1;
+  }
+
+  bus->contended++;
+  bus_add(&bus->waiting, 1);
+  start = HAL_GetTick();
+  cycles = bus_cycles();
+  while (!spi_bus_try_claim(dev))
+  {
+    if (HAL_GetTick() - start > timeout_ms)
+    {
+      /* Queued transfers gave way to this claim, start them again */
+      bus_add(&bus->waiting, -1);
+      bus_kick(bus);
+      return 0;
+    }
+  }
+  bus_add(&bus->waiting, -1);
+
+  us = (bus_cycles() - cycles) / (SystemCoreClock / 1000000U);
+  if (us > bus->max_wait_us)
+  {
+    bus->max_wait_us = us;
+  }
+  return 1;
+}
+
+/**
+  * @brief  Deasserts CS of @p dev, frees the bus and starts queued work.
+  */
+void spi_bus_release(spi_device_t *dev)
+{
+  spi_bus_t *bus = dev->bus;
+
+  if (bus->owner != dev)
+  {
+    return;
+  }
+  bus_select(dev, GPIO_PIN_SET);
+  __DMB();
+  bus->owner = NULL;
+  bus_kick(bus);
+}
+
+/******************************************************************************/
+
+/* Moves submitted transfers into the priority ordered pending list.
+   Only called by the owner of the bus. */
+static void bus_collect(spi_bus_t *bus)
+{
+  spi_xfer_t *list, *rev = NULL, *next, **p;
+
+  do
+  {
+    list = bus->incoming;
+  } while (list && !bus_cas((void * volatile *)&bus->incoming, list, NULL));
+
+  /* The stack is newest first, restore submission order */
+  while (list)
+  {
+    next = list->next;
+    list->next = rev;
+    rev = list;
+    list = next;
+  }
+  while (rev)
+  {
+    next = rev->next;
+    p = &bus->pending;
+    while (*p && (*p)->dev->priority >= rev->dev->priority)
+    {
+      p = &(*p)->next;
+    }
+    rev->next = *p;
+    *p = rev;
+    rev = next;
+  }
+}
+
+/* Puts a paused transfer back ahead of everything of the same priority */
+static void bus_requeue(spi_bus_t *bus, spi_xfer_t *xfer)
+{
+  spi_xfer_t **p = &bus->pending;
+
+  while (*p && (*p)->dev->priority > xfer->dev->priority)
+  {
+    p = &(*p)->next;
+  }
+  xfer->next = *p;
+  *p = xfer;
+}
+
+static void bus_finish(spi_bus_t *bus, HAL_StatusTypeDef status);
+
+static void bus_chunk(spi_bus_t *bus)
+{
+  spi_xfer_t *xfer = bus->active;
+  SPI_HandleTypeDef *hspi = bus->hspi;
+  uint16_t n = xfer->len - xfer->pos;
+  uint8_t *tx, *rx;
+  HAL_StatusTypeDef status;
+
+  if (n > SPI_BUS_CHUNK)
+  {
+    n = SPI_BUS_CHUNK;
+  }
+  tx = xfer->tx ? (uint8_t *)xfer->tx + xfer->pos : bus->tx_fill;
+  rx = xfer->rx ? xfer->rx + xfer->pos : bus->rx_sink;
+  bus->chunk = n;
+
+  if (hspi->hdmatx && hspi->hdmarx)
+  {
+    status = HAL_SPI_TransmitReceive_DMA(hspi, tx, rx, n);
+  }
+  else
+  {
+    status = HAL_SPI_TransmitReceive_IT(hspi, tx, rx, n);
+  }
+  if (status != HAL_OK)
+  {
+    bus_finish(bus, status);
+  }
+}
+
+static void bus_finish(spi_bus_t *bus, HAL_StatusTypeDef status)
+{
+  spi_xfer_t *xfer = bus->active;
+
+  bus_select(xfer->dev, GPIO_PIN_SET);
+  bus->active = NULL;
+  xfer->status = status;
+  xfer->state = SPI_XFER_DONE;
+  __DMB();
+  bus->owner = NULL;
+  if (xfer->complete)
+  {
+    xfer->complete(xfer);
+  }
+  bus_kick(bus);
+}
+
+/* Starts the next queued transfer if the bus is free and nobody is spinning for it */
+static void bus_kick(spi_bus_t *bus)
+{
+  spi_xfer_t *xfer;
+
+  while (bus->incoming || bus->pending)
+  {
+    if (bus->waiting)
+    {
+      return;   /* the claimer kicks again on release */
+    }
+    if (!bus_cas(&bus->owner, NULL, BUS_ENGINE(bus)))
+    {
+      return;   /* so does the current owner */
+    }
+    bus_collect(bus);
+    xfer = bus->pending;
+    if (xfer == NULL)
+    {
+      bus->owner = NULL;
+      continue;  /* something may have been pushed after the collect */
+    }
+    bus->pending = xfer->next;
+    bus->owner = xfer->dev;
+    bus->claims++;
+    bus->active = xfer;
+    xfer->state = SPI_XFER_ACTIVE;
+    bus_apply(bus, xfer->dev);
+    bus_select(xfer->dev, GPIO_PIN_RESET);
+    bus_chunk(bus);
+    return;
+  }
+}
+
+/**
+  * @brief  Queues @p xfer, it starts as soon as the bus is free. Safe from
+  *         any context; @p xfer must stay valid until it is SPI_XFER_DONE.
+  * @retval HAL_BUSY if @p xfer is still queued or running
+  */
+HAL_StatusTypeDef spi_bus_submit(spi_xfer_t *xfer)
+{
+  spi_bus_t *bus;
+  spi_xfer_t *head;
+
+  if (xfer->dev == NULL || xfer->dev->bus == NULL || xfer->len == 0)
+  {
+    return HAL_ERROR;
+  }
+  if (xfer->state == SPI_XFER_QUEUED || xfer->state == SPI_XFER_ACTIVE)
+  {
+    return HAL_BUSY;
+  }
+  bus = xfer->dev->bus;
+  xfer->pos = 0;
+  xfer->status = HAL_BUSY;
+  xfer->state = SPI_XFER_QUEUED;
+  do
+  {
+    head = bus->incoming;
+    xfer->next = head;
+  } while (!bus_cas((void * volatile *)&bus->incoming, head, xfer));
+
+  bus_kick(bus);
+  return HAL_OK;
+}
+
+/**
+  * @brief  Chunk boundary of a queued transfer, from the SPI/DMA callbacks.
+  */
+void spi_bus_irq(SPI_HandleTypeDef *hspi, HAL_StatusTypeDef status)
+{
+  spi_bus_t *bus = spi_bus_get(hspi);
+  spi_xfer_t *xfer = bus ? bus->active : NULL;
+
+  if (xfer == NULL)
+  {
+    return;
+  }
+  if (status != HAL_OK)
+  {
+    bus_finish(bus, status);
+    return;
+  }
+
+  xfer->pos += bus->chunk;
+  if (xfer->pos >= xfer->len)
+  {
+    bus_finish(bus, HAL_OK);
+    return;
+  }
+
+  if (xfer->dev->flags & SPI_DEV_SPLIT)
+  {
+    bus_collect(bus);
+    if (bus->waiting || (bus->pending && bus->pending->dev->priority > xfer->dev->priority))
+    {
+      /* Give the bus away, the rest goes in a new CS frame */
+      bus_select(xfer->dev, GPIO_PIN_SET);
+      bus->active = NULL;
+      xfer->state = SPI_XFER_QUEUED;
+      bus_requeue(bus, xfer);
+      bus->yields++;
+      __DMB();
+      bus->owner = NULL;
+      bus_kick(bus);
+      return;
+    }
+  }
+  bus_chunk(bus);
+}
+
+/******************************************************************************/
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  spi_bus_irq(hspi, HAL_OK);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  spi_bus_irq(hspi, HAL_ERROR);
+}
+
+/**
+  * @brief  True while any bus is owned or has transfers queued.
+  */
+uint8_t spi_bus_busy(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < SPI_BUS_COUNT; i++)
+  {
+    if (spi_buses[i].owner || spi_buses[i].incoming || spi_buses[i].pending)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  Refits every device set with spi_device_set_clock() to the current
+  *         APB clocks. The new prescalers apply from the next claim.
+  */
+void spi_bus_retune(void)
+{
+  spi_device_t *dev;
+  uint8_t i;
+
+  for (i = 0; i < SPI_BUS_COUNT; i++)
+  {
+    for (dev = spi_buses[i].devices; dev; dev = dev->next)
+    {
+      if (dev->max_hz)
+      {
+        device_fit(dev);
+      }
+    }
+  }
+}
@@ -0,0 +1,125 @@
+/**
+  ******************************************************************************
+  * @file    tlog.c
+  * @brief   Tokenized logging, see tlog.h.
+  ******************************************************************************
+  */
+
+#include "tlog.h"
+#include "telemetry.h"
+
+#if (TLOG_BUFFER & (TLOG_BUFFER - 1)) != 0
+#error "TLOG_BUFFER must be a power of two"
+#endif
+
+static uint8_t tlog_ring[TLOG_BUFFER];
+static volatile uint32_t tlog_head;     /* reserved by producers */
+static volatile uint32_t tlog_tail;     /* consumed by tlog_drain() */
+static tlog_stats_t tlog_counters;
+
+/**
+  * @brief  Logs @p token with @p count arguments, from any context.
+  *         Called by TLOG() and TLOG0().
+  */
+void tlog_write(uint16_t token, const uint32_t *args, uint8_t count)
+{
+  uint8_t record[TLOG_RECORD_MAX];
+  uint8_t len = 3;
+  uint32_t head;
+  uint32_t value;
+  uint8_t i;
+
+  record[1] = (uint8_t)token;
+  record[2] = (uint8_t)(token >> 8);
+  for (i = 0; (i < count) && (i < TLOG_ARGS); i++)
+  {
+    value = args[i];
+    while (value >= 0x80U)
+    {
+      record[len++] = (uint8_t)(value | 0x80U);
+      value >>= 7;
+    }
+    record[len++] = (uint8_t)value;
+  }
+
+  /* Reserve len bytes, another producer may take the head meanwhile */
+  do
+  {
+    head = __LDREXW(&tlog_head);
+    if (head + len - tlog_tail > TLOG_BUFFER)
+    {
+      __CLREX();
+      tlog_counters.dropped++;
+      return;
+    }
+  } while (__STREXW(head + len, &tlog_head) != 0U);
+
+  for (i = 1; i < len; i++)
+  {
+    tlog_ring[(head + i) & (TLOG_BUFFER - 1U)] = record[i];
+  }
+  if (head + len - tlog_tail > tlog_counters.peak)
+  {
+    tlog_counters.peak = (uint16_t)(head + len - tlog_tail);
+  }
+  tlog_counters.records++;
+
+  /* The record is complete before its length says so */
+  __DMB();
+  tlog_ring[head & (TLOG_BUFFER - 1U)] = len;
+}
+
+/**
+  * @brief  Sends the committed records as TELEMETRY_LOG, call from the main
+  *         loop only.
+  * @retval Number of TELEMETRY_LOG records sent
+  */
+uint8_t tlog_drain(void)
+{
+  uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+  uint8_t sent = 0;
+  uint32_t tail = tlog_tail;
+  uint16_t fill;
+  uint8_t len;
+  uint8_t i;
+
+  for (;;)
+  {
+    fill = 0;
+    for (;;)
+    {
+      len = tlog_ring[tail & (TLOG_BUFFER - 1U)];
+      if ((len == 0U) || (fill + len > sizeof(payload)))
+      {
+        break;                          /* not committed yet, or the next batch */
+      }
+      __DMB();
+      for (i = 0; i < len; i++)
+      {
+        payload[fill + i] = tlog_ring[(tail + i) & (TLOG_BUFFER - 1U)];
+        tlog_ring[(tail + i) & (TLOG_BUFFER - 1U)] = 0;
+      }
+      fill += len;
+      tail += len;
+    }
+    if (fill == 0U)
+    {
+      break;
+    }
+    /* A batch the hook refuses is lost all the same, the sequence gap of
+       the telemetry records shows it */
+    if (telemetry_send(TELEMETRY_LOG, NULL, 0, payload, fill))
+    {
+      sent++;
+    }
+    /* The zeroes are written before producers may reuse the bytes */
+    __DMB();
+    tlog_tail = tail;
+  }
+  return sent;
+}
+
+const tlog_stats_t *tlog_get_stats(void)
+{
+  return &tlog_counters;
+}
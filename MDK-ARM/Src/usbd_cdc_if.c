@@ -66,7 +66,17 @@
 /* Define size for the receive and transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
 #define APP_RX_DATA_SIZE  2048
-#define APP_TX_DATA_SIZE  2048
+/* UserTxBufferFS is the TX ring, a power of two, may be set on the command line */
+#ifndef APP_TX_DATA_SIZE
+#define APP_TX_DATA_SIZE  4096
+#endif
+#if ((APP_TX_DATA_SIZE & (APP_TX_DATA_SIZE - 1)) != 0) || (APP_TX_DATA_SIZE < 128) || (APP_TX_DATA_SIZE > 32768)
+#error "APP_TX_DATA_SIZE must be a power of two from 128 up to 32768"
+#endif
+/* Largest IN transfer, whole packets. The ring space of a transfer comes back
+   to the producers when it completes, half the ring leaves them the other
+   half meanwhile. Each transfer costs a gap of two interrupts on the bus */
+#define CDC_TX_MAX_TRANSFER  (APP_TX_DATA_SIZE / 2U)
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -99,7 +109,19 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
-
+/* head and tail run free over UserTxBufferFS, the fill is head - tail.
+   Producers move head with interrupts masked, only the USB interrupt moves tail */
+static volatile uint32_t cdc_tx_head;
+static volatile uint32_t cdc_tx_tail;
+static volatile uint16_t cdc_tx_inflight;      /* bytes of the IN transfer on the bus, 0 if none */
+static volatile uint8_t  cdc_tx_zlp;           /* the last transfer ended on a packet boundary */
+static volatile uint8_t  cdc_dtr;              /* the host has a terminal open */
+/* Received data stays in UserRxBufferFS until consumed, packets land one
+   after the other from cdc_rx_end. The OUT transfer armed there spans all
+   the whole packets that fit, the core takes them back to back */
+static volatile uint16_t cdc_rx_start;         /* first byte not consumed */
+static volatile uint16_t cdc_rx_end;           /* end of the completed transfers */
+static volatile uint8_t  cdc_rx_armed;         /* OUT transfer armed at cdc_rx_end */
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -114,7 +136,7 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
 /* USER CODE BEGIN EXPORTED_VARIABLES */
-
+CDC_TxStatsTypeDef CDC_TxStats_FS;
 /* USER CODE END EXPORTED_VARIABLES */
 
 /**
@@ -132,7 +154,7 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
-
+static void CDC_RxArm_FS(void);
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
 /**
@@ -158,6 +180,14 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  /* A transfer cut by a reset is sent again, the host waits for DTR anew */
+  cdc_tx_inflight = 0;
+  cdc_tx_zlp = 0;
+  cdc_dtr = 0;
+  /* The class arms the OUT endpoint on UserRxBufferFS after this */
+  cdc_rx_start = 0;
+  cdc_rx_end = 0;
+  cdc_rx_armed = 1;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -169,6 +199,9 @@ static int8_t CDC_Init_FS(void)
 static int8_t CDC_DeInit_FS(void)
 {
   /* USER CODE BEGIN 4 */
+  cdc_tx_inflight = 0;
+  cdc_tx_zlp = 0;
+  cdc_dtr = 0;
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -231,7 +264,8 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
     break;
 
     case CDC_SET_CONTROL_LINE_STATE:
-
+      /* No data stage, pbuf is the setup request and wValue bit 0 is DTR */
+      cdc_dtr = (((USBD_SetupReqTypedef *)(void *)pbuf)->wValue & 0x0001U) ? 1U : 0U;
     break;
 
     case CDC_SEND_BREAK:
@@ -263,8 +297,12 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  /* Buf is &UserRxBufferFS[cdc_rx_end], the data is parsed there by
+     CDC_RxData_FS() users. The transfer ends on a short packet or with the
+     buffer full, the next one goes right after it while a whole packet
+     fits, else the endpoint NAKs until CDC_RxRelease_FS() */
+  cdc_rx_end += (uint16_t)*Len;
+  CDC_RxArm_FS();
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -274,7 +312,10 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   *         Data to send over USB IN endpoint are sent over CDC interface
   *         through this function.
   *         @note
-  *
+  *         Buf is copied into the TX ring, whole or not at all, and may be
+  *         reused on return. Callable from any context, it never waits: the
+  *         USB interrupt sends the ring on SOF and on IN completion, see
+  *         CDC_TxService_FS().
   *
   * @param  Buf: Buffer of data to be sent
   * @param  Len: Number of data to be sent (in bytes)
@@ -284,18 +325,214 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
-  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
-  if (hcdc->TxState != 0){
-    return USBD_BUSY;
+  uint32_t primask;
+  uint32_t used;
+  uint32_t start;
+  uint32_t first;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  used = cdc_tx_head - cdc_tx_tail;
+  if (Len > APP_TX_DATA_SIZE - used)
+  {
+    /* No room for the whole line, a torn line would be worse */
+    CDC_TxStats_FS.dropped++;
+    result = USBD_BUSY;
+  }
+  else
+  {
+    start = cdc_tx_head & (APP_TX_DATA_SIZE - 1U);
+    first = APP_TX_DATA_SIZE - start;
+    if (first > Len)
+    {
+      first = Len;
+    }
+    memcpy(&UserTxBufferFS[start], Buf, first);
+    memcpy(UserTxBufferFS, Buf + first, Len - first);
+    cdc_tx_head += Len;
+    CDC_TxStats_FS.queued += Len;
+    if (used + Len > CDC_TxStats_FS.peak)
+    {
+      CDC_TxStats_FS.peak = (uint16_t)(used + Len);
+    }
   }
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, Len);
-  result = USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+  __set_PRIMASK(primask);
   /* USER CODE END 7 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  CDC_TxService_FS
+  *         Starts the next IN transfer from the TX ring. Called by the USB
+  *         interrupt only, on SOF and when an IN transfer on CDC_IN_EP ends.
+  *
+  *         A transfer runs to the end of the ring at most and is cut to whole
+  *         packets while more data follows. Between SOFs only whole packets
+  *         go: a partial one waits for the next SOF and fills up with the
+  *         records written meanwhile, small records share packets instead of
+  *         taking one each. Transfers go out without the ZLP of the class,
+  *         the next one follows at once; a burst that ends on a packet
+  *         boundary gets its ZLP on the SOF that finds the ring still empty,
+  *         so the host sees the end of the data. Nothing starts until DTR is
+  *         set.
+  * @param  sof: 1 when called on SOF
+  * @retval None
+  */
+void CDC_TxService_FS(uint8_t sof)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  uint32_t used;
+  uint32_t start;
+  uint32_t len;
 
+  if ((hcdc == NULL) || (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) || (hcdc->TxState != 0U))
+  {
+    return;
+  }
+  if (cdc_tx_inflight != 0U)
+  {
+    cdc_tx_tail += cdc_tx_inflight;
+    CDC_TxStats_FS.sent += cdc_tx_inflight;
+    cdc_tx_inflight = 0;
+  }
+  used = cdc_tx_head - cdc_tx_tail;
+  if ((cdc_dtr == 0U) || (used == 0U))
+  {
+    if ((sof != 0U) && (cdc_tx_zlp != 0U))
+    {
+      USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0U);
+      if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK)
+      {
+        cdc_tx_zlp = 0;
+      }
+    }
+    return;
+  }
+
+  start = cdc_tx_tail & (APP_TX_DATA_SIZE - 1U);
+  len = APP_TX_DATA_SIZE - start;
+  if (len > used)
+  {
+    len = used;
+  }
+  if (len > CDC_TX_MAX_TRANSFER)
+  {
+    len = CDC_TX_MAX_TRANSFER;
+  }
+  if ((sof == 0U) || ((len < used) && (len > CDC_DATA_FS_MAX_PACKET_SIZE)))
+  {
+    len &= ~(CDC_DATA_FS_MAX_PACKET_SIZE - 1U);
+    if (len == 0U)
+    {
+      return;
+    }
+  }
+
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &UserTxBufferFS[start], (uint16_t)len);
+  if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK)
+  {
+    hUsbDeviceFS.ep_in[CDC_IN_EP & 0xFU].total_length = 0U;
+    cdc_tx_zlp = ((len & (CDC_DATA_FS_MAX_PACKET_SIZE - 1U)) == 0U) ? 1U : 0U;
+    cdc_tx_inflight = (uint16_t)len;
+    CDC_TxStats_FS.transfers++;
+  }
+}
+
+/**
+  * @brief  CDC_TxPending_FS
+  * @retval Bytes in the TX ring, the transfer on the bus included
+  */
+uint16_t CDC_TxPending_FS(void)
+{
+  return (uint16_t)(cdc_tx_head - cdc_tx_tail);
+}
+
+/**
+  * @brief  CDC_RxData_FS
+  *         Received bytes not consumed yet, in place in the receive buffer.
+  *         Call from the main loop only.
+  * @param  data: Set to the first of them
+  * @retval Number of bytes
+  */
+uint16_t CDC_RxData_FS(uint8_t** data)
+{
+  PCD_HandleTypeDef *hpcd = (PCD_HandleTypeDef*)hUsbDeviceFS.pData;
+  uint32_t primask;
+  uint16_t start = cdc_rx_start;
+  uint16_t end;
+
+  /* The packets of the open transfer count too: one the host leaves at a
+     64 byte boundary would otherwise wait for the next short packet */
+  primask = __get_PRIMASK();
+  __disable_irq();
+  end = cdc_rx_end;
+  if (cdc_rx_armed != 0U)
+  {
+    end += (uint16_t)hpcd->OUT_ep[CDC_OUT_EP & 0xFU].xfer_count;
+  }
+  __set_PRIMASK(primask);
+
+  *data = &UserRxBufferFS[start];
+  return (uint16_t)(end - start);
+}
+
+/**
+  * @brief  CDC_RxRelease_FS
+  *         Consumes Len bytes from CDC_RxData_FS(). Once the buffer is full
+  *         the rest, a partial command at most, moves to its start and the
+  *         OUT endpoint is armed again: call after every parse, even with 0.
+  * @param  Len: Bytes done with
+  * @retval None
+  */
+void CDC_RxRelease_FS(uint16_t Len)
+{
+  uint32_t primask;
+  uint16_t rest;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  cdc_rx_start += Len;
+  if (cdc_rx_armed == 0U)
+  {
+    rest = cdc_rx_end - cdc_rx_start;
+    memmove(UserRxBufferFS, &UserRxBufferFS[cdc_rx_start], rest);
+    cdc_rx_start = 0;
+    cdc_rx_end = rest;
+    CDC_RxArm_FS();
+  }
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  CDC_RxArm_FS
+  *         Arms the OUT endpoint at cdc_rx_end for all the whole packets
+  *         left in UserRxBufferFS, none if not one fits. From the USB
+  *         interrupt or with it masked.
+  * @retval None
+  */
+static void CDC_RxArm_FS(void)
+{
+  uint32_t room = (APP_RX_DATA_SIZE - cdc_rx_end) & ~(CDC_DATA_FS_OUT_PACKET_SIZE - 1U);
+
+  cdc_rx_armed = 0;
+  if (room != 0U)
+  {
+    cdc_rx_armed = 1;
+    /* The class hands RxBuffer to CDC_Receive_FS() */
+    USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &UserRxBufferFS[cdc_rx_end]);
+    USBD_LL_PrepareReceive(&hUsbDeviceFS, CDC_OUT_EP, &UserRxBufferFS[cdc_rx_end], (uint16_t)room);
+  }
+}
+
+/**
+  * @brief  CDC_IsOpen_FS
+  * @retval 1 while the host asserts DTR, a terminal is reading
+  */
+uint8_t CDC_IsOpen_FS(void)
+{
+  return cdc_dtr;
+}
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**